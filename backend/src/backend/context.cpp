@@ -32,6 +32,7 @@
 #include "ir/image.hpp"
 #include "sys/cvar.hpp"
 #include <algorithm>
+#include <sstream>
 
 namespace gbe
 {
@@ -317,13 +318,24 @@ namespace gbe
   // Generic Context (shared by the simulator and the HW context)
   ///////////////////////////////////////////////////////////////////////////
   IVAR(OCL_SIMD_WIDTH, 8, 15, 16);
+  BVAR(OCL_OUTPUT_UNIFORM_STATS, false);
 
   Context::Context(const ir::Unit &unit, const std::string &name) :
     unit(unit), fn(*unit.getFunction(name)), name(name), liveness(NULL), dag(NULL), useDWLabel(false)
   {
     GBE_ASSERT(unit.getPointerSize() == ir::POINTER_32_BITS);
     this->liveness = GBE_NEW(ir::Liveness, const_cast<ir::Function&>(fn));
+    if (OCL_OUTPUT_UNIFORM_STATS) {
+      // Kernels may be compiled concurrently, print the line at once
+      std::ostringstream stats;
+      stats << "kernel " << name << ": " << fn.regNum() << " registers, "
+            << this->liveness->getLegacyUniformNum() << " uniform before and "
+            << this->liveness->getUniformNum() << " after the divergence analysis"
+            << std::endl;
+      std::cout << stats.str() << std::flush;
+    }
     this->dag = GBE_NEW(ir::FunctionDAG, *this->liveness);
+    this->estimateRegisterPressure();
     // r0 (GEN_REG_SIZE) is always set by the HW and used at the end by EOT
     this->registerAllocator = NULL; //GBE_NEW(RegisterAllocator, GEN_REG_SIZE, 4*KB - GEN_REG_SIZE);
     this->scratchAllocator = NULL; //GBE_NEW(ScratchAllocator, 12*KB);
@@ -347,7 +359,6 @@ namespace gbe
     this->registerAllocator = GBE_NEW(RegisterAllocator, GEN_REG_SIZE, 4*KB - GEN_REG_SIZE);
     this->scratchAllocator = GBE_NEW(ScratchAllocator, this->getScratchSize());
     this->curbeRegs.clear();
-    this->JIPs.clear();
   }
 
   Kernel *Context::compileKernel(void) {
@@ -652,6 +663,60 @@ namespace gbe
 
   }
 
+  void Context::estimateRegisterPressure(void) {
+    using namespace ir;
+    // Walk every block backward from its live-out set and track the bytes
+    // held by the live registers. Uniform registers only take one lane. The
+    // temporaries the instruction selection adds are ignored, so this is a
+    // lower bound of what the register allocator will need
+    vector<uint8_t> isLive(fn.regNum(), 0);
+    vector<Register> touched;
+    vector<const Instruction*> insns;
+    uint32_t maxPressure8 = 0, maxPressure16 = 0;
+    fn.foreachBlock([&](const BasicBlock &bb) {
+      uint32_t varyingSize = 0, uniformSize = 0;
+      auto regSize = [&](Register reg, bool &uniform) {
+        const RegisterData data = fn.getRegisterData(reg);
+        uniform = data.isUniform();
+        return data.family == FAMILY_BOOL ? 2u : getFamilySize(data.family);
+      };
+      auto setLive = [&](Register reg, bool live) {
+        if (bool(isLive[reg]) == live) return;
+        isLive[reg] = live;
+        if (live) touched.push_back(reg);
+        bool uniform;
+        const uint32_t size = regSize(reg, uniform);
+        uint32_t &total = uniform ? uniformSize : varyingSize;
+        if (live) total += size; else total -= size;
+      };
+      auto updateMax = [&]() {
+        maxPressure8 = std::max(maxPressure8, varyingSize * 8 + uniformSize);
+        maxPressure16 = std::max(maxPressure16, varyingSize * 16 + uniformSize);
+      };
+      for (auto reg : liveness->getLiveOut(&bb))
+        setLive(reg, true);
+      updateMax();
+      insns.clear();
+      const_cast<BasicBlock&>(bb).foreach([&](const Instruction &insn) {
+        insns.push_back(&insn);
+      });
+      for (auto it = insns.rbegin(); it != insns.rend(); ++it) {
+        const Instruction &insn = **it;
+        for (uint32_t dstID = 0; dstID < insn.getDstNum(); ++dstID)
+          setLive(insn.getDst(dstID), false);
+        for (uint32_t srcID = 0; srcID < insn.getSrcNum(); ++srcID)
+          setLive(insn.getSrc(srcID), true);
+        updateMax();
+      }
+      // Reset the live set for the next block
+      for (auto reg : touched)
+        isLive[reg] = false;
+      touched.clear();
+    });
+    regPressure[0] = ALIGN(maxPressure8, GEN_REG_SIZE) / GEN_REG_SIZE;
+    regPressure[1] = ALIGN(maxPressure16, GEN_REG_SIZE) / GEN_REG_SIZE;
+  }
+
   void Context::handleSLM(void) {
     const bool useSLM = fn.getUseSLM();
     kernel->useSLM = useSLM;
@@ -71,6 +71,12 @@ namespace gbe
     INLINE const ir::Liveness &getLiveness(void) const { return *liveness; }
     /*! Tells if the register is used */
     bool isRegUsed(const ir::Register &reg) const;
+    /*! Lower bound of the GRFs needed by the IR registers at the given SIMD
+     *  width. Computed once from the liveness, before any instruction selection
+     */
+    INLINE uint32_t getRegisterPressure(uint32_t simdWidth) const {
+      return simdWidth == 16 ? regPressure[1] : regPressure[0];
+    }
     /*! Get the kernel we are currently compiling */
     INLINE Kernel *getKernel(void) const { return this->kernel; }
     /*! Get the function we are currently compiling */
@@ -126,6 +132,8 @@ namespace gbe
      *  the branch target due to unstructured branches
      */
     void buildJIPs(void);
+    /*! Estimate the maximum number of GRFs simultaneously alive */
+    void estimateRegisterPressure(void);
     /*! Configure SLM use if needed */
     void handleSLM(void);
     /*! Insert a new entry with the given size in the Curbe. Return the offset
@@ -148,6 +156,7 @@ namespace gbe
     JIPMap JIPs;                          //!< Where to jump all labels/branches
     uint32_t simdWidth;                   //!< Number of lanes per HW threads
     bool useDWLabel;                      //!< false means using u16 label, true means using u32 label.
+    uint32_t regPressure[2];              //!< Estimated GRF pressure in SIMD8 and SIMD16
     map<unsigned char, ir::Register> btiRegMap;
     GBE_CLASS(Context);                   //!< Use custom allocators
   };
@@ -2064,14 +2064,29 @@ namespace gbe
 
   bool GenContext::emitCode(void) {
     GenKernel *genKernel = static_cast<GenKernel*>(this->kernel);
+    gbe_kernel_compile_stats &stats = genKernel->stats;
     buildPatchList();
+    double phaseStart = getSeconds();
     sel->select();
+    stats.selection_time = (getSeconds() - phaseStart) * 1000.0;
+    phaseStart = getSeconds();
     schedulePreRegAllocation(*this, *this->sel);
+    stats.schedule_time = (getSeconds() - phaseStart) * 1000.0;
+    phaseStart = getSeconds();
     if (UNLIKELY(ra->allocate(*this->sel) == false))
       return false;
+    stats.reg_alloc_time = (getSeconds() - phaseStart) * 1000.0;
+    const RegAllocStats &raStats = ra->getStats();
+    stats.grf_num = raStats.grfNum;
+    stats.spill_num = raStats.spillNum;
+    stats.fill_num = raStats.fillNum;
+    stats.remat_num = raStats.rematNum;
+    phaseStart = getSeconds();
     schedulePostRegAllocation(*this, *this->sel);
+    stats.schedule_time += (getSeconds() - phaseStart) * 1000.0;
     if (OCL_OUTPUT_REG_ALLOC)
       ra->outputAllocation();
+    phaseStart = getSeconds();
     this->clearFlagRegister();
     this->emitStackPointer();
     this->emitSLMOffset();
@@ -2081,6 +2096,15 @@ namespace gbe
     genKernel->insnNum = p->store.size();
     genKernel->insns = GBE_NEW_ARRAY_NO_ARG(GenInstruction, genKernel->insnNum);
     std::memcpy(genKernel->insns, &p->store[0], genKernel->insnNum * sizeof(GenInstruction));
+    stats.encode_time = (getSeconds() - phaseStart) * 1000.0;
+    for (uint32_t insnID = 0; insnID < genKernel->insnNum; stats.insn_num++) {
+      const GenCompactInstruction *pCom = (const GenCompactInstruction*)&p->store[insnID];
+      if (pCom->bits1.cmpt_control == 1) {
+        stats.compacted_insn_num++;
+        insnID++;
+      } else
+        insnID += 2;
+    }
     if (OCL_OUTPUT_ASM) {
       std::cout << genKernel->getName() << "'s disassemble begin:" << std::endl;
       ir::LabelIndex curLabel = (ir::LabelIndex)0;
@@ -51,6 +51,15 @@
  * this provides a pretty good strategy enabling SIMD16 code generation where
  * when scheduling is deactivated, even SIMD8 fails
  *
+ * The LIFO order is only used to break ties. Among the ready instructions, we
+ * first pick the one which increases the number of live bytes the least: the
+ * bytes of the destinations which become alive minus the bytes of the sources
+ * it reads for the last time in the block (and which are not live out). So the
+ * values are consumed as soon as they can be and new values are only created
+ * when nothing else can be done. Since it costs latency, this is only done
+ * when SIMD16 fails without it, and only if OCL_PRE_ALLOC_INSN_SCHEDULE is set
+ * (to 2, it runs for all the kernels).
+ *
  * One may argue that this strategy is bad, latency wise. This is not true since
  * the register allocator will anyway try to burn as many registers as possible.
  * So, there is still opportunities to schedule after register allocation.
@@ -65,10 +74,20 @@
  * After the register allocation
  * ==============================
  *
- * This is here a pretty simple strategy based on a regular forward list
- * scheduling. Since Gen is a co-issue based machine, this is useless to take
- * into account really precise timings since instruction issues will happen
- * out-of-order based on other thread executions.
+ * This is a regular forward list scheduling driven by the critical path. Each
+ * node gets as priority the length in cycles of the longest dependency chain
+ * from it to the end of the block, using the Gen7 latency estimates on every
+ * generation (gen_insn_gen7_schedule_info.hxx). At each cycle, we issue among
+ * the instructions whose operands are available the one with the highest
+ * priority, so the long latency sends (memory reads, sampler, scratch) are
+ * issued as early as possible and their latency is covered by independent ALU
+ * instructions. If nothing can issue, we stall until the first instruction is
+ * ready.
+ *
+ * Since Gen is a co-issue based machine, the timings are only estimates:
+ * instruction issues also depend on the other threads of the EU. They are
+ * good enough to compare two schedules though and OCL_OUTPUT_SCHEDULE_STATS
+ * reports the estimated cycles of every kernel before and after scheduling.
  *
  * Note that we over-simplify the problem. Indeed, Gen register file is flexible
  * and we are able to use sub-registers of GRF in particular when we handle
@@ -86,6 +105,8 @@
 #include "backend/gen_reg_allocation.hpp"
 #include "sys/cvar.hpp"
 #include "sys/intrusive_list.hpp"
+#include <iostream>
+#include <sstream>
 
 namespace gbe
 {
@@ -114,7 +135,8 @@ namespace gbe
   struct ScheduleDAGNode
   {
     INLINE ScheduleDAGNode(SelectionInstruction &insn) :
-      insn(insn), refNum(0), retiredCycle(0), preRetired(false), readDistance(0x7fffffff) {}
+      insn(insn), refNum(0), index(0), latency(0), throughput(0),
+      criticalPath(0), readyCycle(0) {}
     bool dependsOn(ScheduleDAGNode *node) const {
       GBE_ASSERT(node != NULL);
       for (auto child : node->children)
@@ -128,10 +150,16 @@ namespace gbe
     SelectionInstruction &insn;
     /*! Number of nodes that point to us (i.e. nodes we depend on) */
     uint32_t refNum;
-    /*! Cycle when the instruction is retired */
-    uint32_t retiredCycle;
-    bool preRetired;
-    uint32_t readDistance;
+    /*! Position of the instruction in the block before scheduling */
+    uint32_t index;
+    /*! Cycles before a dependent instruction can start */
+    uint32_t latency;
+    /*! Cycles during which the instruction is issued */
+    uint32_t throughput;
+    /*! Longest latency path from this node to the end of the block */
+    uint32_t criticalPath;
+    /*! First cycle when all the dependencies are satisfied */
+    uint32_t readyCycle;
   };
 
   /*! To track loads and stores */
@@ -155,7 +183,7 @@ namespace gbe
   {
     DependencyTracker(const Selection &selection, SelectionScheduler &scheduler);
     /*! Reset it before scheduling a new block */
-    void clear(bool fullClear = false);
+    void clear(void);
     /*! Get an index in the node array for the given register */
     uint32_t getIndex(GenRegister reg) const;
     /*! Get an index in the node array for the given memory system */
@@ -196,8 +224,6 @@ namespace gbe
     static const uint32_t MAX_ARF_REGISTER = MAX_FLAG_REGISTER + MAX_ACC_REGISTER + MAX_TM_REGISTER;
     /*! Stores the last node that wrote to a register / memory ... */
     vector<ScheduleDAGNode*> nodes;
-    /*! store nodes each node depends on */
-    map<ScheduleDAGNode *, vector<ScheduleDAGNode*>> deps;
     /*! Stores the nodes per instruction */
     vector<ScheduleDAGNode*> insnNodes;
     /*! Number of virtual register in the selection */
@@ -213,29 +239,81 @@ namespace gbe
     void clearLists(void);
     /*! Return the number of instructions to schedule in the DAG */
     int32_t buildDAG(SelectionBlock &bb);
-    /*! traverse read node and update read distance for all the child. */
-    void traverseReadNode(ScheduleDAGNode *node, uint32_t degree = 0);
-    /*! Schedule the DAG, pre register allocation and post register allocation. */
+    /*! Compute the critical path of every node of the DAG */
+    void computeCriticalPaths(int32_t insnNum);
+    /*! Estimated cycles to run the block in its current order */
+    uint32_t estimateCycles(int32_t insnNum);
+    /*! Schedule the DAG, pre register allocation and post register allocation.
+     *  The post register allocation one returns the estimated cycles */
     void preScheduleDAG(SelectionBlock &bb, int32_t insnNum);
-    void postScheduleDAG(SelectionBlock &bb, int32_t insnNum);
+    uint32_t postScheduleDAG(SelectionBlock &bb, int32_t insnNum);
+    /*! Pre allocation: how many live bytes issuing the node adds */
+    int32_t getPressureDelta(const ScheduleDAGNode *node) const;
+    /*! Pre allocation: size in bytes of a virtual register */
+    uint32_t getRegSize(ir::Register reg) const;
+    /*! Should a be issued before b at the given cycle? */
+    bool isBetterCandidate(const ScheduleDAGNode *a, const ScheduleDAGNode *b, uint32_t cycle) const;
+    /*! Cycles between the issue of node and the issue of a dependent node */
+    INLINE uint32_t getDelay(const ScheduleDAGNode *node, DepMode m) const {
+      // The sources are read when the instruction is issued
+      return m == WRITE_AFTER_READ ? 0 : node->latency;
+    }
     /*! To limit register pressure or limit insn latency problems */
     SchedulePolicy policy;
     /*! Make ScheduleListNode allocation faster */
     DECL_POOL(ScheduleListNode, listPool);
     /*! Make ScheduleDAGNode allocation faster */
     DECL_POOL(ScheduleDAGNode, nodePool);
-    /*! Ready list is instructions that can be scheduled */
+    /*! Ready list is instructions whose dependencies are all issued */
     intrusive_list<ScheduleListNode> ready;
-    /*! Active list is instructions that are executing */
-    intrusive_list<ScheduleListNode> active;
     /*! Handle complete compilation */
     GenContext &ctx;
     /*! Code to schedule */
     Selection &selection;
     /*! To help tracking dependencies */
     DependencyTracker tracker;
+    /*! Pre allocation: state of each virtual register in the current block */
+    enum {
+      REG_USED     = 1 << 0, // Read or written in the block
+      REG_LIVE     = 1 << 1, // Currently holds a value
+      REG_LIVE_OUT = 1 << 2  // Read by a following block
+    };
+    vector<uint8_t> regState;
+    /*! Pre allocation: instructions of the block still to read each register */
+    vector<uint32_t> regReadNum;
+    /*! Pre allocation: registers used by the current block */
+    vector<ir::Register> blockRegs;
   };
 
+  /*! Only virtual GRFs are taken into account for the register pressure */
+  static INLINE bool isVirtualGRF(const GenRegister &reg) {
+    return reg.file == GEN_GENERAL_REGISTER_FILE && !reg.physical;
+  }
+
+  /*! Was the same register already found in a previous source? */
+  static INLINE bool isRepeatedSrc(const SelectionInstruction &insn, uint32_t srcID) {
+    for (uint32_t otherID = 0; otherID < srcID; ++otherID)
+      if (isVirtualGRF(insn.src(otherID)) && insn.src(otherID).reg() == insn.src(srcID).reg())
+        return true;
+    return false;
+  }
+
+  /*! Same thing for the destinations */
+  static INLINE bool isRepeatedDst(const SelectionInstruction &insn, uint32_t dstID) {
+    for (uint32_t otherID = 0; otherID < dstID; ++otherID)
+      if (isVirtualGRF(insn.dst(otherID)) && insn.dst(otherID).reg() == insn.dst(dstID).reg())
+        return true;
+    return false;
+  }
+
+  /*! Is the register written by the instruction? */
+  static INLINE bool isWrittenBy(const SelectionInstruction &insn, ir::Register reg) {
+    for (uint32_t dstID = 0; dstID < insn.dstNum; ++dstID)
+      if (isVirtualGRF(insn.dst(dstID)) && insn.dst(dstID).reg() == reg)
+        return true;
+    return false;
+  }
+
   DependencyTracker::DependencyTracker(const Selection &selection, SelectionScheduler &scheduler) :
     scheduler(scheduler)
   {
@@ -251,7 +329,7 @@ namespace gbe
     insnNodes.resize(selection.getLargestBlockSize());
   }
 
-  void DependencyTracker::clear(bool fullClear) { for (auto &x : nodes) x = NULL; if (fullClear) deps.clear(); }
+  void DependencyTracker::clear(void) { for (auto &x : nodes) x = NULL; }
   void DependencyTracker::addDependency(ScheduleDAGNode *node0, GenRegister reg, DepMode m) {
     if (this->ignoreDependency(reg) == false) {
       const uint32_t index = this->getIndex(reg);
@@ -277,14 +355,6 @@ namespace gbe
       ScheduleListNode *dep = scheduler.newScheduleListNode(node0, depMode);
       node0->refNum++;
       node1->children.push_back(dep);
-      auto it = deps.find(node0);
-      if (it != deps.end()) {
-        it->second.push_back(node1);
-      } else {
-        vector<ScheduleDAGNode*> vn;
-        vn.push_back(node1);
-        deps.insert(std::make_pair(node0, vn));
-      }
     }
   }
 
@@ -438,45 +508,36 @@ namespace gbe
   SelectionScheduler::SelectionScheduler(GenContext &ctx,
                                          Selection &selection,
                                          SchedulePolicy policy) :
-    policy(policy), listPool(nextHighestPowerOf2(selection.getLargestBlockSize())),
+    policy(policy),
+    listPool(nextHighestPowerOf2(selection.getLargestBlockSize())),
     ctx(ctx), selection(selection), tracker(selection, *this)
   {
     this->clearLists();
+    if (policy == PRE_ALLOC) {
+      regState.resize(selection.getRegNum(), 0);
+      regReadNum.resize(selection.getRegNum(), 0);
+    }
   }
 
   void SelectionScheduler::clearLists(void) {
     this->ready.fast_clear();
-    this->active.fast_clear();
-  }
-
-  void SelectionScheduler::traverseReadNode(ScheduleDAGNode *node, uint32_t degree) {
-    GBE_ASSERT(degree != 0 || node->insn.isRead());
-    if (node->readDistance != 0x7FFFFFFF)
-      return;
-    node->readDistance = degree;
-    if (degree > 5)
-      return;
-    //printf("node id %d op %d degree %d \n", node->insn.ID, node->insn.opcode, degree);
-    auto it = tracker.deps.find(node);
-    if (it != tracker.deps.end()) {
-      for (auto &depNode : it->second) {
-        if (depNode && !depNode->insn.isRead())
-          traverseReadNode(depNode, degree + 1);
-      }
-    }
   }
 
   int32_t SelectionScheduler::buildDAG(SelectionBlock &bb) {
     nodePool.rewind();
     listPool.rewind();
-    tracker.clear(true);
+    tracker.clear();
     this->clearLists();
 
     // Track write-after-write and read-after-write dependencies
+    const bool isSIMD8 = this->ctx.getSimdWidth() == 8;
     int32_t insnNum = 0;
     for (auto &insn : bb.insnList) {
       // Create a new node for this instruction
       ScheduleDAGNode *node = this->newScheduleDAGNode(insn);
+      node->index = insnNum;
+      node->latency = getLatencyGen7(insn);
+      node->throughput = getThroughputGen7(insn, isSIMD8);
       tracker.insnNodes[insnNum++] = node;
 
       // read-after-write in registers
@@ -576,14 +637,6 @@ namespace gbe
       tracker.updateWrites(node);
     }
 
-    // Update distance to read for each read node.
-    for (int32_t insnID = 0; insnID < insnNum; ++insnID) {
-      ScheduleDAGNode *node = tracker.insnNodes[insnID];
-      const SelectionInstruction &insn = node->insn;
-      if (insn.isRead())
-        traverseReadNode(node);
-    }
-
     // Make labels and branches non-schedulable (i.e. they act as barriers)
     for (int32_t insnID = 0; insnID < insnNum; ++insnID) {
       ScheduleDAGNode *node = tracker.insnNodes[insnID];
@@ -594,6 +647,8 @@ namespace gbe
         tracker.makeBarrier(insnID, insnNum);
     }
 
+    this->computeCriticalPaths(insnNum);
+
     // Build the initial ready list (should only be the label actually)
     for (int32_t insnID = 0; insnID < insnNum; ++insnID) {
       ScheduleDAGNode *node = tracker.insnNodes[insnID];
@@ -606,117 +661,235 @@ namespace gbe
     return insnNum;
   }
 
-  void SelectionScheduler::preScheduleDAG(SelectionBlock &bb, int32_t insnNum) {
-    printf("Not implemented yet. \n");
+  uint32_t SelectionScheduler::getRegSize(ir::Register reg) const {
+    const ir::RegisterData data = selection.getRegisterData(reg);
+    const uint32_t size = data.family == ir::FAMILY_BOOL ? 2u : ir::getFamilySize(data.family);
+    return data.isUniform() ? size : size * ctx.getSimdWidth();
   }
 
-  void SelectionScheduler::postScheduleDAG(SelectionBlock &bb, int32_t insnNum) {
-    uint32_t cycle = 0;
-    const bool isSIMD8 = this->ctx.getSimdWidth() == 8;
-    vector <ScheduleDAGNode *> scheduledNodes;
-    while (insnNum) {
+  int32_t SelectionScheduler::getPressureDelta(const ScheduleDAGNode *node) const {
+    const SelectionInstruction &insn = node->insn;
+    int32_t delta = 0;
+    for (uint32_t dstID = 0; dstID < insn.dstNum; ++dstID) {
+      const GenRegister &dst = insn.dst(dstID);
+      if (!isVirtualGRF(dst) || isRepeatedDst(insn, dstID))
+        continue;
+      if ((regState[dst.reg()] & REG_LIVE) == 0)
+        delta += this->getRegSize(dst.reg());
+    }
+    for (uint32_t srcID = 0; srcID < insn.srcNum; ++srcID) {
+      const GenRegister &src = insn.src(srcID);
+      if (!isVirtualGRF(src) || isRepeatedSrc(insn, srcID))
+        continue;
+      const ir::Register reg = src.reg();
+      if (regReadNum[reg] == 1 && (regState[reg] & REG_LIVE_OUT) == 0 && !isWrittenBy(insn, reg))
+        delta -= this->getRegSize(reg);
+    }
+    return delta;
+  }
 
-      // Retire all the instructions that finished
-      //printf("cycle = %d \n", cycle);
-      for (auto toRetireIt = active.begin(); toRetireIt != active.end();) {
-        ScheduleDAGNode *toRetireNode = toRetireIt.node()->node;
-        // Firstly, put all write after read children to ready.
-        if (toRetireNode->preRetired == false) {
-          auto &children = toRetireNode->children;
-          toRetireNode->preRetired = true;
-          //printf("id %d pre retired \n", toRetireNode->insn.ID);
-          for (auto it = children.begin(); it != children.end();) {
-            ScheduleListNode *listNode = it.node();
-            if (listNode->depMode != WRITE_AFTER_READ) {
-              ++it;
-              continue;
-            }
-            if (--it->node->refNum == 0) {
-              //printf("pre push id %d to ready list. \n", listNode->node->insn.ID);
-              it = children.erase(it);
-              this->ready.push_back(listNode);
-            } else
-              ++it;
-          }
-          if (children.size() == 0) {
-            toRetireIt = this->active.erase(toRetireIt);
-            continue;
-          }
+  void SelectionScheduler::preScheduleDAG(SelectionBlock &bb, int32_t insnNum) {
+    // Count the readers of every register. A register read before being
+    // written is live into the block
+    const ir::Liveness::LiveOut &liveOut = ctx.getLiveOut(bb.bb);
+    blockRegs.clear();
+    for (int32_t insnID = 0; insnID < insnNum; ++insnID) {
+      const SelectionInstruction &insn = tracker.insnNodes[insnID]->insn;
+      for (uint32_t srcID = 0; srcID < insn.srcNum; ++srcID) {
+        const GenRegister &src = insn.src(srcID);
+        if (!isVirtualGRF(src) || isRepeatedSrc(insn, srcID))
+          continue;
+        const ir::Register reg = src.reg();
+        if (regState[reg] == 0) {
+          regState[reg] = REG_USED | REG_LIVE;
+          blockRegs.push_back(reg);
         }
-        // Instruction is now complete
-        if (toRetireNode->retiredCycle <= cycle) {
-          toRetireIt = this->active.erase(toRetireIt);
-          //printf("id %d retired \n", toRetireNode->insn.ID);
-          // Traverse all children and make them ready if no more dependency
-          auto &children = toRetireNode->children;
-          for (auto it = children.begin(); it != children.end();) {
-            ScheduleListNode *listNode = it.node();
-            if (listNode->depMode == WRITE_AFTER_READ) {
-              ++it;
-              continue;
-            }
-            if (--it->node->refNum == 0) {
-              it = children.erase(it);
-              if (listNode->depMode != WRITE_AFTER_READ)
-                this->ready.push_back(listNode);
-              //printf("push id %d to ready list. \n", listNode->node->insn.ID);
-            } else
-              ++it;
-          }
-        } else
-          ++toRetireIt;
+        regReadNum[reg]++;
+      }
+      for (uint32_t dstID = 0; dstID < insn.dstNum; ++dstID) {
+        const GenRegister &dst = insn.dst(dstID);
+        if (!isVirtualGRF(dst) || regState[dst.reg()] != 0)
+          continue;
+        regState[dst.reg()] = REG_USED;
+        blockRegs.push_back(dst.reg());
       }
+    }
+    for (auto reg : blockRegs)
+      if (liveOut.find(reg) != liveOut.end())
+        regState[reg] |= REG_LIVE_OUT;
 
-      // Try to schedule something from the ready list
-      intrusive_list<ScheduleListNode>::iterator toSchedule;
-      toSchedule = this->ready.begin();
-      float minCost = 1000;
-      for(auto it = this->ready.begin(); it != this->ready.end(); ++it) {
-        float cost = (it->depMode == WRITE_AFTER_READ) ?  0 : ((it->depMode == WRITE_AFTER_WRITE) ? 5 : 10)
-                     - 5.0 / (it->node->readDistance == 0 ? 0.1 : it->node->readDistance);
-        if (cost < minCost) {
+    while (insnNum) {
+      // Pick the ready instruction which adds the fewest live bytes. On a tie,
+      // the most recent one wins (LIFO)
+      GBE_ASSERT(!this->ready.empty());
+      auto toSchedule = this->ready.begin();
+      int32_t minDelta = this->getPressureDelta(toSchedule->node);
+      for (auto it = ++this->ready.begin(); it != this->ready.end(); ++it) {
+        const int32_t delta = this->getPressureDelta(it->node);
+        if (delta <= minDelta) {
           toSchedule = it;
-          minCost = cost;
+          minDelta = delta;
         }
       }
-      if (toSchedule != this->ready.end()) {
-        //printf("get id %d  op %d to schedule \n", toSchedule->node->insn.ID, toSchedule->node->insn.opcode);
-        // The instruction is instantaneously issued to simulate zero cycle
-        // scheduling
-        cycle += getThroughputGen7(toSchedule->node->insn, isSIMD8);
-
-        this->ready.erase(toSchedule);
-        this->active.push_back(toSchedule.node());
-        // When we schedule before allocation, instruction is instantaneously
-        // ready. This allows to have a real LIFO strategy
-        toSchedule->node->retiredCycle = cycle + getLatencyGen7(toSchedule->node->insn);
-        bb.append(&toSchedule->node->insn);
-        scheduledNodes.push_back(toSchedule->node);
-        insnNum--;
-      } else
-        cycle++;
+      ScheduleDAGNode *node = toSchedule->node;
+      const SelectionInstruction &insn = node->insn;
+      this->ready.erase(toSchedule);
+      bb.append(&node->insn);
+      insnNum--;
+
+      // Update the live registers
+      for (uint32_t srcID = 0; srcID < insn.srcNum; ++srcID) {
+        const GenRegister &src = insn.src(srcID);
+        if (!isVirtualGRF(src) || isRepeatedSrc(insn, srcID))
+          continue;
+        const ir::Register reg = src.reg();
+        if (--regReadNum[reg] == 0 && (regState[reg] & REG_LIVE_OUT) == 0)
+          regState[reg] &= ~REG_LIVE;
+      }
+      for (uint32_t dstID = 0; dstID < insn.dstNum; ++dstID) {
+        const GenRegister &dst = insn.dst(dstID);
+        if (!isVirtualGRF(dst))
+          continue;
+        const ir::Register reg = dst.reg();
+        if (regReadNum[reg] != 0 || (regState[reg] & REG_LIVE_OUT) != 0)
+          regState[reg] |= REG_LIVE;
+      }
+
+      // Instructions complete in zero cycle: the children are ready as soon
+      // as all their dependencies are scheduled
+      auto &children = node->children;
+      for (auto it = children.begin(); it != children.end();) {
+        ScheduleListNode *listNode = it.node();
+        if (--listNode->node->refNum == 0) {
+          it = children.erase(it);
+          this->ready.push_back(listNode);
+        } else
+          ++it;
+      }
+    }
+
+    for (auto reg : blockRegs) {
+      regState[reg] = 0;
+      regReadNum[reg] = 0;
+    }
+  }
+
+  void SelectionScheduler::computeCriticalPaths(int32_t insnNum) {
+    // A node only depends on nodes located before it in the block
+    for (int32_t insnID = insnNum-1; insnID >= 0; --insnID) {
+      ScheduleDAGNode *node = tracker.insnNodes[insnID];
+      uint32_t path = node->latency;
+      for (auto &child : node->children)
+        path = std::max(path, this->getDelay(node, child.depMode) + child.node->criticalPath);
+      node->criticalPath = path;
+    }
+  }
+
+  uint32_t SelectionScheduler::estimateCycles(int32_t insnNum) {
+    uint32_t cycle = 0, endCycle = 0;
+    for (int32_t insnID = 0; insnID < insnNum; ++insnID) {
+      ScheduleDAGNode *node = tracker.insnNodes[insnID];
+      const uint32_t issueCycle = std::max(cycle, node->readyCycle);
+      for (auto &child : node->children)
+        child.node->readyCycle = std::max(child.node->readyCycle,
+                                          issueCycle + this->getDelay(node, child.depMode));
+      cycle = issueCycle + node->throughput;
+      endCycle = std::max(endCycle, issueCycle + node->latency);
+    }
+    for (int32_t insnID = 0; insnID < insnNum; ++insnID)
+      tracker.insnNodes[insnID]->readyCycle = 0;
+    return std::max(cycle, endCycle);
+  }
+
+  bool SelectionScheduler::isBetterCandidate(const ScheduleDAGNode *a,
+                                             const ScheduleDAGNode *b,
+                                             uint32_t cycle) const {
+    // Something which can issue now is better than anything which stalls
+    const bool aIsReady = a->readyCycle <= cycle, bIsReady = b->readyCycle <= cycle;
+    if (aIsReady != bIsReady)
+      return aIsReady;
+    if (!aIsReady && a->readyCycle != b->readyCycle)
+      return a->readyCycle < b->readyCycle;
+    // Longest path to the end of the block first
+    if (a->criticalPath != b->criticalPath)
+      return a->criticalPath > b->criticalPath;
+    // Then the longest latency, to start the sends as soon as possible
+    if (a->latency != b->latency)
+      return a->latency > b->latency;
+    // Then the original order
+    return a->index < b->index;
+  }
+
+  uint32_t SelectionScheduler::postScheduleDAG(SelectionBlock &bb, int32_t insnNum) {
+    uint32_t cycle = 0, endCycle = 0;
+    while (insnNum) {
+      // Pick the best instruction from the ready list
+      GBE_ASSERT(!this->ready.empty());
+      auto toSchedule = this->ready.begin();
+      for (auto it = this->ready.begin(); it != this->ready.end(); ++it)
+        if (this->isBetterCandidate(it->node, toSchedule->node, cycle))
+          toSchedule = it;
+      ScheduleDAGNode *node = toSchedule->node;
+      this->ready.erase(toSchedule);
+
+      // Stall if its dependencies are not complete yet
+      const uint32_t issueCycle = std::max(cycle, node->readyCycle);
+      bb.append(&node->insn);
+      insnNum--;
+
+      // Make the children ready once all their dependencies are issued
+      auto &children = node->children;
+      for (auto it = children.begin(); it != children.end();) {
+        ScheduleListNode *listNode = it.node();
+        ScheduleDAGNode *child = listNode->node;
+        child->readyCycle = std::max(child->readyCycle,
+                                     issueCycle + this->getDelay(node, listNode->depMode));
+        if (--child->refNum == 0) {
+          it = children.erase(it);
+          this->ready.push_back(listNode);
+        } else
+          ++it;
+      }
+      cycle = issueCycle + node->throughput;
+      endCycle = std::max(endCycle, issueCycle + node->latency);
     }
+    return std::max(cycle, endCycle);
   }
 
   BVAR(OCL_POST_ALLOC_INSN_SCHEDULE, true);
-  BVAR(OCL_PRE_ALLOC_INSN_SCHEDULE, false);
+  /*! 0: no scheduling before the register allocation, 1: only to rescue the
+   *  kernels failing in SIMD16 without it, 2: for all the kernels
+   */
+  IVAR(OCL_PRE_ALLOC_INSN_SCHEDULE, 0, 0, 2);
+  BVAR(OCL_OUTPUT_SCHEDULE_STATS, false);
 
   void schedulePostRegAllocation(GenContext &ctx, Selection &selection) {
     if (OCL_POST_ALLOC_INSN_SCHEDULE) {
       SelectionScheduler scheduler(ctx, selection, POST_ALLOC);
+      uint64_t cyclesBefore = 0, cyclesAfter = 0;
       for (auto &bb : *selection.blockList) {
         const int32_t insnNum = scheduler.buildDAG(bb);
+        if (OCL_OUTPUT_SCHEDULE_STATS)
+          cyclesBefore += scheduler.estimateCycles(insnNum);
         bb.insnList.clear();
-        scheduler.postScheduleDAG(bb, insnNum);
+        cyclesAfter += scheduler.postScheduleDAG(bb, insnNum);
+      }
+      if (OCL_OUTPUT_SCHEDULE_STATS) {
+        // Kernels may be compiled concurrently, print the line at once
+        std::ostringstream stats;
+        stats << "kernel " << ctx.getFunction().getName()
+              << ": SIMD" << ctx.getSimdWidth()
+              << ", estimated cycles " << cyclesBefore
+              << " before scheduling, " << cyclesAfter << " after" << std::endl;
+        std::cout << stats.str() << std::flush;
       }
     }
   }
 
   void schedulePreRegAllocation(GenContext &ctx, Selection &selection) {
-    if (OCL_PRE_ALLOC_INSN_SCHEDULE) {
+    if (OCL_PRE_ALLOC_INSN_SCHEDULE == 2 ||
+        (OCL_PRE_ALLOC_INSN_SCHEDULE == 1 && ctx.limitRegisterPressure)) {
       SelectionScheduler scheduler(ctx, selection, PRE_ALLOC);
-      // FIXME, need to implement proper pre reg allocation scheduling algorithm.
-      return;
       for (auto &bb : *selection.blockList) {
         const int32_t insnNum = scheduler.buildDAG(bb);
         bb.insnList.clear();
@@ -28,10 +28,12 @@
 #include "llvm/LLVMContext.h"
 #include "llvm/Module.h"
 #include "llvm/DataLayout.h"
+#include "llvm/Constants.h"
 #else
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Constants.h"
 #endif  /* LLVM_VERSION_MINOR <= 2 */
 #include "llvm-c/Linker.h"
 #include "llvm/Transforms/Utils/Cloning.h"
@@ -54,6 +56,7 @@
 #include "backend/gen/gen_mesa_disasm.h"
 #include "backend/gen_reg_allocation.hpp"
 #include "ir/unit.hpp"
+#include "sys/cvar.hpp"
 
 #ifdef GBE_COMPILER_AVAILABLE
 #include "llvm/llvm_to_gen.hpp"
@@ -66,6 +69,7 @@
 #include <memory>
 #include <iostream>
 #include <fstream>
+#include <iterator>
 #include <mutex>
 #include <unistd.h>
 
@@ -128,33 +132,64 @@ namespace gbe {
 #endif
   }
 
-  /*! We must avoid spilling at all cost with Gen */
+  /*! We must avoid spilling at all cost with Gen. When SIMD16 fails, we try
+   *  again with the register pressure scheduling, if it is enabled, before
+   *  falling back to SIMD8
+   */
   static const struct CodeGenStrategy {
     uint32_t simdWidth;
     uint32_t reservedSpillRegs;
     bool limitRegisterPressure;
   } codeGenStrategy[] = {
     {16, 0, false},
+    {16, 0, true},
     {8, 0, false},
     {8, 8, false},
     {8, 16, false},
   };
+  static const uint32_t codeGenNumSIMD16 = 2;
+  extern int32_t OCL_PRE_ALLOC_INSN_SCHEDULE;
+
+#ifdef GBE_COMPILER_AVAILABLE
+  /*! Skip SIMD16 when the estimated pressure goes beyond that many GRFs (0
+   *  means always try SIMD16 first)
+   */
+  IVAR(OCL_SIMD16_PRESSURE_LIMIT, 0, 160, 4096);
+
+  /*! Index of the first strategy worth trying given the register pressure */
+  static uint32_t getFirstCodeGen(const Context &ctx, uint32_t codeGen) {
+    // The pressure estimate is a lower bound. More than the whole register
+    // file in SIMD8 cannot succeed without spill registers
+    const uint32_t grfNum = 4*KB / GEN_REG_SIZE - 1;
+    if (codeGen == 0 && OCL_SIMD16_PRESSURE_LIMIT != 0 &&
+        ctx.getRegisterPressure(16) > uint32_t(OCL_SIMD16_PRESSURE_LIMIT))
+      codeGen = codeGenNumSIMD16;
+    if (codeGen == codeGenNumSIMD16 && ctx.getRegisterPressure(8) > grfNum)
+      codeGen++;
+    return codeGen;
+  }
+#endif
 
   Kernel *GenProgram::compileKernel(const ir::Unit &unit, const std::string &name, bool relaxMath) {
 #ifdef GBE_COMPILER_AVAILABLE
+    const double startTime = getSeconds();
     // Be careful when the simdWidth is forced by the programmer. We can see it
     // when the function already provides the simd width we need to use (i.e.
     // non zero)
     const ir::Function *fn = unit.getFunction(name);
     uint32_t codeGenNum = sizeof(codeGenStrategy) / sizeof(codeGenStrategy[0]);
     uint32_t codeGen = 0;
+    uint32_t attempts = 0;
     GenContext *ctx = NULL;
+    bool autoSimdWidth = false;
     if (fn->getSimdWidth() == 8) {
-      codeGen = 1;
+      codeGen = codeGenNumSIMD16;
+      autoSimdWidth = true;
     } else if (fn->getSimdWidth() == 16) {
-      codeGenNum = 1;
+      codeGenNum = codeGenNumSIMD16;
     } else if (fn->getSimdWidth() == 0) {
       codeGen = 0;
+      autoSimdWidth = true;
     } else
       GBE_ASSERT(0);
     Kernel *kernel = NULL;
@@ -171,14 +206,25 @@ namespace gbe {
     }
     GBE_ASSERTM(ctx != NULL, "Fail to create the gen context\n");
 
+    // The liveness, the DAG, the labels and the JIPs are computed once by the
+    // context and shared by all the attempts. Only the selection, the
+    // scheduling and the register allocation depend on the strategy
+    if (autoSimdWidth)
+      codeGen = getFirstCodeGen(*ctx, codeGen);
+
     for (; codeGen < codeGenNum; ++codeGen) {
       const uint32_t simdWidth = codeGenStrategy[codeGen].simdWidth;
       const bool limitRegisterPressure = codeGenStrategy[codeGen].limitRegisterPressure;
       const uint32_t reservedSpillRegs = codeGenStrategy[codeGen].reservedSpillRegs;
+      // The SIMD16 attempt limiting the pressure only differs by the
+      // scheduling before the register allocation
+      if (simdWidth == 16 && limitRegisterPressure && OCL_PRE_ALLOC_INSN_SCHEDULE == 0)
+        continue;
 
       // Force the SIMD width now and try to compile
       unit.getFunction(name)->setSimdWidth(simdWidth);
       ctx->startNewCG(simdWidth, reservedSpillRegs, limitRegisterPressure);
+      attempts++;
       kernel = ctx->compileKernel();
       if (kernel != NULL) {
         GBE_ASSERT(ctx->getErrCode() == NO_ERROR);
@@ -195,6 +241,10 @@ namespace gbe {
     }
 
     GBE_ASSERTM(kernel != NULL, "Fail to compile kernel, may need to increase reserved registers for spilling.");
+    kernel->setCompileStats(attempts, (getSeconds() - startTime) * 1000.0,
+                            codeGen < codeGenNum &&
+                            codeGenStrategy[codeGen].simdWidth == 16 &&
+                            codeGenStrategy[codeGen].limitRegisterPressure);
     return kernel;
 #else
     return NULL;
@@ -441,6 +491,86 @@ namespace gbe {
 #endif
   }
 
+#ifdef GBE_COMPILER_AVAILABLE
+  /*! Replace the uses of the given arguments of the kernel by constants and
+   *  drop the bodies of the other kernels so that only this one is compiled.
+   *  The argument list is left untouched to keep the same curbe layout
+   */
+  static bool specializeKernel(llvm::Module &mod,
+                               const char *kernelName,
+                               uint32_t argNum,
+                               const uint32_t *argIndex,
+                               const uint64_t *argValue)
+  {
+    llvm::Function *kernel = mod.getFunction(kernelName);
+    if (kernel == NULL || kernel->isDeclaration() || !isKernelFunction(*kernel))
+      return false;
+    const uint32_t paramNum = kernel->getFunctionType()->getNumParams();
+    for (uint32_t i = 0; i < argNum; ++i) {
+      if (argIndex[i] >= paramNum)
+        return false;
+      llvm::Function::arg_iterator arg = kernel->arg_begin();
+      std::advance(arg, argIndex[i]);
+      llvm::Type *type = arg->getType();
+      llvm::Constant *value = NULL;
+      if (type->isIntegerTy())
+        value = llvm::ConstantInt::get(type, argValue[i]);
+      else if (type->isFloatingPointTy()) {
+        // The bits are given as is: go through an integer of the same size
+        const uint32_t bitNum = type->getPrimitiveSizeInBits();
+        llvm::Type *bitsType = llvm::IntegerType::get(mod.getContext(), bitNum);
+        value = llvm::ConstantExpr::getBitCast(llvm::ConstantInt::get(bitsType, argValue[i]), type);
+      } else // Pointers, structures and vectors stay in the curbe
+        return false;
+      arg->replaceAllUsesWith(value);
+    }
+    for (llvm::Module::iterator it = mod.begin(); it != mod.end(); ++it) {
+      llvm::Function &F = *it;
+      if (&F == kernel || F.isDeclaration() || !F.use_empty())
+        continue;
+      if (isKernelFunction(F))
+        F.deleteBody();
+    }
+    return true;
+  }
+#endif /* GBE_COMPILER_AVAILABLE */
+
+  static gbe_program genProgramNewSpecialized(gbe_program program,
+                                              const char *kernelName,
+                                              uint32_t argNum,
+                                              const uint32_t *argIndex,
+                                              const uint64_t *argValue,
+                                              int optLevel)
+  {
+#ifdef GBE_COMPILER_AVAILABLE
+    using namespace gbe;
+    GenProgram *src = (GenProgram*) program;
+    GenProgram *dst = NULL;
+    if (src == NULL || kernelName == NULL)
+      return NULL;
+
+    acquireLLVMContextLock();
+    if (src->module != NULL) {
+      // The source module is kept as is for the next specializations
+      llvm::Module *module = llvm::CloneModule((llvm::Module*)src->module);
+      if (specializeKernel(*module, kernelName, argNum, argIndex, argValue)) {
+        std::string error;
+        dst = GBE_NEW(GenProgram, src->deviceID);
+        if (dst->buildFromLLVMFile(NULL, module, error, optLevel) == false ||
+            dst->getKernel(std::string(kernelName)) == NULL) {
+          GBE_DELETE(dst);
+          dst = NULL;
+        }
+      }
+      delete module;
+    }
+    releaseLLVMContextLock();
+    return (gbe_program) dst;
+#else
+    return NULL;
+#endif
+  }
+
 } /* namespace gbe */
 
 void genSetupCallBacks(void)
@@ -452,4 +582,5 @@ void genSetupCallBacks(void)
   gbe_program_new_gen_program = gbe::genProgramNewGenProgram;
   gbe_program_link_from_llvm = gbe::genProgramLinkFromLLVM;
   gbe_program_build_from_llvm = gbe::genProgramBuildFromLLVM;
+  gbe_program_new_specialized = gbe::genProgramNewSpecialized;
 }
@@ -48,19 +48,38 @@ namespace gbe
    */
   struct GenRegInterval {
     INLINE GenRegInterval(ir::Register reg) :
-      reg(reg), minID(INT_MAX), maxID(-INT_MAX) {}
+      reg(reg), minID(INT_MAX), maxID(-INT_MAX), spillWeight(0) {}
     ir::Register reg;     //!< (virtual) register of the interval
     int32_t minID, maxID; //!< Starting and ending points
+    uint32_t spillWeight; //!< Accesses weighted by the loop depth
   };
 
+  /*! 0: legacy linear scan, 1: linear scan with rematerialization of the
+   *  immediate values across blocks and spill choice weighted by loop depth
+   */
+  IVAR(OCL_REG_ALLOCATOR, 0, 0, 1);
+
+  /*! The spill candidate with the highest priority is spilled first. The
+   *  legacy allocator spills the interval which ends last. The weighted one
+   *  spills the interval which holds a register for the longest time per
+   *  (loop weighted) access
+   */
+  INLINE int32_t getSpillPriority(const GenRegInterval &interval) {
+    if (OCL_REG_ALLOCATOR == 0)
+      return interval.maxID;
+    const uint64_t length = interval.maxID - interval.minID + 1;
+    const uint64_t weight = std::max(interval.spillWeight, 1u);
+    return int32_t(std::min(length * 64 / weight, uint64_t(INT_MAX)));
+  }
+
   typedef struct GenRegIntervalKey {
-    GenRegIntervalKey(uint32_t reg, int32_t maxID) {
-      key = ((uint64_t)maxID << 32) | reg;
+    GenRegIntervalKey(uint32_t reg, int32_t priority) {
+      key = ((uint64_t)priority << 32) | reg;
     }
     const ir::Register getReg() const {
       return (ir::Register)(key & 0xFFFFFFFF);
     }
-    int32_t getMaxID() const {
+    int32_t getPriority() const {
       return key >> 32;
     }
     uint64_t key;
@@ -77,15 +96,15 @@ namespace gbe
   {
   public:
     std::set<GenRegIntervalKey, spillCmp>::iterator find(GenRegInterval interval) {
-      GenRegIntervalKey key(interval.reg, interval.maxID);
+      GenRegIntervalKey key(interval.reg, getSpillPriority(interval));
       return SpillSet::find(key);
     }
     void insert(GenRegInterval interval) {
-      GenRegIntervalKey key(interval.reg, interval.maxID);
+      GenRegIntervalKey key(interval.reg, getSpillPriority(interval));
       SpillSet::insert(key);
     }
     void erase(GenRegInterval interval) {
-      GenRegIntervalKey key(interval.reg, interval.maxID);
+      GenRegIntervalKey key(interval.reg, getSpillPriority(interval));
       SpillSet::erase(key);
     }
   };
@@ -104,6 +123,8 @@ namespace gbe
     GenRegister genReg(const GenRegister &reg);
     /*! Output the register allocation */
     void outputAllocation(void);
+    /*! Statistics of the allocation */
+    INLINE const RegAllocStats &getStats(void) const { return stats; }
     INLINE void getRegAttrib(ir::Register reg, uint32_t &regSize, ir::RegisterFamily *regFamily = NULL) const {
       // Note that byte vector registers use two bytes per byte (and can be
       // interleaved)
@@ -148,6 +169,18 @@ namespace gbe
      *  contigous in memory
      */
     void coalesce(Selection &selection, SelectionVector *vector);
+    /*! Number of loops each block belongs to */
+    void computeLoopDepth(void);
+    /*! Weight of one register access in the given block */
+    uint32_t getBlockWeight(const SelectionBlock &block) const;
+    /*! Recompute the immediate values in the blocks using them instead of
+     *  keeping them alive across blocks
+     */
+    void rematerialize(Selection &selection);
+    /*! Count the spill and fill instructions of the selection */
+    void countSpills(Selection &selection);
+    /*! Count the GRFs used by the allocation */
+    void countGRFs(void);
     /*! The context owns the register allocator */
     GenContext &ctx;
     /*! Map virtual registers to offset in the (physical) register file */
@@ -174,6 +207,12 @@ namespace gbe
     vector<GenRegInterval*> ending;
     /*! registers that are spilled */
     SpilledRegs spilledRegs;
+    /*! registers which are now only alive in their definition block */
+    set<ir::Register> rematerializedRegs;
+    /*! loop depth of the basic blocks */
+    map<ir::LabelIndex, uint32_t> loopDepth;
+    /*! what the allocation had to do */
+    RegAllocStats stats;
     /*! register which could be spilled.*/
     SpillCandidateSet spillCandidate;
     /* reserved registers for register spill/reload */
@@ -664,6 +703,185 @@ namespace gbe
     }
   }
 
+  void GenRegAllocator::Opaque::computeLoopDepth(void) {
+    const ir::Function &fn = ctx.getFunction();
+    for (auto loop : fn.getLoops())
+      for (auto label : loop->bbs)
+        loopDepth[label]++;
+  }
+
+  uint32_t GenRegAllocator::Opaque::getBlockWeight(const SelectionBlock &block) const {
+    if (block.bb == NULL)
+      return 1;
+    auto it = loopDepth.find(block.bb->getLabelIndex());
+    if (it == loopDepth.end())
+      return 1;
+    // Assume each loop runs 8 times
+    return 1u << (3 * std::min(it->second, 3u));
+  }
+
+  /*! A register defined once by a plain move of an immediate can be
+   *  recomputed anywhere
+   */
+  static bool isRematerializable(const Selection &selection, const SelectionInstruction &def) {
+    if (def.opcode != SEL_OP_MOV || def.dstNum != 1 || def.srcNum != 1)
+      return false;
+    const GenRegister &dst = def.dst(0);
+    const GenRegister &src = def.src(0);
+    if (src.file != GEN_IMMEDIATE_VALUE || dst.quarter != 0 || dst.subphysical)
+      return false;
+    if (def.state.predicate != GEN_PREDICATE_NONE || def.state.physicalFlag == 0 ||
+        def.state.modFlag || def.state.flagGen)
+      return false;
+    const ir::Register reg = dst.reg();
+    const ir::RegisterFamily family = selection.getRegisterFamily(reg);
+    if (family != ir::FAMILY_DWORD && family != ir::FAMILY_WORD)
+      return false;
+    if (ir::getFamily(getIRType(dst.type)) != family)
+      return false;
+    return selection.isScalarReg(reg) == (def.state.execWidth == 1);
+  }
+
+  /*! Can the use be rewritten to read a copy made in its own block */
+  static bool canReadCopy(const SelectionInstruction &def,
+                          const SelectionInstruction &use,
+                          const GenRegister &src) {
+    if (use.state.execWidth != def.state.execWidth)
+      return false;
+    if (use.state.noMask && !def.state.noMask)
+      return false;
+    return src.quarter == 0 && !src.subphysical;
+  }
+
+  void GenRegAllocator::Opaque::rematerialize(Selection &selection) {
+    typedef std::pair<SelectionInstruction*, uint32_t> Use;
+    // Vector registers must stay contiguous, keep them as they are
+    set<ir::Register> pinned;
+    map<ir::Register, SelectionInstruction*> defs;
+    uint32_t insnID = 0;
+    for (auto &block : *selection.blockList) {
+      for (auto &vector : block.vectorList)
+        for (uint32_t regID = 0; regID < vector.regNum; ++regID)
+          pinned.insert(vector.reg[regID].reg());
+      for (auto &insn : block.insnList) {
+        insn.ID = insnID++;
+        for (uint32_t dstID = 0; dstID < insn.dstNum; ++dstID) {
+          const GenRegister &dst = insn.dst(dstID);
+          if (dst.file != GEN_GENERAL_REGISTER_FILE)
+            continue;
+          const ir::Register reg = dst.reg();
+          if (defs.contains(reg))
+            pinned.insert(reg);
+          else
+            defs.insert(std::make_pair(reg, &insn));
+        }
+      }
+    }
+
+    // Gather the uses of the candidates in program order
+    map<ir::Register, vector<Use>> uses;
+    for (auto &block : *selection.blockList)
+      for (auto &insn : block.insnList)
+        for (uint32_t srcID = 0; srcID < insn.srcNum; ++srcID) {
+          const GenRegister &src = insn.src(srcID);
+          if (src.file != GEN_GENERAL_REGISTER_FILE)
+            continue;
+          const ir::Register reg = src.reg();
+          auto def = defs.find(reg);
+          if (def == defs.end() || pinned.contains(reg) || ctx.isSpecialReg(reg) ||
+              !isRematerializable(selection, *def->second))
+            continue;
+          uses[reg].push_back(std::make_pair(&insn, srcID));
+        }
+
+    for (auto &it : uses) {
+      const ir::Register reg = it.first;
+      SelectionInstruction *def = defs.find(reg)->second;
+      const SelectionBlock *defBlock = def->parent;
+      const uint32_t defWeight = getBlockWeight(*defBlock);
+      bool isLocal = true, isValid = true;
+      for (auto &use : it.second) {
+        const SelectionInstruction *insn = use.first;
+        if (insn->parent == defBlock) {
+          isValid = insn->ID > def->ID;
+        } else {
+          isLocal = false;
+          isValid = canReadCopy(*def, *insn, insn->src(use.second));
+          // Adding moves into a hotter loop is only worth it when we are
+          // about to spill
+          if (getBlockWeight(*insn->parent) > defWeight && ctx.reservedSpillRegs == 0)
+            isValid = false;
+        }
+        if (!isValid)
+          break;
+      }
+      if (isLocal || !isValid)
+        continue;
+
+      // One copy per block, right before the first use
+      const ir::Type type = getIRType(def->dst(0).type);
+      const SelectionBlock *block = NULL;
+      ir::Register tmp;
+      for (auto &use : it.second) {
+        SelectionInstruction *insn = use.first;
+        if (insn->parent == defBlock)
+          continue;
+        const GenRegister src = insn->src(use.second);
+        if (insn->parent != block) {
+          block = insn->parent;
+          tmp = selection.replaceSrc(insn, use.second, type, false);
+          SelectionInstruction *mov = selection.create(SEL_OP_MOV, 1, 1);
+          mov->src(0) = def->src(0);
+          mov->dst(0) = def->dst(0);
+          mov->dst(0).value.reg = tmp;
+          mov->state = GenInstructionState(def->state.execWidth);
+          mov->state.noMask = def->state.noMask;
+          if (block->removeSimpleIfEndif) {
+            mov->state.predicate = GEN_PREDICATE_NORMAL;
+            mov->state.flag = 0;
+            mov->state.subFlag = 0;
+          }
+          insn->prepend(*mov);
+          stats.rematNum++;
+        }
+        // Keep the region of the original source
+        insn->src(use.second) = src;
+        insn->src(use.second).value.reg = tmp;
+      }
+      rematerializedRegs.insert(reg);
+    }
+  }
+
+  void GenRegAllocator::Opaque::countSpills(Selection &selection) {
+    stats.spilledRegNum = spilledRegs.size();
+    for (auto &it : spilledRegs) {
+      uint32_t regSize;
+      getRegAttrib(it.first, regSize);
+      stats.spilledBytes += regSize;
+    }
+    for (auto &block : *selection.blockList)
+      for (auto &insn : block.insnList) {
+        if (insn.opcode == SEL_OP_SPILL_REG)
+          stats.spillNum++;
+        else if (insn.opcode == SEL_OP_UNSPILL_REG)
+          stats.fillNum++;
+      }
+  }
+
+  void GenRegAllocator::Opaque::countGRFs(void) {
+    set<uint32_t> grfs;
+    for (auto &it : RA) {
+      uint32_t regSize;
+      getRegAttrib(it.first, regSize);
+      const uint32_t last = (it.second + regSize - 1) / GEN_REG_SIZE;
+      for (uint32_t grf = it.second / GEN_REG_SIZE; grf <= last; ++grf)
+        grfs.insert(grf);
+    }
+    for (uint32_t regID = 0; regID < ctx.reservedSpillRegs; ++regID)
+      grfs.insert(reservedReg + regID);
+    stats.grfNum = grfs.size();
+  }
+
   IVAR(OCL_SIMD16_SPILL_THRESHOLD, 0, 16, 256);
   bool GenRegAllocator::Opaque::allocateGRFs(Selection &selection) {
     // Perform the linear scan allocator
@@ -738,6 +956,7 @@ namespace gbe
         ctx.errCode = REGISTER_SPILL_FAIL;
         return false;
       }
+      this->countSpills(selection);
     }
     ctx.errCode = NO_ERROR;
     return true;
@@ -886,7 +1105,7 @@ namespace gbe
     // The reason is that the caller may have a vector to allocate, and some element may be
     // temporary registers which could not be spilled.
     if (it == spillCandidate.end()
-        || (ctx.getSimdWidth() == 8 && (it->getMaxID() <= interval.maxID
+        || (ctx.getSimdWidth() == 8 && (it->getPriority() <= getSpillPriority(interval)
             && alignment == ctx.getSimdWidth()/8 * GEN_REG_SIZE)))
       return false;
 
@@ -992,6 +1211,10 @@ namespace gbe
     }
     // schedulePreRegAllocation(ctx, selection);
 
+    this->computeLoopDepth();
+    if (OCL_REG_ALLOCATOR == 1)
+      this->rematerialize(selection);
+
     // Now start the linear scan allocation
     for (uint32_t regID = 0; regID < ctx.sel->getRegNum(); ++regID)
       this->intervals.push_back(ir::Register(regID));
@@ -1015,6 +1238,7 @@ namespace gbe
       // Update the intervals of each used register. Note that we do not
       // register allocate R0, so we skip all sub-registers in r0
       RegIntervalMap *boolsMap = new RegIntervalMap;
+      const uint32_t blockWeight = this->getBlockWeight(block);
       if (block.isLargeBlock)
         flag0ReservedBlocks.insert(&block);
       for (auto &insn : block.insnList) {
@@ -1031,6 +1255,7 @@ namespace gbe
             continue;
           this->intervals[reg].minID = std::min(this->intervals[reg].minID, insnID);
           this->intervals[reg].maxID = std::max(this->intervals[reg].maxID, insnID);
+          this->intervals[reg].spillWeight += blockWeight;
         }
         for (uint32_t dstID = 0; dstID < dstNum; ++dstID) {
           const GenRegister &selReg = insn.dst(dstID);
@@ -1043,6 +1268,7 @@ namespace gbe
             continue;
           this->intervals[reg].minID = std::min(this->intervals[reg].minID, insnID);
           this->intervals[reg].maxID = std::max(this->intervals[reg].maxID, insnID);
+          this->intervals[reg].spillWeight += blockWeight;
         }
 
         // OK, a flag is used as a predicate or a conditional modifier
@@ -1090,13 +1316,17 @@ namespace gbe
 
       // All registers alive at the begining of the block must update their intervals.
       const ir::BasicBlock *bb = block.bb;
+      // Rematerialized registers are not used outside of their definition
+      // block anymore.
       for (auto reg : ctx.getLiveIn(bb))
-        this->intervals[reg].minID = std::min(this->intervals[reg].minID, firstID);
+        if (!rematerializedRegs.contains(reg))
+          this->intervals[reg].minID = std::min(this->intervals[reg].minID, firstID);
 
       // All registers alive at the end of the block must have their intervals
       // updated as well
       for (auto reg : ctx.getLiveOut(bb))
-        this->intervals[reg].maxID = std::max(this->intervals[reg].maxID, lastID);
+        if (!rematerializedRegs.contains(reg))
+          this->intervals[reg].maxID = std::max(this->intervals[reg].maxID, lastID);
 
       if (boolsMap->size() > 0)
         boolIntervalsMap.insert(std::make_pair(&block, boolsMap));
@@ -1134,7 +1364,10 @@ namespace gbe
 
     // Allocate all the GRFs now (regular register and boolean that are not in
     // flag registers)
-    return this->allocateGRFs(selection);
+    if (this->allocateGRFs(selection) == false)
+      return false;
+    this->countGRFs();
+    return true;
   }
 
   INLINE void GenRegAllocator::Opaque::outputAllocation(void) {
@@ -1171,6 +1404,9 @@ namespace gbe
            << " -> " << setw(8) << this->intervals[(uint)vReg].maxID
            << "]" << endl;
     }
+    cout << "## spilled " << stats.spilledRegNum << " registers (" << stats.spilledBytes
+         << "B), " << stats.spillNum << " spill(s), " << stats.fillNum << " fill(s), "
+         << stats.rematNum << " rematerialization(s)" << endl;
     cout << endl;
   }
 
@@ -1225,6 +1461,10 @@ namespace gbe
     this->opaque->outputAllocation();
   }
 
+  const RegAllocStats &GenRegAllocator::getStats(void) const {
+    return this->opaque->getStats();
+  }
+
   uint32_t GenRegAllocator::getRegSize(ir::Register reg) {
      uint32_t regSize; 
      this->opaque->getRegAttrib(reg, regSize); 
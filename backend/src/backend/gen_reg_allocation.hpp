@@ -42,6 +42,18 @@ namespace gbe
 
   typedef map<ir::Register, SpillRegTag> SpilledRegs;
 
+  /*! What the register allocation had to do to fit in the register file */
+  struct RegAllocStats {
+    RegAllocStats(void) :
+      grfNum(0), spilledRegNum(0), spilledBytes(0), spillNum(0), fillNum(0), rematNum(0) {}
+    uint32_t grfNum;        //!< GRFs holding at least one register
+    uint32_t spilledRegNum; //!< Registers living in scratch memory
+    uint32_t spilledBytes;  //!< Their size in bytes
+    uint32_t spillNum;      //!< Scratch writes inserted
+    uint32_t fillNum;       //!< Scratch reads inserted
+    uint32_t rematNum;      //!< Values recomputed instead of kept alive
+  };
+
   /*! Register allocate (i.e. virtual to physical register mapping) */
   class GenRegAllocator
   {
@@ -58,6 +70,8 @@ namespace gbe
     void outputAllocation(void);
     /*! Get register actual size in byte. */
     uint32_t getRegSize(ir::Register reg);
+    /*! Statistics of the last allocation */
+    const RegAllocStats &getStats(void) const;
   private:
     /*! Actual implementation of the register allocator (use Pimpl) */
     class Opaque;
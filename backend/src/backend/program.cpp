@@ -24,6 +24,7 @@
 
 #include "program.h"
 #include "program.hpp"
+#include "program_cache.hpp"
 #include "gen_program.h"
 #include "sys/platform.hpp"
 #include "sys/cvar.hpp"
@@ -37,11 +38,14 @@
 #include "llvm/Config/llvm-config.h"
 #include "llvm/Support/Threading.h"
 #include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/Utils/Cloning.h"
 #include "llvm/IR/LLVMContext.h"
 #endif
 
 #include <cstring>
+#include <cstdio>
 #include <algorithm>
 #include <fstream>
 #include <dlfcn.h>
@@ -49,6 +53,8 @@
 #include <iostream>
 #include <unistd.h>
 #include <mutex>
+#include <thread>
+#include <atomic>
 
 #ifdef GBE_COMPILER_AVAILABLE
 /* Not defined for LLVM 3.0 */
@@ -88,7 +94,10 @@ namespace gbe {
 
   Kernel::Kernel(const std::string &name) :
     name(name), args(NULL), argNum(0), curbeSize(0), stackSize(0), useSLM(false),
-        slmSize(0), ctx(NULL), samplerSet(NULL), imageSet(NULL), printfSet(NULL) {}
+        slmSize(0), ctx(NULL), samplerSet(NULL), imageSet(NULL), printfSet(NULL)
+  {
+    std::memset(&stats, 0, sizeof(stats));
+  }
   Kernel::~Kernel(void) {
     if(ctx) GBE_DELETE(ctx);
     if(samplerSet) GBE_DELETE(samplerSet);
@@ -96,6 +105,42 @@ namespace gbe {
     if(printfSet) GBE_DELETE(printfSet);
     GBE_SAFE_DELETE_ARRAY(args);
   }
+  void Kernel::setCompileStats(uint32_t attempts, double time, bool pressureScheduled) {
+    stats.simd_width = simdWidth;
+    stats.attempts = attempts;
+    stats.scratch_size = scratchSize;
+    stats.curbe_size = curbeSize;
+    stats.slm_size = slmSize;
+    stats.pressure_scheduled = pressureScheduled;
+    stats.total_time = time;
+  }
+
+  std::string Kernel::getCompileStatsJSON(void) const {
+    char times[256];
+    snprintf(times, sizeof(times),
+             "\"selection_ms\":%.3f,\"schedule_ms\":%.3f,\"reg_alloc_ms\":%.3f,"
+             "\"encode_ms\":%.3f,\"total_ms\":%.3f",
+             stats.selection_time, stats.schedule_time, stats.reg_alloc_time,
+             stats.encode_time, stats.total_time);
+    std::ostringstream json;
+    // Kernel names are C identifiers, no need to escape them
+    json << "{\"kernel\":\"" << name << "\""
+         << ",\"simd_width\":" << stats.simd_width
+         << ",\"attempts\":" << stats.attempts
+         << ",\"insn_num\":" << stats.insn_num
+         << ",\"compacted_insn_num\":" << stats.compacted_insn_num
+         << ",\"grf_num\":" << stats.grf_num
+         << ",\"spill_num\":" << stats.spill_num
+         << ",\"fill_num\":" << stats.fill_num
+         << ",\"remat_num\":" << stats.remat_num
+         << ",\"scratch_size\":" << stats.scratch_size
+         << ",\"curbe_size\":" << stats.curbe_size
+         << ",\"slm_size\":" << stats.slm_size
+         << ",\"pressure_scheduled\":" << (stats.pressure_scheduled ? "true" : "false")
+         << "," << times << "}";
+    return json.str();
+  }
+
   int32_t Kernel::getCurbeOffset(gbe_curbe_type type, uint32_t subType) const {
     const PatchInfo patch(type, subType);
     const auto it = std::lower_bound(patches.begin(), patches.end(), patch);
@@ -104,7 +149,9 @@ namespace gbe {
     return it->offset; // we found it!
   }
 
-  Program::Program(void) : constantSet(NULL) {}
+  Program::Program(void) : constantSet(NULL) {
+    std::memset(&stats, 0, sizeof(stats));
+  }
   Program::~Program(void) {
     for (map<std::string, Kernel*>::iterator it = kernels.begin(); it != kernels.end(); ++it)
       GBE_DELETE(it->second);
@@ -114,6 +161,8 @@ namespace gbe {
 #ifdef GBE_COMPILER_AVAILABLE
   BVAR(OCL_OUTPUT_GEN_IR, false);
   BVAR(OCL_STRICT_CONFORMANCE, false);
+  BVAR(OCL_OUTPUT_BUILD_LOG, false);
+  BVAR(OCL_OUTPUT_KERNEL_STATS, false);
 
   bool Program::buildFromLLVMFile(const char *fileName, const void* module, std::string &error, int optLevel) {
     ir::Unit *unit = new ir::Unit();
@@ -121,7 +170,7 @@ namespace gbe {
     if(module){
       cloned_module = llvm::CloneModule((llvm::Module*)module);
     }
-    if (llvmToGen(*unit, fileName, module, optLevel, OCL_STRICT_CONFORMANCE) == false) {
+    if (llvmToGen(*unit, fileName, module, optLevel, OCL_STRICT_CONFORMANCE, &stats) == false) {
       if (fileName)
         error = std::string(fileName) + " not found";
       delete unit;
@@ -134,10 +183,10 @@ namespace gbe {
       unit = new ir::Unit();
       if(cloned_module){
         //suppose file exists and llvmToGen will not return false.
-        llvmToGen(*unit, fileName, cloned_module, 0, OCL_STRICT_CONFORMANCE);
+        llvmToGen(*unit, fileName, cloned_module, 0, OCL_STRICT_CONFORMANCE, &stats);
       }else{
         //suppose file exists and llvmToGen will not return false.
-        llvmToGen(*unit, fileName, module, 0, OCL_STRICT_CONFORMANCE);
+        llvmToGen(*unit, fileName, module, 0, OCL_STRICT_CONFORMANCE, &stats);
       }
     }
     assert(unit->getValid());
@@ -149,21 +198,89 @@ namespace gbe {
     return true;
   }
 
+  IVAR(OCL_KERNEL_COMPILE_THREADS, 0, 0, 64);
+  extern int32_t OCL_OUTPUT_ASM;
+  extern int32_t OCL_OUTPUT_REG_ALLOC;
+
+  /*! Number of threads used to compile the kernels of one unit */
+  static uint32_t getKernelCompileThreadNum(uint32_t kernelNum) {
+    // The dumps are written as the kernels are compiled and the disassembler
+    // is not reentrant
+    if (OCL_OUTPUT_ASM || OCL_OUTPUT_REG_ALLOC) return 1;
+    uint32_t threadNum = OCL_KERNEL_COMPILE_THREADS;
+    if (threadNum == 0) threadNum = std::max(std::thread::hardware_concurrency(), 1u);
+    return std::min(threadNum, kernelNum);
+  }
+
   bool Program::buildFromUnit(const ir::Unit &unit, std::string &error) {
     constantSet = new ir::ConstantSet(unit.getConstantSet());
     const auto &set = unit.getFunctionSet();
     const uint32_t kernelNum = set.size();
     if (OCL_OUTPUT_GEN_IR) std::cout << unit;
     if (kernelNum == 0) return true;
+
+    // Every kernel is compiled from its own function by its own context, so
+    // kernels only share read-only data and can be compiled concurrently.
+    // Biggest kernels go first to keep the workers busy until the end
+    vector<const std::string*> names;
+    vector<std::pair<uint32_t, uint32_t>> order;
+    for (const auto &pair : set) {
+      uint32_t insnNum = 0;
+      pair.second->foreachInstruction([&](const ir::Instruction &) { insnNum++; });
+      order.push_back(std::make_pair(insnNum, uint32_t(names.size())));
+      names.push_back(&pair.first);
+    }
+    std::sort(order.begin(), order.end(),
+              [](const std::pair<uint32_t, uint32_t> &a, const std::pair<uint32_t, uint32_t> &b) {
+                return a.first > b.first || (a.first == b.first && a.second < b.second);
+              });
+
+    const double codegenStart = getSeconds();
+    vector<Kernel*> compiled(kernelNum, NULL);
+    std::atomic<uint32_t> next(0);
+    auto compileKernels = [&]() {
+      for (uint32_t i = next++; i < kernelNum; i = next++) {
+        const uint32_t id = order[i].second;
+        compiled[id] = this->compileKernel(unit, *names[id], !OCL_STRICT_CONFORMANCE);
+      }
+    };
+    const uint32_t threadNum = getKernelCompileThreadNum(kernelNum);
+    vector<std::thread> workers;
+    for (uint32_t i = 1; i < threadNum; ++i)
+      workers.push_back(std::thread(compileKernels));
+    compileKernels();
+    for (auto &worker : workers)
+      worker.join();
+    stats.codegen_time += (getSeconds() - codegenStart) * 1000.0;
+    stats.kernel_num = kernelNum;
+
+    // Kernels are registered in the function set order whatever the order
+    // they were compiled in
+    uint32_t id = 0;
     for (const auto &pair : set) {
       const std::string &name = pair.first;
-      Kernel *kernel = this->compileKernel(unit, name, !OCL_STRICT_CONFORMANCE);
+      Kernel *kernel = compiled[id++];
       kernel->setSamplerSet(pair.second->getSamplerSet());
       kernel->setImageSet(pair.second->getImageSet());
       kernel->setPrintfSet(pair.second->getPrintfSet());
       kernel->setCompileWorkGroupSize(pair.second->getCompileWorkGroupSize());
       kernel->setFunctionAttributes(pair.second->getFunctionAttributes());
       kernels.insert(std::make_pair(name, kernel));
+      const gbe_kernel_compile_stats &kernelStats = kernel->getCompileStats();
+      stats.selection_time += kernelStats.selection_time;
+      stats.schedule_time += kernelStats.schedule_time;
+      stats.reg_alloc_time += kernelStats.reg_alloc_time;
+      stats.encode_time += kernelStats.encode_time;
+      if (OCL_OUTPUT_BUILD_LOG)
+        llvm::errs() << "kernel " << name << ": SIMD" << kernelStats.simd_width
+                     << ", " << kernelStats.attempts << " code generation attempt(s), "
+                     << llvm::format("%.2f", kernelStats.total_time) << " ms, "
+                     << kernelStats.spill_num << " spill(s), " << kernelStats.fill_num
+                     << " fill(s), " << kernelStats.remat_num << " rematerialization(s)"
+                     << (kernelStats.pressure_scheduled ?
+                         ", SIMD16 rescued by the pre-allocation scheduler\n" : "\n");
+      if (OCL_OUTPUT_KERNEL_STATS)
+        std::cout << kernel->getCompileStatsJSON() << std::endl;
     }
     return true;
   }
@@ -178,6 +295,7 @@ namespace gbe {
     int has_constset = 0;
 
     OUT_UPDATE_SZ(magic_begin);
+    OUT_UPDATE_SZ(binary_version);
 
     if (constantSet) {
       has_constset = 1;
@@ -215,6 +333,10 @@ namespace gbe {
     IN_UPDATE_SZ(magic);
     if (magic != magic_begin)
       return 0;
+    uint32_t version;
+    IN_UPDATE_SZ(version);
+    if (version != binary_version)
+      return 0;
 
     IN_UPDATE_SZ(has_constset);
     if(has_constset) {
@@ -296,6 +418,24 @@ namespace gbe {
     OUT_UPDATE_SZ(compileWgSize[0]);
     OUT_UPDATE_SZ(compileWgSize[1]);
     OUT_UPDATE_SZ(compileWgSize[2]);
+    /* One field at a time: the layout does not depend on the struct padding */
+    OUT_UPDATE_SZ(stats.simd_width);
+    OUT_UPDATE_SZ(stats.attempts);
+    OUT_UPDATE_SZ(stats.insn_num);
+    OUT_UPDATE_SZ(stats.compacted_insn_num);
+    OUT_UPDATE_SZ(stats.grf_num);
+    OUT_UPDATE_SZ(stats.spill_num);
+    OUT_UPDATE_SZ(stats.fill_num);
+    OUT_UPDATE_SZ(stats.remat_num);
+    OUT_UPDATE_SZ(stats.scratch_size);
+    OUT_UPDATE_SZ(stats.curbe_size);
+    OUT_UPDATE_SZ(stats.slm_size);
+    OUT_UPDATE_SZ(stats.pressure_scheduled);
+    OUT_UPDATE_SZ(stats.selection_time);
+    OUT_UPDATE_SZ(stats.schedule_time);
+    OUT_UPDATE_SZ(stats.reg_alloc_time);
+    OUT_UPDATE_SZ(stats.encode_time);
+    OUT_UPDATE_SZ(stats.total_time);
     /* samplers. */
     if (!samplerSet->empty()) {   //samplerSet is always valid, allocated in Function::Function
       has_samplerset = 1;
@@ -388,6 +528,23 @@ namespace gbe {
     IN_UPDATE_SZ(compileWgSize[0]);
     IN_UPDATE_SZ(compileWgSize[1]);
     IN_UPDATE_SZ(compileWgSize[2]);
+    IN_UPDATE_SZ(stats.simd_width);
+    IN_UPDATE_SZ(stats.attempts);
+    IN_UPDATE_SZ(stats.insn_num);
+    IN_UPDATE_SZ(stats.compacted_insn_num);
+    IN_UPDATE_SZ(stats.grf_num);
+    IN_UPDATE_SZ(stats.spill_num);
+    IN_UPDATE_SZ(stats.fill_num);
+    IN_UPDATE_SZ(stats.remat_num);
+    IN_UPDATE_SZ(stats.scratch_size);
+    IN_UPDATE_SZ(stats.curbe_size);
+    IN_UPDATE_SZ(stats.slm_size);
+    IN_UPDATE_SZ(stats.pressure_scheduled);
+    IN_UPDATE_SZ(stats.selection_time);
+    IN_UPDATE_SZ(stats.schedule_time);
+    IN_UPDATE_SZ(stats.reg_alloc_time);
+    IN_UPDATE_SZ(stats.encode_time);
+    IN_UPDATE_SZ(stats.total_time);
 
     IN_UPDATE_SZ(has_samplerset);
     if (has_samplerset) {
@@ -470,6 +627,7 @@ namespace gbe {
     outs << spaces_nl << "  useSLM: " << useSLM << "\n";
     outs << spaces_nl << "  slmSize: " << slmSize << "\n";
     outs << spaces_nl << "  compileWgSize: " << compileWgSize[0] << compileWgSize[1] << compileWgSize[2] << "\n";
+    outs << spaces_nl << "  compileStats: " << getCompileStatsJSON() << "\n";
 
     outs << spaces_nl << "  Argument Number is " << argNum << "\n";
     for (uint32_t i = 0; i < argNum; i++) {
@@ -516,8 +674,6 @@ namespace gbe {
   }
 
 #ifdef GBE_COMPILER_AVAILABLE
-  BVAR(OCL_OUTPUT_BUILD_LOG, false);
-
   static bool buildModuleFromSource(const char* input, llvm::Module** out_module, llvm::LLVMContext* llvm_ctx,
                                     std::vector<std::string>& options, size_t stringSize, char *err,
                                     size_t *errSize) {
@@ -590,16 +746,26 @@ namespace gbe {
     lang_opts.OpenCL = 1;
     
     //llvm flags need command line parsing to take effect
+    //The parsed options are process wide: serialize the parsing and skip it
+    //when the options are the ones already in effect, which is the usual case
+    //and avoids rewriting them while other threads compile.
     if (!Clang.getFrontendOpts().LLVMArgs.empty()) {
-      unsigned NumArgs = Clang.getFrontendOpts().LLVMArgs.size();
-      const char **Args = new const char*[NumArgs + 2];
-      Args[0] = "clang (LLVM option parsing)";
-      for (unsigned i = 0; i != NumArgs; ++i){
-        Args[i + 1] = Clang.getFrontendOpts().LLVMArgs[i].c_str();
+      static std::mutex llvm_cl_mutex;
+      static std::vector<std::string> parsedLLVMArgs;
+      std::lock_guard<std::mutex> lock(llvm_cl_mutex);
+      const std::vector<std::string> &LLVMArgs = Clang.getFrontendOpts().LLVMArgs;
+      if (LLVMArgs != parsedLLVMArgs) {
+        unsigned NumArgs = LLVMArgs.size();
+        const char **Args = new const char*[NumArgs + 2];
+        Args[0] = "clang (LLVM option parsing)";
+        for (unsigned i = 0; i != NumArgs; ++i){
+          Args[i + 1] = LLVMArgs[i].c_str();
+        }
+        Args[NumArgs + 1] = 0;
+        llvm::cl::ParseCommandLineOptions(NumArgs + 1, Args);
+        delete [] Args;
+        parsedLLVMArgs = LLVMArgs;
       }
-      Args[NumArgs + 1] = 0;
-      llvm::cl::ParseCommandLineOptions(NumArgs + 1, Args);
-      delete [] Args;
     }
   
     // Create an action and make the compiler instance carry it out
@@ -762,6 +928,15 @@ namespace gbe {
     return true;
   }
 
+  /*! Printf sets are not serialized, so such programs cannot be reloaded */
+  static bool programIsCacheable(gbe_program gbeProgram) {
+    const gbe::Program *program = (const gbe::Program*) gbeProgram;
+    for (uint32_t i = 0; i < program->getKernelNum(); ++i)
+      if (program->getKernel(i)->getPrintfNum() != 0)
+        return false;
+    return true;
+  }
+
   static gbe_program programNewFromSource(uint32_t deviceID,
                                           const char *source,
                                           size_t stringSize,
@@ -769,6 +944,25 @@ namespace gbe {
                                           char *err,
                                           size_t *errSize)
   {
+    std::string cacheKey;
+    const bool useCache = ProgramCache::makeKey(deviceID, source, options, cacheKey);
+    if (useCache) {
+      char *binary = NULL;
+      size_t binarySize = 0;
+      if (ProgramCache::load(cacheKey, &binary, &binarySize)) {
+        gbe_program p = gbe_program_new_from_binary(deviceID, binary, binarySize);
+        free(binary);
+        if (p != NULL) {
+          if (err != NULL && errSize != NULL)
+            *errSize = 0;
+          if (OCL_OUTPUT_BUILD_LOG)
+            llvm::errs() << "binary cache hit: " << cacheKey << "\n";
+          return p;
+        }
+        ProgramCache::invalidate(cacheKey);
+      }
+    }
+
     int optLevel = 1;
     std::vector<std::string> clOpt;
     std::string clName;
@@ -778,14 +972,19 @@ namespace gbe {
 
     gbe_program p;
     // will delete the module and act in GenProgram::CleanLlvmResource().
+    // Each program owns its LLVMContext, so several programs can be built
+    // concurrently. Only an LLVM built without thread support needs the
+    // builds to be serialized.
     llvm::Module * out_module;
     llvm::LLVMContext* llvm_ctx = new llvm::LLVMContext;
-    static std::mutex llvm_mutex;
-    if (!llvm::llvm_is_multithreaded())
-      llvm_mutex.lock();
+    const bool serializeBuild = !llvm::llvm_is_multithreaded();
+    if (serializeBuild)
+      acquireLLVMContextLock();
 
+    const double buildStart = getSeconds();
     if (buildModuleFromSource(clName.c_str(), &out_module, llvm_ctx, clOpt,
                               stringSize, err, errSize)) {
+      const double frontendTime = (getSeconds() - buildStart) * 1000.0;
     // Now build the program from llvm
       size_t clangErrSize = 0;
       if (err != NULL) {
@@ -801,13 +1000,26 @@ namespace gbe {
         *errSize += clangErrSize;
       if (OCL_OUTPUT_BUILD_LOG && options)
         llvm::errs() << options;
+      if (p != NULL) {
+        gbe_program_compile_stats &stats = ((gbe::Program*) p)->getCompileStats();
+        stats.frontend_time = frontendTime;
+        stats.total_time = (getSeconds() - buildStart) * 1000.0;
+      }
     } else
       p = NULL;
 
-    if (!llvm::llvm_is_multithreaded())
-      llvm_mutex.unlock();
+    if (serializeBuild)
+      releaseLLVMContextLock();
 
     remove(clName.c_str());
+
+    if (p != NULL && useCache && programIsCacheable(p)) {
+      char *binary = NULL;
+      const size_t binarySize = gbe_program_serialize_to_binary(p, &binary, 0);
+      if (binarySize != 0)
+        ProgramCache::store(cacheKey, binary, binarySize);
+      free(binary);
+    }
     return p;
   }
 #endif
@@ -1099,9 +1311,44 @@ namespace gbe {
     kernel->getImageData(images);
   }
 
+  static void kernelGetCompileStats(gbe_kernel gbeKernel, gbe_kernel_compile_stats *stats) {
+    if (stats == NULL) return;
+    if (gbeKernel == NULL) {
+      std::memset(stats, 0, sizeof(*stats));
+      return;
+    }
+    const gbe::Kernel *kernel = (const gbe::Kernel*) gbeKernel;
+    *stats = kernel->getCompileStats();
+  }
+
+  static void programGetCompileStats(gbe_program gbeProgram, gbe_program_compile_stats *stats) {
+    if (stats == NULL) return;
+    if (gbeProgram == NULL) {
+      std::memset(stats, 0, sizeof(*stats));
+      return;
+    }
+    const gbe::Program *program = (const gbe::Program*) gbeProgram;
+    *stats = program->getCompileStats();
+  }
+
+  static size_t kernelGetCompileStatsJSON(gbe_kernel gbeKernel, char *buf, size_t size) {
+    if (gbeKernel == NULL) return 0;
+    const gbe::Kernel *kernel = (const gbe::Kernel*) gbeKernel;
+    const std::string json = kernel->getCompileStatsJSON();
+    if (buf != NULL && size > json.size())
+      std::memcpy(buf, json.c_str(), json.size() + 1);
+    return json.size() + 1;
+  }
+
   static uint32_t kernelGetRequiredWorkGroupSize(gbe_kernel kernel, uint32_t dim) {
     return 0u;
   }
+
+#ifdef GBE_COMPILER_AVAILABLE
+  static void programCacheGetStats(uint64_t *hits, uint64_t *misses) {
+    ProgramCache::getStats(hits, misses);
+  }
+#endif
 } /* namespace gbe */
 
 std::mutex llvm_ctx_mutex;
@@ -1125,6 +1372,7 @@ GBE_EXPORT_SYMBOL gbe_program_new_from_llvm_cb *gbe_program_new_from_llvm = NULL
 GBE_EXPORT_SYMBOL gbe_program_new_gen_program_cb *gbe_program_new_gen_program = NULL;
 GBE_EXPORT_SYMBOL gbe_program_link_from_llvm_cb *gbe_program_link_from_llvm = NULL;
 GBE_EXPORT_SYMBOL gbe_program_build_from_llvm_cb *gbe_program_build_from_llvm = NULL;
+GBE_EXPORT_SYMBOL gbe_program_new_specialized_cb *gbe_program_new_specialized = NULL;
 GBE_EXPORT_SYMBOL gbe_program_get_global_constant_size_cb *gbe_program_get_global_constant_size = NULL;
 GBE_EXPORT_SYMBOL gbe_program_get_global_constant_data_cb *gbe_program_get_global_constant_data = NULL;
 GBE_EXPORT_SYMBOL gbe_program_clean_llvm_resource_cb *gbe_program_clean_llvm_resource = NULL;
@@ -1155,6 +1403,8 @@ GBE_EXPORT_SYMBOL gbe_kernel_get_sampler_data_cb *gbe_kernel_get_sampler_data =
 GBE_EXPORT_SYMBOL gbe_kernel_get_compile_wg_size_cb *gbe_kernel_get_compile_wg_size = NULL;
 GBE_EXPORT_SYMBOL gbe_kernel_get_image_size_cb *gbe_kernel_get_image_size = NULL;
 GBE_EXPORT_SYMBOL gbe_kernel_get_image_data_cb *gbe_kernel_get_image_data = NULL;
+GBE_EXPORT_SYMBOL gbe_kernel_get_compile_stats_cb *gbe_kernel_get_compile_stats = NULL;
+GBE_EXPORT_SYMBOL gbe_kernel_get_compile_stats_json_cb *gbe_kernel_get_compile_stats_json = NULL;
 GBE_EXPORT_SYMBOL gbe_get_printf_num_cb *gbe_get_printf_num = NULL;
 GBE_EXPORT_SYMBOL gbe_dup_printfset_cb *gbe_dup_printfset = NULL;
 GBE_EXPORT_SYMBOL gbe_get_printf_buf_bti_cb *gbe_get_printf_buf_bti = NULL;
@@ -1162,6 +1412,8 @@ GBE_EXPORT_SYMBOL gbe_get_printf_indexbuf_bti_cb *gbe_get_printf_indexbuf_bti =
 GBE_EXPORT_SYMBOL gbe_release_printf_info_cb *gbe_release_printf_info = NULL;
 GBE_EXPORT_SYMBOL gbe_get_printf_sizeof_size_cb *gbe_get_printf_sizeof_size = NULL;
 GBE_EXPORT_SYMBOL gbe_output_printf_cb *gbe_output_printf = NULL;
+GBE_EXPORT_SYMBOL gbe_program_cache_get_stats_cb *gbe_program_cache_get_stats = NULL;
+GBE_EXPORT_SYMBOL gbe_program_get_compile_stats_cb *gbe_program_get_compile_stats = NULL;
 
 #ifdef GBE_COMPILER_AVAILABLE
 namespace gbe
@@ -1203,6 +1455,8 @@ namespace gbe
       gbe_kernel_get_compile_wg_size = gbe::kernelGetCompileWorkGroupSize;
       gbe_kernel_get_image_size = gbe::kernelGetImageSize;
       gbe_kernel_get_image_data = gbe::kernelGetImageData;
+      gbe_kernel_get_compile_stats = gbe::kernelGetCompileStats;
+      gbe_kernel_get_compile_stats_json = gbe::kernelGetCompileStatsJSON;
       gbe_get_printf_num = gbe::kernelGetPrintfNum;
       gbe_get_printf_buf_bti = gbe::kernelGetPrintfBufBTI;
       gbe_get_printf_indexbuf_bti = gbe::kernelGetPrintfIndexBufBTI;
@@ -1210,7 +1464,13 @@ namespace gbe
       gbe_get_printf_sizeof_size = gbe::kernelGetPrintfSizeOfSize;
       gbe_release_printf_info = gbe::kernelReleasePrintfSet;
       gbe_output_printf = gbe::kernelOutputPrintf;
+      gbe_program_cache_get_stats = gbe::programCacheGetStats;
+      gbe_program_get_compile_stats = gbe::programGetCompileStats;
       genSetupCallBacks();
+#if (LLVM_VERSION_MAJOR == 3) && (LLVM_VERSION_MINOR <= 4)
+      // Older LLVM only makes its managed statics thread safe on request
+      llvm::llvm_start_multithreaded();
+#endif
     }
 
     ~CallBackInitializer() {
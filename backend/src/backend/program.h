@@ -170,6 +170,33 @@ typedef gbe_program (gbe_program_new_from_source_cb)(uint32_t deviceID,
                                                      char *err,
                                                      size_t *err_size);
 extern gbe_program_new_from_source_cb *gbe_program_new_from_source;
+/*! Get the hit / miss counters of the on-disk binary cache (OCL_BINARY_CACHE_DIR) */
+typedef void (gbe_program_cache_get_stats_cb)(uint64_t *hits, uint64_t *misses);
+extern gbe_program_cache_get_stats_cb *gbe_program_cache_get_stats;
+
+/*! Where the build of a program went, in ms. The code generation times are
+ *  summed over the kernels, which may be compiled concurrently
+ */
+typedef struct gbe_program_compile_stats {
+  uint32_t kernel_num;          /* Kernels in the program */
+  double frontend_time;         /* Clang: preprocessing, parsing and LLVM IR emission */
+  double llvm_time;             /* Bitcode linking and LLVM passes in llvmToGen */
+  double gen_ir_time;           /* Gen IR emission by the llvm_gen_backend pass */
+  double ir_opt_time;           /* Gen IR optimization passes */
+  double selection_time;        /* Instruction selection */
+  double schedule_time;         /* Pre and post allocation scheduling */
+  double reg_alloc_time;        /* Register allocation */
+  double encode_time;           /* Encoding and branch patching */
+  double codegen_time;          /* Wall clock time of the Gen code generation */
+  double total_time;            /* Whole build */
+} gbe_program_compile_stats;
+
+/*! Get the compile statistics of the program (zero for a program loaded from
+ *  a binary or the binary cache)
+ */
+typedef void (gbe_program_get_compile_stats_cb)(gbe_program, gbe_program_compile_stats *stats);
+extern gbe_program_get_compile_stats_cb *gbe_program_get_compile_stats;
+
 /*! Create a new program from the given source code and compile it (zero terminated string) */
 typedef gbe_program (gbe_program_compile_from_source_cb)(uint32_t deviceID,
                                                          const char *source,
@@ -231,6 +258,20 @@ typedef void gbe_program_build_from_llvm_cb(gbe_program program,
                                       const char *          options);
 extern gbe_program_build_from_llvm_cb *gbe_program_build_from_llvm;
 
+/*! Compile again the given kernel of a program built from LLVM with some of
+ *  its scalar arguments replaced by constants. arg_value holds the raw bits of
+ *  each argument, zero extended. The returned program only contains the
+ *  specialized kernel. NULL if the program has no LLVM module anymore or if an
+ *  argument cannot be folded
+ */
+typedef gbe_program (gbe_program_new_specialized_cb)(gbe_program program,
+                                                     const char *kernel_name,
+                                                     uint32_t arg_num,
+                                                     const uint32_t *arg_index,
+                                                     const uint64_t *arg_value,
+                                                     int optLevel);
+extern gbe_program_new_specialized_cb *gbe_program_new_specialized;
+
 /*! Get the size of global constants */
 typedef size_t (gbe_program_get_global_constant_size_cb)(gbe_program gbeProgram);
 extern gbe_program_get_global_constant_size_cb *gbe_program_get_global_constant_size;
@@ -337,6 +378,39 @@ extern gbe_kernel_get_curbe_offset_cb *gbe_kernel_get_curbe_offset;
 typedef uint32_t (gbe_kernel_get_required_work_group_size_cb)(gbe_kernel, uint32_t dim);
 extern gbe_kernel_get_required_work_group_size_cb *gbe_kernel_get_required_work_group_size;
 
+/*! What the compiler did for one kernel. Times are in milliseconds and only
+ *  cover the code generation attempt which succeeded, except total_time
+ */
+typedef struct gbe_kernel_compile_stats {
+  uint32_t simd_width;          /* SIMD width finally used */
+  uint32_t attempts;            /* Code generation strategies tried */
+  uint32_t insn_num;            /* Gen instructions */
+  uint32_t compacted_insn_num;  /* Of which are compacted */
+  uint32_t grf_num;             /* GRFs touched by the register allocation */
+  uint32_t spill_num;           /* Scratch writes inserted by the allocator */
+  uint32_t fill_num;            /* Scratch reads inserted by the allocator */
+  uint32_t remat_num;           /* Values recomputed by the allocator */
+  uint32_t scratch_size;        /* Scratch memory per thread in bytes */
+  uint32_t curbe_size;          /* Constant URB size in bytes */
+  uint32_t slm_size;            /* Shared local memory in bytes */
+  uint32_t pressure_scheduled;  /* SIMD16 needed the pre-allocation scheduler */
+  double selection_time;        /* Instruction selection */
+  double schedule_time;         /* Pre and post allocation scheduling */
+  double reg_alloc_time;        /* Register allocation */
+  double encode_time;           /* Encoding and branch patching */
+  double total_time;            /* Whole code generation, all attempts included */
+} gbe_kernel_compile_stats;
+
+/*! Get the compile statistics of the kernel (zero if not known) */
+typedef void (gbe_kernel_get_compile_stats_cb)(gbe_kernel, gbe_kernel_compile_stats *stats);
+extern gbe_kernel_get_compile_stats_cb *gbe_kernel_get_compile_stats;
+
+/*! Write the compile statistics as a JSON object into buf (if big enough).
+ *  Return the size needed including the terminating zero
+ */
+typedef size_t (gbe_kernel_get_compile_stats_json_cb)(gbe_kernel, char *buf, size_t size);
+extern gbe_kernel_get_compile_stats_json_cb *gbe_kernel_get_compile_stats_json;
+
 /*! Says if SLM is used. Required to reconfigure the L3 complex */
 typedef int32_t (gbe_kernel_use_slm_cb)(gbe_kernel);
 extern gbe_kernel_use_slm_cb *gbe_kernel_use_slm;
@@ -344,7 +418,8 @@ extern gbe_kernel_use_slm_cb *gbe_kernel_use_slm;
 typedef int32_t (gbe_kernel_get_slm_size_cb)(gbe_kernel);
 extern gbe_kernel_get_slm_size_cb *gbe_kernel_get_slm_size;
 
-/*mutex to lock global llvmcontext access.*/
+/*mutex to lock global llvmcontext access. Programs built from source use
+  their own context and only take it when LLVM has no thread support.*/
 extern void acquireLLVMContextLock();
 extern void releaseLLVMContextLock();
 
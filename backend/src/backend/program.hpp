@@ -180,6 +180,15 @@ namespace gbe {
     /*! Get function attributes string. */
     const char* getFunctionAttributes(void) const {return this->functionAttributes.c_str();}
 
+    /*! Record how many code generation attempts and how long it took, once
+     *  the kernel is complete
+     */
+    void setCompileStats(uint32_t attempts, double time, bool pressureScheduled);
+    /*! What the compiler did (the phases are filled by the context) */
+    INLINE const gbe_kernel_compile_stats &getCompileStats(void) const { return this->stats; }
+    /*! The compile statistics as a JSON object */
+    std::string getCompileStatsJSON(void) const;
+
     /*! Get defined image size */
     size_t getImageSize(void) const { return (imageSet == NULL ? 0 : imageSet->getDataSize()); }
     /*! Get defined image value array */
@@ -202,6 +211,8 @@ namespace gbe {
        scratchSize       |
        useSLM            |
        slmSize           |
+       compileWgSize     |
+       compile stats     |
        samplers          |
        images            |
        code_size         |
@@ -233,6 +244,7 @@ namespace gbe {
     ir::PrintfSet *printfSet;  //!< Copy from the corresponding function.
     size_t compileWgSize[3];   //!< required work group size by kernel attribute.
     std::string functionAttributes; //!< function attribute qualifiers combined.
+    gbe_kernel_compile_stats stats; //!< What the compiler did
     GBE_CLASS(Kernel);         //!< Use custom allocators
   };
 
@@ -279,12 +291,21 @@ namespace gbe {
     size_t getGlobalConstantSize(void) const { return constantSet->getDataSize(); }
     /*! Get the content of global constant arrays */
     void getGlobalConstantData(char *mem) const { constantSet->getData(mem); }
+    /*! Where the build went (the front end time is filled by the caller) */
+    INLINE gbe_program_compile_stats &getCompileStats(void) { return this->stats; }
+    INLINE const gbe_program_compile_stats &getCompileStats(void) const { return this->stats; }
 
     static const uint32_t magic_begin = TO_MAGIC('P', 'R', 'O', 'G');
     static const uint32_t magic_end = TO_MAGIC('G', 'O', 'R', 'P');
+    /*! Bump it whenever the layout of the program or of its kernels changes.
+     *  The binaries without version have the constant set flag (0 or 1)
+     *  there, so the versions start at 2
+     */
+    static const uint32_t binary_version = 2;
 
     /* format:
        magic_begin       |
+       binary_version    |
        constantSet_flag  |
        constSet_data     |
        kernel_num        |
@@ -309,6 +330,8 @@ namespace gbe {
     map<std::string, Kernel*> kernels;
     /*! Global (constants) outside any kernel */
     ir::ConstantSet *constantSet;
+    /*! Time spent in each phase of the build (not serialized) */
+    gbe_program_compile_stats stats;
     /*! Use custom allocators */
     GBE_CLASS(Program);
   };
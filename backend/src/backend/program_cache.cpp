@@ -0,0 +1,459 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file program_cache.cpp
+ *
+ * Layout of the cache directory: one "<key>.gbin" file per program, made of
+ * a CacheEntryHeader followed by the Gen binary. Files are written to a
+ * temporary name and renamed, so a reader never sees a partial entry. The
+ * modification time of an entry is refreshed on every hit and is used as the
+ * LRU stamp when the directory grows beyond OCL_BINARY_CACHE_SIZE megabytes.
+ */
+
+#include "backend/program_cache.hpp"
+#include "sys/cvar.hpp"
+#include "src/GBEConfig.h"
+
+#ifdef GBE_COMPILER_AVAILABLE
+#include "llvm/Config/llvm-config.h"
+#endif
+
+#include <atomic>
+#include <algorithm>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <dlfcn.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+namespace gbe
+{
+  SVAR(OCL_BINARY_CACHE_DIR, "");
+  IVAR(OCL_BINARY_CACHE_SIZE, 1, 512, 65536); // in MB
+
+  static std::atomic<uint64_t> cacheHits(0);
+  static std::atomic<uint64_t> cacheMisses(0);
+
+  /*! Bump it whenever the entry or the key layout changes */
+  static const uint32_t cacheVersion = 3;
+  static const char cacheSuffix[] = ".gbin";
+
+  struct CacheEntryHeader {
+    uint32_t magic;     //!< TO_MAGIC('G','B','E','C')
+    uint32_t version;   //!< cacheVersion
+    uint64_t size;      //!< Size of the binary following the header
+    uint64_t checksum;  //!< Hash of the binary, to detect torn or damaged files
+    char key[32];       //!< Copy of the key the entry was stored under
+  };
+  static const uint32_t cacheMagic = TO_MAGIC('G', 'B', 'E', 'C');
+
+  /*! Two independent 64-bit FNV-1a lanes with a final avalanche: cheap and
+   *  wide enough to make collisions between sources a non-issue
+   */
+  class CacheHasher
+  {
+  public:
+    CacheHasher(void) : h0(0xcbf29ce484222325ULL), h1(0x84222325cbf29ce4ULL) {}
+    void update(const void *data, size_t size) {
+      const uint8_t *p = (const uint8_t *) data;
+      for (size_t i = 0; i < size; ++i) {
+        h0 = (h0 ^ p[i]) * 0x100000001b3ULL;
+        h1 = (h1 ^ p[i]) * 0x1000193000001b3ULL;
+      }
+      // Separate the fields so that ("ab","c") and ("a","bc") differ
+      h0 = (h0 ^ size) * 0x100000001b3ULL;
+      h1 = (h1 ^ ~size) * 0x1000193000001b3ULL;
+    }
+    void update(const std::string &str) { update(str.c_str(), str.size()); }
+    uint64_t lane0(void) const { return mix(h0); }
+    uint64_t lane1(void) const { return mix(h1); }
+  private:
+    static uint64_t mix(uint64_t h) {
+      h ^= h >> 33; h *= 0xff51afd7ed558ccdULL;
+      h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ULL;
+      h ^= h >> 33;
+      return h;
+    }
+    uint64_t h0, h1;
+  };
+
+  static uint64_t checksum(const char *data, size_t size) {
+    CacheHasher hasher;
+    hasher.update(data, size);
+    return hasher.lane0();
+  }
+
+  /*! Identify the libgbe binary itself: a rebuilt library may generate
+   *  different code even if its version number did not change
+   */
+  static void hashLibraryIdentity(CacheHasher &hasher) {
+    Dl_info info;
+    struct stat st;
+    const uint32_t versions[] = {
+      LIBGBE_VERSION_MAJOR, LIBGBE_VERSION_MINOR,
+#ifdef GBE_COMPILER_AVAILABLE
+      LLVM_VERSION_MAJOR, LLVM_VERSION_MINOR,
+#endif
+    };
+    hasher.update(versions, sizeof(versions));
+    if (dladdr((void *) &hashLibraryIdentity, &info) && info.dli_fname &&
+        stat(info.dli_fname, &st) == 0) {
+      const uint64_t identity[2] = {uint64_t(st.st_size), uint64_t(st.st_mtime)};
+      hasher.update(identity, sizeof(identity));
+    }
+  }
+
+  /*! Environment variables which change the generated code: the front end
+   *  settings and every code generation knob of the back end
+   */
+  static void hashEnvironment(CacheHasher &hasher) {
+    static const char *vars[] = {
+      "OCL_STRICT_CONFORMANCE",
+      "OCL_PCH_PATH",
+      "OCL_HEADER_FILE_DIR",
+      "OCL_BITCODE_LIB_PATH",
+      "OCL_SIMD_WIDTH",
+      "OCL_SIMD16_SPILL_THRESHOLD",
+      "OCL_SIMD16_PRESSURE_LIMIT",
+      "OCL_REG_ALLOCATOR",
+      "OCL_PRE_ALLOC_INSN_SCHEDULE",
+      "OCL_POST_ALLOC_INSN_SCHEDULE",
+      "OCL_OPTIMIZE_IMMEDIATE",
+      "OCL_OPTIMIZE_PHI_MOVES",
+      "OCL_OPTIMIZE_LOADI",
+      "OCL_OPTIMIZE_CONST_FOLD",
+      "OCL_OPTIMIZE_CSE",
+      "OCL_OPTIMIZE_GLOBAL_CSE",
+    };
+    for (uint32_t i = 0; i < ARRAY_ELEM_NUM(vars); ++i) {
+      const char *value = getenv(vars[i]);
+      hasher.update(value ? value : "");
+    }
+  }
+
+  /*! Directories of the -I options, in the order the front end searches them */
+  static std::vector<std::string> includeDirectories(const char *options) {
+    std::vector<std::string> dirs;
+    std::istringstream stream(options ? options : "");
+    std::string option;
+    while (stream >> option) {
+      if (option == "-I") {
+        if (stream >> option) dirs.push_back(option);
+      } else if (option.compare(0, 2, "-I") == 0)
+        dirs.push_back(option.substr(2));
+    }
+    return dirs;
+  }
+
+  static bool readFile(const std::string &path, std::string &contents) {
+    std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+    if (!file) return false;
+    std::ostringstream stream;
+    stream << file.rdbuf();
+    contents = stream.str();
+    return true;
+  }
+
+  /*! Hash the contents of the headers the text includes, recursively, so that
+   *  editing a header misses the entry built with its previous version. The
+   *  directives are found with a plain scan: one in a disabled #if block only
+   *  makes the key stricter. Returns false if a header cannot be found, the
+   *  program is then not cached at all
+   */
+  static bool hashIncludes(CacheHasher &hasher, const std::string &text,
+                           const std::string &textDir,
+                           const std::vector<std::string> &dirs,
+                           std::set<std::string> &visited, uint32_t depth) {
+    if (depth > 32) return false;
+    size_t pos = 0;
+    while ((pos = text.find("include", pos)) != std::string::npos) {
+      const size_t directive = pos;
+      pos += 7;
+      // Only "#  include" at the start of a line is a directive
+      size_t p = directive;
+      while (p > 0 && (text[p-1] == ' ' || text[p-1] == '\t')) --p;
+      if (p == 0 || text[p-1] != '#') continue;
+      --p;
+      while (p > 0 && (text[p-1] == ' ' || text[p-1] == '\t')) --p;
+      if (p != 0 && text[p-1] != '\n') continue;
+
+      size_t q = pos;
+      while (q < text.size() && (text[q] == ' ' || text[q] == '\t')) ++q;
+      if (q == text.size() || (text[q] != '"' && text[q] != '<')) return false;
+      const char close = text[q] == '"' ? '"' : '>';
+      const size_t nameEnd = text.find(close, q + 1);
+      if (nameEnd == std::string::npos) return false;
+      const std::string name = text.substr(q + 1, nameEnd - q - 1);
+
+      // Same search order as the front end: the directory of the including
+      // file first for the quoted names, then the -I directories
+      std::vector<std::string> candidates;
+      if (!name.empty() && name[0] == '/')
+        candidates.push_back(name);
+      else {
+        if (close == '"')
+          candidates.push_back(textDir + "/" + name);
+        for (size_t i = 0; i < dirs.size(); ++i)
+          candidates.push_back(dirs[i] + "/" + name);
+      }
+      bool found = false;
+      for (size_t i = 0; i < candidates.size() && !found; ++i) {
+        std::string contents;
+        if (!readFile(candidates[i], contents))
+          continue;
+        found = true;
+        hasher.update(name);
+        hasher.update(contents);
+        if (!visited.insert(candidates[i]).second)
+          continue;
+        const size_t slash = candidates[i].find_last_of('/');
+        const std::string dir = slash == 0 ? "/" : candidates[i].substr(0, slash);
+        if (!hashIncludes(hasher, contents, dir, dirs, visited, depth + 1))
+          return false;
+      }
+      if (!found) return false;
+    }
+    return true;
+  }
+
+  /*! Collapse white spaces so that "-DX  -DY" and "-DX -DY " share an entry */
+  static std::string normalizeOptions(const char *options) {
+    std::string normalized;
+    if (options == NULL) return normalized;
+    const char *p = options;
+    while (*p) {
+      while (*p && isspace(*p)) ++p;
+      const char *start = p;
+      while (*p && !isspace(*p)) ++p;
+      if (p == start) break;
+      if (!normalized.empty()) normalized += ' ';
+      normalized.append(start, p - start);
+    }
+    return normalized;
+  }
+
+  static std::string entryPath(const std::string &key) {
+    return OCL_BINARY_CACHE_DIR + "/" + key + cacheSuffix;
+  }
+
+  /*! mkdir -p */
+  static bool createDirectory(const std::string &dir) {
+    struct stat st;
+    if (stat(dir.c_str(), &st) == 0)
+      return S_ISDIR(st.st_mode);
+    const size_t slash = dir.find_last_of('/');
+    if (slash != std::string::npos && slash != 0)
+      createDirectory(dir.substr(0, slash));
+    return mkdir(dir.c_str(), 0700) == 0 || errno == EEXIST;
+  }
+
+  static bool readAll(int fd, void *data, size_t size) {
+    char *p = (char *) data;
+    while (size) {
+      const ssize_t n = read(fd, p, size);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      p += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  static bool writeAll(int fd, const void *data, size_t size) {
+    const char *p = (const char *) data;
+    while (size) {
+      const ssize_t n = write(fd, p, size);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      p += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  /*! Evict the least recently used entries until we fit in the budget */
+  static void trimCache(void) {
+    struct Entry {
+      std::string path;
+      uint64_t size;
+      time_t stamp;
+      bool operator< (const Entry &other) const { return stamp < other.stamp; }
+    };
+    const uint64_t budget = uint64_t(OCL_BINARY_CACHE_SIZE) << 20;
+    const time_t now = time(NULL);
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+
+    DIR *dir = opendir(OCL_BINARY_CACHE_DIR.c_str());
+    if (dir == NULL) return;
+    while (struct dirent *ent = readdir(dir)) {
+      const std::string name(ent->d_name);
+      const std::string path = OCL_BINARY_CACHE_DIR + "/" + name;
+      struct stat st;
+      if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        continue;
+      // Leftover of a writer that died before its rename
+      if (name.compare(0, 5, ".tmp-") == 0) {
+        if (now - st.st_mtime > 3600) unlink(path.c_str());
+        continue;
+      }
+      const size_t suffixLen = sizeof(cacheSuffix) - 1;
+      if (name.size() <= suffixLen ||
+          name.compare(name.size() - suffixLen, suffixLen, cacheSuffix) != 0)
+        continue;
+      Entry entry = {path, uint64_t(st.st_size), st.st_mtime};
+      entries.push_back(entry);
+      total += entry.size;
+    }
+    closedir(dir);
+
+    if (total <= budget) return;
+    std::sort(entries.begin(), entries.end());
+    for (size_t i = 0; i < entries.size() && total > budget; ++i)
+      if (unlink(entries[i].path.c_str()) == 0)
+        total -= entries[i].size;
+  }
+
+  bool ProgramCache::makeKey(uint32_t deviceID, const char *source,
+                             const char *options, std::string &key)
+  {
+    if (OCL_BINARY_CACHE_DIR.empty() || source == NULL)
+      return false;
+    // Argument info is not part of the Gen binary
+    if (options && strstr(options, "-cl-kernel-arg-info"))
+      return false;
+
+    CacheHasher hasher;
+    const uint32_t version = cacheVersion;
+    hasher.update(&version, sizeof(version));
+    hasher.update(&deviceID, sizeof(deviceID));
+    hashLibraryIdentity(hasher);
+    hashEnvironment(hasher);
+    hasher.update(normalizeOptions(options));
+    hasher.update(source, strlen(source));
+    // The source is compiled from a temporary file of /tmp
+    std::set<std::string> visited;
+    if (!hashIncludes(hasher, source, "/tmp", includeDirectories(options), visited, 0))
+      return false;
+
+    char str[33];
+    snprintf(str, sizeof(str), "%016llx%016llx",
+             (unsigned long long) hasher.lane0(),
+             (unsigned long long) hasher.lane1());
+    key = str;
+    return true;
+  }
+
+  bool ProgramCache::load(const std::string &key, char **binary, size_t *size)
+  {
+    const std::string path = entryPath(key);
+    CacheEntryHeader header;
+    struct stat st;
+    char *data = NULL;
+    bool valid = false;
+
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      cacheMisses++;
+      return false;
+    }
+    if (fstat(fd, &st) == 0 &&
+        uint64_t(st.st_size) >= sizeof(header) &&
+        readAll(fd, &header, sizeof(header)) &&
+        header.magic == cacheMagic &&
+        header.version == cacheVersion &&
+        header.size == uint64_t(st.st_size) - sizeof(header) &&
+        key.compare(0, sizeof(header.key), header.key, sizeof(header.key)) == 0) {
+      data = (char *) malloc(header.size);
+      valid = data != NULL &&
+              readAll(fd, data, header.size) &&
+              checksum(data, header.size) == header.checksum;
+    }
+    close(fd);
+
+    if (!valid) {
+      free(data);
+      unlink(path.c_str()); // damaged: drop it, the next build rewrites it
+      cacheMisses++;
+      return false;
+    }
+
+    utimes(path.c_str(), NULL); // LRU stamp
+    *binary = data;
+    *size = header.size;
+    cacheHits++;
+    return true;
+  }
+
+  void ProgramCache::invalidate(const std::string &key)
+  {
+    unlink(entryPath(key).c_str());
+    cacheHits--;
+    cacheMisses++;
+  }
+
+  void ProgramCache::store(const std::string &key, const char *binary, size_t size)
+  {
+    if (binary == NULL || size == 0) return;
+    if (uint64_t(size) + sizeof(CacheEntryHeader) > (uint64_t(OCL_BINARY_CACHE_SIZE) << 20))
+      return;
+    if (!createDirectory(OCL_BINARY_CACHE_DIR))
+      return;
+
+    CacheEntryHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = cacheMagic;
+    header.version = cacheVersion;
+    header.size = size;
+    header.checksum = checksum(binary, size);
+    memcpy(header.key, key.c_str(), std::min(key.size(), sizeof(header.key)));
+
+    std::string tmpPath = OCL_BINARY_CACHE_DIR + "/.tmp-XXXXXX";
+    std::vector<char> tmpName(tmpPath.begin(), tmpPath.end());
+    tmpName.push_back('\0');
+    const int fd = mkstemp(&tmpName[0]);
+    if (fd < 0) return;
+
+    const bool written = writeAll(fd, &header, sizeof(header)) &&
+                         writeAll(fd, binary, size) &&
+                         fsync(fd) == 0;
+    close(fd);
+    if (!written || rename(&tmpName[0], entryPath(key).c_str()) != 0) {
+      unlink(&tmpName[0]);
+      return;
+    }
+    trimCache();
+  }
+
+  void ProgramCache::getStats(uint64_t *hits, uint64_t *misses)
+  {
+    if (hits) *hits = cacheHits.load();
+    if (misses) *misses = cacheMisses.load();
+  }
+} /* namespace gbe */
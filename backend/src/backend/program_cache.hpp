@@ -0,0 +1,56 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file program_cache.hpp
+ *
+ * Persistent on-disk cache of compiled Gen programs. Entries are keyed by the
+ * OpenCL source, the headers it includes, the normalized build options, the
+ * code generation settings of the environment, the device ID and the libgbe
+ * build, and hold the same Gen binary clGetProgramInfo(CL_PROGRAM_BINARIES)
+ * returns. The cache is only active when OCL_BINARY_CACHE_DIR is set.
+ */
+
+#ifndef __GBE_PROGRAM_CACHE_HPP__
+#define __GBE_PROGRAM_CACHE_HPP__
+
+#include "sys/platform.hpp"
+#include <string>
+
+namespace gbe
+{
+  /*! Look-up / store interface of the binary cache. All the functions are
+   *  thread safe and never fail hard: any I/O problem is reported as a miss
+   */
+  class ProgramCache
+  {
+  public:
+    /*! Compute the key of a program. Returns false if the cache is disabled */
+    static bool makeKey(uint32_t deviceID, const char *source,
+                        const char *options, std::string &key);
+    /*! Read the binary stored under key. The returned buffer is malloc'ed */
+    static bool load(const std::string &key, char **binary, size_t *size);
+    /*! Atomically publish a binary under key and trim the cache if needed */
+    static void store(const std::string &key, const char *binary, size_t size);
+    /*! Drop an entry which was loaded but turned out to be unusable */
+    static void invalidate(const std::string &key);
+    /*! Hit / miss counters since the library was loaded */
+    static void getStats(uint64_t *hits, uint64_t *misses);
+  };
+} /* namespace gbe */
+
+#endif /* __GBE_PROGRAM_CACHE_HPP__ */
@@ -63,6 +63,8 @@ struct BinInterpCallBackInitializer
     gbe_program_get_global_constant_data = gbe::programGetGlobalConstantData;
     gbe_kernel_get_sampler_data = gbe::kernelGetSamplerData;
     gbe_kernel_get_image_data = gbe::kernelGetImageData;
+    gbe_kernel_get_compile_stats = gbe::kernelGetCompileStats;
+    gbe_kernel_get_compile_stats_json = gbe::kernelGetCompileStatsJSON;
     gbe_kernel_get_arg_info = gbe::kernelGetArgInfo;
     gbe_get_printf_num = gbe::kernelGetPrintfNum;
     gbe_get_printf_buf_bti = gbe::kernelGetPrintfBufBTI;
@@ -0,0 +1,317 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*******************************************************************************
+   Compiler throughput benchmark. Every .cl file of a directory is built from
+   source by libgbe for each device, first one program at a time and then by
+   several threads at once. The time spent in each phase of the compiler and
+   the peak resident memory are reported. Only the CPU is used.
+ *******************************************************************************/
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "backend/program.h"
+#include "src/cl_device_data.h"
+
+using namespace std;
+
+struct device_target {
+    const char *name;
+    uint32_t pci_id;
+};
+
+/* One device per generation the backend generates code for */
+static const device_target all_devices[] = {
+    { "IVB", PCI_CHIP_IVYBRIDGE_GT2 },
+    { "HSW", PCI_CHIP_HASWELL_D2 },
+    { "BDW", PCI_CHIP_BROADWLL_D_GT2 },
+    { "SKL", PCI_CHIP_SKYLAKE_DT_GT2 },
+};
+
+struct source_file {
+    string path;
+    string options;
+    string code;
+};
+
+struct run_result {
+    gbe_program_compile_stats stats;
+    uint32_t built_num;
+    uint32_t failed_num;
+    double wall_time;
+    long peak_rss;
+    bool peak_rss_reset;
+};
+
+static double get_time_ms(void)
+{
+    struct timeval tp;
+    gettimeofday(&tp, NULL);
+    return tp.tv_sec * 1000.0 + tp.tv_usec / 1000.0;
+}
+
+/* Reset the peak resident set size of the process (Linux 4.0 and later). When
+   it cannot be reset, the peak of the previous runs leaks into the next one */
+static bool reset_peak_rss(void)
+{
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (fd < 0)
+        return false;
+    const bool done = write(fd, "5", 1) == 1;
+    close(fd);
+    return done;
+}
+
+/* Peak resident set size in KB */
+static long get_peak_rss(void)
+{
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+            return atol(line.c_str() + 6);
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static bool load_sources(const string &dir, vector<source_file> &files)
+{
+    DIR *d = opendir(dir.c_str());
+    if (d == NULL)
+        return false;
+
+    vector<string> names;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        const string name = entry->d_name;
+        if (name.size() > 3 && name.compare(name.size() - 3, 3, ".cl") == 0)
+            names.push_back(name);
+    }
+    closedir(d);
+    sort(names.begin(), names.end());
+
+    for (auto &name : names) {
+        ifstream in((dir + "/" + name).c_str());
+        if (!in)
+            continue;
+        ostringstream code;
+        code << in.rdbuf();
+        source_file file;
+        file.path = dir + "/" + name;
+        // Some kernels include headers of the corpus
+        file.options = "-I" + dir;
+        file.code = code.str();
+        files.push_back(file);
+    }
+    return true;
+}
+
+static void add_stats(gbe_program_compile_stats &sum, const gbe_program_compile_stats &stats)
+{
+    sum.kernel_num += stats.kernel_num;
+    sum.frontend_time += stats.frontend_time;
+    sum.llvm_time += stats.llvm_time;
+    sum.gen_ir_time += stats.gen_ir_time;
+    sum.ir_opt_time += stats.ir_opt_time;
+    sum.selection_time += stats.selection_time;
+    sum.schedule_time += stats.schedule_time;
+    sum.reg_alloc_time += stats.reg_alloc_time;
+    sum.encode_time += stats.encode_time;
+    sum.codegen_time += stats.codegen_time;
+    sum.total_time += stats.total_time;
+}
+
+static run_result run(const vector<source_file> &files, uint32_t pci_id,
+                      uint32_t thread_num, bool verbose)
+{
+    run_result result;
+    memset(&result, 0, sizeof(result));
+    result.peak_rss_reset = reset_peak_rss();
+
+    vector<gbe_program_compile_stats> stats(thread_num);
+    vector<uint32_t> built(thread_num, 0), failed(thread_num, 0);
+    memset(&stats[0], 0, sizeof(stats[0]) * thread_num);
+    atomic<uint32_t> next(0);
+
+    auto build = [&](uint32_t id) {
+        char err[4096];
+        for (uint32_t i = next++; i < files.size(); i = next++) {
+            size_t err_size = 0;
+            gbe_program p = gbe_program_new_from_source(pci_id, files[i].code.c_str(),
+                                                        sizeof(err), files[i].options.c_str(),
+                                                        err, &err_size);
+            if (p == NULL) {
+                failed[id]++;
+                if (verbose)
+                    cerr << files[i].path << " failed to build:\n"
+                         << string(err, err_size) << endl;
+                continue;
+            }
+            gbe_program_compile_stats program_stats;
+            gbe_program_get_compile_stats(p, &program_stats);
+            add_stats(stats[id], program_stats);
+            built[id]++;
+            gbe_program_delete(p);
+        }
+    };
+
+    const double start = get_time_ms();
+    vector<thread> workers;
+    for (uint32_t id = 1; id < thread_num; ++id)
+        workers.push_back(thread(build, id));
+    build(0);
+    for (auto &worker : workers)
+        worker.join();
+    result.wall_time = get_time_ms() - start;
+    result.peak_rss = get_peak_rss();
+
+    for (uint32_t id = 0; id < thread_num; ++id) {
+        add_stats(result.stats, stats[id]);
+        result.built_num += built[id];
+        result.failed_num += failed[id];
+    }
+    return result;
+}
+
+static void report(const device_target &device, uint32_t thread_num, const run_result &r)
+{
+    const gbe_program_compile_stats &s = r.stats;
+    cout << fixed << setprecision(1)
+         << device.name << " (0x" << hex << device.pci_id << dec << "), "
+         << thread_num << " thread(s): " << r.built_num << " program(s), "
+         << s.kernel_num << " kernel(s) in " << r.wall_time << " ms, "
+         << (r.wall_time > 0 ? r.built_num * 1000.0 / r.wall_time : 0.0) << " program(s)/s, "
+         << "peak RSS " << r.peak_rss / 1024.0 << " MB"
+         << (r.peak_rss_reset ? "" : " (process peak)") << endl;
+    if (r.failed_num)
+        cout << "  " << r.failed_num << " file(s) failed to build and are ignored" << endl;
+    cout << "  clang " << s.frontend_time << " ms, LLVM passes " << s.llvm_time
+         << " ms, Gen IR emission " << s.gen_ir_time << " ms, Gen IR optimization "
+         << s.ir_opt_time << " ms" << endl
+         << "  selection " << s.selection_time << " ms, scheduling " << s.schedule_time
+         << " ms, register allocation " << s.reg_alloc_time << " ms, encoding "
+         << s.encode_time << " ms, code generation " << s.codegen_time << " ms" << endl;
+
+    cout << setprecision(3)
+         << "  [CompileStats] {\"device\":\"" << device.name << "\",\"pci_id\":" << device.pci_id
+         << ",\"threads\":" << thread_num << ",\"programs\":" << r.built_num
+         << ",\"failed\":" << r.failed_num << ",\"kernels\":" << s.kernel_num
+         << ",\"wall_ms\":" << r.wall_time << ",\"frontend_ms\":" << s.frontend_time
+         << ",\"llvm_ms\":" << s.llvm_time << ",\"gen_ir_ms\":" << s.gen_ir_time
+         << ",\"ir_opt_ms\":" << s.ir_opt_time << ",\"selection_ms\":" << s.selection_time
+         << ",\"schedule_ms\":" << s.schedule_time << ",\"reg_alloc_ms\":" << s.reg_alloc_time
+         << ",\"encode_ms\":" << s.encode_time << ",\"codegen_ms\":" << s.codegen_time
+         << ",\"total_ms\":" << s.total_time << ",\"peak_rss_kb\":" << r.peak_rss
+         << ",\"peak_rss_reset\":" << (r.peak_rss_reset ? "true" : "false") << "}" << endl;
+}
+
+static void usage(const char *name)
+{
+    cout << "Usage: " << name << " [-t gen_pci_id]... [-j thread_num] [-r repeat] [-v] kernel_dir" << endl
+         << "  -t  device to compile for, may be repeated (default: IVB, HSW, BDW and SKL)" << endl
+         << "  -j  threads of the multi-threaded run (default: the CPU count, 1 skips it)" << endl
+         << "  -r  times the corpus is compiled per run (default: 1)" << endl
+         << "  -v  print the build errors" << endl;
+}
+
+int main(int argc, char **argv)
+{
+    vector<device_target> devices;
+    uint32_t thread_num = max(thread::hardware_concurrency(), 1u);
+    uint32_t repeat = 1;
+    bool verbose = false;
+    int oc;
+
+    while ((oc = getopt(argc, argv, "t:j:r:vh")) != -1) {
+        switch (oc) {
+        case 't':
+        {
+            const device_target device = { "custom", (uint32_t)strtoul(optarg, NULL, 16) };
+            devices.push_back(device);
+            for (auto &known : all_devices)
+                if (known.pci_id == device.pci_id)
+                    devices.back().name = known.name;
+            break;
+        }
+        case 'j':
+            thread_num = max(atoi(optarg), 1);
+            break;
+        case 'r':
+            repeat = max(atoi(optarg), 1);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (devices.empty())
+        devices.assign(all_devices, all_devices + sizeof(all_devices) / sizeof(all_devices[0]));
+
+    if (gbe_program_new_from_source == NULL || gbe_program_get_compile_stats == NULL) {
+        cout << "libgbe was built without the compiler" << endl;
+        return 1;
+    }
+
+    vector<source_file> corpus, files;
+    if (!load_sources(argv[optind], corpus) || corpus.empty()) {
+        cout << "no .cl file found in " << argv[optind] << endl;
+        return 1;
+    }
+    for (uint32_t i = 0; i < repeat; ++i)
+        files.insert(files.end(), corpus.begin(), corpus.end());
+
+    if (getenv("OCL_BINARY_CACHE_DIR"))
+        cout << "OCL_BINARY_CACHE_DIR is set: cached programs are not compiled" << endl;
+    const char *kernel_threads = getenv("OCL_KERNEL_COMPILE_THREADS");
+    cout << corpus.size() << " file(s) from " << argv[optind] << ", compiled "
+         << repeat << " time(s) per run, kernels of a program compiled by "
+         << (kernel_threads ? kernel_threads : "all the CPUs")
+         << " thread(s) (OCL_KERNEL_COMPILE_THREADS)" << endl;
+
+    for (auto &device : devices) {
+        report(device, 1, run(files, device.pci_id, 1, verbose));
+        if (thread_num > 1)
+            report(device, thread_num, run(files, device.pci_id, thread_num, verbose));
+    }
+    return 0;
+}
@@ -466,7 +466,7 @@ namespace ir {
     INLINE void pushStackSize(uint32_t step) { this->stackSize += step; }
     /*! add the loop info for later liveness analysis */
     void addLoop(const vector<LabelIndex> &bbs, const vector<std::pair<LabelIndex, LabelIndex>> &exits);
-    INLINE const vector<Loop * > &getLoops() { return loops; }
+    INLINE const vector<Loop * > &getLoops() const { return loops; }
     vector<BasicBlock *> &getBlocks() { return blocks; }
     /*! Get surface starting address register from bti */
     Register getSurfaceBaseReg(uint8_t bti) const;
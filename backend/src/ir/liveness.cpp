@@ -25,9 +25,11 @@
 #include <sstream>
 
 namespace gbe {
+  extern int32_t OCL_OUTPUT_UNIFORM_STATS;
 namespace ir {
 
-  Liveness::Liveness(Function &fn) : fn(fn) {
+  Liveness::Liveness(Function &fn) :
+    fn(fn), uniformNum(0), legacyUniformNum(0) {
     // Initialize UEVar and VarKill for each block
     fn.foreachBlock([this](const BasicBlock &bb) {
       this->initBlock(bb);
@@ -50,9 +52,10 @@ namespace ir {
     set<Register> extentRegs;
     this->computeExtraLiveInOut(extentRegs);
     // analyze uniform values. The extentRegs contains all the values which is
-    // defined in a loop and use out-of-loop which could not be a uniform. The reason
-    // is that when it reenter the second time, it may active different lanes. So
-    // reenter many times may cause it has different values in different lanes.
+    // defined in a loop and use out-of-loop which could not be a uniform if the
+    // loop is divergent. The reason is that when it reenter the second time, it
+    // may active different lanes. So reenter many times may cause it has
+    // different values in different lanes.
     this->analyzeUniform(&extentRegs);
   }
 
@@ -60,38 +63,225 @@ namespace ir {
     for (auto &pair : liveness) GBE_SAFE_DELETE(pair.second);
   }
 
+  /*! Immediate post-dominator of each block, from the iterative algorithm of
+   *  Cooper, Harvey and Kennedy ("A Simple, Fast Dominance Algorithm") run on
+   *  the reversed CFG. blockNum stands for a virtual exit following the
+   *  blocks with no successor. The blocks which never reach it get -1
+   */
+  static void computePostDominators(const vector<const BasicBlock*> &blocks,
+                                    const map<const BasicBlock*, uint32_t> &index,
+                                    vector<int32_t> &ipdom)
+  {
+    const int32_t blockNum = blocks.size(), exit = blockNum;
+    vector<vector<int32_t>> succs(blockNum), preds(blockNum + 1);
+    for (int32_t b = 0; b < blockNum; ++b) {
+      for (auto succ : blocks[b]->getSuccessorSet()) {
+        const int32_t s = index.find(succ)->second;
+        succs[b].push_back(s);
+        preds[s].push_back(b);
+      }
+      if (succs[b].size() == 0) {
+        succs[b].push_back(exit);
+        preds[exit].push_back(b);
+      }
+    }
+
+    // Post order of the reversed CFG from the virtual exit
+    vector<int32_t> order, number(blockNum + 1, -1);
+    vector<std::pair<int32_t, uint32_t>> stack;
+    vector<uint8_t> visited(blockNum + 1, 0);
+    stack.push_back(std::make_pair(exit, 0u));
+    visited[exit] = 1;
+    while (stack.size() != 0) {
+      const int32_t b = stack.back().first;
+      const uint32_t predID = stack.back().second;
+      if (predID < preds[b].size()) {
+        const int32_t pred = preds[b][predID];
+        stack.back().second++;
+        if (!visited[pred]) {
+          visited[pred] = 1;
+          stack.push_back(std::make_pair(pred, 0u));
+        }
+      } else {
+        number[b] = order.size();
+        order.push_back(b);
+        stack.pop_back();
+      }
+    }
+
+    // Walk up from both blocks to their closest common post-dominator
+    auto intersect = [&](int32_t a, int32_t b) {
+      while (a != b) {
+        while (number[a] < number[b]) a = ipdom[a];
+        while (number[b] < number[a]) b = ipdom[b];
+      }
+      return a;
+    };
+    ipdom.assign(blockNum + 1, -1);
+    ipdom[exit] = exit;
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      // Reverse post order, the exit being last in post order
+      for (int32_t i = int32_t(order.size()) - 2; i >= 0; --i) {
+        const int32_t b = order[i];
+        int32_t curr = -1;
+        for (auto s : succs[b]) {
+          if (ipdom[s] == -1) continue;
+          curr = curr == -1 ? s : intersect(s, curr);
+        }
+        if (curr != ipdom[b]) {
+          ipdom[b] = curr;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  /*! A block is divergent when it may run with only a part of the lanes of
+   *  the thread active. This is the case of the blocks reachable from a
+   *  branch on a varying predicate before the control flow reconverges at
+   *  the immediate post-dominator of the branch: every path from the branch
+   *  reaches it before any other post-dominator
+   */
+  static void computeDivergentBlocks(const vector<const BasicBlock*> &blocks,
+                                     const map<const BasicBlock*, uint32_t> &index,
+                                     const vector<int32_t> &ipdom,
+                                     const set<Register> &varying,
+                                     set<const BasicBlock*> &divergentBlocks)
+  {
+    divergentBlocks.clear();
+    for (uint32_t b = 0; b < blocks.size(); ++b) {
+      const Instruction *last = blocks[b]->getLastInstruction();
+      if (last == NULL || !last->isMemberOf<BranchInstruction>())
+        continue;
+      if (last->getSrcNum() == 0 || !varying.contains(last->getSrc(0)))
+        continue;
+      vector<const BasicBlock*> workList;
+      for (auto succ : blocks[b]->getSuccessorSet())
+        workList.push_back(succ);
+      while (workList.size() != 0) {
+        const BasicBlock *bb = workList.back();
+        workList.pop_back();
+        const int32_t id = index.find(bb)->second;
+        if (id == ipdom[b] || divergentBlocks.contains(bb))
+          continue;
+        divergentBlocks.insert(bb);
+        for (auto succ : bb->getSuccessorSet())
+          workList.push_back(succ);
+      }
+    }
+  }
+
   void Liveness::analyzeUniform(set<Register> *extentRegs) {
-    fn.foreachBlock([this, extentRegs](const BasicBlock &bb) {
-      const_cast<BasicBlock&>(bb).foreach([this, extentRegs](const Instruction &insn) {
-        const uint32_t srcNum = insn.getSrcNum();
-        const uint32_t dstNum = insn.getDstNum();
+    // Gather the definitions of each register. A register with no definition
+    // is an input: the arguments and the special registers are already marked
+    // uniform or not (the local IDs or the stack pointer are not)
+    map<Register, vector<const Instruction*>> defs;
+    fn.foreachInstruction([&defs](const Instruction &insn) {
+      for (uint32_t dstID = 0; dstID < insn.getDstNum(); ++dstID)
+        defs[insn.getDst(dstID)].push_back(&insn);
+    });
+    set<Register> varying;
+    for (uint32_t regID = 0; regID < fn.regNum(); ++regID) {
+      const Register reg(regID);
+      if (!defs.contains(reg) && !fn.isUniformRegister(reg))
+        varying.insert(reg);
+    }
+
+    // What the former single forward pass found, only computed to be reported
+    if (OCL_OUTPUT_UNIFORM_STATS) {
+      set<Register> legacy;
+      fn.foreachInstruction([&](const Instruction &insn) {
         bool uniform = true;
-        for (uint32_t srcID = 0; srcID < srcNum; ++srcID) {
+        for (uint32_t srcID = 0; srcID < insn.getSrcNum(); ++srcID) {
           const Register reg = insn.getSrc(srcID);
-          if (!fn.isUniformRegister(reg))
+          if (!legacy.contains(reg) && (defs.contains(reg) || !fn.isUniformRegister(reg)))
             uniform = false;
         }
-        // A destination is a killed value
-        for (uint32_t dstID = 0; dstID < dstNum; ++dstID) {
+        const Opcode opcode = insn.getOpcode();
+        for (uint32_t dstID = 0; dstID < insn.getDstNum(); ++dstID) {
           const Register reg = insn.getDst(dstID);
-          int opCode = insn.getOpcode();
-          // FIXME, ADDSAT and uniform vector should be supported.
           if (uniform &&
-              fn.getRegisterFamily(reg) != ir::FAMILY_QWORD &&
+              fn.getRegisterFamily(reg) != FAMILY_QWORD &&
               !insn.getParent()->definedPhiRegs.contains(reg) &&
-              opCode != ir::OP_ATOMIC &&
-              opCode != ir::OP_MUL_HI &&
-              opCode != ir::OP_HADD &&
-              opCode != ir::OP_RHADD &&
-              opCode != ir::OP_READ_ARF &&
-              opCode != ir::OP_ADDSAT &&
-              (dstNum == 1 || insn.getOpcode() != ir::OP_LOAD) &&
-              !extentRegs->contains(reg)
-             )
-            fn.setRegisterUniform(reg, true);
+              opcode != OP_ATOMIC && opcode != OP_MUL_HI &&
+              opcode != OP_HADD && opcode != OP_RHADD &&
+              opcode != OP_READ_ARF && opcode != OP_ADDSAT &&
+              (insn.getDstNum() == 1 || opcode != OP_LOAD) &&
+              !extentRegs->contains(reg))
+            legacy.insert(reg);
         }
       });
+      legacyUniformNum = legacy.size();
+    }
+
+    vector<const BasicBlock*> blocks;
+    map<const BasicBlock*, uint32_t> index;
+    fn.foreachBlock([&](const BasicBlock &bb) {
+      index[&bb] = blocks.size();
+      blocks.push_back(&bb);
     });
+    vector<int32_t> ipdom;
+    computePostDominators(blocks, index, ipdom);
+
+    // Everything written starts uniform and we propagate the varying values
+    // through the data and the divergent control flow until nothing changes.
+    // The registers already marked uniform stay so
+    set<const BasicBlock*> divergentBlocks;
+    size_t varyingNum;
+    do {
+      varyingNum = varying.size();
+      computeDivergentBlocks(blocks, index, ipdom, varying, divergentBlocks);
+      bool changed = true;
+      while (changed) {
+        changed = false;
+        fn.foreachInstruction([&](const Instruction &insn) {
+          const Opcode opcode = insn.getOpcode();
+          bool uniform = opcode != OP_ATOMIC && opcode != OP_READ_ARF;
+          for (uint32_t srcID = 0; uniform && srcID < insn.getSrcNum(); ++srcID)
+            if (varying.contains(insn.getSrc(srcID)))
+              uniform = false;
+          for (uint32_t dstID = 0; dstID < insn.getDstNum(); ++dstID) {
+            const Register reg = insn.getDst(dstID);
+            if (varying.contains(reg) || fn.isUniformRegister(reg))
+              continue;
+            // The instruction selection has no scalar form for these ones:
+            // the 64-bit emulation sequences, the MUL_HI/HADD/RHADD sequences
+            // which work on 8 lanes at a time, and the vector loads whose
+            // messages write whole SIMD registers
+            bool isUniform = uniform &&
+              fn.getRegisterFamily(reg) != FAMILY_QWORD &&
+              opcode != OP_MUL_HI && opcode != OP_HADD && opcode != OP_RHADD &&
+              (insn.getDstNum() == 1 || opcode != OP_LOAD);
+            // A phi value merges several definitions. When one of them is
+            // under divergent control, the lanes may have taken different ones
+            const vector<const Instruction*> &regDefs = defs.find(reg)->second;
+            const bool isPhi = regDefs.size() > 1 ||
+                               insn.getParent()->definedPhiRegs.contains(reg);
+            // A value defined in a loop and used out of it may come from
+            // different iterations when the lanes leave the loop at different
+            // times
+            if (isUniform && (isPhi || extentRegs->contains(reg)))
+              for (auto def : regDefs)
+                if (divergentBlocks.contains(def->getParent()))
+                  isUniform = false;
+            if (!isUniform) {
+              varying.insert(reg);
+              changed = true;
+            }
+          }
+        });
+      }
+    } while (varying.size() != varyingNum);
+
+    uniformNum = 0;
+    for (auto &pair : defs) {
+      const Register reg = pair.first;
+      if (varying.contains(reg)) continue;
+      fn.setRegisterUniform(reg, true);
+      uniformNum++;
+    }
   }
 
   void Liveness::initBlock(const BasicBlock &bb) {
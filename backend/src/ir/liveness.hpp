@@ -96,6 +96,11 @@ namespace ir {
 
     /*! Return the function the liveness was computed on */
     INLINE const Function &getFunction(void) const { return fn; }
+    /*! Number of written registers found uniform */
+    INLINE uint32_t getUniformNum(void) const { return uniformNum; }
+    /*! Number of them the former single forward pass would have found, only
+     *  computed with OCL_OUTPUT_UNIFORM_STATS */
+    INLINE uint32_t getLegacyUniformNum(void) const { return legacyUniformNum; }
     /*! Actually do something for each successor / predecessor of *all* blocks */
     template <DataFlowDirection dir, typename T>
     void foreach(const T &functor) {
@@ -128,7 +133,11 @@ namespace ir {
     /*! Now really compute LiveOut based on UEVar and VarKill */
     void computeLiveInOut(void);
     void computeExtraLiveInOut(set<Register> &extentRegs);
+    /*! Divergence analysis marking the registers equal in all the lanes */
     void analyzeUniform(set<Register> *extentRegs);
+    /*! Uniform register counts of the last analysis */
+    uint32_t uniformNum;
+    uint32_t legacyUniformNum;
     /*! Set of work list block which has exit(return) instruction */
     typedef set <struct BlockInfo*> WorkSet;
     WorkSet workSet;
@@ -0,0 +1,446 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * \file optimization.cpp
+ */
+
+#include "ir/optimization.hpp"
+#include "ir/unit.hpp"
+#include "ir/function.hpp"
+#include "ir/instruction.hpp"
+#include "ir/immediate.hpp"
+#include "sys/cvar.hpp"
+#include "sys/map.hpp"
+#include "sys/set.hpp"
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+
+namespace gbe {
+namespace ir {
+
+  BVAR(OCL_OUTPUT_IR_PASS_STATS, false);
+  BVAR(OCL_OPTIMIZE_CONST_FOLD, true);
+  BVAR(OCL_OPTIMIZE_CSE, true);
+  BVAR(OCL_OPTIMIZE_GLOBAL_CSE, true);
+
+  /*! Definitions and uses of all the registers of a function. The passes keep
+   *  it up to date when they rewrite or remove instructions
+   */
+  class RegisterUses : public NonCopyable
+  {
+  public:
+    RegisterUses(Function &fn) :
+      fn(fn), defs(fn.regNum()), uses(fn.regNum())
+    {
+      fn.foreachInstruction([this](Instruction &insn) { this->add(&insn); });
+      // Registers merged by the phi lowering are handled with care by the
+      // liveness: we leave them alone
+      fn.foreachBlock([this](const BasicBlock &bb) {
+        for (auto reg : bb.definedPhiRegs) phiRegs.insert(reg);
+        for (auto reg : bb.undefPhiRegs) phiRegs.insert(reg);
+      });
+      for (uint32_t outputID = 0; outputID < fn.outputNum(); ++outputID)
+        outputs.insert(fn.getOutput(outputID));
+    }
+    /*! Number of instructions writing the register */
+    INLINE uint32_t getDefNum(Register reg) const { return defs[reg].size(); }
+    /*! A register written once we are free to rename or to delete. The special
+     *  registers and the outputs are read by the code generator directly
+     */
+    INLINE bool isPlain(Register reg) const {
+      return !fn.isSpecialReg(reg) && !outputs.contains(reg) && !phiRegs.contains(reg);
+    }
+    /*! The register always holds the same value where it is read: it is
+     *  either an input or written once
+     */
+    INLINE bool isStable(Register reg) const {
+      return defs[reg].size() <= 1 && !phiRegs.contains(reg);
+    }
+    /*! The LOADI giving the value of the register if it is a constant */
+    INLINE const LoadImmInstruction *getConstant(Register reg) const {
+      if (defs[reg].size() != 1 || phiRegs.contains(reg))
+        return NULL;
+      const Instruction *insn = defs[reg][0];
+      if (insn->getOpcode() != OP_LOADI)
+        return NULL;
+      return &cast<LoadImmInstruction>(*insn);
+    }
+    /*! Record a new instruction */
+    void add(Instruction *insn) {
+      for (uint32_t srcID = 0; srcID < insn->getSrcNum(); ++srcID)
+        uses[insn->getSrc(srcID)].push_back(insn);
+      for (uint32_t dstID = 0; dstID < insn->getDstNum(); ++dstID)
+        defs[insn->getDst(dstID)].push_back(insn);
+    }
+    /*! Remove the instruction from the function */
+    void remove(Instruction *insn) {
+      for (uint32_t srcID = 0; srcID < insn->getSrcNum(); ++srcID) {
+        vector<Instruction*> &regUses = uses[insn->getSrc(srcID)];
+        regUses.erase(std::remove(regUses.begin(), regUses.end(), insn), regUses.end());
+      }
+      for (uint32_t dstID = 0; dstID < insn->getDstNum(); ++dstID) {
+        vector<Instruction*> &regDefs = defs[insn->getDst(dstID)];
+        regDefs.erase(std::remove(regDefs.begin(), regDefs.end(), insn), regDefs.end());
+      }
+      insn->remove();
+    }
+    /*! Read "to" everywhere "from" was read */
+    void replaceUses(Register from, Register to) {
+      for (auto insn : uses[from]) {
+        for (uint32_t srcID = 0; srcID < insn->getSrcNum(); ++srcID)
+          if (insn->getSrc(srcID) == from)
+            insn->setSrc(srcID, to);
+        if (std::find(uses[to].begin(), uses[to].end(), insn) == uses[to].end())
+          uses[to].push_back(insn);
+      }
+      uses[from].clear();
+    }
+  private:
+    Function &fn;
+    vector<vector<Instruction*>> defs;
+    vector<vector<Instruction*>> uses;
+    set<Register> phiRegs;
+    set<Register> outputs;
+  };
+
+  /*! Two registers can stand for each other when they are allocated the same
+   *  way. Booleans live in the flags, so we do not extend their live ranges.
+   *  The liveness built by GenWriter already ran the divergence analysis
+   *  when the passes run, and the later ones never unmark a register: the
+   *  uniform ones, computed as scalars without mask, stay valid in divergent
+   *  blocks, and only stand for other uniform ones
+   */
+  static bool areInterchangeable(const Function &fn, Register a, Register b) {
+    Function &mutableFn = const_cast<Function&>(fn);
+    return fn.getRegisterFamily(a) == fn.getRegisterFamily(b) &&
+           fn.getRegisterFamily(a) != FAMILY_BOOL &&
+           mutableFn.isUniformRegister(a) == mutableFn.isUniformRegister(b);
+  }
+
+  /*! Replace the integer arithmetic on constants by a LOADI of the result */
+  class ConstantFolding : public FunctionPass
+  {
+  public:
+    ConstantFolding(void) : FunctionPass("constant folding") {}
+    virtual uint32_t run(Function &fn);
+  private:
+    /*! Immediate operation implementing the opcode for the given type */
+    static bool getImmOpCode(Opcode opcode, Type type, ImmOpCode &op);
+  };
+
+  bool ConstantFolding::getImmOpCode(Opcode opcode, Type type, ImmOpCode &op) {
+    const bool isSigned = type == TYPE_S32 || type == TYPE_S64;
+    switch (opcode) {
+      case OP_ADD: op = IMM_ADD; return true;
+      case OP_SUB: op = IMM_SUB; return true;
+      case OP_MUL: op = IMM_MUL; return true;
+      case OP_AND: op = IMM_AND; return true;
+      case OP_OR:  op = IMM_OR;  return true;
+      case OP_XOR: op = IMM_XOR; return true;
+      case OP_SHL: op = IMM_SHL; return true;
+      case OP_SHR: op = IMM_LSHR; return !isSigned;
+      case OP_ASR: op = IMM_ASHR; return isSigned;
+      default: return false;
+    }
+  }
+
+  uint32_t ConstantFolding::run(Function &fn) {
+    RegisterUses regUses(fn);
+    uint32_t foldNum = 0;
+    fn.foreachInstruction([&](Instruction &insn) {
+      const Opcode opcode = insn.getOpcode();
+      if (!insn.isMemberOf<BinaryInstruction>())
+        return;
+      const Register dst = insn.getDst(0);
+      if (regUses.getDefNum(dst) != 1 || !regUses.isPlain(dst))
+        return;
+      // Only the integer types the immediate arithmetic keeps as they are
+      const Type type = cast<BinaryInstruction>(insn).getType();
+      if (type != TYPE_S32 && type != TYPE_U32 && type != TYPE_S64 && type != TYPE_U64)
+        return;
+      ImmOpCode op;
+      if (!getImmOpCode(opcode, type, op))
+        return;
+      const LoadImmInstruction *loadImm0 = regUses.getConstant(insn.getSrc(0));
+      const LoadImmInstruction *loadImm1 = regUses.getConstant(insn.getSrc(1));
+      if (loadImm0 == NULL || loadImm1 == NULL)
+        return;
+      const Immediate src0 = loadImm0->getImmediate();
+      const Immediate src1 = loadImm1->getImmediate();
+      if (src0.getType() != type || src0.getElemNum() != 1 ||
+          src1.getType() != type || src1.getElemNum() != 1)
+        return;
+      if (opcode == OP_SHL || opcode == OP_SHR || opcode == OP_ASR) {
+        const int64_t shift = src1.getIntegerValue();
+        if (shift < 0 || shift >= int64_t(getFamilySize(getFamily(type)) * 8))
+          return;
+      }
+      const ImmediateIndex index = fn.newImmediate(Immediate(op, src0, src1, type));
+      Instruction *loadImm = NULL;
+      LOADI(type, dst, index).insert(&insn, &loadImm);
+      regUses.remove(&insn);
+      regUses.add(loadImm);
+      foldNum++;
+    });
+    return foldNum;
+  }
+
+  /*! Reuse the value of an identical computation dominating this one. In the
+   *  local mode, only the previous instructions of the block are considered.
+   *  The LLVM translation loads the constants again in each block, so the
+   *  sources loaded with the same immediate count as the same value
+   */
+  class CommonSubexpressionElimination : public FunctionPass
+  {
+  public:
+    CommonSubexpressionElimination(bool global) :
+      FunctionPass(global ? "global cse" : "local cse"), global(global) {}
+    virtual uint32_t run(Function &fn);
+  private:
+    /*! What makes two instructions compute the same value */
+    struct Expression {
+      Opcode opcode;
+      uint32_t type0, type1;
+      vector<uint64_t> srcs; //!< Registers, or constants above 1 << 32
+      bool operator< (const Expression &other) const {
+        if (opcode != other.opcode) return opcode < other.opcode;
+        if (type0 != other.type0) return type0 < other.type0;
+        if (type1 != other.type1) return type1 < other.type1;
+        return srcs < other.srcs;
+      }
+    };
+    /*! Fill the expression if the instruction is a pure computation */
+    bool getExpression(const Instruction &insn, Expression &expr);
+    /*! Process the block and the blocks it dominates */
+    void visit(const BasicBlock *bb);
+    /*! Dominator tree, built for the global mode */
+    map<const BasicBlock*, vector<const BasicBlock*>> children;
+    /*! Expressions available in the blocks being visited */
+    map<Expression, Register> available;
+    /*! Number given to each immediate loaded in the function */
+    map<Immediate, uint32_t> constants;
+    RegisterUses *regUses;
+    Function *fn;
+    uint32_t removedNum;
+    bool global;
+  };
+
+  bool CommonSubexpressionElimination::getExpression(const Instruction &insn, Expression &expr) {
+    const Opcode opcode = insn.getOpcode();
+    expr.opcode = opcode;
+    expr.type0 = expr.type1 = 0;
+    if (opcode == OP_MOV || opcode == OP_SIMD_ANY || opcode == OP_SIMD_ALL)
+      return false;
+    if (insn.isMemberOf<UnaryInstruction>())
+      expr.type0 = cast<UnaryInstruction>(insn).getType();
+    else if (insn.isMemberOf<BinaryInstruction>())
+      expr.type0 = cast<BinaryInstruction>(insn).getType();
+    else if (insn.isMemberOf<TernaryInstruction>())
+      expr.type0 = cast<TernaryInstruction>(insn).getType();
+    else if (insn.isMemberOf<SelectInstruction>())
+      expr.type0 = cast<SelectInstruction>(insn).getType();
+    else if (insn.isMemberOf<CompareInstruction>())
+      expr.type0 = cast<CompareInstruction>(insn).getType();
+    else if (insn.isMemberOf<ConvertInstruction>()) {
+      expr.type0 = cast<ConvertInstruction>(insn).getDstType();
+      expr.type1 = cast<ConvertInstruction>(insn).getSrcType();
+    } else
+      return false;
+    expr.srcs.clear();
+    for (uint32_t srcID = 0; srcID < insn.getSrcNum(); ++srcID) {
+      const Register src = insn.getSrc(srcID);
+      if (!regUses->isStable(src))
+        return false;
+      const LoadImmInstruction *loadImm = regUses->getConstant(src);
+      if (loadImm == NULL || loadImm->getImmediate().getElemNum() != 1) {
+        expr.srcs.push_back(src.value());
+        continue;
+      }
+      auto it = constants.insert(std::make_pair(loadImm->getImmediate(), uint32_t(constants.size())));
+      expr.srcs.push_back((uint64_t(1) << 32) | it.first->second);
+    }
+    if (insn.isMemberOf<BinaryInstruction>() && cast<BinaryInstruction>(insn).commutes())
+      std::sort(expr.srcs.begin(), expr.srcs.end());
+    return true;
+  }
+
+  void CommonSubexpressionElimination::visit(const BasicBlock *bb) {
+    vector<Expression> added;
+    BasicBlock &block = const_cast<BasicBlock&>(*bb);
+    block.foreach([&](Instruction &insn) {
+      Expression expr;
+      if (insn.getDstNum() != 1 || !getExpression(insn, expr))
+        return;
+      const Register dst = insn.getDst(0);
+      if (regUses->getDefNum(dst) != 1 || !regUses->isPlain(dst))
+        return;
+      auto it = available.find(expr);
+      if (it == available.end()) {
+        available.insert(std::make_pair(expr, dst));
+        added.push_back(expr);
+      } else if (areInterchangeable(*fn, dst, it->second)) {
+        regUses->replaceUses(dst, it->second);
+        regUses->remove(&insn);
+        removedNum++;
+      }
+    });
+    if (global) {
+      auto it = children.find(bb);
+      if (it != children.end())
+        for (auto child : it->second)
+          this->visit(child);
+    }
+    for (const auto &expr : added)
+      available.erase(expr);
+  }
+
+  uint32_t CommonSubexpressionElimination::run(Function &fn) {
+    RegisterUses uses(fn);
+    this->regUses = &uses;
+    this->fn = &fn;
+    this->removedNum = 0;
+    this->constants.clear();
+    if (!global) {
+      fn.foreachBlock([this](const BasicBlock &bb) { this->visit(&bb); });
+      return removedNum;
+    }
+
+    // Iterative dominator sets, the entry being the first block. The immediate
+    // dominator of a block is its dominator with the most dominators
+    vector<const BasicBlock*> blocks;
+    map<const BasicBlock*, uint32_t> index;
+    fn.foreachBlock([&](const BasicBlock &bb) {
+      index[&bb] = blocks.size();
+      blocks.push_back(&bb);
+    });
+    const uint32_t blockNum = blocks.size();
+    if (blockNum == 0) return 0;
+    vector<uint8_t> reachable(blockNum, 0);
+    vector<const BasicBlock*> workList(1, blocks[0]);
+    reachable[0] = 1;
+    while (workList.size() != 0) {
+      const BasicBlock *bb = workList.back();
+      workList.pop_back();
+      for (auto succ : bb->getSuccessorSet())
+        if (!reachable[index[succ]]) {
+          reachable[index[succ]] = 1;
+          workList.push_back(succ);
+        }
+    }
+    vector<vector<uint8_t>> dom(blockNum, vector<uint8_t>(blockNum, 1));
+    dom[0].assign(blockNum, 0);
+    dom[0][0] = 1;
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (uint32_t b = 1; b < blockNum; ++b) {
+        if (!reachable[b]) continue;
+        vector<uint8_t> curr(blockNum, 1);
+        for (auto pred : blocks[b]->getPredecessorSet()) {
+          if (!reachable[index[pred]]) continue;
+          const vector<uint8_t> &other = dom[index[pred]];
+          for (uint32_t i = 0; i < blockNum; ++i)
+            curr[i] &= other[i];
+        }
+        curr[b] = 1;
+        if (curr != dom[b]) {
+          dom[b].swap(curr);
+          changed = true;
+        }
+      }
+    }
+    vector<uint32_t> domNum(blockNum, 0);
+    for (uint32_t b = 0; b < blockNum; ++b)
+      for (uint32_t i = 0; i < blockNum; ++i)
+        domNum[b] += reachable[i] & dom[b][i];
+    children.clear();
+    for (uint32_t b = 1; b < blockNum; ++b) {
+      if (!reachable[b]) continue;
+      int32_t idom = -1;
+      for (uint32_t i = 0; i < blockNum; ++i)
+        if (i != b && dom[b][i] && (idom < 0 || domNum[i] > domNum[idom]))
+          idom = i;
+      if (idom >= 0)
+        children[blocks[idom]].push_back(blocks[b]);
+    }
+    this->visit(blocks[0]);
+    return removedNum;
+  }
+
+  PassManager::~PassManager(void) {
+    for (auto pass : passes) GBE_DELETE(pass);
+  }
+
+  void PassManager::addPass(FunctionPass *pass) {
+    passes.push_back(pass);
+  }
+
+  /*! Never loop forever on passes undoing each other */
+  static const uint32_t maxRoundNum = 4;
+
+  void PassManager::run(Function &fn) {
+    for (uint32_t round = 0; round < maxRoundNum; ++round) {
+      uint32_t changeNum = 0;
+      for (auto pass : passes) {
+        const double start = getSeconds();
+        const uint32_t passChangeNum = pass->run(fn);
+        pass->time += getSeconds() - start;
+        pass->changeNum += passChangeNum;
+        changeNum += passChangeNum;
+      }
+      if (changeNum == 0) break;
+    }
+  }
+
+  void PassManager::run(Unit &unit) {
+    const Unit::FunctionSet &fs = unit.getFunctionSet();
+    for (auto &pair : fs) {
+      Function &fn = *pair.second;
+      uint32_t insnNum = 0;
+      if (OCL_OUTPUT_IR_PASS_STATS) {
+        fn.foreachInstruction([&insnNum](const Instruction &insn) { insnNum++; });
+        for (auto pass : passes)
+          pass->changeNum = 0, pass->time = 0;
+      }
+      this->run(fn);
+      if (OCL_OUTPUT_IR_PASS_STATS) {
+        uint32_t optimizedNum = 0;
+        fn.foreachInstruction([&optimizedNum](const Instruction &insn) { optimizedNum++; });
+        std::cout << "function " << fn.getName() << ": " << insnNum << " -> "
+                  << optimizedNum << " IR instructions" << std::endl;
+        for (auto pass : passes)
+          std::cout << "  " << std::setw(24) << std::left << pass->getName()
+                    << pass->changeNum << " instruction(s), "
+                    << pass->time * 1000. << " ms" << std::endl;
+      }
+    }
+  }
+
+  void optimizeUnit(Unit &unit) {
+    PassManager passes;
+    if (OCL_OPTIMIZE_CONST_FOLD)
+      passes.addPass(GBE_NEW_NO_ARG(ConstantFolding));
+    if (OCL_OPTIMIZE_CSE)
+      passes.addPass(GBE_NEW(CommonSubexpressionElimination, OCL_OPTIMIZE_GLOBAL_CSE));
+    passes.run(unit);
+  }
+
+} /* namespace ir */
+} /* namespace gbe */
@@ -0,0 +1,82 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * \file optimization.hpp
+ *  Scalar optimizations run on the Gen IR once the LLVM code is translated:
+ *  constant folding and common sub-expression elimination. They mostly clean
+ *  up the address computations the GEP lowering repeats for each access
+ */
+
+#ifndef __GBE_IR_OPTIMIZATION_HPP__
+#define __GBE_IR_OPTIMIZATION_HPP__
+
+#include "sys/platform.hpp"
+#include "sys/vector.hpp"
+
+namespace gbe {
+namespace ir {
+
+  // Structures to optimize
+  class Unit;
+  class Function;
+
+  /*! An optimization pass run on one function at a time */
+  class FunctionPass : public NonCopyable
+  {
+  public:
+    FunctionPass(const char *name) : name(name), changeNum(0), time(0) {}
+    virtual ~FunctionPass(void) {}
+    /*! Return the name of the pass */
+    INLINE const char *getName(void) const { return name; }
+    /*! Optimize the function and return the number of instructions changed */
+    virtual uint32_t run(Function &fn) = 0;
+    /*! Name used when reporting the statistics */
+    const char *name;
+    /*! Instructions changed and time spent since the creation of the pass */
+    uint32_t changeNum;
+    double time;
+    GBE_CLASS(FunctionPass);
+  };
+
+  /*! Run a sequence of passes until they do not change anything anymore */
+  class PassManager : public NonCopyable
+  {
+  public:
+    PassManager(void) {}
+    ~PassManager(void);
+    /*! The manager owns the pass */
+    void addPass(FunctionPass *pass);
+    /*! Optimize one function */
+    void run(Function &fn);
+    /*! Optimize all the functions of the unit */
+    void run(Unit &unit);
+  private:
+    vector<FunctionPass*> passes;
+    GBE_CLASS(PassManager);
+  };
+
+  /*! Run the default pipeline on the unit. Each pass is enabled by its own
+   *  OCL_OPTIMIZE_* variable, read at each call
+   */
+  void optimizeUnit(Unit &unit);
+
+} /* namespace ir */
+} /* namespace gbe */
+
+#endif /* __GBE_IR_OPTIMIZATION_HPP__ */
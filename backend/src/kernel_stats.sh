@@ -0,0 +1,141 @@
+#!/bin/bash
+# Compile every .cl file of the kernel directory offline with gbe_bin_generater
+# for the given device, so no GPU is needed, and report for each kernel its
+# SIMD width, Gen instructions, spills, fills, rematerializations and the cycles
+# estimated by the post register allocation scheduler before and after
+# scheduling. With two settings of the OCL_* variables (-a and -b), the kernels
+# whose statistics differ between them are listed, with the totals of both.
+#
+# Usage: kernel_stats.sh [-p preset | -a "VAR=value ..." [-b "VAR=value ..."]]
+#                        path/to/gbe_bin_generater gen_pci_id [kernel_dir]
+# Presets:
+#   regalloc  legacy (a) and loop weighted (b) register allocators
+#   iropt     Gen IR optimizations disabled (a) and enabled (b)
+# Examples: kernel_stats.sh build/backend/src/gbe_bin_generater 0x0166
+#           kernel_stats.sh -p regalloc build/backend/src/gbe_bin_generater 0x0166
+#           kernel_stats.sh -a OCL_SIMD_WIDTH=8 -b OCL_SIMD_WIDTH=16 ...
+
+usage() {
+    echo "Usage: $0 [-p regalloc|iropt | -a settings [-b settings]] gbe_bin_generater gen_pci_id [kernel_dir]"
+    exit 1
+}
+
+iropt="OCL_OPTIMIZE_CONST_FOLD OCL_OPTIMIZE_CSE OCL_OPTIMIZE_GLOBAL_CSE"
+settings_a=
+settings_b=
+while getopts "p:a:b:" opt; do
+    case $opt in
+        p)
+            case $OPTARG in
+                regalloc) settings_a="OCL_REG_ALLOCATOR=0"; settings_b="OCL_REG_ALLOCATOR=1";;
+                iropt) settings_a=$(for v in $iropt; do echo -n "$v=0 "; done)
+                       settings_b=$(for v in $iropt; do echo -n "$v=1 "; done);;
+                *) usage;;
+            esac;;
+        a) settings_a=$OPTARG;;
+        b) settings_b=$OPTARG;;
+        *) usage;;
+    esac
+done
+shift $((OPTIND - 1))
+if [ $# -lt 2 ] || { [ -n "$settings_b" ] && [ -z "$settings_a" ]; }; then
+    usage
+fi
+
+generater=$1
+pciid=$2
+kerneldir=${3:-$(dirname $0)/../../kernels}
+tmpbin=$(mktemp)
+
+# One line per kernel: file:kernel simd insn spill fill remat cycles_before cycles_after
+collect() {
+    local out=$1
+    shift
+    touch $out
+    for kernel in $kerneldir/*.cl; do
+        if ! env "$@" OCL_OUTPUT_KERNEL_STATS=1 OCL_OUTPUT_SCHEDULE_STATS=1 \
+             $generater $kernel -o$tmpbin -t$pciid > $tmpbin.log 2>&1; then
+            echo "$(basename $kernel) failed" >> $out
+            continue
+        fi
+        awk -v file=$(basename $kernel) '
+        function field(name) {
+            if (!match($0, "\"" name "\":[0-9]+")) return 0
+            return substr($0, RSTART + length(name) + 3, RLENGTH - length(name) - 3)
+        }
+        # kernel <name>: SIMD<w>, estimated cycles <b> before scheduling, <a> after
+        /^kernel .*estimated cycles/ {
+            name = substr($2, 1, length($2) - 1)
+            cycles[name] = $(NF-4) " " $(NF-1)  # the last attempt is the one kept
+        }
+        /^{"kernel":/ {
+            match($0, "\"kernel\":\"[^\"]*\"")
+            name = substr($0, RSTART + 10, RLENGTH - 11)
+            line[name] = file ":" name " " field("simd_width") " " field("insn_num") " " \
+                         field("spill_num") " " field("fill_num") " " field("remat_num")
+        }
+        END {
+            for (name in line)
+                print line[name], (name in cycles) ? cycles[name] : "0 0"
+        }' $tmpbin.log >> $out
+    done
+    sort -o $out $out
+}
+
+collect $tmpbin.a $settings_a
+if [ -z "$settings_b" ]; then
+    awk '
+    BEGIN {
+        printf("%-50s %6s %7s %11s %6s %15s\n", "kernel", "SIMD", "insns", "spill/fill", "remat", "cycles")
+    }
+    $2 == "failed" { failed++; next }
+    {
+        printf("%-50s %6d %7d %5d/%-5d %6d %7d/%-7d\n", $1, $2, $3, $4, $5, $6, $7, $8)
+        n++; insn += $3; spill += $4; fill += $5; remat += $6; before += $7; after += $8
+    }
+    END {
+        if (failed) printf("%d file(s) failed to build and are ignored\n", failed)
+        printf("%d kernels, %d instructions, spills/fills %d/%d, %d rematerialization(s)\n",
+               n, insn, spill, fill, remat)
+        printf("estimated cycles %d before scheduling, %d after (%.1f%%)\n",
+               before, after, before ? (after - before) * 100.0 / before : 0)
+    }' $tmpbin.a
+    rm -f $tmpbin $tmpbin.log $tmpbin.a
+    exit 0
+fi
+
+collect $tmpbin.b $settings_b
+echo "a: $settings_a"
+echo "b: $settings_b"
+join -a1 -a2 -e- -o 0,1.2,1.3,1.4,1.5,1.6,1.8,2.2,2.3,2.4,2.5,2.6,2.8 $tmpbin.a $tmpbin.b | awk '
+BEGIN {
+    printf("%-50s %33s %33s\n", "kernel", "a: SIMD insns spill/fill cycles", "b: SIMD insns spill/fill cycles")
+}
+{
+    if ($2 == "failed" || $8 == "failed" || $2 == "-" || $8 == "-") {
+        if ($2 != $8) printf("%-50s %33s %33s\n", $1, $2 == "failed" || $2 == "-" ? "failed" : "ok",
+                             $8 == "failed" || $8 == "-" ? "failed" : "ok")
+        next
+    }
+    n++
+    insn0 += $3; spill0 += $4; fill0 += $5; remat0 += $6; cycles0 += $7
+    insn1 += $9; spill1 += $10; fill1 += $11; remat1 += $12; cycles1 += $13
+    if ($2 != $8 || $3 != $9 || $4 != $10 || $5 != $11 || $7 != $13)
+        printf("%-50s SIMD%-2d %6d %5d/%-5d %8d SIMD%-2d %6d %5d/%-5d %8d\n",
+               $1, $2, $3, $4, $5, $7, $8, $9, $10, $11, $13)
+    if ($2 > $8) simd16lost++
+    if ($2 < $8) simd16won++
+    if ($3 > $9) smaller++
+    if ($3 < $9) larger++
+}
+END {
+    printf("%d kernels built with both settings\n", n)
+    printf("a: %d instructions, spills/fills %d/%d, %d rematerialization(s), %d estimated cycles\n",
+           insn0, spill0, fill0, remat0, cycles0)
+    printf("b: %d instructions, spills/fills %d/%d, %d rematerialization(s), %d estimated cycles\n",
+           insn1, spill1, fill1, remat1, cycles1)
+    printf("with b, %d kernel(s) smaller and %d larger, SIMD16 gained by %d and lost by %d\n",
+           smaller, larger, simd16won, simd16lost)
+}'
+
+rm -f $tmpbin $tmpbin.log $tmpbin.a $tmpbin.b
@@ -333,7 +333,11 @@ error:
     Value* g1Xg2Xg3;
     Value* wg_offset;
     int out_buf_sizeof_offset;
-    static map<CallInst*, PrintfSet::PrintfFmt*> printfs;
+    map<CallInst*, PrintfSet::PrintfFmt*> printfs;
+    /*! Parser of the module being compiled by this thread. The gen pass of
+     *  the same pass manager queries it, and several modules may be compiled
+     *  concurrently by different threads */
+    static THREAD PrintfParser *current;
     int printf_num;
     int totalSizeofSize;
 
@@ -355,6 +359,7 @@ error:
       wg_offset = NULL;
       printf_num = 0;
       totalSizeofSize = 0;
+      current = this;
     }
 
     ~PrintfParser(void)
@@ -364,6 +369,8 @@ error:
         s.second = NULL;
       }
       printfs.clear();
+      if (current == this)
+        current = NULL;
     }
 
     bool parseOnePrintfInstruction(CallInst * call, PrintfParserInfo& info, int& sizeof_size);
@@ -1002,12 +1009,16 @@ error:
     return false;
   }
 
-  map<CallInst*, PrintfSet::PrintfFmt*> PrintfParser::printfs;
+  THREAD PrintfParser *PrintfParser::current = NULL;
 
   void* getPrintfInfo(CallInst* inst)
   {
-    if (PrintfParser::printfs[inst])
-      return (void*)PrintfParser::printfs[inst];
+    PrintfParser *parser = PrintfParser::current;
+    if (parser == NULL)
+      return NULL;
+    auto it = parser->printfs.find(inst);
+    if (it != parser->printfs.end() && it->second)
+      return (void*)it->second;
     return NULL;
   }
 
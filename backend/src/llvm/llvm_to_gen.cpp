@@ -62,6 +62,7 @@
 #include "sys/platform.hpp"
 #include "ir/unit.hpp"
 #include "ir/structural_analysis.hpp"
+#include "ir/optimization.hpp"
 
 #include <clang/CodeGen/CodeGenAction.h>
 
@@ -221,8 +222,21 @@ namespace gbe
   BVAR(OCL_OUTPUT_LLVM_AFTER_LINK, false);
   BVAR(OCL_OUTPUT_LLVM_AFTER_GEN, false);
 
-  bool llvmToGen(ir::Unit &unit, const char *fileName,const void* module, int optLevel, bool strictMath)
+  static void addDataLayoutPass(llvm::PassManager &passes, const DataLayout &DL)
   {
+#if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 6
+    passes.add(new DataLayoutPass());
+#elif LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR == 5
+    passes.add(new DataLayoutPass(DL));
+#else
+    passes.add(new DataLayout(DL));
+#endif
+  }
+
+  bool llvmToGen(ir::Unit &unit, const char *fileName,const void* module, int optLevel, bool strictMath,
+                 gbe_program_compile_stats *stats)
+  {
+    double phaseStart = getSeconds();
     std::string errInfo;
     std::unique_ptr<llvm::raw_fd_ostream> o = NULL;
     if (OCL_OUTPUT_LLVM_BEFORE_LINK || OCL_OUTPUT_LLVM_AFTER_LINK || OCL_OUTPUT_LLVM_AFTER_GEN)
@@ -268,13 +282,7 @@ namespace gbe
     runFuntionPass(mod, libraryInfo, DL);
     runModulePass(mod, libraryInfo, DL, optLevel, strictMath);
     llvm::PassManager passes;
-#if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR >= 6
-    passes.add(new DataLayoutPass());
-#elif LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR == 5
-    passes.add(new DataLayoutPass(DL));
-#else
-    passes.add(new DataLayout(DL));
-#endif
+    addDataLayoutPass(passes, DL);
     // Print the code before further optimizations
     passes.add(createIntrinsicLoweringPass());
     passes.add(createStripAttributesPass());     // Strip unsupported attributes and calling conventions.
@@ -303,12 +311,38 @@ namespace gbe
       passes.add(createCFGPrinterPass());
     if(OCL_OUTPUT_CFG_ONLY)
       passes.add(createCFGOnlyPrinterPass());
-    passes.add(createGenPass(unit));
     passes.run(mod);
+    if (stats) {
+      const double now = getSeconds();
+      stats->llvm_time += (now - phaseStart) * 1000.0;
+      phaseStart = now;
+    }
+
+    // The Gen IR emission runs on its own so its time can be told apart from
+    // the LLVM passes
+    llvm::PassManager genPasses;
+    addDataLayoutPass(genPasses, DL);
+    genPasses.add(createGenPass(unit));
+    genPasses.run(mod);
+    if (stats) {
+      const double now = getSeconds();
+      stats->gen_ir_time += (now - phaseStart) * 1000.0;
+      phaseStart = now;
+    }
 
     // Print the code extra optimization passes
     OUTPUT_BITCODE(AFTER_GEN, mod);
 
+    // Clean up the Gen IR left by the phi and argument lowering
+    if (optLevel > 0 && unit.getValid()) {
+      ir::optimizeUnit(unit);
+      if (stats) {
+        const double now = getSeconds();
+        stats->ir_opt_time += (now - phaseStart) * 1000.0;
+        phaseStart = now;
+      }
+    }
+
     const ir::Unit::FunctionSet& fs = unit.getFunctionSet();
     ir::Unit::FunctionSet::const_iterator iter = fs.begin();
     while(iter != fs.end())
@@ -320,6 +354,8 @@ namespace gbe
         iter->second->outputCFG();
       iter++;
     }
+    if (stats)
+      stats->gen_ir_time += (getSeconds() - phaseStart) * 1000.0;
 
     delete libraryInfo;
     return true;
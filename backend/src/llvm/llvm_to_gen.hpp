@@ -24,6 +24,8 @@
 #ifndef __GBE_IR_LLVM_TO_GEN_HPP__
 #define __GBE_IR_LLVM_TO_GEN_HPP__
 
+#include "backend/program.h"
+
 namespace gbe {
   namespace ir {
     // The code is output into an IR unit
@@ -31,8 +33,10 @@ namespace gbe {
   } /* namespace ir */
 
   /*! Convert the LLVM IR code to a GEN IR code,
-		  optLevel 0 equal to clang -O1 and 1 equal to clang -O2*/
-  bool llvmToGen(ir::Unit &unit, const char *fileName, const void* module, int optLevel, bool strictMath);
+		  optLevel 0 equal to clang -O1 and 1 equal to clang -O2.
+      The time spent in each phase is added to stats if given */
+  bool llvmToGen(ir::Unit &unit, const char *fileName, const void* module, int optLevel, bool strictMath,
+                 gbe_program_compile_stats *stats = NULL);
 
 } /* namespace gbe */
 
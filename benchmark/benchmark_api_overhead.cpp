@@ -0,0 +1,264 @@
+#include "utests/utest_helper.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Host cost of the API entry points, call by call. Each benchmark returns the
+ * median latency and prints the distribution and the calls per second as one
+ * JSON line starting with "[Latency]", so the results can be collected and
+ * compared across releases. A failed call fails the benchmark: the time of an
+ * error path is not the cost of the call.
+ * The GPU does (almost) no work: run them with OCL_NULL_DRIVER=1 to measure
+ * the runtime alone. */
+namespace {
+
+class LatencyRecorder
+{
+public:
+  LatencyRecorder(const char *name, size_t call_n) : name(name) { samples.reserve(call_n); }
+  void start(void) { clock_gettime(CLOCK_MONOTONIC, &begin); }
+  void stop(void) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    samples.push_back((end.tv_sec - begin.tv_sec) * 1e9 + (end.tv_nsec - begin.tv_nsec));
+  }
+  /* Print the percentiles and the calls per second, and return the median in
+   * the given unit */
+  double report(const char *unit, double ns_per_unit) {
+    OCL_ASSERT(!samples.empty());
+    std::sort(samples.begin(), samples.end());
+    double sum = 0;
+    for (size_t i = 0; i < samples.size(); ++i)
+      sum += samples[i];
+    std::cout << "    [Latency] {\"name\": \"" << name << "\", \"unit\": \"" << unit
+              << "\", \"calls\": " << samples.size() << std::fixed << std::setprecision(3)
+              << ", \"mean\": " << sum / samples.size() / ns_per_unit
+              << ", \"min\": " << samples.front() / ns_per_unit
+              << ", \"p50\": " << percentile(0.50) / ns_per_unit
+              << ", \"p90\": " << percentile(0.90) / ns_per_unit
+              << ", \"p99\": " << percentile(0.99) / ns_per_unit
+              << ", \"max\": " << samples.back() / ns_per_unit
+              << ", \"calls_per_s\": " << samples.size() * 1e9 / sum << "}" << std::endl;
+    return percentile(0.50) / ns_per_unit;
+  }
+private:
+  double percentile(double p) const {
+    return samples[std::min(samples.size() - 1, (size_t)(p * samples.size()))];
+  }
+  const char *name;
+  std::vector<double> samples;
+  struct timespec begin;
+};
+
+const char *build_source =
+  "kernel void benchmark_api_build(global float *dst, global const float *src, int n) {\n"
+  "  int gid = get_global_id(0);\n"
+  "  float sum = 0.f;\n"
+  "  for (int i = 0; i < n; i++)\n"
+  "    sum += src[gid * n + i] * SCALE;\n"
+  "  dst[gid] = sum > 0.f ? sqrt(sum) : -sum;\n"
+  "}\n";
+
+void build_program(const char *options, LatencyRecorder *recorder)
+{
+  cl_program prog;
+  cl_int status;
+  OCL_CALL2(clCreateProgramWithSource, prog, ctx, 1, &build_source, NULL);
+  if (recorder) recorder->start();
+  status = clBuildProgram(prog, 1, &device, options, NULL, NULL);
+  if (recorder) recorder->stop();
+  OCL_ASSERT(status == CL_SUCCESS);
+  OCL_CALL(clReleaseProgram, prog);
+}
+
+} /* namespace */
+
+double benchmark_api_set_kernel_arg(void)
+{
+  const int call_n = 100000;
+  LatencyRecorder recorder("clSetKernelArg", call_n);
+
+  cl_int status;
+
+  OCL_CREATE_KERNEL("benchmark_enqueue_rate");
+  for (int value = 0; value < call_n; ++value) {
+    recorder.start();
+    status = clSetKernelArg(kernel, 1, sizeof(int), &value);
+    recorder.stop();
+    OCL_ASSERT(status == CL_SUCCESS);
+  }
+  return recorder.report("us", 1e3);
+}
+
+MAKE_BENCHMARK_FROM_FUNCTION_WITH_UNIT(benchmark_api_set_kernel_arg, "us");
+
+double benchmark_api_enqueue_ndrange(void)
+{
+  const int call_n = 10000;
+  LatencyRecorder recorder("clEnqueueNDRangeKernel", call_n);
+  cl_int status;
+  int value = 0;
+
+  OCL_CREATE_KERNEL("benchmark_enqueue_rate");
+  OCL_CREATE_BUFFER(buf[0], 0, 64 * sizeof(int), NULL);
+  OCL_SET_ARG(0, sizeof(cl_mem), &buf[0]);
+  OCL_SET_ARG(1, sizeof(int), &value);
+  globals[0] = 64;
+  globals[1] = 1;
+  locals[0] = 16;
+  locals[1] = 1;
+  OCL_NDRANGE(2);
+  OCL_FINISH();
+
+  for (int i = 0; i < call_n; ++i) {
+    recorder.start();
+    status = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, globals, locals, 0, NULL, NULL);
+    recorder.stop();
+    OCL_ASSERT(status == CL_SUCCESS);
+  }
+  OCL_FINISH();
+  return recorder.report("us", 1e3);
+}
+
+MAKE_BENCHMARK_FROM_FUNCTION_WITH_UNIT(benchmark_api_enqueue_ndrange, "us");
+
+/* Each launch waits for the previous one. Give the launches a duration with
+ * OCL_NULL_DRIVER_EVENT_LATENCY: the enqueuing thread leaves the wait to the
+ * event dispatcher, unless OCL_EVENT_DISPATCHER=0 */
+double benchmark_api_enqueue_dependent(void)
+{
+  const int call_n = 2000;
+  LatencyRecorder recorder("clEnqueueNDRangeKernel with wait list", call_n);
+  cl_event prev, ev;
+  cl_int status;
+  int value = 0;
+
+  OCL_CREATE_KERNEL("benchmark_enqueue_rate");
+  OCL_CREATE_BUFFER(buf[0], 0, 64 * sizeof(int), NULL);
+  OCL_SET_ARG(0, sizeof(cl_mem), &buf[0]);
+  OCL_SET_ARG(1, sizeof(int), &value);
+  globals[0] = 64;
+  globals[1] = 1;
+  locals[0] = 16;
+  locals[1] = 1;
+  OCL_CALL(clEnqueueNDRangeKernel, queue, kernel, 2, NULL, globals, locals, 0, NULL, &prev);
+
+  for (int i = 0; i < call_n; ++i) {
+    recorder.start();
+    status = clEnqueueNDRangeKernel(queue, kernel, 2, NULL, globals, locals, 1, &prev, &ev);
+    recorder.stop();
+    OCL_ASSERT(status == CL_SUCCESS);
+    OCL_CALL(clReleaseEvent, prev);
+    prev = ev;
+  }
+  OCL_CALL(clWaitForEvents, 1, &prev);
+  OCL_CALL(clReleaseEvent, prev);
+  OCL_FINISH();
+  return recorder.report("us", 1e3);
+}
+
+MAKE_BENCHMARK_FROM_FUNCTION_WITH_UNIT(benchmark_api_enqueue_dependent, "us");
+
+double benchmark_api_create_release_buffer(void)
+{
+  const int call_n = 10000;
+  LatencyRecorder recorder("clCreateBuffer+clReleaseMemObject", call_n);
+  cl_int create_status, release_status;
+  cl_mem mem;
+
+  for (int i = 0; i < call_n; ++i) {
+    recorder.start();
+    mem = clCreateBuffer(ctx, 0, 4096, NULL, &create_status);
+    release_status = clReleaseMemObject(mem);
+    recorder.stop();
+    OCL_ASSERT(create_status == CL_SUCCESS && mem != NULL);
+    OCL_ASSERT(release_status == CL_SUCCESS);
+  }
+  return recorder.report("us", 1e3);
+}
+
+MAKE_BENCHMARK_FROM_FUNCTION_WITH_UNIT(benchmark_api_create_release_buffer, "us");
+
+double benchmark_api_map_buffer(void)
+{
+  const int call_n = 10000;
+  LatencyRecorder recorder("clEnqueueMapBuffer+clEnqueueUnmapMemObject", call_n);
+  cl_int map_status, unmap_status;
+  void *ptr;
+
+  OCL_CREATE_BUFFER(buf[0], 0, 4096, NULL);
+  for (int i = 0; i < call_n; ++i) {
+    recorder.start();
+    ptr = clEnqueueMapBuffer(queue, buf[0], CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+                             0, 4096, 0, NULL, NULL, &map_status);
+    unmap_status = clEnqueueUnmapMemObject(queue, buf[0], ptr, 0, NULL, NULL);
+    recorder.stop();
+    OCL_ASSERT(map_status == CL_SUCCESS && ptr != NULL);
+    OCL_ASSERT(unmap_status == CL_SUCCESS);
+  }
+  OCL_FINISH();
+  return recorder.report("us", 1e3);
+}
+
+MAKE_BENCHMARK_FROM_FUNCTION_WITH_UNIT(benchmark_api_map_buffer, "us");
+
+double benchmark_api_event_wait(void)
+{
+  const int call_n = 10000;
+  LatencyRecorder recorder("clCreateUserEvent+clSetUserEventStatus+clWaitForEvents+clReleaseEvent", call_n);
+  cl_int status[4];
+  cl_event ev;
+
+  for (int i = 0; i < call_n; ++i) {
+    recorder.start();
+    ev = clCreateUserEvent(ctx, &status[0]);
+    status[1] = clSetUserEventStatus(ev, CL_COMPLETE);
+    status[2] = clWaitForEvents(1, &ev);
+    status[3] = clReleaseEvent(ev);
+    recorder.stop();
+    OCL_ASSERT(ev != NULL);
+    for (int j = 0; j < 4; ++j)
+      OCL_ASSERT(status[j] == CL_SUCCESS);
+  }
+  return recorder.report("us", 1e3);
+}
+
+MAKE_BENCHMARK_FROM_FUNCTION_WITH_UNIT(benchmark_api_event_wait, "us");
+
+/* Every build uses new options, so neither the in-memory nor the on-disk
+ * program caches can serve it */
+double benchmark_api_build_program_cold(void)
+{
+  const int call_n = 20;
+  LatencyRecorder recorder("clBuildProgram cold", call_n);
+  char options[128];
+
+  for (int i = 0; i < call_n; ++i) {
+    snprintf(options, sizeof(options), "-DSCALE=%d.f -DBENCHMARK_SEED=%ld", i + 1,
+             (long)getpid() * 1000003L + (long)time(NULL) + i);
+    build_program(options, &recorder);
+  }
+  return recorder.report("ms", 1e6);
+}
+
+MAKE_BENCHMARK_FROM_FUNCTION_WITH_UNIT(benchmark_api_build_program_cold, "ms");
+
+/* The same program again and again: served by the program caches when
+ * OCL_BINARY_CACHE_DIR is set, recompiled in a warm compiler otherwise */
+double benchmark_api_build_program_warm(void)
+{
+  const int call_n = 20;
+  LatencyRecorder recorder("clBuildProgram warm", call_n);
+  const char *options = "-DSCALE=2.f";
+
+  build_program(options, NULL);
+  for (int i = 0; i < call_n; ++i)
+    build_program(options, &recorder);
+  return recorder.report("ms", 1e6);
+}
+
+MAKE_BENCHMARK_FROM_FUNCTION_WITH_UNIT(benchmark_api_build_program_warm, "ms");
@@ -0,0 +1,45 @@
+#include "utests/utest_helper.hpp"
+#include <sys/time.h>
+
+/* Host cost of small launches: a tiny 2D kernel is enqueued again and again
+ * with a scalar argument changing at each launch. Most of the time goes into
+ * the driver, not into the GPU */
+double benchmark_enqueue_rate(void)
+{
+  struct timeval start,stop;
+  const int launch_n = 10000;
+  int value = 0;
+
+  OCL_CREATE_KERNEL("benchmark_enqueue_rate");
+  OCL_CREATE_BUFFER(buf[0], 0, 64 * 4 * sizeof(int), NULL);
+  OCL_SET_ARG(0, sizeof(cl_mem), &buf[0]);
+  OCL_SET_ARG(1, sizeof(int), &value);
+  globals[0] = 64;
+  globals[1] = 4;
+  locals[0] = 16;
+  locals[1] = 4;
+
+  /* The first launch pays for the setup of the kernel */
+  OCL_NDRANGE(2);
+  OCL_FINISH();
+
+  gettimeofday(&start,0);
+  for (value = 1; value <= launch_n; ++value) {
+    OCL_SET_ARG(1, sizeof(int), &value);
+    OCL_NDRANGE(2);
+  }
+  OCL_FINISH();
+  gettimeofday(&stop,0);
+  double elapsed = time_subtract(&stop, &start, 0);
+
+  OCL_MAP_BUFFER(0);
+  for (int y = 0; y < 4; ++y)
+    for (int x = 0; x < 64; ++x)
+      OCL_ASSERT(((int *)buf_data[0])[y * 64 + x] == launch_n + x % 16 + y);
+  OCL_UNMAP_BUFFER(0);
+
+  /* Enqueues per second */
+  return launch_n * 1000.0 / elapsed;
+}
+
+MAKE_BENCHMARK_FROM_FUNCTION_WITH_UNIT(benchmark_enqueue_rate, "launches/s");
@@ -0,0 +1,79 @@
+#include "utests/utest_helper.hpp"
+#include <pthread.h>
+#include <sys/time.h>
+
+/* Host threads enqueueing small launches on the same queue at the same time,
+ * each one with its own kernel. The launch rate should grow with the threads
+ * until the GPU or the kernel driver is the limit, not the queue */
+static const int launch_n = 20000;
+static pthread_barrier_t start_barrier;
+
+/* Returns non NULL on failure: the assertions only work in the main thread */
+static void *enqueue_thread(void *arg)
+{
+  int launches = (int)(intptr_t)arg, value = 1;
+  size_t global[2] = {64, 4}, local[2] = {16, 4};
+  cl_int err = CL_SUCCESS;
+  cl_kernel k = clCreateKernel(program, "benchmark_enqueue_rate", &err);
+
+  if (err == CL_SUCCESS)
+    err = clSetKernelArg(k, 0, sizeof(cl_mem), &buf[0]);
+  if (err == CL_SUCCESS)
+    err = clSetKernelArg(k, 1, sizeof(int), &value);
+  pthread_barrier_wait(&start_barrier);
+  for (int i = 0; i < launches && err == CL_SUCCESS; ++i)
+    err = clEnqueueNDRangeKernel(queue, k, 2, NULL, global, local, 0, NULL, NULL);
+  if (err == CL_SUCCESS)
+    err = clFlush(queue);
+  if (k != NULL)
+    clReleaseKernel(k);
+  return err == CL_SUCCESS ? NULL : (void *)1;
+}
+
+static double enqueue_threads(int thread_n)
+{
+  struct timeval start, stop;
+  pthread_t threads[64];
+
+  OCL_CREATE_KERNEL("benchmark_enqueue_rate");
+  OCL_CREATE_BUFFER(buf[0], 0, 64 * 4 * sizeof(int), NULL);
+  OCL_SET_ARG(0, sizeof(cl_mem), &buf[0]);
+  OCL_SET_ARG(1, sizeof(int), &thread_n);
+  globals[0] = 64;
+  globals[1] = 4;
+  locals[0] = 16;
+  locals[1] = 4;
+  /* The first launch pays for the setup of the kernel */
+  OCL_NDRANGE(2);
+  OCL_FINISH();
+
+  pthread_barrier_init(&start_barrier, NULL, thread_n + 1);
+  for (int t = 0; t < thread_n; ++t)
+    OCL_ASSERT(pthread_create(&threads[t], NULL, enqueue_thread,
+                              (void *)(intptr_t)(launch_n / thread_n)) == 0);
+  pthread_barrier_wait(&start_barrier);
+  gettimeofday(&start, 0);
+  int failed = 0;
+  for (int t = 0; t < thread_n; ++t) {
+    void *ret;
+    pthread_join(threads[t], &ret);
+    failed += ret != NULL;
+  }
+  OCL_FINISH();
+  gettimeofday(&stop, 0);
+  pthread_barrier_destroy(&start_barrier);
+  OCL_ASSERT(failed == 0);
+  double elapsed = time_subtract(&stop, &start, 0);
+
+  /* Enqueues per second */
+  return launch_n / thread_n * thread_n * 1000.0 / elapsed;
+}
+
+#define BENCHMARK_ENQUEUE_THREADS(N) \
+  double benchmark_enqueue_threads_##N(void) { return enqueue_threads(N); } \
+  MAKE_BENCHMARK_FROM_FUNCTION_WITH_UNIT(benchmark_enqueue_threads_##N, "launches/s");
+
+BENCHMARK_ENQUEUE_THREADS(1)
+BENCHMARK_ENQUEUE_THREADS(4)
+BENCHMARK_ENQUEUE_THREADS(16)
+BENCHMARK_ENQUEUE_THREADS(64)
@@ -0,0 +1,41 @@
+#include "utests/utest_helper.hpp"
+#include <sys/time.h>
+
+/* Latency of the first clEnqueueCopyBuffer in a brand new context. This is
+ * where the internal copy kernel gets loaded, so it shows what short-lived
+ * contexts pay before their first real work. */
+double benchmark_first_copy_latency(void)
+{
+  struct timeval start,stop;
+  const size_t sz = 4096;
+  const int context_n = 32;
+  double elapsed = 0;
+  cl_int status;
+
+  for (int i = 0; i < context_n; i++) {
+    cl_context fresh_ctx = clCreateContext(NULL, 1, &device, NULL, NULL, &status);
+    OCL_ASSERT(status == CL_SUCCESS);
+    cl_command_queue fresh_queue = clCreateCommandQueue(fresh_ctx, device, 0, &status);
+    OCL_ASSERT(status == CL_SUCCESS);
+    cl_mem src = clCreateBuffer(fresh_ctx, 0, sz, NULL, &status);
+    OCL_ASSERT(status == CL_SUCCESS);
+    cl_mem dst = clCreateBuffer(fresh_ctx, 0, sz, NULL, &status);
+    OCL_ASSERT(status == CL_SUCCESS);
+
+    gettimeofday(&start,0);
+    OCL_ASSERT(CL_SUCCESS == clEnqueueCopyBuffer(fresh_queue, src, dst, 0, 0, sz, 0, NULL, NULL));
+    OCL_ASSERT(CL_SUCCESS == clFinish(fresh_queue));
+    gettimeofday(&stop,0);
+    elapsed += time_subtract(&stop, &start, 0);
+
+    clReleaseMemObject(src);
+    clReleaseMemObject(dst);
+    clReleaseCommandQueue(fresh_queue);
+    clReleaseContext(fresh_ctx);
+  }
+
+  /* Average latency in ms */
+  return elapsed / context_n;
+}
+
+MAKE_BENCHMARK_FROM_FUNCTION_WITH_UNIT(benchmark_first_copy_latency, "ms");
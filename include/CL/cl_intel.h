@@ -133,6 +133,54 @@ typedef CL_API_ENTRY cl_int (CL_API_CALL *clGetMemObjectFdIntel_fn)(
                              cl_mem       /* Memory Obejct */,
                              int*         /* returned fd */);
 
+/* Set a scalar kernel argument which keeps the same value for many launches.
+ * The next launches run a variant of the kernel compiled with the value
+ * folded in. Variants are cached per program. Setting the argument again with
+ * clSetKernelArg brings back the generic code. When the kernel cannot be
+ * specialized, it behaves as clSetKernelArg */
+extern CL_API_ENTRY cl_int CL_API_CALL
+clSetKernelArgConstantIntel(cl_kernel    /* kernel */,
+                            cl_uint      /* arg_index */,
+                            size_t       /* arg_size */,
+                            const void * /* arg_value */);
+
+typedef CL_API_ENTRY cl_int (CL_API_CALL *clSetKernelArgConstantIntel_fn)(
+                             cl_kernel    /* kernel */,
+                             cl_uint      /* arg_index */,
+                             size_t       /* arg_size */,
+                             const void * /* arg_value */);
+
+/* What the compiler did for a kernel, queried with clGetKernelWorkGroupInfo.
+ * Times are in milliseconds and only cover the code generation attempt which
+ * succeeded, except total_time. Kernels loaded from a binary report the
+ * statistics of the build which produced it */
+#define CL_KERNEL_COMPILE_STATS_INTEL       0x4300 /* cl_kernel_compile_stats_intel */
+#define CL_KERNEL_COMPILE_STATS_JSON_INTEL  0x4301 /* char[], a JSON object */
+
+typedef struct _cl_kernel_compile_stats_intel {
+    cl_uint   simd_width;          /* SIMD width finally used */
+    cl_uint   attempts;            /* Code generation strategies tried */
+    cl_uint   insn_num;            /* Gen instructions */
+    cl_uint   compacted_insn_num;  /* Of which are compacted */
+    cl_uint   grf_num;             /* GRFs used by the register allocation */
+    cl_uint   spill_num;           /* Scratch writes inserted by the allocator */
+    cl_uint   fill_num;            /* Scratch reads inserted by the allocator */
+    cl_uint   remat_num;           /* Values recomputed by the allocator */
+    cl_uint   scratch_size;        /* Scratch memory per thread in bytes */
+    cl_uint   curbe_size;          /* Constant URB size in bytes */
+    cl_uint   slm_size;            /* Shared local memory in bytes */
+    cl_bool   pressure_scheduled;  /* SIMD16 needed the pre-allocation scheduler */
+    cl_double selection_time;      /* Instruction selection */
+    cl_double schedule_time;       /* Pre and post allocation scheduling */
+    cl_double reg_alloc_time;      /* Register allocation */
+    cl_double encode_time;         /* Encoding and branch patching */
+    cl_double total_time;          /* Whole code generation, all attempts included */
+} cl_kernel_compile_stats_intel;
+
+/* Hits and misses of the binary cache (OCL_BINARY_CACHE_DIR) since the
+ * process started, queried with clGetProgramBuildInfo on any program */
+#define CL_PROGRAM_BINARY_CACHE_STATS_INTEL 0x4302 /* cl_ulong[2] */
+
 #ifdef __cplusplus
 }
 #endif
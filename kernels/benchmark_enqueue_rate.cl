@@ -0,0 +1,4 @@
+kernel void benchmark_enqueue_rate(global int *dst, int value) {
+  dst[get_global_id(1) * get_global_size(0) + get_global_id(0)] =
+    value + get_local_id(0) + get_local_id(1);
+}
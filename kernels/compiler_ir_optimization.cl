@@ -0,0 +1,19 @@
+/* The distance between the local arrays is only known once the LLVM code is
+ * translated: its arithmetic is left to the Gen IR constant folding */
+kernel void compiler_ir_optimization_fold(global int *src, global int *dst) {
+  local int a[16], b[16];
+  int lid = get_local_id(0), gid = get_global_id(0);
+  a[lid] = src[gid];
+  b[lid] = src[gid] + 1;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  dst[gid] = a[15 - lid] * b[lid] + (int)((local char *)&b[0] - (local char *)&a[4]);
+}
+
+/* The lowering of the accesses computes the offset of i for each of them: in
+ * the block for a and b, in the branch for dst */
+kernel void compiler_ir_optimization_cse(global int *a, global int *b, global int *dst) {
+  int i = get_global_id(0);
+  int x = a[i] + b[i];
+  if (x & 1)
+    dst[i] = x;
+}
@@ -0,0 +1,24 @@
+/* Enough values live across the loop for the allocators to choose what to
+ * spill in SIMD16 */
+kernel void compiler_reg_allocator_pressure(global uint *src, global uint *dst, int n) {
+  int gid = get_global_id(0);
+  uint16 a = vload16(gid * 2, src), b = vload16(gid * 2 + 1, src);
+  for (int i = 0; i < n; ++i) {
+    a = a * 3u + b.s123456789abcdef0;
+    b = (b ^ 0x5a5au) + a.sf0123456789abcde;
+  }
+  vstore16(a ^ b, gid, dst);
+}
+
+/* Immediate values defined once and used in other blocks, which the loop
+ * weighted allocator recomputes where they are used */
+kernel void compiler_reg_allocator_remat(global uint *dst, int n) {
+  uint x = get_global_id(0);
+  for (int i = 0; i < n; ++i) {
+    if ((x + i) & 1)
+      x = x * 0x1234u + 0x5678u;
+    else
+      x = (x ^ 0x9abcu) - 0xdefu;
+  }
+  dst[get_global_id(0)] = x;
+}
@@ -0,0 +1,20 @@
+/* The values carried by the loop on n are the same in all the lanes. The one
+ * carried by the loop on the local ID, and the phi of the branch on it, are
+ * not, even if every lane computes them from the same uniform values */
+kernel void compiler_uniform_phi(global uint *src, global uint *dst, int n) {
+  int gid = get_global_id(0), lid = get_local_id(0);
+  uint acc = 0, step = 1;
+  for (int i = 0; i < n; ++i) {
+    acc += src[i] * step;
+    step = step * 3 + i;
+  }
+  uint x = acc;
+  for (int i = 0; i < (lid & 3); ++i)
+    x = x * 2 + step;
+  uint y;
+  if (lid & 4)
+    y = step;
+  else
+    y = acc;
+  dst[gid] = x + y;
+}
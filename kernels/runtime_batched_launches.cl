@@ -0,0 +1,4 @@
+kernel void runtime_batched_launches(global uint *dst, uint step) {
+  int gid = get_global_id(0);
+  dst[gid] = dst[gid] * 3 + step;
+}
@@ -0,0 +1,8 @@
+kernel void runtime_kernel_specialization(global const float *src, global float *dst,
+                                          int n, float scale) {
+  int gid = get_global_id(0);
+  float sum = 0.f;
+  for (int i = 0; i < n; i++)
+    sum += src[gid * 8 + i] * scale;
+  dst[gid] = sum;
+}
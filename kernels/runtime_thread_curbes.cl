@@ -0,0 +1,5 @@
+kernel void runtime_thread_curbes(global int *dst, int base) {
+  int x = get_group_id(0) * get_local_size(0) + get_local_id(0);
+  int y = get_group_id(1) * get_local_size(1) + get_local_id(1);
+  dst[y * get_global_size(0) + x] = base + y * get_global_size(0) + x;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "program.h"
+#include "cl_access_set.h"
+#include "cl_kernel.h"
+#include "cl_mem.h"
+#include "cl_gbe_loader.h"
+#include "cl_utils.h"
+
+#include <string.h>
+
+LOCAL void
+cl_access_set_clear(cl_access_set *set)
+{
+  set->written = 0;
+  set->mem_n = 0;
+  set->all = CL_FALSE;
+}
+
+/* The object holding the storage of mem */
+static cl_mem
+cl_access_set_owner(cl_mem mem)
+{
+  if (mem->type == CL_MEM_SUBBUFFER_TYPE)
+    return (cl_mem)((struct _cl_mem_buffer *)mem)->parent;
+  if (IS_IMAGE(mem) && cl_mem_image(mem)->buffer_1d != NULL)
+    return cl_access_set_owner(cl_mem_image(mem)->buffer_1d);
+  return mem;
+}
+
+/* The objects of the sets are only compared: they may be released already */
+static void
+cl_access_set_insert(cl_access_set *set, cl_mem mem, cl_bool write)
+{
+  uint32_t i;
+
+  if (set->all)
+    return;
+  for (i = 0; i < set->mem_n; i++)
+    if (set->mems[i] == mem)
+      break;
+  if (i == CL_ACCESS_SET_MAX) {
+    set->all = CL_TRUE;
+    return;
+  }
+  if (i == set->mem_n)
+    set->mems[set->mem_n++] = mem;
+  if (write)
+    set->written |= 1u << i;
+}
+
+LOCAL void
+cl_access_set_add(cl_access_set *set, cl_mem mem, cl_bool write)
+{
+  cl_access_set_insert(set, cl_access_set_owner(mem), write);
+}
+
+LOCAL void
+cl_access_set_add_kernel(cl_access_set *set, cl_kernel k)
+{
+  const char *qual;
+  uint32_t i;
+
+  for (i = 0; i < k->arg_n; i++) {
+    if (k->args[i].mem == NULL)
+      continue;
+    switch (interp_kernel_get_arg_type(k->opaque, i)) {
+      case GBE_ARG_GLOBAL_PTR:
+        qual = interp_kernel_get_arg_info(k->opaque, i, GBE_GET_ARG_INFO_TYPEQUAL);
+        cl_access_set_add(set, k->args[i].mem, qual == NULL || strstr(qual, "const") == NULL);
+        break;
+      case GBE_ARG_CONSTANT_PTR:
+        cl_access_set_add(set, k->args[i].mem, CL_FALSE);
+        break;
+      case GBE_ARG_IMAGE:
+        qual = interp_kernel_get_arg_info(k->opaque, i, GBE_GET_ARG_INFO_ACCESS);
+        cl_access_set_add(set, k->args[i].mem, qual == NULL || strcmp(qual, "read_only") != 0);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+LOCAL void
+cl_access_set_merge(cl_access_set *set, const cl_access_set *other)
+{
+  uint32_t i;
+
+  if (other->all)
+    set->all = CL_TRUE;
+  for (i = 0; i < other->mem_n; i++)
+    cl_access_set_insert(set, other->mems[i], (other->written >> i) & 1);
+}
+
+LOCAL cl_bool
+cl_access_set_hazard(const cl_access_set *a, const cl_access_set *b)
+{
+  uint32_t i, j;
+
+  if (a->all || b->all)
+    return CL_TRUE;
+  for (i = 0; i < a->mem_n; i++)
+    for (j = 0; j < b->mem_n; j++)
+      if (a->mems[i] == b->mems[j] && (((a->written >> i) | (b->written >> j)) & 1))
+        return CL_TRUE;
+  return CL_FALSE;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __CL_ACCESS_SET_H__
+#define __CL_ACCESS_SET_H__
+
+#include "cl_internals.h"
+#include "CL/cl.h"
+
+#include <stdint.h>
+
+/* The memory objects a command reads and writes, found from the arguments of
+ * the kernels it launches. Two commands have a hazard when one of them
+ * writes a memory object the other one accesses: the second one must then
+ * wait for the first one and see its results. The out-of-order queues use
+ * it to order their commands beyond the wait lists and to only flush the
+ * caches between the launches of a batch which have a hazard.
+ */
+
+enum { CL_ACCESS_SET_MAX = 32 };
+
+typedef struct _cl_access_set {
+  cl_mem mems[CL_ACCESS_SET_MAX]; /* Sub-buffers given by their parent buffer */
+  uint32_t written;               /* Bit i set when mems[i] is written */
+  uint32_t mem_n;
+  cl_bool all;                    /* Has a hazard with any command: barriers
+                                     and commands accessing too many objects */
+} cl_access_set;
+
+/* Empty the set */
+extern void cl_access_set_clear(cl_access_set *set);
+
+/* Add a memory object read, or written if write is set */
+extern void cl_access_set_add(cl_access_set *set, cl_mem mem, cl_bool write);
+
+/* Add the buffers and images given to the kernel. The const global buffers,
+ * the constant buffers and the read only images are read, the other ones
+ * are written
+ */
+extern void cl_access_set_add_kernel(cl_access_set *set, cl_kernel k);
+
+/* Add the accesses of another set */
+extern void cl_access_set_merge(cl_access_set *set, const cl_access_set *other);
+
+/* Whether the commands of both sets have a hazard */
+extern cl_bool cl_access_set_hazard(const cl_access_set *a, const cl_access_set *b);
+
+#endif /* __CL_ACCESS_SET_H__ */
@@ -23,6 +23,7 @@
 #include "cl_command_queue.h"
 #include "cl_enqueue.h"
 #include "cl_event.h"
+#include "cl_event_dispatcher.h"
 #include "cl_program.h"
 #include "cl_kernel.h"
 #include "cl_mem.h"
@@ -68,8 +69,38 @@ inline cl_int
 handle_events(cl_command_queue queue, cl_int num, const cl_event *wait_list,
               cl_event* event, enqueue_data* data, cl_command_type type)
 {
-  cl_int status = cl_event_wait_events(num, wait_list, queue);
-  cl_event e = NULL;
+  cl_int status, i, hazard_n = 0;
+  cl_event e = NULL, *hazards = NULL, *deps = NULL;
+  const cl_bool out_of_order = (queue->props & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) &&
+                               cl_event_is_gpu_command_type(type);
+
+  /* The CPU must not run the command before the kernels any thread batched,
+   * nor before the ones the event dispatcher still holds */
+  if (!cl_event_is_gpu_command_type(type)) {
+    cl_command_queue_flush_batches(queue);
+    cl_event_dispatcher_wait_queue(queue, CL_FALSE);
+  }
+
+  /* The GPU commands do not wait for the GPU: the dispatcher does */
+  status = cl_event_wait_events(num, wait_list, queue, cl_event_is_gpu_command_type(type));
+
+  /* Besides its wait list, a command of an out-of-order queue waits for the
+   * deferred commands it has a hazard with */
+  if (out_of_order && cl_event_dispatcher_available(queue->ctx->device))
+    hazard_n = cl_command_queue_get_hazards(queue, cl_get_thread_access_set(queue), &hazards);
+  if (hazard_n > 0) {
+    deps = CALLOC_ARRAY(cl_event, num + hazard_n);
+    if (deps != NULL) {
+      for (i = 0; i < num; i++)
+        deps[i] = wait_list[i];
+      for (i = 0; i < hazard_n; i++)
+        deps[num + i] = hazards[i];
+      num += hazard_n;
+      wait_list = deps;
+      status = CL_ENQUEUE_EXECUTE_DEFER;
+    }
+  }
+
   if(event != NULL || status == CL_ENQUEUE_EXECUTE_DEFER) {
     e = cl_event_new(queue->ctx, queue, type, event!=NULL);
 
@@ -86,6 +117,17 @@ handle_events(cl_command_queue queue, cl_int num, const cl_event *wait_list,
     }
   }
   queue->current_event = e;
+
+  for (i = 0; i < hazard_n; i++)
+    cl_event_delete(hazards[i]);
+  cl_free(hazards);
+  cl_free(deps);
+  if (out_of_order)
+    cl_access_set_clear(cl_get_thread_access_set(queue));
+  /* The launch the command recorded is not batched: the other threads may
+   * flush the batch buffer again */
+  if (cl_event_is_gpu_command_type(type) && status != CL_ENQUEUE_EXECUTE_IMM)
+    cl_thread_batch_unlock(queue);
   return status;
 }
 
@@ -416,11 +458,6 @@ clCreateCommandQueue(cl_context                   context,
   INVALID_DEVICE_IF (device != context->device);
   INVALID_VALUE_IF (properties & ~(CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE | CL_QUEUE_PROFILING_ENABLE));
 
-  if(properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) {/*not supported now.*/
-    err = CL_INVALID_QUEUE_PROPERTIES;
-    goto error;
-  }
-
   queue = cl_context_create_queue(context, device, properties, &err);
 error:
   if (errcode_ret)
@@ -1154,6 +1191,11 @@ clGetProgramBuildInfo(cl_program             program,
   }else if (param_name == CL_PROGRAM_BINARY_TYPE){
 
     FILL_GETINFO_RET (cl_uint, 1, &program->binary_type, CL_SUCCESS);
+  } else if (param_name == CL_PROGRAM_BINARY_CACHE_STATS_INTEL) {
+    cl_ulong stats[2];
+    if (!cl_program_get_cache_stats(stats))
+      return CL_INVALID_VALUE;
+    FILL_GETINFO_RET (cl_ulong, 2, stats, CL_SUCCESS);
   } else {
     return CL_INVALID_VALUE;
   }
@@ -1335,8 +1377,8 @@ clWaitForEvents(cl_uint          num_events,
 
   TRY(cl_event_check_waitlist, num_events, event_list, NULL, ctx);
 
-  while(cl_event_wait_events(num_events, event_list, NULL) == CL_ENQUEUE_EXECUTE_DEFER) {
-    usleep(8000);       //sleep 8ms to wait other thread
+  while(cl_event_wait_events(num_events, event_list, NULL, CL_FALSE) == CL_ENQUEUE_EXECUTE_DEFER) {
+    cl_event_dispatcher_wait_progress(ctx->device, 8000);  //wait 8ms at most for other threads
   }
 
 error:
@@ -1509,11 +1551,15 @@ error:
 cl_int
 clFlush(cl_command_queue command_queue)
 {
-  /* have nothing to do now, as currently
-   * clEnqueueNDRangeKernel will flush at
-   * the end of each calling. we may need
-   * to optimize it latter.*/
-  return 0;
+  cl_int err = CL_SUCCESS;
+
+  CHECK_QUEUE (command_queue);
+  /* Only the kernels batched by clEnqueueNDRangeKernel are not submitted yet,
+   * by any thread */
+  err = cl_command_queue_flush_batches(command_queue);
+
+error:
+  return err;
 }
 
 cl_int
@@ -1850,13 +1896,13 @@ clEnqueueFillImage(cl_command_queue   command_queue,
     goto error;
   }
 
+  TRY(cl_event_check_waitlist, num_events_in_wait_list, event_wait_list, event, image->ctx);
+
   err = cl_image_fill(command_queue, fill_color, src_image, origin, region);
   if (err) {
     goto error;
   }
 
-  TRY(cl_event_check_waitlist, num_events_in_wait_list, event_wait_list, event, image->ctx);
-
   data = &no_wait_data;
   data->type = EnqueueFillImage;
   data->queue = command_queue;
@@ -1868,7 +1914,7 @@ clEnqueueFillImage(cl_command_queue   command_queue,
       cl_event_get_timestamp(*event, CL_PROFILING_COMMAND_SUBMIT);
     }
 
-    err = cl_command_queue_flush(command_queue);
+    err = cl_command_queue_batch(command_queue);
   }
 
   if(b_output_kernel_perf)
@@ -1928,13 +1974,13 @@ clEnqueueFillBuffer(cl_command_queue   command_queue,
     goto error;
   }
 
+  TRY(cl_event_check_waitlist, num_events_in_wait_list, event_wait_list, event, buffer->ctx);
+
   err = cl_mem_fill(command_queue, pattern, pattern_size, buffer, offset, size);
   if (err) {
     goto error;
   }
 
-  TRY(cl_event_check_waitlist, num_events_in_wait_list, event_wait_list, event, buffer->ctx);
-
   data = &no_wait_data;
   data->type = EnqueueFillBuffer;
   data->queue = command_queue;
@@ -1946,7 +1992,7 @@ clEnqueueFillBuffer(cl_command_queue   command_queue,
       cl_event_get_timestamp(*event, CL_PROFILING_COMMAND_SUBMIT);
     }
 
-    err = cl_command_queue_flush(command_queue);
+    err = cl_command_queue_batch(command_queue);
   }
 
   if(b_output_kernel_perf)
@@ -2019,10 +2065,10 @@ clEnqueueCopyBuffer(cl_command_queue     command_queue,
     }
   }
 
-  err = cl_mem_copy(command_queue, src_buffer, dst_buffer, src_offset, dst_offset, cb);
-
   TRY(cl_event_check_waitlist, num_events_in_wait_list, event_wait_list, event, src_buffer->ctx);
 
+  err = cl_mem_copy(command_queue, src_buffer, dst_buffer, src_offset, dst_offset, cb);
+
   data = &no_wait_data;
   data->type = EnqueueCopyBuffer;
   data->queue = command_queue;
@@ -2034,7 +2080,7 @@ clEnqueueCopyBuffer(cl_command_queue     command_queue,
       cl_event_get_timestamp(*event, CL_PROFILING_COMMAND_SUBMIT);
     }
 
-    err = cl_command_queue_flush(command_queue);
+    err = cl_command_queue_batch(command_queue);
   }
 
   if(b_output_kernel_perf)
@@ -2122,11 +2168,11 @@ clEnqueueCopyBufferRect(cl_command_queue     command_queue,
     goto error;
   }
 
+  TRY(cl_event_check_waitlist, num_events_in_wait_list, event_wait_list, event, src_buffer->ctx);
+
   cl_mem_copy_buffer_rect(command_queue, src_buffer, dst_buffer, src_origin, dst_origin, region,
                           src_row_pitch, src_slice_pitch, dst_row_pitch, dst_slice_pitch);
 
-  TRY(cl_event_check_waitlist, num_events_in_wait_list, event_wait_list, event, src_buffer->ctx);
-
   data = &no_wait_data;
   data->type = EnqueueCopyBufferRect;
   data->queue = command_queue;
@@ -2138,7 +2184,7 @@ clEnqueueCopyBufferRect(cl_command_queue     command_queue,
       cl_event_get_timestamp(*event, CL_PROFILING_COMMAND_SUBMIT);
     }
 
-    err = cl_command_queue_flush(command_queue);
+    err = cl_command_queue_batch(command_queue);
   }
 
   if(b_output_kernel_perf)
@@ -2372,10 +2418,10 @@ clEnqueueCopyImage(cl_command_queue      command_queue,
     }
   }
 
-  cl_mem_kernel_copy_image(command_queue, src_image, dst_image, src_origin, dst_origin, region);
-
   TRY(cl_event_check_waitlist, num_events_in_wait_list, event_wait_list, event, src_mem->ctx);
 
+  cl_mem_kernel_copy_image(command_queue, src_image, dst_image, src_origin, dst_origin, region);
+
   data = &no_wait_data;
   data->type = EnqueueCopyImage;
   data->queue = command_queue;
@@ -2387,7 +2433,7 @@ clEnqueueCopyImage(cl_command_queue      command_queue,
       cl_event_get_timestamp(*event, CL_PROFILING_COMMAND_SUBMIT);
     }
 
-    err = cl_command_queue_flush(command_queue);
+    err = cl_command_queue_batch(command_queue);
   }
 
   if(b_output_kernel_perf)
@@ -2438,10 +2484,10 @@ clEnqueueCopyImageToBuffer(cl_command_queue  command_queue,
     goto error;
   }
 
-  cl_mem_copy_image_to_buffer(command_queue, src_image, dst_buffer, src_origin, dst_offset, region);
-
   TRY(cl_event_check_waitlist, num_events_in_wait_list, event_wait_list, event, src_mem->ctx);
 
+  cl_mem_copy_image_to_buffer(command_queue, src_image, dst_buffer, src_origin, dst_offset, region);
+
   data = &no_wait_data;
   data->type = EnqueueCopyImageToBuffer;
   data->queue = command_queue;
@@ -2453,7 +2499,7 @@ clEnqueueCopyImageToBuffer(cl_command_queue  command_queue,
       cl_event_get_timestamp(*event, CL_PROFILING_COMMAND_SUBMIT);
     }
 
-    err = cl_command_queue_flush(command_queue);
+    err = cl_command_queue_batch(command_queue);
   }
 
   if(b_output_kernel_perf)
@@ -2504,10 +2550,10 @@ clEnqueueCopyBufferToImage(cl_command_queue  command_queue,
     goto error;
   }
 
-  cl_mem_copy_buffer_to_image(command_queue, src_buffer, dst_image, src_offset, dst_origin, region);
-
   TRY(cl_event_check_waitlist, num_events_in_wait_list, event_wait_list, event, dst_mem->ctx);
 
+  cl_mem_copy_buffer_to_image(command_queue, src_buffer, dst_image, src_offset, dst_origin, region);
+
   data = &no_wait_data;
   data->type = EnqueueCopyBufferToImage;
   data->queue = command_queue;
@@ -2519,7 +2565,7 @@ clEnqueueCopyBufferToImage(cl_command_queue  command_queue,
       cl_event_get_timestamp(*event, CL_PROFILING_COMMAND_SUBMIT);
     }
 
-    err = cl_command_queue_flush(command_queue);
+    err = cl_command_queue_batch(command_queue);
   }
 
   if(b_output_kernel_perf)
@@ -2967,6 +3013,13 @@ clEnqueueNDRangeKernel(cl_command_queue  command_queue,
     }
   }
 
+  /* A launch with dependencies gets a batch buffer of its own */
+  if (event != NULL || num_events_in_wait_list > 0) {
+    err = cl_command_queue_flush_batch(command_queue);
+    if (err != CL_SUCCESS)
+      goto error;
+  }
+
   /* Do device specific checks are enqueue the kernel */
   err = cl_command_queue_ND_range(command_queue,
                                   kernel,
@@ -2988,7 +3041,7 @@ clEnqueueNDRangeKernel(cl_command_queue  command_queue,
       cl_event_get_timestamp(*event, CL_PROFILING_COMMAND_SUBMIT);
     }
 
-    err = cl_command_queue_flush(command_queue);
+    err = cl_command_queue_batch(command_queue);
   }
 
   if(b_output_kernel_perf)
@@ -3180,6 +3233,7 @@ internal_clGetExtensionFunctionAddress(const char *func_name)
   EXTFUNC(clCreateBufferFromLibvaIntel)
   EXTFUNC(clCreateImageFromLibvaIntel)
   EXTFUNC(clGetMemObjectFdIntel)
+  EXTFUNC(clSetKernelArgConstantIntel)
   return NULL;
 }
 
@@ -3212,6 +3266,8 @@ clMapBufferIntel(cl_mem mem, cl_int *errcode_ret)
   void *ptr = NULL;
   cl_int err = CL_SUCCESS;
   CHECK_MEM (mem);
+  /* No queue tells which batched kernels write the buffer */
+  cl_context_flush_batches(mem->ctx);
   ptr = cl_mem_map(mem, 1);
 error:
   if (errcode_ret)
@@ -3235,6 +3291,8 @@ clMapBufferGTTIntel(cl_mem mem, cl_int *errcode_ret)
   void *ptr = NULL;
   cl_int err = CL_SUCCESS;
   CHECK_MEM (mem);
+  /* No queue tells which batched kernels write the buffer */
+  cl_context_flush_batches(mem->ctx);
   ptr = cl_mem_map_gtt(mem);
 error:
   if (errcode_ret)
@@ -3348,3 +3406,16 @@ clGetMemObjectFdIntel(cl_context context,
 error:
   return err;
 }
+
+extern CL_API_ENTRY cl_int CL_API_CALL
+clSetKernelArgConstantIntel(cl_kernel    kernel,
+                            cl_uint      arg_index,
+                            size_t       arg_size,
+                            const void * arg_value)
+{
+  cl_int err = CL_SUCCESS;
+  CHECK_KERNEL(kernel);
+  err = cl_kernel_set_arg_constant(kernel, arg_index, arg_size, arg_value);
+error:
+  return err;
+}
@@ -30,10 +30,13 @@
 #include "cl_driver.h"
 #include "cl_khr_icd.h"
 #include "cl_event.h"
+#include "cl_event_dispatcher.h"
+#include "cl_access_set.h"
 #include "performance.h"
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 LOCAL cl_command_queue
@@ -47,6 +50,7 @@ cl_command_queue_new(cl_context ctx)
   queue->magic = CL_MAGIC_QUEUE_HEADER;
   queue->ref_n = 1;
   queue->ctx = ctx;
+  pthread_mutex_init(&queue->last_event_lock, NULL);
   if ((queue->thread_data = cl_thread_data_create()) == NULL) {
     goto error;
   }
@@ -73,13 +77,20 @@ error:
 LOCAL void
 cl_command_queue_delete(cl_command_queue queue)
 {
+  cl_event last_event;
+
   assert(queue);
   if (atomic_dec(&queue->ref_n) != 1) return;
 
+  // The event dispatcher runs the deferred commands and calls the
+  // call-back functions of the queue, wait for it.
+  cl_event_dispatcher_wait_queue(queue, CL_TRUE);
   // If there is a valid last event, we need to give it a chance to
   // call the call-back function.
-  if (queue->last_event && queue->last_event->user_cb)
-    cl_event_update_status(queue->last_event, 1);
+  last_event = cl_command_queue_get_last_event(queue);
+  if (last_event && last_event->user_cb)
+    cl_event_update_status(last_event, 1);
+  cl_event_delete(last_event);
   /* Remove it from the list */
   assert(queue->ctx);
   pthread_mutex_lock(&queue->ctx->queue_lock);
@@ -96,6 +107,8 @@ cl_command_queue_delete(cl_command_queue queue)
   cl_mem_delete(queue->perf);
   cl_context_delete(queue->ctx);
   cl_free(queue->wait_events);
+  cl_free(queue->pending_events);
+  pthread_mutex_destroy(&queue->last_event_lock);
   queue->magic = CL_MAGIC_DEAD_HEADER; /* For safety */
   cl_free(queue);
 }
@@ -106,6 +119,20 @@ cl_command_queue_add_ref(cl_command_queue queue)
   atomic_inc(&queue->ref_n);
 }
 
+LOCAL cl_event
+cl_command_queue_get_last_event(cl_command_queue queue)
+{
+  cl_event event;
+
+  /* cl_event_delete clears last_event under the lock before freeing it */
+  pthread_mutex_lock(&queue->last_event_lock);
+  event = queue->last_event;
+  if (event)
+    cl_event_add_ref(event);
+  pthread_mutex_unlock(&queue->last_event_lock);
+  return event;
+}
+
 static void
 set_image_info(char *curbe,
                struct ImageInfo * image_info,
@@ -200,19 +227,32 @@ cl_command_queue_ND_range(cl_command_queue queue,
                           const size_t *local_wk_sz)
 {
   if(b_output_kernel_perf)
-    time_start(queue->ctx, cl_kernel_get_name(k), queue);
+    time_start(queue->ctx, k, work_dim, global_wk_sz, local_wk_sz, queue);
   const int32_t ver = cl_driver_get_ver(queue->ctx->drv);
   cl_int err = CL_SUCCESS;
 
   /* Check that the user did not forget any argument */
-  TRY (cl_kernel_check_args, k);
-
+  if ((err = cl_kernel_check_args(k)) != CL_SUCCESS)
+    return err;
+
+  /* The other threads may flush the batch buffer of this one, but not while
+   * the launch is recorded in it. cl_command_queue_batch or handle_events
+   * lets them again */
+  cl_thread_batch_lock(queue);
+  /* Other threads may launch the same kernel: the code to run and the curbes
+   * stay the ones of this launch until they are in the batch buffer */
+  pthread_mutex_lock(&k->lock);
+  /* Run the code specialized on the constant arguments */
+  TRY (cl_kernel_specialize, k);
   if (ver == 7 || ver == 75 || ver == 8 || ver == 9)
     TRY (cl_command_queue_ND_range_gen7, queue, k, work_dim, global_wk_off, global_wk_sz, local_wk_sz);
   else
     FATAL ("Unknown Gen Device");
 
 error:
+  pthread_mutex_unlock(&k->lock);
+  if (err != CL_SUCCESS)
+    cl_thread_batch_unlock(queue);
   return err;
 }
 
@@ -252,28 +292,110 @@ LOCAL cl_int
 cl_command_queue_flush(cl_command_queue queue)
 {
   int err;
+  cl_event last_event;
   GET_QUEUE_THREAD_GPGPU(queue);
   err = cl_command_queue_flush_gpgpu(queue, gpgpu);
-  // As we don't have a deadicate timer thread to take care the possible
-  // event which has a call back function registerred and the event will
-  // be released at the call back function, no other function will access
-  // the event any more. If we don't do this here, we will leak that event
-  // and all the corresponding buffers which is really bad.
-  if (queue->last_event && queue->last_event->user_cb)
-    cl_event_update_status(queue->last_event, 1);
+  // Without the event dispatcher to take care the possible event which
+  // has a call back function registerred and the event will be released
+  // at the call back function, no other function will access the event
+  // any more. If we don't do this here, we will leak that event and all
+  // the corresponding buffers which is really bad.
+  last_event = cl_command_queue_get_last_event(queue);
+  if (last_event && last_event->user_cb &&
+      last_event->dispatch_state == CL_DISPATCH_NONE)
+    cl_event_update_status(last_event, 1);
+  cl_event_delete(last_event);
   if (queue->current_event && err == CL_SUCCESS)
     err = cl_event_flush(queue->current_event);
   cl_invalid_thread_gpgpu(queue);
+  cl_thread_batch_unlock(queue);
   return err;
 }
 
 LOCAL cl_int
 cl_command_queue_finish(cl_command_queue queue)
 {
-  cl_gpgpu_sync(cl_get_thread_batch_buf(queue));
+  /* The launches of all the threads, batched or not */
+  cl_int err = cl_thread_flush_batches(queue, 1);
+  /* The commands the dispatcher submitted run in other batches */
+  cl_event_dispatcher_wait_queue(queue, CL_TRUE);
+  return err;
+}
+
+#define DEFAULT_BATCH_LIMIT 16
+static int batch_limit = -1;
+
+LOCAL int
+cl_command_queue_get_batch_limit(void)
+{
+  if (batch_limit < 0) {
+    const char *env = getenv("OCL_BATCH_KERNEL_NUM");
+    int limit = DEFAULT_BATCH_LIMIT;
+    if (env != NULL && atoi(env) >= 0)
+      limit = atoi(env);
+    batch_limit = limit > 1 ? limit : 1;
+  }
+  return batch_limit;
+}
+
+/* Whether the last event has a callback, without taking a reference on it */
+static int
+last_event_has_callback(cl_command_queue queue)
+{
+  int has_callback;
+
+  pthread_mutex_lock(&queue->last_event_lock);
+  has_callback = queue->last_event && queue->last_event->user_cb;
+  pthread_mutex_unlock(&queue->last_event_lock);
+  return has_callback;
+}
+
+LOCAL cl_int
+cl_command_queue_batch(cl_command_queue queue)
+{
+  GET_QUEUE_THREAD_GPGPU(queue);
+  const int batched_n = cl_get_thread_batched_num(queue) + 1;
+  size_t global_wk_sz[3];
+  size_t outbuf_sz = 0;
+
+  /* The printf output is read back at the flush and the timings need the
+   * launch alone in its batch. The launches of an out-of-order queue share
+   * the batch too: only the ones with a hazard flush the caches in between */
+  if (batched_n >= cl_command_queue_get_batch_limit() ||
+      queue->current_event != NULL ||
+      last_event_has_callback(queue) ||
+      (queue->props & CL_QUEUE_PROFILING_ENABLE) ||
+      b_output_kernel_perf ||
+      cl_gpgpu_get_printf_info(gpgpu, global_wk_sz, &outbuf_sz) != NULL)
+    return cl_command_queue_flush(queue);
+
+  cl_set_thread_batched_num(queue, batched_n);
+  cl_thread_batch_unlock(queue);
   return CL_SUCCESS;
 }
 
+LOCAL cl_int
+cl_command_queue_flush_batch(cl_command_queue queue)
+{
+  const int locked = cl_thread_batch_lock(queue);
+  cl_int err = CL_SUCCESS;
+
+  if (cl_get_thread_batched_num(queue) > 0) {
+    GET_QUEUE_THREAD_GPGPU(queue);
+    err = cl_command_queue_flush_gpgpu(queue, gpgpu);
+    cl_invalid_thread_gpgpu(queue);
+  }
+  if (locked)
+    cl_thread_batch_unlock(queue);
+  return err;
+}
+
+LOCAL cl_int
+cl_command_queue_flush_batches(cl_command_queue queue)
+{
+  return cl_thread_flush_batches(queue, 0);
+}
+
 #define DEFAULT_WAIT_EVENTS_SIZE  16
 LOCAL void
 cl_command_queue_insert_event(cl_command_queue queue, cl_event event)
@@ -411,3 +533,66 @@ cl_command_queue_remove_barrier_event(cl_command_queue queue, cl_event event)
   }
   queue->barrier_events_num -= 1;
 }
+
+LOCAL void
+cl_command_queue_insert_pending_event(cl_command_queue queue, cl_event event)
+{
+  cl_event *new_list;
+
+  assert(queue != NULL && event->enqueue_cb != NULL);
+  if(queue->pending_events_num == queue->pending_events_size) {
+    new_list = cl_realloc(queue->pending_events,
+                          sizeof(cl_event) * MAX(2 * queue->pending_events_size, DEFAULT_WAIT_EVENTS_SIZE));
+    //not tracked, the command is then only ordered by its wait list
+    if(new_list == NULL)
+      return;
+    queue->pending_events = new_list;
+    queue->pending_events_size = MAX(2 * queue->pending_events_size, DEFAULT_WAIT_EVENTS_SIZE);
+  }
+  queue->pending_events[queue->pending_events_num++] = event;
+}
+
+LOCAL void
+cl_command_queue_remove_pending_event(cl_command_queue queue, cl_event event)
+{
+  cl_int i;
+
+  for(i=0; i<queue->pending_events_num; i++) {
+    if(queue->pending_events[i] == event)
+      break;
+  }
+  if(i == queue->pending_events_num)
+    return;
+
+  //keep the enqueue order
+  memmove(queue->pending_events + i, queue->pending_events + i + 1,
+          sizeof(cl_event) * (queue->pending_events_num - i - 1));
+  queue->pending_events_num -= 1;
+}
+
+LOCAL cl_int
+cl_command_queue_get_hazards(cl_command_queue queue, const cl_access_set *access, cl_event **hazards)
+{
+  cl_event event;
+  cl_int i, n = 0;
+
+  *hazards = NULL;
+  pthread_mutex_lock(&queue->ctx->event_lock);
+  if(queue->pending_events_num == 0)
+    goto exit;
+  TRY_ALLOC_NO_ERR (*hazards, CALLOC_ARRAY(cl_event, queue->pending_events_num));
+  for(i=0; i<queue->pending_events_num; i++) {
+    event = queue->pending_events[i];
+    if(cl_access_set_hazard(&event->enqueue_cb->access, access)) {
+      cl_event_add_ref(event);
+      (*hazards)[n++] = event;
+    }
+  }
+
+exit:
+  pthread_mutex_unlock(&queue->ctx->event_lock);
+  return n;
+error:
+  //only ordered by its wait list then
+  goto exit;
+}
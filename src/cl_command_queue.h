@@ -27,6 +27,7 @@
 #include <stdint.h>
 
 struct intel_gpgpu;
+struct _cl_access_set;
 
 /* Basically, this is a (kind-of) batch buffer */
 struct _cl_command_queue {
@@ -41,11 +42,17 @@ struct _cl_command_queue {
   cl_int    wait_events_num;           /* Number of Non-complete user events */
   cl_int    wait_events_size;          /* The size of array that wait_events point to */
   cl_event  last_event;                /* The last event in the queue, for enqueue mark used */
+  pthread_mutex_t last_event_lock;     /* To set, clear and read last_event from any thread */
   cl_event  current_event;             /* Current event. */
   cl_command_queue_properties  props;  /* Queue properties */
   cl_command_queue prev, next;         /* We chain the command queues together */
   void *thread_data;                   /* Used to store thread context data */
   cl_mem perf;                         /* Where to put the perf counters */
+  volatile int deferred_n;             /* Commands the event dispatcher did not submit yet */
+  volatile int dispatched_n;           /* Events of the queue held by the event dispatcher */
+  cl_event* pending_events;            /* Deferred commands of the out-of-order queue, oldest first */
+  cl_int    pending_events_num;        /* Number of deferred commands */
+  cl_int    pending_events_size;       /* The size of array that pending_events point to */
 };
 
 /* The macro to get the thread specified gpgpu struct. */
@@ -85,6 +92,23 @@ extern int cl_command_queue_flush_gpgpu(cl_command_queue, cl_gpgpu);
 /* Wait for the completion of the command queue */
 extern cl_int cl_command_queue_finish(cl_command_queue);
 
+/* Most launches the thread may record in one batch buffer before submitting it */
+extern int cl_command_queue_get_batch_limit(void);
+
+/* Leave the last launch in the batch buffer of the thread when nothing
+ * prevents it, flush the queue otherwise
+ */
+extern cl_int cl_command_queue_batch(cl_command_queue);
+
+/* Submit the launches the thread left in its batch buffer */
+extern cl_int cl_command_queue_flush_batch(cl_command_queue);
+
+/* Submit the launches all the threads left in their batch buffers */
+extern cl_int cl_command_queue_flush_batches(cl_command_queue);
+
+/* The last event flushed on the queue with a reference on it, NULL if none */
+extern cl_event cl_command_queue_get_last_event(cl_command_queue);
+
 /* Bind all the surfaces in the GPGPU state */
 extern cl_int cl_command_queue_bind_surface(cl_command_queue, cl_kernel);
 
@@ -101,5 +125,15 @@ extern void cl_command_queue_insert_barrier_event(cl_command_queue queue, cl_eve
 
 extern void cl_command_queue_remove_barrier_event(cl_command_queue queue, cl_event event);
 
+/* Insert a deferred command of the out-of-order queue in pending_events, with ctx->event_lock held */
+extern void cl_command_queue_insert_pending_event(cl_command_queue, cl_event);
+
+/* Remove a command from pending_events once submitted or cancelled, with ctx->event_lock held */
+extern void cl_command_queue_remove_pending_event(cl_command_queue, cl_event);
+
+/* The deferred commands of the queue having a hazard with a command accessing
+ * access, with a reference on each. Returns their number */
+extern cl_int cl_command_queue_get_hazards(cl_command_queue, const struct _cl_access_set *access, cl_event **hazards);
+
 #endif /* __CL_COMMAND_QUEUE_H__ */
 
@@ -25,6 +25,7 @@
 #include "cl_mem.h"
 #include "cl_utils.h"
 #include "cl_alloc.h"
+#include "cl_access_set.h"
 
 #include <assert.h>
 #include <stdio.h>
@@ -34,21 +35,19 @@
 static INLINE size_t cl_kernel_compute_batch_sz(cl_kernel k) { return 256+256; }
 
 /* "Varing" payload is the part of the curbe that changes accross threads in the
- *  same work group. Right now, it consists in local IDs and block IPs
+ *  same work group. Right now, it consists in local IDs and block IPs. They
+ *  only depend on the work group shape, so they are written once per shape
+ *  directly in the thread curbes
  */
-static cl_int
-cl_set_varying_payload(const cl_kernel ker,
-                       char *data,
-                       const size_t *local_wk_sz,
-                       size_t simd_sz,
-                       size_t cst_sz,
-                       size_t thread_n)
+static void
+cl_set_varying_payload(const cl_kernel ker, const cl_curbe_payload *payload)
 {
-  uint32_t *ids[3] = {NULL,NULL,NULL};
-  uint16_t *block_ips = NULL;
-  size_t i, j, k, curr = 0;
+  const size_t local_sz = payload->local_wk_sz[0] * payload->local_wk_sz[1] * payload->local_wk_sz[2];
+  const size_t simd_sz = payload->simd_sz;
+  char *data = payload->data;
+  uint32_t id[3] = {0, 0, 0};
+  size_t i, j, curr = 0;
   int32_t id_offset[3], ip_offset;
-  cl_int err = CL_SUCCESS;
   int32_t dw_ip_offset = -1;
 
   id_offset[0] = interp_kernel_get_curbe_offset(ker->opaque, GBE_CURBE_LOCAL_ID_X, 0);
@@ -63,45 +62,102 @@ cl_set_varying_payload(const cl_kernel ker,
          id_offset[2] >= 0 &&
          (ip_offset >= 0 || dw_ip_offset >= 0));
 
-  TRY_ALLOC(ids[0], (uint32_t*) alloca(sizeof(uint32_t)*thread_n*simd_sz));
-  TRY_ALLOC(ids[1], (uint32_t*) alloca(sizeof(uint32_t)*thread_n*simd_sz));
-  TRY_ALLOC(ids[2], (uint32_t*) alloca(sizeof(uint32_t)*thread_n*simd_sz));
-  TRY_ALLOC(block_ips, (uint16_t*) alloca(sizeof(uint16_t)*thread_n*simd_sz));
-  /* 0xffff means that the lane is inactivated */
-  memset(block_ips, 0xff, sizeof(int16_t)*thread_n*simd_sz);
-
-
-  /* Compute the IDs and the block IPs */
-  for (k = 0; k < local_wk_sz[2]; ++k)
-  for (j = 0; j < local_wk_sz[1]; ++j)
-  for (i = 0; i < local_wk_sz[0]; ++i, ++curr) {
-    ids[0][curr] = i;
-    ids[1][curr] = j;
-    ids[2][curr] = k;
-    block_ips[curr] = 0;
-  }
-
-  /* Copy them to the curbe buffer */
-  curr = 0;
-  for (i = 0; i < thread_n; ++i, data += cst_sz) {
+  /* Walk the work group in x, y, z order. 0xffff means that the lane is
+   * inactivated */
+  for (i = 0; i < payload->thread_n; ++i, data += payload->cst_sz) {
     uint32_t *ids0 = (uint32_t *) (data + id_offset[0]);
     uint32_t *ids1 = (uint32_t *) (data + id_offset[1]);
     uint32_t *ids2 = (uint32_t *) (data + id_offset[2]);
     uint16_t *ips  = (uint16_t *) (data + ip_offset);
     uint32_t *dw_ips  = (uint32_t *) (data + dw_ip_offset);
     for (j = 0; j < simd_sz; ++j, ++curr) {
-      ids0[j] = ids[0][curr];
-      ids1[j] = ids[1][curr];
-      ids2[j] = ids[2][curr];
+      const int active = curr < local_sz;
+      ids0[j] = active ? id[0] : 0;
+      ids1[j] = active ? id[1] : 0;
+      ids2[j] = active ? id[2] : 0;
       if (ip_offset >= 0)
-        ips[j] = block_ips[curr];
+        ips[j] = active ? 0 : 0xffff;
       if (dw_ip_offset >= 0)
-        dw_ips[j] = block_ips[curr];
+        dw_ips[j] = active ? 0 : 0xffff;
+      if (++id[0] == payload->local_wk_sz[0]) {
+        id[0] = 0;
+        if (++id[1] == payload->local_wk_sz[1]) {
+          id[1] = 0;
+          ++id[2];
+        }
+      }
     }
   }
+}
 
-error:
-  return err;
+/* Copy to all the thread curbes the words of the shared curbe modified since
+ * the last launch. The varying payload is never written in the shared curbe
+ * so it is left untouched
+ */
+static void
+cl_patch_thread_curbes(const cl_kernel ker, cl_curbe_payload *payload)
+{
+  const uint32_t *curbe = (const uint32_t *) ker->curbe;
+  uint32_t *shared = (uint32_t *) payload->shared;
+  const size_t word_n = payload->cst_sz / sizeof(uint32_t);
+  size_t i = 0, first, t;
+
+  while (i < word_n) {
+    if (curbe[i] == shared[i]) {
+      ++i;
+      continue;
+    }
+    for (first = i; i < word_n && curbe[i] != shared[i]; ++i)
+      shared[i] = curbe[i];
+    for (t = 0; t < payload->thread_n; ++t)
+      memcpy(payload->data + t * payload->cst_sz + first * sizeof(uint32_t),
+             curbe + first, (i - first) * sizeof(uint32_t));
+  }
+}
+
+/* Get the curbes of all the threads of a work group, built from the shared
+ * curbe and the varying payload. They belong to the kernel: the caller holds
+ * the kernel lock until they are uploaded, since the next launch updates or
+ * reallocates them
+ */
+static char *
+cl_get_thread_curbes(const cl_kernel ker,
+                     const size_t *local_wk_sz,
+                     size_t simd_sz,
+                     size_t cst_sz,
+                     size_t thread_n)
+{
+  cl_curbe_payload *payload = ker->payload;
+  size_t i;
+
+  if (payload &&
+      payload->local_wk_sz[0] == local_wk_sz[0] &&
+      payload->local_wk_sz[1] == local_wk_sz[1] &&
+      payload->local_wk_sz[2] == local_wk_sz[2] &&
+      payload->simd_sz == simd_sz &&
+      payload->cst_sz == cst_sz &&
+      payload->thread_n == thread_n) {
+    cl_patch_thread_curbes(ker, payload);
+    return payload->data;
+  }
+
+  /* New work group shape: build everything again */
+  cl_kernel_release_payload(ker);
+  payload = cl_malloc(sizeof(cl_curbe_payload) + (thread_n + 1) * cst_sz);
+  if (payload == NULL)
+    return NULL;
+  memcpy(payload->local_wk_sz, local_wk_sz, sizeof(payload->local_wk_sz));
+  payload->simd_sz = simd_sz;
+  payload->thread_n = thread_n;
+  payload->cst_sz = cst_sz;
+  payload->shared = (char *) (payload + 1);
+  payload->data = payload->shared + cst_sz;
+  memcpy(payload->shared, ker->curbe, cst_sz);
+  for (i = 0; i < thread_n; ++i)
+    memcpy(payload->data + cst_sz * i, ker->curbe, cst_sz);
+  cl_set_varying_payload(ker, payload);
+  ker->payload = payload;
+  return payload->data;
 }
 
 static int
@@ -170,10 +226,9 @@ cl_upload_constant_buffer(cl_command_queue queue, cl_kernel ker)
       assert(curbe_offset >= 0);
       *(uint32_t *) (ker->curbe + curbe_offset) = offset;
 
-      cl_buffer_map(mem->bo, 1);
-      void * addr = cl_buffer_get_virtual(mem->bo);
+      void * addr = cl_mem_map(mem, 1);
       memcpy(cst_addr + offset, addr, mem->size);
-      cl_buffer_unmap(mem->bo);
+      cl_mem_unmap(mem);
       offset += mem->size;
     }
   }
@@ -298,6 +353,27 @@ cl_bind_printf(cl_gpgpu gpgpu, cl_kernel ker, void* printf_info, int printf_num,
   return 0;
 }
 
+/* An out-of-order queue only flushes the caches between the launches of a
+ * batch which have a hazard. The objects the launch accesses are also kept
+ * for the command being enqueued, to order it after the commands of the
+ * queue not submitted yet
+ */
+static void
+cl_command_queue_track_access(cl_command_queue queue, cl_gpgpu gpgpu, cl_kernel ker, int new_batch)
+{
+  cl_access_set *batch_access = cl_get_thread_batch_access_set(queue);
+  cl_access_set access;
+
+  cl_access_set_clear(&access);
+  cl_access_set_add_kernel(&access, ker);
+  if (new_batch || cl_access_set_hazard(batch_access, &access))
+    cl_access_set_clear(batch_access);
+  else
+    cl_gpgpu_skip_flush(gpgpu);
+  cl_access_set_merge(batch_access, &access);
+  cl_access_set_merge(cl_get_thread_access_set(queue), &access);
+}
+
 LOCAL cl_int
 cl_command_queue_ND_range_gen7(cl_command_queue queue,
                                cl_kernel ker,
@@ -311,11 +387,12 @@ cl_command_queue_ND_range_gen7(cl_command_queue queue,
   char *final_curbe = NULL;  /* Includes them and one sub-buffer per group */
   cl_gpgpu_kernel kernel;
   const uint32_t simd_sz = cl_kernel_get_simd_width(ker);
-  size_t i, batch_sz = 0u, local_sz = 0u;
+  size_t batch_sz = 0u, local_sz = 0u;
   size_t cst_sz = ker->curbe_sz= interp_kernel_get_curbe_size(ker->opaque);
   int32_t scratch_sz = interp_kernel_get_scratch_size(ker->opaque);
   size_t thread_n = 0u;
   int printf_num = 0;
+  int new_batch;
   cl_int err = CL_SUCCESS;
   size_t global_size = global_wk_sz[0] * global_wk_sz[1] * global_wk_sz[2];
   void* printf_info = NULL;
@@ -386,20 +463,22 @@ cl_command_queue_ND_range_gen7(cl_command_queue queue,
   /* Curbe step 2. Give the localID and upload it to video memory */
   if (ker->curbe) {
     assert(cst_sz > 0);
-    TRY_ALLOC (final_curbe, (char*) alloca(thread_n * cst_sz));
-    for (i = 0; i < thread_n; ++i) {
-        memcpy(final_curbe + cst_sz * i, ker->curbe, cst_sz);
-    }
-    TRY (cl_set_varying_payload, ker, final_curbe, local_wk_sz, simd_sz, cst_sz, thread_n);
+    TRY_ALLOC (final_curbe, cl_get_thread_curbes(ker, local_wk_sz, simd_sz, cst_sz, thread_n));
     if (cl_gpgpu_upload_curbes(gpgpu, final_curbe, thread_n*cst_sz) != 0)
       goto error;
   }
 
-  /* Start a new batch buffer */
-  batch_sz = cl_kernel_compute_batch_sz(ker);
-  if (cl_gpgpu_batch_reset(gpgpu, batch_sz) != 0)
-    goto error;
-  cl_set_thread_batch_buf(queue, cl_gpgpu_ref_batch_buf(gpgpu));
+  /* Start a new batch buffer unless the previous launches are still waiting
+   * in it. The pipe control of the batch start orders the walkers */
+  new_batch = cl_get_thread_batched_num(queue) == 0;
+  if (new_batch) {
+    batch_sz = cl_kernel_compute_batch_sz(ker) * cl_command_queue_get_batch_limit();
+    if (cl_gpgpu_batch_reset(gpgpu, batch_sz) != 0)
+      goto error;
+    cl_set_thread_batch_buf(queue, cl_gpgpu_ref_batch_buf(gpgpu));
+  }
+  if (queue->props & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE)
+    cl_command_queue_track_access(queue, gpgpu, ker, new_batch);
   cl_gpgpu_batch_start(gpgpu);
 
   /* Issue the GPGPU_WALKER command */
@@ -28,6 +28,8 @@
 #include "cl_khr_icd.h"
 #include "cl_kernel.h"
 #include "cl_program.h"
+#include "cl_program_registry.h"
+#include "cl_suballoc.h"
 
 #include "CL/cl.h"
 #include "CL/cl_gl.h"
@@ -176,6 +178,8 @@ cl_context_new(struct _cl_context_prop *props)
   pthread_mutex_init(&ctx->queue_lock, NULL);
   pthread_mutex_init(&ctx->buffer_lock, NULL);
   pthread_mutex_init(&ctx->sampler_lock, NULL);
+  cl_handle_registry_init(&ctx->handles);
+  ctx->suballoc = cl_suballoc_new(ctx);
 
 exit:
   return ctx;
@@ -223,6 +227,8 @@ cl_context_delete(cl_context ctx)
   assert(ctx->programs == NULL);
   assert(ctx->buffers == NULL);
   assert(ctx->drv);
+  cl_suballoc_delete(ctx->suballoc);
+  cl_handle_registry_destroy(&ctx->handles);
   cl_free(ctx->prop_user);
   cl_driver_delete(ctx->drv);
   ctx->magic = CL_MAGIC_DEAD_HEADER; /* For safety */
@@ -261,58 +267,76 @@ error:
   goto exit;
 }
 
+LOCAL void
+cl_context_flush_batches(cl_context ctx)
+{
+  cl_command_queue queue;
+
+  pthread_mutex_lock(&ctx->queue_lock);
+  for (queue = ctx->queues; queue != NULL; queue = queue->next)
+    cl_command_queue_flush_batches(queue);
+  pthread_mutex_unlock(&ctx->queue_lock);
+}
+
 cl_buffer_mgr
 cl_context_get_bufmgr(cl_context ctx)
 {
   return cl_driver_get_bufmgr(ctx->drv);
 }
 
+/* Create the kernels of the internal program(s) of index from the compiled
+ * program shared by all the contexts
+ */
+static cl_int
+cl_context_load_static_kernel(cl_context ctx, cl_int index, gbe_program opaque)
+{
+  ctx->internal_prgs[index] = cl_program_create_from_registry(ctx, opaque);
+  if (!ctx->internal_prgs[index])
+    return CL_OUT_OF_HOST_MEMORY;
+
+  /* All CL_ENQUEUE_FILL_BUFFER_ALIGN16_xxx use the same program, different kernel. */
+  if (index >= CL_ENQUEUE_FILL_BUFFER_ALIGN8_8 && index <= CL_ENQUEUE_FILL_BUFFER_ALIGN8_64) {
+    int i = CL_ENQUEUE_FILL_BUFFER_ALIGN8_8;
+    for (; i <= CL_ENQUEUE_FILL_BUFFER_ALIGN8_64; i++) {
+      if (index != i) {
+        assert(ctx->internal_prgs[i] == NULL);
+        assert(ctx->internel_kernels[i] == NULL);
+        cl_program_add_ref(ctx->internal_prgs[index]);
+        ctx->internal_prgs[i] = ctx->internal_prgs[index];
+      }
+
+      if (i == CL_ENQUEUE_FILL_BUFFER_ALIGN8_8) {
+        ctx->internel_kernels[i] = cl_program_create_kernel(ctx->internal_prgs[index],
+                                                            "__cl_fill_region_align8_2", NULL);
+      } else if (i == CL_ENQUEUE_FILL_BUFFER_ALIGN8_16) {
+        ctx->internel_kernels[i] = cl_program_create_kernel(ctx->internal_prgs[index],
+                                                            "__cl_fill_region_align8_4", NULL);
+      } else if (i == CL_ENQUEUE_FILL_BUFFER_ALIGN8_32) {
+        ctx->internel_kernels[i] = cl_program_create_kernel(ctx->internal_prgs[index],
+                                                            "__cl_fill_region_align8_8", NULL);
+      } else if (i == CL_ENQUEUE_FILL_BUFFER_ALIGN8_64) {
+        ctx->internel_kernels[i] = cl_program_create_kernel(ctx->internal_prgs[index],
+                                                            "__cl_fill_region_align8_16", NULL);
+      } else
+        assert(0);
+    }
+  } else {
+    ctx->internel_kernels[index] = cl_kernel_dup(ctx->internal_prgs[index]->ker[0]);
+  }
+  return CL_SUCCESS;
+}
+
 cl_kernel
 cl_context_get_static_kernel(cl_context ctx, cl_int index, const char * str_kernel, const char * str_option)
 {
-  cl_int ret;
   if (!ctx->internal_prgs[index]) {
     size_t length = strlen(str_kernel) + 1;
-    ctx->internal_prgs[index] = cl_program_create_from_source(ctx, 1, &str_kernel, &length, NULL);
-
-    if (!ctx->internal_prgs[index])
+    gbe_program opaque = cl_program_registry_get(ctx->device, str_kernel, length,
+                                                 CL_TRUE, str_option);
+    if (!opaque)
       return NULL;
-
-    ret = cl_program_build(ctx->internal_prgs[index], str_option);
-    if (ret != CL_SUCCESS)
+    if (cl_context_load_static_kernel(ctx, index, opaque) != CL_SUCCESS)
       return NULL;
-
-    ctx->internal_prgs[index]->is_built = 1;
-
-    /* All CL_ENQUEUE_FILL_BUFFER_ALIGN16_xxx use the same program, different kernel. */
-    if (index >= CL_ENQUEUE_FILL_BUFFER_ALIGN8_8 && index <= CL_ENQUEUE_FILL_BUFFER_ALIGN8_64) {
-      int i = CL_ENQUEUE_FILL_BUFFER_ALIGN8_8;
-      for (; i <= CL_ENQUEUE_FILL_BUFFER_ALIGN8_64; i++) {
-        if (index != i) {
-          assert(ctx->internal_prgs[i] == NULL);
-          assert(ctx->internel_kernels[i] == NULL);
-          cl_program_add_ref(ctx->internal_prgs[index]);
-          ctx->internal_prgs[i] = ctx->internal_prgs[index];
-        }
-
-        if (i == CL_ENQUEUE_FILL_BUFFER_ALIGN8_8) {
-          ctx->internel_kernels[i] = cl_program_create_kernel(ctx->internal_prgs[index],
-                                                              "__cl_fill_region_align8_2", NULL);
-        } else if (i == CL_ENQUEUE_FILL_BUFFER_ALIGN8_16) {
-          ctx->internel_kernels[i] = cl_program_create_kernel(ctx->internal_prgs[index],
-                                                              "__cl_fill_region_align8_4", NULL);
-        } else if (i == CL_ENQUEUE_FILL_BUFFER_ALIGN8_32) {
-          ctx->internel_kernels[i] = cl_program_create_kernel(ctx->internal_prgs[index],
-                                                              "__cl_fill_region_align8_8", NULL);
-        } else if (i == CL_ENQUEUE_FILL_BUFFER_ALIGN8_64) {
-          ctx->internel_kernels[i] = cl_program_create_kernel(ctx->internal_prgs[index],
-                                                              "__cl_fill_region_align8_16", NULL);
-        } else
-          assert(0);
-      }
-    } else {
-      ctx->internel_kernels[index] = cl_kernel_dup(ctx->internal_prgs[index]->ker[0]);
-    }
   }
 
   return ctx->internel_kernels[index];
@@ -322,50 +346,13 @@ cl_kernel
 cl_context_get_static_kernel_from_bin(cl_context ctx, cl_int index,
                   const char * str_kernel, size_t size, const char * str_option)
 {
-  cl_int ret;
-  cl_int binary_status = CL_SUCCESS;
   if (!ctx->internal_prgs[index]) {
-    ctx->internal_prgs[index] = cl_program_create_from_binary(ctx, 1, &ctx->device,
-      &size, (const unsigned char **)&str_kernel, &binary_status, &ret);
-
-    if (!ctx->internal_prgs[index])
+    gbe_program opaque = cl_program_registry_get(ctx->device, str_kernel, size,
+                                                 CL_FALSE, str_option);
+    if (!opaque)
       return NULL;
-
-    ret = cl_program_build(ctx->internal_prgs[index], str_option);
-    if (ret != CL_SUCCESS)
+    if (cl_context_load_static_kernel(ctx, index, opaque) != CL_SUCCESS)
       return NULL;
-
-    ctx->internal_prgs[index]->is_built = 1;
-
-    /* All CL_ENQUEUE_FILL_BUFFER_ALIGN16_xxx use the same program, different kernel. */
-    if (index >= CL_ENQUEUE_FILL_BUFFER_ALIGN8_8 && index <= CL_ENQUEUE_FILL_BUFFER_ALIGN8_64) {
-      int i = CL_ENQUEUE_FILL_BUFFER_ALIGN8_8;
-      for (; i <= CL_ENQUEUE_FILL_BUFFER_ALIGN8_64; i++) {
-        if (index != i) {
-          assert(ctx->internal_prgs[i] == NULL);
-          assert(ctx->internel_kernels[i] == NULL);
-          cl_program_add_ref(ctx->internal_prgs[index]);
-          ctx->internal_prgs[i] = ctx->internal_prgs[index];
-        }
-
-        if (i == CL_ENQUEUE_FILL_BUFFER_ALIGN8_8) {
-          ctx->internel_kernels[i] = cl_program_create_kernel(ctx->internal_prgs[index],
-                                                              "__cl_fill_region_align8_2", NULL);
-        } else if (i == CL_ENQUEUE_FILL_BUFFER_ALIGN8_16) {
-          ctx->internel_kernels[i] = cl_program_create_kernel(ctx->internal_prgs[index],
-                                                              "__cl_fill_region_align8_4", NULL);
-        } else if (i == CL_ENQUEUE_FILL_BUFFER_ALIGN8_32) {
-          ctx->internel_kernels[i] = cl_program_create_kernel(ctx->internal_prgs[index],
-                                                              "__cl_fill_region_align8_8", NULL);
-        } else if (i == CL_ENQUEUE_FILL_BUFFER_ALIGN8_64) {
-          ctx->internel_kernels[i] = cl_program_create_kernel(ctx->internal_prgs[index],
-                                                              "__cl_fill_region_align8_16", NULL);
-        } else
-          assert(0);
-      }
-    } else {
-      ctx->internel_kernels[index] = cl_kernel_dup(ctx->internal_prgs[index]->ker[0]);
-    }
   }
 
   return ctx->internel_kernels[index];
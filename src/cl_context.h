@@ -92,6 +92,8 @@ struct _cl_context_prop {
   };
 };
 
+#include "cl_handle_registry.h"
+
 #define IS_EGL_CONTEXT(ctx)  (ctx->props.gl_type == CL_GL_EGL_DISPLAY)
 #define EGL_DISP(ctx)   (EGLDisplay)(ctx->props.egl_display)
 #define EGL_CTX(ctx)    (EGLContext)(ctx->props.gl_context)
@@ -125,6 +127,9 @@ struct _cl_context {
   void (CL_CALLBACK *pfn_notify)(const char *, const void *, size_t, void *);
                                      /* User's callback when error occur in context */
   void *user_data;                   /* A pointer to user supplied data */
+  struct _cl_suballoc *suballoc;     /* Carves the small buffers out of slabs */
+  cl_handle_registry handles;        /* Buffers, samplers and events, for the handle validation */
+  volatile int batched_n;            /* Kernels batched by all the threads or deferred, not submitted yet */
 
 };
 
@@ -151,6 +156,9 @@ extern cl_command_queue cl_context_create_queue(cl_context,
                                                 cl_command_queue_properties,
                                                 cl_int*);
 
+/* Submit the kernels all the threads batched on the queues of the context */
+extern void cl_context_flush_batches(cl_context);
+
 /* Enqueue a ND Range kernel */
 extern cl_int cl_context_ND_kernel(cl_context,
                                    cl_command_queue,
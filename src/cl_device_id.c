@@ -26,6 +26,7 @@
 #include "cl_khr_icd.h"
 #include "cl_thread.h"
 #include "CL/cl.h"
+#include "CL/cl_intel.h"
 #include "cl_gbe_loader.h"
 #include "cl_alloc.h"
 
@@ -847,6 +848,51 @@ cl_get_kernel_workgroup_info(cl_kernel kernel,
         return CL_SUCCESS;
       }
       return CL_SUCCESS;
+    case CL_KERNEL_COMPILE_STATS_INTEL:
+    {
+      gbe_kernel_compile_stats gbe_stats;
+      cl_kernel_compile_stats_intel stats;
+      if (interp_kernel_get_compile_stats == NULL)
+        return CL_INVALID_VALUE;
+      /* A launch may switch the kernel to its specialized code */
+      pthread_mutex_lock(&kernel->lock);
+      interp_kernel_get_compile_stats(kernel->opaque, &gbe_stats);
+      pthread_mutex_unlock(&kernel->lock);
+      stats.simd_width = gbe_stats.simd_width;
+      stats.attempts = gbe_stats.attempts;
+      stats.insn_num = gbe_stats.insn_num;
+      stats.compacted_insn_num = gbe_stats.compacted_insn_num;
+      stats.grf_num = gbe_stats.grf_num;
+      stats.spill_num = gbe_stats.spill_num;
+      stats.fill_num = gbe_stats.fill_num;
+      stats.remat_num = gbe_stats.remat_num;
+      stats.scratch_size = gbe_stats.scratch_size;
+      stats.curbe_size = gbe_stats.curbe_size;
+      stats.slm_size = gbe_stats.slm_size;
+      stats.pressure_scheduled = gbe_stats.pressure_scheduled ? CL_TRUE : CL_FALSE;
+      stats.selection_time = gbe_stats.selection_time;
+      stats.schedule_time = gbe_stats.schedule_time;
+      stats.reg_alloc_time = gbe_stats.reg_alloc_time;
+      stats.encode_time = gbe_stats.encode_time;
+      stats.total_time = gbe_stats.total_time;
+      _DECL_FIELD(stats)
+    }
+    case CL_KERNEL_COMPILE_STATS_JSON_INTEL:
+    {
+      size_t json_sz;
+      if (interp_kernel_get_compile_stats_json == NULL)
+        return CL_INVALID_VALUE;
+      pthread_mutex_lock(&kernel->lock);
+      json_sz = interp_kernel_get_compile_stats_json(kernel->opaque, NULL, 0);
+      if (param_value && param_value_size >= json_sz)
+        interp_kernel_get_compile_stats_json(kernel->opaque, param_value, param_value_size);
+      pthread_mutex_unlock(&kernel->lock);
+      if (param_value_size_ret != NULL)
+        *param_value_size_ret = json_sz;
+      if (param_value && param_value_size < json_sz)
+        return CL_INVALID_VALUE;
+      return CL_SUCCESS;
+    }
     default:
       return CL_INVALID_VALUE;
   };
@@ -113,6 +113,8 @@ struct _cl_device_id {
   cl_device_affinity_domain    affinity_domain;
   cl_device_partition_property partition_type[3];
   cl_uint      device_reference_count;
+  /* Resolves the event dependencies of all the contexts of the device */
+  struct _cl_event_dispatcher *event_dispatcher;
 };
 
 /* Get a device from the given platform */
@@ -19,6 +19,7 @@
 
 extern "C" {
 #include "intel/intel_driver.h"
+#include "null/null_driver.h"
 #include "cl_utils.h"
 #include <stdlib.h>
 #include <string.h>
@@ -30,7 +31,10 @@ namespace
   struct OCLDriverCallBackInitializer
   {
     OCLDriverCallBackInitializer(void) {
-      intel_setup_callbacks();
+      if (null_driver_enabled())
+        null_setup_callbacks();
+      else
+        intel_setup_callbacks();
     }
   };
 
@@ -124,6 +124,11 @@ extern cl_gpgpu_new_cb *cl_gpgpu_new;
 typedef void (cl_gpgpu_delete_cb)(cl_gpgpu);
 extern cl_gpgpu_delete_cb *cl_gpgpu_delete;
 
+/* Get a flushed GPGPU state ready for new launches, keeping its buffers.
+ * Fails if the GPU did not retire its last batch yet */
+typedef int (cl_gpgpu_reuse_cb)(cl_gpgpu);
+extern cl_gpgpu_reuse_cb *cl_gpgpu_reuse;
+
 /* Synchonize GPU with CPU */
 typedef void (cl_gpgpu_sync_cb)(void*);
 extern cl_gpgpu_sync_cb *cl_gpgpu_sync;
@@ -199,6 +204,12 @@ extern cl_gpgpu_batch_reset_cb *cl_gpgpu_batch_reset;
 typedef void (cl_gpgpu_batch_start_cb)(cl_gpgpu);
 extern cl_gpgpu_batch_start_cb *cl_gpgpu_batch_start;
 
+/* The next launch recorded in the batch has no hazard with the launches
+ * recorded before it: the driver only waits for them to finish before it,
+ * without flushing and invalidating the caches */
+typedef void (cl_gpgpu_skip_flush_cb)(cl_gpgpu);
+extern cl_gpgpu_skip_flush_cb *cl_gpgpu_skip_flush;
+
 /* atomic end with possibly inserted flush */
 typedef void (cl_gpgpu_batch_end_cb)(cl_gpgpu, int32_t flush_mode);
 extern cl_gpgpu_batch_end_cb *cl_gpgpu_batch_end;
@@ -366,12 +377,30 @@ extern cl_buffer_get_subdata_cb *cl_buffer_get_subdata;
 typedef int (cl_buffer_wait_rendering_cb) (cl_buffer);
 extern cl_buffer_wait_rendering_cb *cl_buffer_wait_rendering;
 
+/* Whether the GPU may still access the buffer */
+typedef int (cl_buffer_is_busy_cb) (cl_buffer);
+extern cl_buffer_is_busy_cb *cl_buffer_is_busy;
+
 typedef int (cl_buffer_get_fd_cb)(cl_buffer, int *fd);
 extern cl_buffer_get_fd_cb *cl_buffer_get_fd;
 
 typedef int (cl_buffer_get_tiling_align_cb)(cl_context ctx, uint32_t tiling_mode, uint32_t dim);
 extern cl_buffer_get_tiling_align_cb *cl_buffer_get_tiling_align;
 
+/* How the address bit 6 of a tiled buffer is swizzled in its CPU mapping */
+typedef enum cl_buffer_swizzle {
+  CL_SWIZZLE_NONE = 0,
+  CL_SWIZZLE_9,          /* bit 6 ^= bit 9 */
+  CL_SWIZZLE_9_10,       /* bit 6 ^= bit 9 ^ bit 10 */
+  CL_SWIZZLE_9_11,       /* bit 6 ^= bit 9 ^ bit 11 */
+  CL_SWIZZLE_9_10_11,    /* bit 6 ^= bit 9 ^ bit 10 ^ bit 11 */
+  CL_SWIZZLE_UNSUPPORTED /* Depends on the physical address or unknown */
+} cl_buffer_swizzle;
+
+/* Get the bit 6 swizzling of a tiled buffer */
+typedef cl_buffer_swizzle (cl_buffer_get_swizzle_cb)(cl_buffer);
+extern cl_buffer_get_swizzle_cb *cl_buffer_get_swizzle;
+
 /* Get the device id */
 typedef int (cl_driver_get_device_id_cb)(void);
 extern cl_driver_get_device_id_cb *cl_driver_get_device_id;
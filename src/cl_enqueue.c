@@ -37,7 +37,7 @@ cl_int cl_enqueue_read_buffer(enqueue_data* data)
          mem->type == CL_MEM_SUBBUFFER_TYPE);
   struct _cl_mem_buffer* buffer = (struct _cl_mem_buffer*)mem;
   if (!mem->is_userptr) {
-    if (cl_buffer_get_subdata(mem->bo, data->offset + buffer->sub_offset,
+    if (cl_buffer_get_subdata(mem->bo, mem->offset + data->offset + buffer->sub_offset,
 			       data->size, data->ptr) != 0)
       err = CL_MAP_FAILURE;
   } else {
@@ -122,7 +122,7 @@ cl_int cl_enqueue_write_buffer(enqueue_data *data)
     }
   }
   else {
-    if (cl_buffer_subdata(mem->bo, data->offset + buffer->sub_offset,
+    if (cl_buffer_subdata(mem->bo, mem->offset + data->offset + buffer->sub_offset,
 			   data->size, data->const_ptr) != 0)
       err = CL_MAP_FAILURE;
   }
@@ -183,6 +183,23 @@ error:
 }
 
 
+/* Read or write the region of a tiled image through a cached mapping */
+static cl_int
+cl_enqueue_image_cpu_tiling(enqueue_data *data, struct _cl_mem_image *image, cl_bool write)
+{
+  cl_mem mem = data->mem_obj;
+  void *tiled_ptr;
+
+  if (!(tiled_ptr = cl_mem_map(mem, write)))
+    return CL_MAP_FAILURE;
+  cl_mem_copy_image_region_tiled(data->origin, data->region,
+                                 write ? (void*)data->const_ptr : data->ptr,
+                                 data->row_pitch, data->slice_pitch,
+                                 tiled_ptr, image->row_pitch, image->slice_pitch,
+                                 image, CL_FALSE, write);
+  return cl_mem_unmap(mem);
+}
+
 cl_int cl_enqueue_read_image(enqueue_data *data)
 {
   cl_int err = CL_SUCCESS;
@@ -193,6 +210,9 @@ cl_int cl_enqueue_read_image(enqueue_data *data)
   const size_t* origin = data->origin;
   const size_t* region = data->region;
 
+  if (cl_mem_image_cpu_tiling(image))
+    return cl_enqueue_image_cpu_tiling(data, image, CL_FALSE);
+
   if (!(src_ptr = cl_mem_map_auto(mem, 0))) {
     err = CL_MAP_FAILURE;
     goto error;
@@ -236,6 +256,9 @@ cl_int cl_enqueue_write_image(enqueue_data *data)
   cl_mem mem = data->mem_obj;
   CHECK_IMAGE(mem, image);
 
+  if (cl_mem_image_cpu_tiling(image))
+    return cl_enqueue_image_cpu_tiling(data, image, CL_TRUE);
+
   if (!(dst_ptr = cl_mem_map_auto(mem, 1))) {
     err = CL_MAP_FAILURE;
     goto error;
@@ -294,8 +317,12 @@ cl_int cl_enqueue_map_image(enqueue_data *data)
   void *ptr = NULL;
   size_t row_pitch = 0;
   CHECK_IMAGE(mem, image);
+  /* The application only sees host_ptr: the CPU detiles it, unmap tiles it back */
+  cl_bool cpu_tiling = (mem->flags & CL_MEM_USE_HOST_PTR) && cl_mem_image_cpu_tiling(image);
 
-  if(data->unsync_map == 1)
+  if (cpu_tiling)
+    ptr = cl_mem_map(mem, 1);
+  else if(data->unsync_map == 1)
     //because using unsync map in clEnqueueMapBuffer, so force use map_gtt here
     ptr = cl_mem_map_gtt(mem);
   else
@@ -311,7 +338,11 @@ cl_int cl_enqueue_map_image(enqueue_data *data)
   else
     row_pitch = image->row_pitch;
 
-  if(mem->flags & CL_MEM_USE_HOST_PTR) {
+  if (cpu_tiling)
+    cl_mem_copy_image_region_tiled(data->origin, data->region,
+                                   mem->host_ptr, image->host_row_pitch, image->host_slice_pitch,
+                                   data->ptr, row_pitch, image->slice_pitch, image, CL_TRUE, CL_FALSE);
+  else if(mem->flags & CL_MEM_USE_HOST_PTR) {
     assert(mem->host_ptr);
     //src and dst need add offset in function cl_mem_copy_image_region
     cl_mem_copy_image_region(data->origin, data->region,
@@ -371,10 +402,19 @@ cl_int cl_enqueue_unmap_mem_object(enqueue_data *data)
         row_pitch = image->slice_pitch;
       else
         row_pitch = image->row_pitch;
-      //v_ptr have added offset, host_ptr have not added offset.
-      cl_mem_copy_image_region(origin, region, v_ptr, row_pitch, image->slice_pitch,
-                               memobj->host_ptr, image->host_row_pitch, image->host_slice_pitch,
-                               image, CL_FALSE, CL_TRUE);
+      if (cl_mem_image_cpu_tiling(image)) {
+        /* The buffer may have been mapped through the GTT since */
+        void *tiled_ptr = cl_mem_map(memobj, 1);
+        cl_mem_copy_image_region_tiled(origin, region,
+                                       memobj->host_ptr, image->host_row_pitch, image->host_slice_pitch,
+                                       tiled_ptr, row_pitch, image->slice_pitch,
+                                       image, CL_TRUE, CL_TRUE);
+        cl_mem_unmap(memobj);
+      } else
+        //v_ptr have added offset, host_ptr have not added offset.
+        cl_mem_copy_image_region(origin, region, v_ptr, row_pitch, image->slice_pitch,
+                                 memobj->host_ptr, image->host_row_pitch, image->host_slice_pitch,
+                                 image, CL_FALSE, CL_TRUE);
     }
   } else {
     assert(v_ptr == mapped_ptr);
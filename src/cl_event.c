@@ -24,11 +24,13 @@
 #include "cl_khr_icd.h"
 #include "cl_kernel.h"
 #include "cl_command_queue.h"
+#include "cl_device_id.h"
+#include "cl_event_dispatcher.h"
 
 #include <assert.h>
 #include <stdio.h>
 
-inline cl_bool
+cl_bool
 cl_event_is_gpu_command_type(cl_command_type type)
 {
   switch(type) {
@@ -46,17 +48,28 @@ cl_event_is_gpu_command_type(cl_command_type type)
   }
 }
 
+/* Drop the gpgpu of a deferred command once submitted or cancelled. Its
+ * launches no longer keep the released small buffers from being recycled */
+static void cl_event_drop_gpgpu(cl_event event)
+{
+  cl_gpgpu_delete(event->gpgpu);
+  event->gpgpu = NULL;
+  atomic_add(&event->ctx->batched_n, -event->gpgpu_batched_n);
+  event->gpgpu_batched_n = 0;
+}
+
 int cl_event_flush(cl_event event)
 {
   int err = CL_SUCCESS;
   assert(event->gpgpu_event != NULL);
   if (event->gpgpu) {
     err = cl_command_queue_flush_gpgpu(event->queue, event->gpgpu);
-    cl_gpgpu_delete(event->gpgpu);
-    event->gpgpu = NULL;
+    cl_event_drop_gpgpu(event);
   }
   cl_gpgpu_event_flush(event->gpgpu_event);
+  pthread_mutex_lock(&event->queue->last_event_lock);
   event->queue->last_event = event;
+  pthread_mutex_unlock(&event->queue->last_event_lock);
   return err;
 }
 
@@ -80,6 +93,8 @@ cl_event cl_event_new(cl_context ctx, cl_command_queue queue, cl_command_type ty
   pthread_mutex_unlock(&ctx->event_lock);
   event->ctx   = ctx;
   cl_context_add_ref(ctx);
+  if (cl_handle_registry_add(&ctx->handles, event) != 0)
+    goto error;
 
   /* Initialize all members and create GPGPU event object */
   event->queue = queue;
@@ -114,12 +129,20 @@ void cl_event_delete(cl_event event)
 
   cl_event_update_status(event, 0);
 
-  if (atomic_dec(&event->ref_n) > 1)
+  /* Nobody may take a reference from last_event between the last release
+   * and the clearing of last_event */
+  if (event->queue) {
+    pthread_mutex_lock(&event->queue->last_event_lock);
+    if (atomic_dec(&event->ref_n) > 1) {
+      pthread_mutex_unlock(&event->queue->last_event_lock);
+      return;
+    }
+    if (event->queue->last_event == event)
+      event->queue->last_event = NULL;
+    pthread_mutex_unlock(&event->queue->last_event_lock);
+  } else if (atomic_dec(&event->ref_n) > 1)
     return;
 
-  if(event->queue && event->queue->last_event == event)
-    event->queue->last_event = NULL;
-
   /* Call all user's callback if haven't execute */
   cl_event_call_callback(event, CL_COMPLETE, CL_TRUE); // CL_COMPLETE status will force all callbacks that are not executed to run
 
@@ -129,6 +152,7 @@ void cl_event_delete(cl_event event)
 
   /* Remove it from the list */
   assert(event->ctx);
+  cl_handle_registry_remove(&event->ctx->handles, event);
   pthread_mutex_lock(&event->ctx->event_lock);
 
   if (event->prev)
@@ -140,13 +164,12 @@ void cl_event_delete(cl_event event)
     event->ctx->events = event->next;
 
   pthread_mutex_unlock(&event->ctx->event_lock);
-  cl_context_delete(event->ctx);
 
   if (event->gpgpu) {
     fprintf(stderr, "Warning: a event is deleted with a pending enqueued task.\n");
-    cl_gpgpu_delete(event->gpgpu);
-    event->gpgpu = NULL;
+    cl_event_drop_gpgpu(event);
   }
+  cl_context_delete(event->ctx);
   cl_free(event);
 }
 
@@ -188,6 +211,9 @@ cl_int cl_event_set_callback(cl_event event ,
     cb->next        = event->user_cb;
     event->user_cb  = cb;
     pthread_mutex_unlock(&event->ctx->event_lock);
+    // The dispatcher calls it when the GPU completes the command
+    if (event->gpgpu_event && event->enqueue_cb == NULL)
+      cl_event_dispatcher_watch(event);
   }
 
 exit:
@@ -214,8 +240,11 @@ cl_int cl_event_check_waitlist(cl_uint num_events_in_wait_list,
     goto error;
   }
 
-  /* check the event and context */
+  /* check the event and context: a released event is not in the registry
+   * anymore and must not be dereferenced */
   for(i=0; i<num_events_in_wait_list; i++) {
+    if (!cl_handle_registry_contains(&ctx->handles, event_wait_list[i]))
+      goto error;
     CHECK_EVENT(event_wait_list[i]);
     if(event_wait_list[i]->status < CL_COMPLETE) {
       err = CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST;
@@ -235,7 +264,7 @@ error:
 }
 
 cl_int cl_event_wait_events(cl_uint num_events_in_wait_list, const cl_event *event_wait_list,
-                            cl_command_queue queue)
+                            cl_command_queue queue, cl_bool async)
 {
   cl_int i;
 
@@ -255,14 +284,32 @@ cl_int cl_event_wait_events(cl_uint num_events_in_wait_list, const cl_event *eve
   if(queue && queue->barrier_events_num )
       return CL_ENQUEUE_EXECUTE_DEFER;
 
+  /* Stay behind the commands of the in-order queue left to the dispatcher */
+  if(queue && async && queue->deferred_n > 0 &&
+     !(queue->props & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE))
+    return CL_ENQUEUE_EXECUTE_DEFER;
+
   /* Non user events or all user event finished, wait all enqueue events finish */
   for(i=0; i<num_events_in_wait_list; i++) {
     if(event_wait_list[i]->status <= CL_COMPLETE)
       continue;
 
+    //the dispatcher submits it once its own wait list completes
+    if(!async && event_wait_list[i]->dispatch_state == CL_DISPATCH_DEFERRED) {
+      while(event_wait_list[i]->enqueue_cb != NULL)
+        cl_event_dispatcher_wait_progress(event_wait_list[i]->ctx->device, 1000);
+    }
     //enqueue callback haven't finish, in another thread, wait
     if(event_wait_list[i]->enqueue_cb != NULL)
       return CL_ENQUEUE_EXECUTE_DEFER;
+    //let the dispatcher wait for the GPU instead of the enqueuing thread
+    if(queue && async && event_wait_list[i]->gpgpu_event &&
+       cl_event_dispatcher_available(queue->ctx->device)) {
+      cl_event_update_status(event_wait_list[i], 0);
+      if(event_wait_list[i]->status > CL_COMPLETE)
+        return CL_ENQUEUE_EXECUTE_DEFER;
+      continue;
+    }
     if(event_wait_list[i]->gpgpu_event)
       cl_gpgpu_event_update_status(event_wait_list[i]->gpgpu_event, 1);
     cl_event_set_status(event_wait_list[i], CL_COMPLETE);  //Execute user's callback
@@ -278,13 +325,16 @@ void cl_event_new_enqueue_callback(cl_event event,
   enqueue_callback *cb, *node;
   user_event *user_events, *u_ev;
   cl_command_queue queue = event->queue;
+  const cl_bool out_of_order = queue && (queue->props & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) &&
+                               (event->gpgpu_event != NULL || data->type == EnqueueBarrier);
   cl_int i;
   cl_int err = CL_SUCCESS;
 
   /* Allocate and initialize the structure itself */
   TRY_ALLOC_NO_ERR (cb, CALLOC(enqueue_callback));
   cb->num_events = 0;
-  TRY_ALLOC_NO_ERR (cb->wait_list, CALLOC_ARRAY(cl_event, num_events_in_wait_list));
+  //commands deferred behind their in-order queue may have no wait list
+  TRY_ALLOC_NO_ERR (cb->wait_list, CALLOC_ARRAY(cl_event, MAX(num_events_in_wait_list, 1)));
   for(i=0; i<num_events_in_wait_list; i++) {
     //user event will insert to cb->wait_user_events, need not in wait list, avoid ref twice
     if(event_wait_list[i]->type != CL_COMMAND_USER) {
@@ -295,6 +345,12 @@ void cl_event_new_enqueue_callback(cl_event event,
   cb->event = event;
   cb->next = NULL;
   cb->wait_user_events = NULL;
+  if(out_of_order) {
+    if(data->type == EnqueueBarrier)
+      cb->access.all = CL_TRUE;
+    else
+      cl_access_set_merge(&cb->access, cl_get_thread_access_set(queue));
+  }
 
   if(queue && queue->barrier_events_num > 0) {
     for(i=0; i<queue->barrier_events_num; i++) {
@@ -346,7 +402,7 @@ void cl_event_new_enqueue_callback(cl_event event,
         /* Insert the enqueue_callback to user event's  waits_tail */
         node = user_events->event->waits_head;
         if(node == NULL)
-          event_wait_list[i]->waits_head = cb;
+          user_events->event->waits_head = cb;
         else{
           while((node != cb) && node->next)
             node = node->next;
@@ -369,12 +425,26 @@ void cl_event_new_enqueue_callback(cl_event event,
     }
   }
   if(data->queue != NULL && event->gpgpu_event != NULL) {
-    event->gpgpu = cl_thread_gpgpu_take(event->queue);
+    event->gpgpu = cl_thread_gpgpu_take(event->queue, &event->gpgpu_batched_n);
     data->ptr = (void *)event->gpgpu_event;
   }
   cb->data = *data;
   event->enqueue_cb = cb;
 
+  /* The later commands of the out-of-order queue wait for the ones it has a
+   * hazard with, and for all of them for a barrier. The user events may
+   * have run it already */
+  if(out_of_order) {
+    pthread_mutex_lock(&event->ctx->event_lock);
+    if(event->enqueue_cb != NULL)
+      cl_command_queue_insert_pending_event(queue, event);
+    pthread_mutex_unlock(&event->ctx->event_lock);
+  }
+
+  /* Only commands left: the dispatcher runs it once they complete */
+  if(cb->wait_user_events == NULL)
+    cl_event_dispatcher_defer(event);
+
 exit:
   return;
 error:
@@ -460,8 +530,8 @@ void cl_event_set_status(cl_event event, cl_int status)
       } else {
         if(event->gpgpu_event) {
           // Error then cancel the enqueued event.
-          cl_gpgpu_delete(event->gpgpu);
-          event->gpgpu = NULL;
+          if(event->gpgpu)
+            cl_event_drop_gpgpu(event);
         }
       }
 
@@ -476,6 +546,8 @@ void cl_event_set_status(cl_event event, cl_int status)
         cl_free(event->enqueue_cb->wait_list);
       cl_free(event->enqueue_cb);
       event->enqueue_cb = NULL;
+      if(event->queue)
+        cl_command_queue_remove_pending_event(event->queue, event);
     }
   }
   if(event->status >= status)  //maybe changed in other threads
@@ -505,12 +577,16 @@ void cl_event_set_status(cl_event event, cl_int status)
 
       /* All user events complete, now wait enqueue events */
       ret = cl_event_wait_events(enqueue_cb->num_events, enqueue_cb->wait_list,
-          enqueue_cb->event->queue);
-      assert(ret != CL_ENQUEUE_EXECUTE_DEFER);
-      ret = ~ret;
+          enqueue_cb->event->queue, CL_TRUE);
       cb = enqueue_cb;
       enqueue_cb = enqueue_cb->next;
 
+      /* The dispatcher runs it once the enqueued commands complete */
+      if(ret == CL_ENQUEUE_EXECUTE_DEFER && status == CL_COMPLETE &&
+         cl_event_dispatcher_defer(cb->event) == 0)
+        continue;
+      assert(ret != CL_ENQUEUE_EXECUTE_DEFER || status != CL_COMPLETE);
+
       /* Call the pending operation */
       evt = cb->event;
       /* TODO: if this event wait on several events, one event's
@@ -538,13 +614,72 @@ void cl_event_update_status(cl_event event, int wait)
     cl_event_set_status(event, CL_COMPLETE);
 }
 
+cl_bool cl_event_gpu_running(cl_event event)
+{
+  return event->gpgpu_event != NULL && event->enqueue_cb == NULL &&
+         cl_gpgpu_event_update_status(event->gpgpu_event, 0) == command_running;
+}
+
+cl_int cl_event_check_deferred(cl_event event, cl_event *running)
+{
+  enqueue_callback *cb = event->enqueue_cb;
+  cl_event evt;
+  cl_int i;
+
+  assert(cb && cb->wait_user_events == NULL);
+  *running = NULL;
+  for(i=0; i<cb->num_events; i++) {
+    evt = cb->wait_list[i];
+    cl_event_update_status(evt, 0);
+    if(evt->status < CL_COMPLETE)
+      return evt->status;
+    if(evt->status == CL_COMPLETE)
+      continue;
+    if(cl_event_gpu_running(evt))
+      *running = evt;
+    return CL_QUEUED;
+  }
+  return CL_COMPLETE;
+}
+
+void cl_event_submit_deferred(cl_event event, cl_int status)
+{
+  enqueue_callback *cb;
+  cl_int i;
+
+  /* Markers and cancelled commands complete right away */
+  if(status != CL_COMPLETE || event->gpgpu_event == NULL) {
+    cl_event_set_status(event, status);
+    return;
+  }
+
+  pthread_mutex_lock(&event->ctx->event_lock);
+  cb = event->enqueue_cb;
+  assert(cb);
+  cl_enqueue_handle(event, &cb->data);
+  event->enqueue_cb = NULL;
+  cl_command_queue_remove_pending_event(event->queue, event);
+  if(event->status > CL_SUBMITTED)
+    event->status = CL_SUBMITTED;
+  pthread_mutex_unlock(&event->ctx->event_lock);
+
+  for(i=0; i<cb->num_events; i++)
+    cl_event_delete(cb->wait_list[i]);
+  cl_free(cb->wait_list);
+  cl_free(cb);
+  cl_event_call_callback(event, CL_SUBMITTED, CL_FALSE);
+}
+
 cl_int cl_event_marker_with_wait_list(cl_command_queue queue,
                 cl_uint num_events_in_wait_list,
                 const cl_event *event_wait_list,
                 cl_event* event)
 {
   enqueue_data data = { 0 };
-  cl_event e;
+  cl_event e, last_event;
+
+  /* The marker waits for the kernels batched by all the threads too */
+  cl_command_queue_flush_batches(queue);
 
   e = cl_event_new(queue->ctx, queue, CL_COMMAND_MARKER, CL_TRUE);
   if(e == NULL)
@@ -557,7 +692,7 @@ cl_int cl_event_marker_with_wait_list(cl_command_queue queue,
 //enqueues a marker command which waits for either a list of events to complete, or if the list is
 //empty it waits for all commands previously enqueued in command_queue to complete before it  completes.
   if(num_events_in_wait_list > 0){
-    if(cl_event_wait_events(num_events_in_wait_list, event_wait_list, queue) == CL_ENQUEUE_EXECUTE_DEFER) {
+    if(cl_event_wait_events(num_events_in_wait_list, event_wait_list, queue, CL_TRUE) == CL_ENQUEUE_EXECUTE_DEFER) {
       data.type = EnqueueMarker;
       cl_event_new_enqueue_callback(*event, &data, num_events_in_wait_list, event_wait_list);
       return CL_SUCCESS;
@@ -568,9 +703,13 @@ cl_int cl_event_marker_with_wait_list(cl_command_queue queue,
     return CL_SUCCESS;
   }
 
-  if(queue->last_event && queue->last_event->gpgpu_event) {
-    cl_gpgpu_event_update_status(queue->last_event->gpgpu_event, 1);
+  /* The last event may still be deferred in the dispatcher */
+  cl_event_dispatcher_wait_queue(queue, CL_FALSE);
+  last_event = cl_command_queue_get_last_event(queue);
+  if(last_event && last_event->gpgpu_event) {
+    cl_gpgpu_event_update_status(last_event->gpgpu_event, 1);
   }
+  cl_event_delete(last_event);
 
   cl_event_set_status(e, CL_COMPLETE);
   return CL_SUCCESS;
@@ -582,7 +721,10 @@ cl_int cl_event_barrier_with_wait_list(cl_command_queue queue,
                 cl_event* event)
 {
   enqueue_data data = { 0 };
-  cl_event e;
+  cl_event e, last_event;
+
+  /* The barrier waits for the kernels batched by all the threads too */
+  cl_command_queue_flush_batches(queue);
 
   e = cl_event_new(queue->ctx, queue, CL_COMMAND_BARRIER, CL_TRUE);
   if(e == NULL)
@@ -594,7 +736,7 @@ cl_int cl_event_barrier_with_wait_list(cl_command_queue queue,
 //enqueues a barrier command which waits for either a list of events to complete, or if the list is
 //empty it waits for all commands previously enqueued in command_queue to complete before it  completes.
   if(num_events_in_wait_list > 0){
-    if(cl_event_wait_events(num_events_in_wait_list, event_wait_list, queue) == CL_ENQUEUE_EXECUTE_DEFER) {
+    if(cl_event_wait_events(num_events_in_wait_list, event_wait_list, queue, CL_TRUE) == CL_ENQUEUE_EXECUTE_DEFER) {
       data.type = EnqueueBarrier;
       cl_event_new_enqueue_callback(e, &data, num_events_in_wait_list, event_wait_list);
       return CL_SUCCESS;
@@ -605,9 +747,13 @@ cl_int cl_event_barrier_with_wait_list(cl_command_queue queue,
     return CL_SUCCESS;
   }
 
-  if(queue->last_event && queue->last_event->gpgpu_event) {
-    cl_gpgpu_event_update_status(queue->last_event->gpgpu_event, 1);
+  /* The last event may still be deferred in the dispatcher */
+  cl_event_dispatcher_wait_queue(queue, CL_FALSE);
+  last_event = cl_command_queue_get_last_event(queue);
+  if(last_event && last_event->gpgpu_event) {
+    cl_gpgpu_event_update_status(last_event->gpgpu_event, 1);
   }
+  cl_event_delete(last_event);
 
   cl_event_set_status(e, CL_COMPLETE);
   return CL_SUCCESS;
@@ -25,6 +25,7 @@
 #include "cl_internals.h"
 #include "cl_driver.h"
 #include "cl_enqueue.h"
+#include "cl_access_set.h"
 #include "CL/cl.h"
 
 #define CL_ENQUEUE_EXECUTE_IMM   0
@@ -41,6 +42,7 @@ typedef struct _enqueue_callback {
   cl_uint            num_events;       /* num events in wait list */
   cl_event*          wait_list;        /* All event wait list this callback wait on */
   user_event*        wait_user_events; /* The head of user event list the callback wait on */
+  cl_access_set      access;           /* Objects the command accesses, for out-of-order queues */
   struct _enqueue_callback*  next;     /* The  next enqueue callback in wait list */
 } enqueue_callback;
 
@@ -64,14 +66,19 @@ struct _cl_event {
   cl_command_type    type;        /* The command type associated with event */
   cl_int             status;      /* The execution status */
   cl_gpgpu           gpgpu;       /* Current gpgpu, owned by this structure. */
+  int                gpgpu_batched_n; /* Launches recorded in gpgpu, counted in ctx->batched_n */
   cl_gpgpu_event     gpgpu_event; /* The event object communicate with hardware */
   user_callback*     user_cb;     /* The event callback functions */
   enqueue_callback*  enqueue_cb;  /* This event's enqueue */
   enqueue_callback*  waits_head;  /* The head of enqueues list wait on this event */
   cl_bool            emplict;     /* Identify this event whether created by api emplict*/
   cl_ulong           timestamp[4];/* The time stamps for profiling. */
+  cl_event           dispatch_next; /* Next event held by the event dispatcher */
+  cl_int             dispatch_state;/* Why the event dispatcher holds it */
 };
 
+/* Whether the GPU runs the command of this type */
+cl_bool cl_event_is_gpu_command_type(cl_command_type);
 /* Create a new event object */
 cl_event cl_event_new(cl_context, cl_command_queue, cl_command_type, cl_bool);
 /* Unref the object and delete it if no more reference on it */
@@ -84,14 +91,20 @@ cl_int cl_event_set_callback(cl_event, cl_int, EVENT_NOTIFY, void *);
 void cl_event_call_callback(cl_event event, cl_int status, cl_bool free_cb);
 /* Check events wait list for enqueue commonds */
 cl_int cl_event_check_waitlist(cl_uint, const cl_event *, cl_event *, cl_context);
-/* Wait the all events in wait list complete */
-cl_int cl_event_wait_events(cl_uint, const cl_event *, cl_command_queue);
+/* Wait the all events in wait list complete. With async, the events still running on the GPU defer the command instead */
+cl_int cl_event_wait_events(cl_uint, const cl_event *, cl_command_queue, cl_bool async);
 /* New a enqueue suspend task */
 void cl_event_new_enqueue_callback(cl_event, enqueue_data *, cl_uint, const cl_event *);
 /* Set the event status and call all callbacks */
 void cl_event_set_status(cl_event, cl_int);
 /* Check and update event status */
 void cl_event_update_status(cl_event, cl_int);
+/* Whether the GPU runs the command of the event, so waiting for it ends */
+cl_bool cl_event_gpu_running(cl_event);
+/* Whether the wait list of a deferred command completed: CL_COMPLETE, an error status of a wait event, or CL_QUEUED with the wait event running on the GPU if any */
+cl_int cl_event_check_deferred(cl_event, cl_event *running);
+/* Run the deferred command once its wait list completed, cancel it on error. A GPU command is only submitted */
+void cl_event_submit_deferred(cl_event, cl_int);
 /* Create the marker event */
 cl_int cl_event_marker_with_wait_list(cl_command_queue, cl_uint, const cl_event *,  cl_event*);
 /* Create the barrier event */
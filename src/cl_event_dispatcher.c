@@ -0,0 +1,315 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "cl_event_dispatcher.h"
+#include "cl_event.h"
+#include "cl_context.h"
+#include "cl_command_queue.h"
+#include "cl_device_id.h"
+#include "cl_alloc.h"
+#include "cl_utils.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <assert.h>
+
+/* How long to sleep when no command can be waited for on the GPU */
+#define DISPATCHER_POLL_US 1000
+
+struct _cl_event_dispatcher {
+  pthread_mutex_t lock;
+  pthread_cond_t work;       /* Signalled when an event is added */
+  pthread_cond_t progress;   /* Broadcast when commands are submitted or complete */
+  pthread_t thread;
+  cl_event head, tail;       /* Events to take care of, oldest first */
+};
+
+/* Protects the creation of the dispatchers */
+static pthread_mutex_t dispatcher_lock = PTHREAD_MUTEX_INITIALIZER;
+static int dispatcher_enabled = -1;
+
+static void *cl_event_dispatcher_main(void *arg);
+
+static struct _cl_event_dispatcher *
+cl_event_dispatcher_get(cl_device_id device, cl_bool create)
+{
+  struct _cl_event_dispatcher *dispatcher = NULL;
+
+  pthread_mutex_lock(&dispatcher_lock);
+  if (dispatcher_enabled < 0) {
+    const char *env = getenv("OCL_EVENT_DISPATCHER");
+    dispatcher_enabled = env == NULL || atoi(env) != 0;
+  }
+  if (device->event_dispatcher != NULL || !dispatcher_enabled || !create)
+    goto exit;
+
+  TRY_ALLOC_NO_ERR (dispatcher, CALLOC(struct _cl_event_dispatcher));
+  pthread_mutex_init(&dispatcher->lock, NULL);
+  pthread_cond_init(&dispatcher->work, NULL);
+  pthread_cond_init(&dispatcher->progress, NULL);
+  if (pthread_create(&dispatcher->thread, NULL, cl_event_dispatcher_main, dispatcher) != 0)
+    goto error;
+  /* It serves the device until the process exits */
+  pthread_detach(dispatcher->thread);
+  device->event_dispatcher = dispatcher;
+
+exit:
+  dispatcher = device->event_dispatcher;
+  pthread_mutex_unlock(&dispatcher_lock);
+  return dispatcher;
+error:
+  pthread_cond_destroy(&dispatcher->progress);
+  pthread_cond_destroy(&dispatcher->work);
+  pthread_mutex_destroy(&dispatcher->lock);
+  cl_free(dispatcher);
+  /* Do not try again at each enqueue */
+  dispatcher_enabled = 0;
+  goto exit;
+}
+
+LOCAL cl_bool
+cl_event_dispatcher_available(cl_device_id device)
+{
+  return cl_event_dispatcher_get(device, CL_TRUE) != NULL;
+}
+
+static void
+cl_event_dispatcher_push(struct _cl_event_dispatcher *dispatcher, cl_event event, cl_int state)
+{
+  event->dispatch_state = state;
+  event->dispatch_next = NULL;
+  if (dispatcher->tail != NULL)
+    dispatcher->tail->dispatch_next = event;
+  else
+    dispatcher->head = event;
+  dispatcher->tail = event;
+  pthread_cond_signal(&dispatcher->work);
+}
+
+LOCAL cl_int
+cl_event_dispatcher_defer(cl_event event)
+{
+  struct _cl_event_dispatcher *dispatcher = cl_event_dispatcher_get(event->ctx->device, CL_TRUE);
+
+  if (dispatcher == NULL)
+    return -1;
+  assert(event->enqueue_cb && event->enqueue_cb->wait_user_events == NULL);
+  assert(event->dispatch_state == CL_DISPATCH_NONE);
+
+  /* The dispatcher keeps the event until its command completes. Until the
+   * command is submitted, the slabs of the small buffers are not recycled */
+  cl_event_add_ref(event);
+  atomic_inc(&event->ctx->batched_n);
+  atomic_inc(&event->queue->deferred_n);
+  atomic_inc(&event->queue->dispatched_n);
+  pthread_mutex_lock(&dispatcher->lock);
+  cl_event_dispatcher_push(dispatcher, event, CL_DISPATCH_DEFERRED);
+  pthread_mutex_unlock(&dispatcher->lock);
+  return 0;
+}
+
+LOCAL void
+cl_event_dispatcher_watch(cl_event event)
+{
+  struct _cl_event_dispatcher *dispatcher = cl_event_dispatcher_get(event->ctx->device, CL_TRUE);
+
+  if (dispatcher == NULL)
+    return;
+  assert(event->enqueue_cb == NULL && event->gpgpu_event != NULL);
+
+  pthread_mutex_lock(&dispatcher->lock);
+  if (event->dispatch_state == CL_DISPATCH_NONE) {
+    cl_event_add_ref(event);
+    atomic_inc(&event->queue->dispatched_n);
+    cl_event_dispatcher_push(dispatcher, event, CL_DISPATCH_WATCHED);
+  }
+  pthread_mutex_unlock(&dispatcher->lock);
+}
+
+LOCAL void
+cl_event_dispatcher_wait_queue(cl_command_queue queue, cl_bool complete)
+{
+  struct _cl_event_dispatcher *dispatcher = cl_event_dispatcher_get(queue->ctx->device, CL_FALSE);
+
+  if (dispatcher == NULL || pthread_equal(pthread_self(), dispatcher->thread))
+    return;
+  pthread_mutex_lock(&dispatcher->lock);
+  while ((complete ? queue->dispatched_n : queue->deferred_n) > 0)
+    pthread_cond_wait(&dispatcher->progress, &dispatcher->lock);
+  pthread_mutex_unlock(&dispatcher->lock);
+}
+
+/* Absolute time timeout_us from now for pthread_cond_timedwait */
+static void
+cl_event_dispatcher_deadline(struct timespec *ts, int timeout_us)
+{
+  clock_gettime(CLOCK_REALTIME, ts);
+  ts->tv_nsec += (long)timeout_us * 1000;
+  ts->tv_sec += ts->tv_nsec / 1000000000;
+  ts->tv_nsec %= 1000000000;
+}
+
+LOCAL void
+cl_event_dispatcher_wait_progress(cl_device_id device, int timeout_us)
+{
+  struct _cl_event_dispatcher *dispatcher = cl_event_dispatcher_get(device, CL_FALSE);
+  struct timespec ts;
+
+  if (dispatcher == NULL || pthread_equal(pthread_self(), dispatcher->thread)) {
+    usleep(timeout_us);
+    return;
+  }
+  cl_event_dispatcher_deadline(&ts, timeout_us);
+  pthread_mutex_lock(&dispatcher->lock);
+  pthread_cond_timedwait(&dispatcher->progress, &dispatcher->lock, &ts);
+  pthread_mutex_unlock(&dispatcher->lock);
+}
+
+/* An in-order queue runs its deferred commands one after the other */
+static cl_bool
+cl_event_dispatcher_queue_busy(cl_event list, cl_event event)
+{
+  cl_event it;
+
+  if (event->queue->props & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE)
+    return CL_FALSE;
+  for (it = list; it != event; it = it->dispatch_next)
+    if (it->dispatch_state == CL_DISPATCH_DEFERRED && it->queue == event->queue)
+      return CL_TRUE;
+  return CL_FALSE;
+}
+
+/* Submit or cancel a deferred command. Returns whether the dispatcher still
+ * has to wait for it */
+static cl_bool
+cl_event_dispatcher_submit(cl_event event, cl_int status)
+{
+  cl_command_queue queue = event->queue;
+
+  cl_event_submit_deferred(event, status);
+  atomic_dec(&event->ctx->batched_n);
+  atomic_dec(&queue->deferred_n);
+  /* Whoever runs a deferred command drops the reference of the enqueue
+   * when the application did not ask for the event */
+  if (event->emplict == CL_FALSE)
+    cl_event_delete(event);
+  return event->status > CL_COMPLETE;
+}
+
+/* One pass over the events. Removes the ones done with, returns whether any
+ * command was submitted or completed and the oldest command running on the
+ * GPU, if any, with a reference on it */
+static cl_bool
+cl_event_dispatcher_run(cl_event *list, cl_event *running)
+{
+  cl_event event, blocker, *it = list;
+  cl_command_queue queue;
+  cl_int status;
+  cl_bool progress = CL_FALSE, done;
+
+  *running = NULL;
+  while ((event = *it) != NULL) {
+    blocker = NULL;
+    done = CL_FALSE;
+    if (event->dispatch_state == CL_DISPATCH_DEFERRED) {
+      status = CL_QUEUED;
+      if (!cl_event_dispatcher_queue_busy(*list, event))
+        status = cl_event_check_deferred(event, &blocker);
+      if (status <= CL_COMPLETE) {
+        progress = CL_TRUE;
+        if (cl_event_dispatcher_submit(event, status))
+          event->dispatch_state = CL_DISPATCH_WATCHED;
+        else
+          done = CL_TRUE;
+      }
+    } else {
+      cl_event_update_status(event, 0);
+      if (event->status <= CL_COMPLETE) {
+        progress = CL_TRUE;
+        done = CL_TRUE;
+      } else if (cl_event_gpu_running(event))
+        blocker = event;
+    }
+
+    if (*running == NULL && blocker != NULL) {
+      cl_event_add_ref(blocker);
+      *running = blocker;
+    }
+    if (!done) {
+      it = &event->dispatch_next;
+      continue;
+    }
+    *it = event->dispatch_next;
+    event->dispatch_next = NULL;
+    event->dispatch_state = CL_DISPATCH_NONE;
+    /* The queue may go as soon as it does not count the event anymore */
+    queue = event->queue;
+    cl_event_delete(event);
+    atomic_dec(&queue->dispatched_n);
+  }
+  return progress;
+}
+
+static void *
+cl_event_dispatcher_main(void *arg)
+{
+  struct _cl_event_dispatcher *dispatcher = arg;
+  cl_event list, last, running;
+  cl_bool progress, added;
+  struct timespec ts;
+
+  for (;;) {
+    pthread_mutex_lock(&dispatcher->lock);
+    while (dispatcher->head == NULL)
+      pthread_cond_wait(&dispatcher->work, &dispatcher->lock);
+    list = dispatcher->head;
+    dispatcher->head = dispatcher->tail = NULL;
+    pthread_mutex_unlock(&dispatcher->lock);
+
+    progress = cl_event_dispatcher_run(&list, &running);
+
+    pthread_mutex_lock(&dispatcher->lock);
+    added = dispatcher->head != NULL;
+    /* What is left goes ahead of the events added in the meantime */
+    if (list != NULL) {
+      for (last = list; last->dispatch_next != NULL; last = last->dispatch_next)
+        ;
+      last->dispatch_next = dispatcher->head;
+      if (dispatcher->head == NULL)
+        dispatcher->tail = last;
+      dispatcher->head = list;
+    }
+    if (progress)
+      pthread_cond_broadcast(&dispatcher->progress);
+    if (!progress && !added && running == NULL && list != NULL) {
+      cl_event_dispatcher_deadline(&ts, DISPATCHER_POLL_US);
+      pthread_cond_timedwait(&dispatcher->work, &dispatcher->lock, &ts);
+    }
+    pthread_mutex_unlock(&dispatcher->lock);
+
+    if (running != NULL) {
+      /* The GPU runs the commands in order: the oldest completes first */
+      if (!progress && !added)
+        cl_event_update_status(running, 1);
+      cl_event_delete(running);
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __CL_EVENT_DISPATCHER_H__
+#define __CL_EVENT_DISPATCHER_H__
+
+#include "cl_internals.h"
+#include "CL/cl.h"
+
+/* A thread per device which takes over the events the enqueuing threads
+ * would otherwise block on. It runs the deferred commands whose wait list
+ * is made of commands still running on the GPU once these complete, and
+ * watches the submitted commands until they complete, so their callbacks
+ * are called and their references dropped without anybody waiting for
+ * them. OCL_EVENT_DISPATCHER=0 disables it: the enqueuing threads then wait
+ * for the wait lists themselves.
+ */
+
+/* Why the dispatcher holds an event (event->dispatch_state) */
+enum {
+  CL_DISPATCH_NONE = 0,
+  CL_DISPATCH_DEFERRED,  /* Its command waits for its wait list */
+  CL_DISPATCH_WATCHED    /* Its command runs, the dispatcher waits for it */
+};
+
+/* Whether the dispatcher of the device runs, starting it if needed */
+extern cl_bool cl_event_dispatcher_available(cl_device_id device);
+
+/* Run the deferred command of event (event->enqueue_cb, which must not wait
+ * for user events anymore) once its wait list completes. Returns -1 if the
+ * dispatcher is not available: the caller then runs it itself
+ */
+extern cl_int cl_event_dispatcher_defer(cl_event event);
+
+/* Wait in the dispatcher for the command of event to complete */
+extern void cl_event_dispatcher_watch(cl_event event);
+
+/* Wait until the dispatcher submitted the deferred commands of queue, and
+ * until they completed if complete is set. Does not wait when called by the
+ * dispatcher itself (from an event callback)
+ */
+extern void cl_event_dispatcher_wait_queue(cl_command_queue queue, cl_bool complete);
+
+/* Wait until the dispatcher submits or completes a command, for at most
+ * timeout_us microseconds
+ */
+extern void cl_event_dispatcher_wait_progress(cl_device_id device, int timeout_us);
+
+#endif /* __CL_EVENT_DISPATCHER_H__ */
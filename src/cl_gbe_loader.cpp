@@ -32,6 +32,8 @@ gbe_program_new_from_llvm_binary_cb *compiler_program_new_from_llvm_binary = NUL
 gbe_program_serialize_to_binary_cb *compiler_program_serialize_to_binary = NULL;
 gbe_program_new_from_llvm_cb *compiler_program_new_from_llvm = NULL;
 gbe_program_clean_llvm_resource_cb *compiler_program_clean_llvm_resource = NULL;
+gbe_program_cache_get_stats_cb *compiler_program_cache_get_stats = NULL;
+gbe_program_new_specialized_cb *compiler_program_new_specialized = NULL;
 
 //function pointer from libgbeinterp.so
 gbe_program_new_from_binary_cb *interp_program_new_from_binary = NULL;
@@ -71,6 +73,8 @@ gbe_get_printf_sizeof_size_cb* interp_get_printf_sizeof_size = NULL;
 gbe_release_printf_info_cb* interp_release_printf_info = NULL;
 gbe_output_printf_cb* interp_output_printf = NULL;
 gbe_kernel_get_arg_info_cb *interp_kernel_get_arg_info = NULL;
+gbe_kernel_get_compile_stats_cb *interp_kernel_get_compile_stats = NULL;
+gbe_kernel_get_compile_stats_json_cb *interp_kernel_get_compile_stats_json = NULL;
 
 struct GbeLoaderInitializer
 {
@@ -244,6 +248,16 @@ struct GbeLoaderInitializer
     if (interp_kernel_get_arg_info == NULL)
       return false;
 
+    /* Optional: an older libgbeinterp has no compile statistics. */
+    gbe_kernel_get_compile_stats_cb **compile_stats =
+      (gbe_kernel_get_compile_stats_cb **)dlsym(dlhInterp, "gbe_kernel_get_compile_stats");
+    if (compile_stats != NULL)
+      interp_kernel_get_compile_stats = *compile_stats;
+    gbe_kernel_get_compile_stats_json_cb **compile_stats_json =
+      (gbe_kernel_get_compile_stats_json_cb **)dlsym(dlhInterp, "gbe_kernel_get_compile_stats_json");
+    if (compile_stats_json != NULL)
+      interp_kernel_get_compile_stats_json = *compile_stats_json;
+
     return true;
   }
 
@@ -299,6 +313,18 @@ struct GbeLoaderInitializer
       if (compiler_program_clean_llvm_resource == NULL)
         return;
 
+      /* Optional: an older libgbe has no binary cache. */
+      gbe_program_cache_get_stats_cb **cache_stats =
+        (gbe_program_cache_get_stats_cb **)dlsym(dlhCompiler, "gbe_program_cache_get_stats");
+      if (cache_stats != NULL)
+        compiler_program_cache_get_stats = *cache_stats;
+
+      /* Optional: kernels just keep their generic code without it. */
+      gbe_program_new_specialized_cb **new_specialized =
+        (gbe_program_new_specialized_cb **)dlsym(dlhCompiler, "gbe_program_new_specialized");
+      if (new_specialized != NULL)
+        compiler_program_new_specialized = *new_specialized;
+
       compilerLoaded = true;
     }
   }
@@ -33,6 +33,8 @@ extern gbe_program_new_from_llvm_binary_cb *compiler_program_new_from_llvm_binar
 extern gbe_program_serialize_to_binary_cb *compiler_program_serialize_to_binary;
 extern gbe_program_new_from_llvm_cb *compiler_program_new_from_llvm;
 extern gbe_program_clean_llvm_resource_cb *compiler_program_clean_llvm_resource;
+extern gbe_program_cache_get_stats_cb *compiler_program_cache_get_stats;
+extern gbe_program_new_specialized_cb *compiler_program_new_specialized;
 
 extern gbe_program_new_from_binary_cb *interp_program_new_from_binary;
 extern gbe_program_get_global_constant_size_cb *interp_program_get_global_constant_size;
@@ -71,6 +73,8 @@ extern gbe_get_printf_sizeof_size_cb* interp_get_printf_sizeof_size;
 extern gbe_release_printf_info_cb* interp_release_printf_info;
 extern gbe_output_printf_cb* interp_output_printf;
 extern gbe_kernel_get_arg_info_cb *interp_kernel_get_arg_info;
+extern gbe_kernel_get_compile_stats_cb *interp_kernel_get_compile_stats;
+extern gbe_kernel_get_compile_stats_json_cb *interp_kernel_get_compile_stats_json;
 
 int CompilerSupported();
 #ifdef __cplusplus
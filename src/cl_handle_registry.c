@@ -0,0 +1,174 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "cl_handle_registry.h"
+#include "cl_alloc.h"
+#include "cl_utils.h"
+
+#include <string.h>
+#include <assert.h>
+
+/* Marks the slots of the removed handles, so the probe sequences go on */
+static const char tombstone;
+#define TOMBSTONE ((const void *)&tombstone)
+
+#define MIN_SLOT_N 16
+
+static INLINE uint64_t
+cl_handle_hash(const void *handle)
+{
+  return (uint64_t)(uintptr_t)handle * 0x9e3779b97f4a7c15ull;
+}
+
+/* The low bits of the product only depend on the low bits of the pointers,
+ * which are aligned: the shard and the slot come from the high bits */
+static INLINE uint32_t
+cl_handle_slot(uint64_t hash)
+{
+  return (uint32_t)(hash >> 32);
+}
+
+static INLINE cl_handle_shard *
+cl_handle_get_shard(cl_handle_registry *registry, uint64_t hash)
+{
+  return &registry->shards[hash >> 60];
+}
+
+LOCAL void
+cl_handle_registry_init(cl_handle_registry *registry)
+{
+  int i;
+  memset(registry, 0, sizeof(*registry));
+  for (i = 0; i < CL_HANDLE_SHARD_N; i++)
+    pthread_mutex_init(&registry->shards[i].lock, NULL);
+}
+
+LOCAL void
+cl_handle_registry_destroy(cl_handle_registry *registry)
+{
+  int i;
+  for (i = 0; i < CL_HANDLE_SHARD_N; i++) {
+    cl_free(registry->shards[i].slots);
+    registry->shards[i].slots = NULL;
+    pthread_mutex_destroy(&registry->shards[i].lock);
+  }
+}
+
+/* Slot of the handle, or -1 */
+static int64_t
+cl_handle_shard_find(const cl_handle_shard *shard, const void *handle, uint64_t hash)
+{
+  const uint32_t mask = shard->slot_n - 1;
+  uint32_t i, n;
+
+  if (shard->slot_n == 0)
+    return -1;
+  for (i = cl_handle_slot(hash) & mask, n = 0; n < shard->slot_n; i = (i + 1) & mask, n++) {
+    if (shard->slots[i] == handle)
+      return i;
+    if (shard->slots[i] == NULL)
+      return -1;
+  }
+  return -1;
+}
+
+/* Rebuild the table for the live handles, dropping the tombstones */
+static int
+cl_handle_shard_resize(cl_handle_shard *shard, uint32_t slot_n)
+{
+  const void **slots = CALLOC_ARRAY(const void *, slot_n);
+  uint32_t i, j;
+
+  if (slots == NULL)
+    return -1;
+  for (i = 0; i < shard->slot_n; i++) {
+    const void *handle = shard->slots[i];
+    if (handle == NULL || handle == TOMBSTONE)
+      continue;
+    for (j = cl_handle_slot(cl_handle_hash(handle)) & (slot_n - 1); slots[j] != NULL; j = (j + 1) & (slot_n - 1))
+      ;
+    slots[j] = handle;
+  }
+  cl_free(shard->slots);
+  shard->slots = slots;
+  shard->slot_n = slot_n;
+  shard->used_n = shard->live_n;
+  return 0;
+}
+
+LOCAL int
+cl_handle_registry_add(cl_handle_registry *registry, const void *handle)
+{
+  const uint64_t hash = cl_handle_hash(handle);
+  cl_handle_shard *shard = cl_handle_get_shard(registry, hash);
+  uint32_t i, mask;
+  int err = 0;
+
+  assert(handle != NULL && handle != TOMBSTONE);
+  pthread_mutex_lock(&shard->lock);
+  assert(cl_handle_shard_find(shard, handle, hash) < 0);
+
+  /* Keep the table at most 3/4 full, tombstones included */
+  if ((shard->used_n + 1) * 4 > shard->slot_n * 3) {
+    uint32_t slot_n = MIN_SLOT_N;
+    while ((shard->live_n + 1) * 2 > slot_n)
+      slot_n *= 2;
+    if ((err = cl_handle_shard_resize(shard, slot_n)) != 0)
+      goto exit;
+  }
+
+  mask = shard->slot_n - 1;
+  for (i = cl_handle_slot(hash) & mask; shard->slots[i] != NULL && shard->slots[i] != TOMBSTONE; i = (i + 1) & mask)
+    ;
+  if (shard->slots[i] == NULL)
+    shard->used_n++;
+  shard->slots[i] = handle;
+  shard->live_n++;
+
+exit:
+  pthread_mutex_unlock(&shard->lock);
+  return err;
+}
+
+LOCAL void
+cl_handle_registry_remove(cl_handle_registry *registry, const void *handle)
+{
+  const uint64_t hash = cl_handle_hash(handle);
+  cl_handle_shard *shard = cl_handle_get_shard(registry, hash);
+  int64_t slot;
+
+  pthread_mutex_lock(&shard->lock);
+  if ((slot = cl_handle_shard_find(shard, handle, hash)) >= 0) {
+    shard->slots[slot] = TOMBSTONE;
+    shard->live_n--;
+  }
+  pthread_mutex_unlock(&shard->lock);
+}
+
+LOCAL int
+cl_handle_registry_contains(cl_handle_registry *registry, const void *handle)
+{
+  const uint64_t hash = cl_handle_hash(handle);
+  cl_handle_shard *shard = cl_handle_get_shard(registry, hash);
+  int found;
+
+  pthread_mutex_lock(&shard->lock);
+  found = cl_handle_shard_find(shard, handle, hash) >= 0;
+  pthread_mutex_unlock(&shard->lock);
+  return found;
+}
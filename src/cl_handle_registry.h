@@ -0,0 +1,60 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __CL_HANDLE_REGISTRY_H__
+#define __CL_HANDLE_REGISTRY_H__
+
+#include <pthread.h>
+#include <stdint.h>
+
+/* Set of the live memory objects, samplers and events of a context, to tell
+ * in constant time whether a handle given by the user as a kernel argument
+ * or in a wait list is one of them before dereferencing it. The handles are spread over shards by hash, each
+ * shard being an open addressing hash table with its own lock, so threads
+ * creating and releasing objects rarely wait for each other. The type of
+ * the object is still told by its magic number.
+ */
+
+enum { CL_HANDLE_SHARD_N = 16 };
+
+typedef struct _cl_handle_shard {
+  pthread_mutex_t lock;
+  const void **slots;   /* Handles, NULL for empty slots */
+  uint32_t slot_n;      /* Size of the table, a power of two */
+  uint32_t used_n;      /* Slots holding a handle or a tombstone */
+  uint32_t live_n;      /* Slots holding a handle */
+} cl_handle_shard;
+
+typedef struct _cl_handle_registry {
+  cl_handle_shard shards[CL_HANDLE_SHARD_N];
+} cl_handle_registry;
+
+extern void cl_handle_registry_init(cl_handle_registry *registry);
+
+extern void cl_handle_registry_destroy(cl_handle_registry *registry);
+
+/* Returns 0 on success, -1 if out of memory */
+extern int cl_handle_registry_add(cl_handle_registry *registry, const void *handle);
+
+/* Does nothing if the handle was not added */
+extern void cl_handle_registry_remove(cl_handle_registry *registry, const void *handle);
+
+/* Whether the handle is in the registry */
+extern int cl_handle_registry_contains(cl_handle_registry *registry, const void *handle);
+
+#endif /* __CL_HANDLE_REGISTRY_H__ */
@@ -44,10 +44,13 @@ cl_kernel_delete(cl_kernel k)
   if (atomic_dec(&k->ref_n) > 1) return;
   /* Release one reference on all bos we own */
   if (k->bo)       cl_buffer_unreference(k->bo);
+  /* The specialized code belongs to the program */
+  if (k->spec) cl_program_put_specialized_kernel(k->program, k->spec);
   /* This will be true for kernels created by clCreateKernel */
   if (k->ref_its_program) cl_program_delete(k->program);
   /* Release the curbe if allocated */
   if (k->curbe) cl_free(k->curbe);
+  cl_kernel_release_payload(k);
   /* Release the argument array if required */
   if (k->args) {
     for (i = 0; i < k->arg_n; ++i)
@@ -57,6 +60,7 @@ cl_kernel_delete(cl_kernel k)
   }
   if (k->image_sz)
     cl_free(k->images);
+  pthread_mutex_destroy(&k->lock);
   k->magic = CL_MAGIC_DEAD_HEADER; /* For safety */
   cl_free(k);
 }
@@ -70,6 +74,7 @@ cl_kernel_new(cl_program p)
   k->ref_n = 1;
   k->magic = CL_MAGIC_KERNEL_HEADER;
   k->program = p;
+  pthread_mutex_init(&k->lock, NULL);
 
 exit:
   return k;
@@ -79,6 +84,13 @@ error:
   goto exit;
 }
 
+LOCAL void
+cl_kernel_release_payload(cl_kernel k)
+{
+  cl_free(k->payload);
+  k->payload = NULL;
+}
+
 LOCAL const char*
 cl_kernel_get_name(cl_kernel k)
 {
@@ -99,8 +111,8 @@ cl_kernel_add_ref(cl_kernel k)
   atomic_inc(&k->ref_n);
 }
 
-LOCAL cl_int
-cl_kernel_set_arg(cl_kernel k, cl_uint index, size_t sz, const void *value)
+static cl_int
+cl_kernel_patch_arg(cl_kernel k, cl_uint index, size_t sz, const void *value)
 {
   uint32_t offset;            /* where to patch */
   enum gbe_arg_type arg_type; /* kind of argument */
@@ -132,7 +144,7 @@ cl_kernel_set_arg(cl_kernel k, cl_uint index, size_t sz, const void *value)
       return CL_INVALID_ARG_VALUE;
 
     cl_sampler s = *(cl_sampler*)value;
-    if(s->magic != CL_MAGIC_SAMPLER_HEADER)
+    if(CL_SUCCESS != is_valid_sampler(s, ctx))
       return CL_INVALID_SAMPLER;
   } else {
     // should be image, GLOBAL_PTR, CONSTANT_PTR
@@ -141,7 +153,7 @@ cl_kernel_set_arg(cl_kernel k, cl_uint index, size_t sz, const void *value)
     if(value != NULL)
       mem = *(cl_mem*)value;
     if(value != NULL && mem) {
-      if( CL_SUCCESS != is_valid_mem(mem, ctx->buffers))
+      if( CL_SUCCESS != is_valid_mem(mem, ctx))
         return CL_INVALID_MEM_OBJECT;
 
       if (UNLIKELY((arg_type == GBE_ARG_IMAGE && !IS_IMAGE(mem))
@@ -214,6 +226,147 @@ cl_kernel_set_arg(cl_kernel k, cl_uint index, size_t sz, const void *value)
   return CL_SUCCESS;
 }
 
+LOCAL cl_int
+cl_kernel_set_arg(cl_kernel k, cl_uint index, size_t sz, const void *value)
+{
+  const cl_int err = cl_kernel_patch_arg(k, index, sz, value);
+
+  /* A regular value is not folded in the code anymore */
+  if (err == CL_SUCCESS && k->args[index].is_const) {
+    k->args[index].is_const = 0;
+    k->spec_dirty = 1;
+  }
+  return err;
+}
+
+LOCAL cl_int
+cl_kernel_set_arg_constant(cl_kernel k, cl_uint index, size_t sz, const void *value)
+{
+  uint64_t bits = 0;
+  cl_int err;
+
+  if (UNLIKELY(index >= k->arg_n))
+    return CL_INVALID_ARG_INDEX;
+  /* Only scalars can be folded */
+  if (UNLIKELY(interp_kernel_get_arg_type(k->opaque, index) != GBE_ARG_VALUE ||
+               sz > sizeof(bits)))
+    return CL_INVALID_ARG_VALUE;
+  if ((err = cl_kernel_patch_arg(k, index, sz, value)) != CL_SUCCESS)
+    return err;
+
+  memcpy(&bits, value, sz);
+  if (!k->args[index].is_const || k->args[index].const_value != bits)
+    k->spec_dirty = 1;
+  k->args[index].is_const = 1;
+  k->args[index].const_value = bits;
+  return CL_SUCCESS;
+}
+
+/* Run another compiled code of the same kernel. Both have the same arguments
+ * but their curbe layout may differ, so the values already set are moved
+ */
+static cl_int
+cl_kernel_switch_code(cl_kernel k, gbe_kernel opaque)
+{
+  const gbe_kernel from = k->opaque;
+  const size_t curbe_sz = interp_kernel_get_curbe_size(opaque);
+  char *curbe = NULL;
+  uint32_t i;
+
+  if (curbe_sz && (curbe = cl_calloc(1, curbe_sz)) == NULL)
+    return CL_OUT_OF_HOST_MEMORY;
+  if (k->image_sz)
+    cl_free(k->images);
+  k->images = NULL;
+  cl_kernel_setup(k, opaque);
+  if (UNLIKELY(k->bo == NULL)) {
+    cl_free(curbe);
+    return CL_OUT_OF_RESOURCES;
+  }
+
+  for (i = 0; i < k->arg_n; ++i) {
+    const enum gbe_arg_type arg_type = interp_kernel_get_arg_type(opaque, i);
+    int32_t src, dst;
+    size_t sz;
+
+    if (!k->args[i].is_set || arg_type == GBE_ARG_LOCAL_PTR)
+      continue;
+    /* Buffers and images are patched when the kernel is bound */
+    if (k->args[i].mem != NULL) {
+      k->args[i].bti = interp_kernel_get_arg_bti(opaque, i);
+      continue;
+    }
+    src = interp_kernel_get_curbe_offset(from, GBE_CURBE_KERNEL_ARGUMENT, i);
+    dst = interp_kernel_get_curbe_offset(opaque, GBE_CURBE_KERNEL_ARGUMENT, i);
+    if (src < 0 || dst < 0)
+      continue;
+    if (arg_type == GBE_ARG_VALUE)
+      sz = interp_kernel_get_arg_size(opaque, i);
+    else /* Sampler value or NULL buffer */
+      sz = 4;
+    assert(dst + sz <= curbe_sz);
+    memcpy(curbe + dst, k->curbe + src, sz);
+    if (arg_type == GBE_ARG_SAMPLER)
+      cl_set_sampler_arg_slot(k, i, k->args[i].sampler);
+  }
+  cl_free(k->curbe);
+  k->curbe = curbe;
+  return CL_SUCCESS;
+}
+
+LOCAL cl_int
+cl_kernel_specialize(cl_kernel k)
+{
+  cl_specialized_kernel *spec = NULL;
+  uint32_t *arg_index = NULL;
+  uint64_t *arg_value = NULL;
+  uint32_t i, arg_num = 0;
+  gbe_kernel opaque;
+  cl_int err = CL_SUCCESS;
+
+  if (!k->spec_dirty)
+    return CL_SUCCESS;
+
+  for (i = 0; i < k->arg_n; ++i)
+    arg_num += k->args[i].is_const;
+  if (arg_num > 0) {
+    TRY_ALLOC (arg_index, CALLOC_ARRAY(uint32_t, arg_num));
+    TRY_ALLOC (arg_value, CALLOC_ARRAY(uint64_t, arg_num));
+    for (i = 0, arg_num = 0; i < k->arg_n; ++i) {
+      if (!k->args[i].is_const) continue;
+      arg_index[arg_num] = i;
+      arg_value[arg_num++] = k->args[i].const_value;
+    }
+    spec = cl_program_get_specialized_kernel(k->program, cl_kernel_get_name(k),
+                                             arg_num, arg_index, arg_value);
+    /* Keep the generic code when the kernel cannot be specialized */
+    if (spec && spec->kernel == NULL) {
+      cl_program_put_specialized_kernel(k->program, spec);
+      spec = NULL;
+    }
+  }
+
+  if (spec != k->spec) {
+    if (spec)
+      opaque = spec->kernel;
+    else
+      opaque = interp_program_get_kernel_by_name(k->program->opaque, cl_kernel_get_name(k));
+    if ((err = cl_kernel_switch_code(k, opaque)) != CL_SUCCESS) {
+      cl_program_put_specialized_kernel(k->program, spec);
+      goto error;
+    }
+    cl_program_put_specialized_kernel(k->program, k->spec);
+    k->spec = spec;
+  } else /* Already running it */
+    cl_program_put_specialized_kernel(k->program, spec);
+  k->spec_dirty = 0;
+
+error:
+  cl_free(arg_index);
+  cl_free(arg_value);
+  return err;
+}
+
 LOCAL int
 cl_get_kernel_arg_info(cl_kernel k, cl_uint arg_index, cl_kernel_arg_info param_name,
                        size_t param_value_size, void *param_value, size_t *param_value_size_ret)
@@ -316,6 +469,8 @@ cl_kernel_setup(cl_kernel k, gbe_kernel opaque)
 
   if(k->bo != NULL)
     cl_buffer_unreference(k->bo);
+  /* The curbe layout of the new code may differ */
+  cl_kernel_release_payload(k);
 
   /* Allocate the gen code here */
   const uint32_t code_sz = interp_kernel_get_code_size(opaque);
@@ -366,6 +521,7 @@ cl_kernel_dup(cl_kernel from)
   to->ref_n = 1;
   to->magic = CL_MAGIC_KERNEL_HEADER;
   to->program = from->program;
+  pthread_mutex_init(&to->lock, NULL);
   to->arg_n = from->arg_n;
   to->curbe_sz = from->curbe_sz;
   to->sampler_sz = from->sampler_sz;
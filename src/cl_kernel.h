@@ -27,6 +27,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 /* This is the kernel as it is interfaced by the compiler */
 struct _gbe_kernel;
@@ -38,10 +39,25 @@ typedef struct cl_argument {
   cl_mem mem;           /* For image and regular buffers */
   cl_sampler sampler;   /* For sampler. */
   unsigned char bti;
-  uint32_t local_sz:31; /* For __local size specification */
+  uint32_t local_sz:30; /* For __local size specification */
   uint32_t is_set:1;    /* All args must be set before NDRange */
+  uint32_t is_const:1;  /* Scalar value the kernel may be specialized on */
+  uint64_t const_value; /* Its bits when is_const is set */
 } cl_argument;
 
+/* Curbes of all the threads of a work group as uploaded by the last launch.
+ * Rebuilt when the work group shape changes. Otherwise only the words of the
+ * shared curbe modified since are copied again
+ */
+typedef struct cl_curbe_payload {
+  size_t local_wk_sz[3];  /* Work group size it was built for */
+  size_t simd_sz;         /* SIMD width of the code */
+  size_t thread_n;        /* Threads per work group */
+  size_t cst_sz;          /* Curbe size of one thread */
+  char *shared;           /* Shared curbe as copied in the thread curbes */
+  char *data;             /* thread_n curbes of cst_sz bytes each */
+} cl_curbe_payload;
+
 /* One OCL function */
 struct _cl_kernel {
   DEFINE_ICD(dispatch)
@@ -63,8 +79,12 @@ struct _cl_kernel {
                                 (i.e. global_work_size argument to clEnqueueNDRangeKernel.)*/
   size_t stack_size;          /* stack size per work item. */
   cl_argument *args;          /* To track argument setting */
-  uint32_t arg_n:31;          /* Number of arguments */
+  uint32_t arg_n:30;          /* Number of arguments */
   uint32_t ref_its_program:1; /* True only for the user kernel (created by clCreateKernel) */
+  uint32_t spec_dirty:1;      /* Constant arguments changed since the last launch */
+  struct cl_specialized_kernel *spec; /* Code in use if specialized, NULL for the generic one */
+  cl_curbe_payload *payload;  /* Thread curbes of the last launch */
+  pthread_mutex_t lock;       /* Held by a launch: it switches the code and fills the curbes */
 };
 
 /* Allocate an empty kernel */
@@ -76,6 +96,9 @@ extern void cl_kernel_delete(cl_kernel);
 /* Setup the kernel with the given GBE Kernel */
 extern void cl_kernel_setup(cl_kernel k, gbe_kernel opaque);
 
+/* Drop the thread curbes of the last launch */
+extern void cl_kernel_release_payload(cl_kernel k);
+
 /* Get the kernel name */
 extern const char *cl_kernel_get_name(cl_kernel k);
 
@@ -99,6 +122,19 @@ extern int cl_kernel_set_arg(cl_kernel,
                              size_t      arg_size,
                              const void *arg_value);
 
+/* Set a scalar argument and allow the kernel to be specialized on its value.
+ * Setting it again with cl_kernel_set_arg makes it a regular argument again
+ */
+extern int cl_kernel_set_arg_constant(cl_kernel,
+                                      uint32_t    arg_index,
+                                      size_t      arg_size,
+                                      const void *arg_value);
+
+/* Switch to the code matching the current constant arguments. Called with
+ * the kernel lock held, by the launch that runs the code
+ */
+extern cl_int cl_kernel_specialize(cl_kernel k);
+
 /* Get the argument information */
 extern int cl_get_kernel_arg_info(cl_kernel k, cl_uint arg_index,
                                   cl_kernel_arg_info param_name,
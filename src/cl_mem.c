@@ -27,6 +27,8 @@
 #include "cl_khr_icd.h"
 #include "cl_kernel.h"
 #include "cl_command_queue.h"
+#include "cl_suballoc.h"
+#include "cl_tiling.h"
 
 #include "CL/cl.h"
 #include "CL/cl_intel.h"
@@ -226,6 +228,28 @@ error:
 
 #undef FIELD_SIZE
 
+/* Only the plain buffers without host memory behind them and never pinned
+ * share their buffer object */
+static INLINE int
+cl_mem_can_suballocate(enum cl_mem_type type, cl_mem_flags flags)
+{
+  return type == CL_MEM_BUFFER_TYPE &&
+         !(flags & (CL_MEM_USE_HOST_PTR | CL_MEM_ALLOC_HOST_PTR | CL_MEM_PINNABLE));
+}
+
+/* Give the chunk of a suballocated buffer back to its slab */
+static void
+cl_mem_release_slab(cl_mem mem)
+{
+  struct _cl_mem_buffer *buffer = (struct _cl_mem_buffer *)mem;
+
+  if (mem->type != CL_MEM_BUFFER_TYPE || buffer->slab == NULL)
+    return;
+  cl_suballoc_free(mem->ctx->suballoc, buffer->slab, mem->offset, mem->size);
+  buffer->slab = NULL;
+  mem->offset = 0;
+}
+
 LOCAL cl_mem
 cl_mem_allocate(enum cl_mem_type type,
                 cl_context ctx,
@@ -308,10 +332,15 @@ cl_mem_allocate(enum cl_mem_type type,
       }
     }
 
-    if (!mem->is_userptr)
+    if (!mem->is_userptr && cl_mem_can_suballocate(type, flags))
+      mem->bo = cl_suballoc_alloc(ctx->suballoc, sz, &mem->offset, &((struct _cl_mem_buffer *)mem)->slab);
+    if (!mem->is_userptr && mem->bo == NULL)
       mem->bo = cl_buffer_alloc(bufmgr, "CL memory object", sz, alignment);
 #else
-    mem->bo = cl_buffer_alloc(bufmgr, "CL memory object", sz, alignment);
+    if (cl_mem_can_suballocate(type, flags))
+      mem->bo = cl_suballoc_alloc(ctx->suballoc, sz, &mem->offset, &((struct _cl_mem_buffer *)mem)->slab);
+    if (mem->bo == NULL)
+      mem->bo = cl_buffer_alloc(bufmgr, "CL memory object", sz, alignment);
 #endif
 
     if (UNLIKELY(mem->bo == NULL)) {
@@ -330,6 +359,10 @@ cl_mem_allocate(enum cl_mem_type type,
     ctx->buffers->prev = mem;
   ctx->buffers = mem;
   pthread_mutex_unlock(&ctx->buffer_lock);
+  if (cl_handle_registry_add(&ctx->handles, mem) != 0) {
+    err = CL_OUT_OF_HOST_MEMORY;
+    goto error;
+  }
 
 exit:
   if (errcode)
@@ -343,18 +376,13 @@ error:
 }
 
 LOCAL cl_int
-is_valid_mem(cl_mem mem, cl_mem buffers)
+is_valid_mem(cl_mem mem, cl_context ctx)
 {
-  cl_mem tmp = buffers;
-  while(tmp){
-    if(mem == tmp){
-      if (UNLIKELY(mem->magic != CL_MAGIC_MEM_HEADER))
-        return CL_INVALID_MEM_OBJECT;
-      return CL_SUCCESS;
-    }
-    tmp = tmp->next;
-  }
-  return CL_INVALID_MEM_OBJECT;
+  if (!cl_handle_registry_contains(&ctx->handles, mem))
+    return CL_INVALID_MEM_OBJECT;
+  if (UNLIKELY(mem->magic != CL_MAGIC_MEM_HEADER))
+    return CL_INVALID_MEM_OBJECT;
+  return CL_SUCCESS;
 }
 
 LOCAL cl_mem
@@ -433,11 +461,11 @@ cl_mem_new_buffer(cl_context ctx,
     if (mem->is_userptr)
       memcpy(mem->host_ptr, data, sz);
     else
-      cl_buffer_subdata(mem->bo, 0, sz, data);
+      cl_buffer_subdata(mem->bo, mem->offset, sz, data);
   }
 
   if ((flags & CL_MEM_USE_HOST_PTR) && !mem->is_userptr)
-    cl_buffer_subdata(mem->bo, 0, sz, data);
+    cl_buffer_subdata(mem->bo, mem->offset, sz, data);
 
   if (flags & CL_MEM_USE_HOST_PTR)
     mem->host_ptr = data;
@@ -550,6 +578,10 @@ cl_mem_new_sub_buffer(cl_mem buffer,
     buffer->ctx->buffers->prev = mem;
   buffer->ctx->buffers = mem;
   pthread_mutex_unlock(&buffer->ctx->buffer_lock);
+  if (cl_handle_registry_add(&buffer->ctx->handles, mem) != 0) {
+    err = CL_OUT_OF_HOST_MEMORY;
+    goto error;
+  }
 
 exit:
   if (errcode_ret)
@@ -563,9 +595,26 @@ error:
 
 void cl_mem_replace_buffer(cl_mem buffer, cl_buffer new_bo)
 {
+  struct _cl_mem_buffer *sub;
+
   cl_buffer_unreference(buffer->bo);
+  cl_mem_release_slab(buffer);
   buffer->bo = new_bo;
+  buffer->offset = 0;
   cl_buffer_reference(new_bo);
+  if (buffer->type == CL_MEM_BUFFER_TYPE) {
+    /* The sub-buffers must not keep the old buffer object, a chunk of a slab
+     * may be handed out again */
+    pthread_mutex_lock(&((struct _cl_mem_buffer*)buffer)->sub_lock);
+    for (sub = ((struct _cl_mem_buffer*)buffer)->subs; sub != NULL; sub = sub->sub_next) {
+      cl_buffer_unreference(sub->base.bo);
+      sub->base.bo = new_bo;
+      sub->base.offset = 0;
+      cl_buffer_reference(new_bo);
+    }
+    pthread_mutex_unlock(&((struct _cl_mem_buffer*)buffer)->sub_lock);
+    return;
+  }
   if (buffer->type != CL_MEM_SUBBUFFER_TYPE)
     return;
 
@@ -574,10 +623,46 @@ void cl_mem_replace_buffer(cl_mem buffer, cl_buffer new_bo)
   {
     cl_buffer_unreference(it->base.bo);
     it->base.bo = new_bo;
+    it->base.offset = 0;
     cl_buffer_reference(new_bo);
   }
 }
 
+/* Move a suballocated buffer and its sub-buffers to a buffer object of
+ * their own, for the callers which need the whole buffer object */
+static cl_int
+cl_mem_leave_slab(cl_mem mem)
+{
+  struct _cl_mem_buffer *buffer = (struct _cl_mem_buffer *)mem;
+  struct _cl_mem_buffer *sub;
+  cl_buffer bo;
+
+  if (mem->type != CL_MEM_BUFFER_TYPE || buffer->slab == NULL)
+    return CL_SUCCESS;
+
+  bo = cl_buffer_alloc(cl_context_get_bufmgr(mem->ctx), "CL memory object", mem->size, 64);
+  if (bo == NULL)
+    return CL_MEM_OBJECT_ALLOCATION_FAILURE;
+  /* Copy what the kernels wrote so far */
+  cl_context_flush_batches(mem->ctx);
+  cl_buffer_subdata(bo, 0, mem->size, cl_mem_map(mem, 0));
+  cl_mem_unmap(mem);
+
+  pthread_mutex_lock(&buffer->sub_lock);
+  for (sub = buffer->subs; sub != NULL; sub = sub->sub_next) {
+    cl_buffer_unreference(sub->base.bo);
+    sub->base.bo = bo;
+    sub->base.offset = 0;
+    cl_buffer_reference(bo);
+  }
+  pthread_mutex_unlock(&buffer->sub_lock);
+
+  cl_buffer_unreference(mem->bo);
+  cl_mem_release_slab(mem);
+  mem->bo = bo;
+  return CL_SUCCESS;
+}
+
 void
 cl_mem_copy_image_region(const size_t *origin, const size_t *region,
                          void *dst, size_t dst_row_pitch, size_t dst_slice_pitch,
@@ -641,16 +726,84 @@ cl_mem_copy_image_to_image(const size_t *dst_origin,const size_t *src_origin, co
 
 }
 
+/* 0: through the GTT, 1: vectorized, 2: scalar reference */
+static int
+cl_mem_cpu_tiling_mode(void)
+{
+  static int mode = -1;
+
+  if (mode < 0) {
+    const char *env = getenv("OCL_CPU_TILING");
+    mode = env == NULL ? 1 : atoi(env);
+  }
+  return mode;
+}
+
+LOCAL cl_bool
+cl_mem_image_cpu_tiling(const struct _cl_mem_image *image)
+{
+  const struct _cl_mem *mem = &image->base;
+
+  if (image->tiling == CL_NO_TILE || cl_mem_cpu_tiling_mode() == 0)
+    return CL_FALSE;
+  /* The rows and slices are found from the offsets in the GTT mapping */
+  if (mem->is_userptr || mem->offset != 0 || image->slice_pitch % image->row_pitch != 0)
+    return CL_FALSE;
+  return cl_tiling_supported(image->tiling, cl_buffer_get_swizzle(mem->bo), image->row_pitch);
+}
+
+LOCAL void
+cl_mem_copy_image_region_tiled(const size_t *origin, const size_t *region,
+                               void *linear, size_t linear_row_pitch, size_t linear_slice_pitch,
+                               void *tiled, size_t tiled_row_pitch, size_t tiled_slice_pitch,
+                               const struct _cl_mem_image *image, cl_bool offset_linear,
+                               cl_bool to_image)
+{
+  cl_tiled_region r;
+
+  assert(cl_mem_image_cpu_tiling(image));
+  if (offset_linear)
+    linear = (char*)linear + image->bpp * origin[0] + linear_row_pitch * origin[1] +
+             linear_slice_pitch * origin[2];
+  r.tiled = tiled;
+  r.pitch = image->row_pitch;
+  r.tiling = image->tiling;
+  r.swizzle = cl_buffer_get_swizzle(image->base.bo);
+  r.row_rows = tiled_row_pitch / image->row_pitch;
+  r.slice_rows = tiled_slice_pitch / image->row_pitch;
+  r.x = image->bpp * origin[0];
+  r.y = r.row_rows * origin[1] + r.slice_rows * origin[2];
+  r.w = image->bpp * region[0];
+  r.h = region[1];
+  r.d = region[2];
+  r.linear = linear;
+  r.linear_row_pitch = linear_row_pitch;
+  r.linear_slice_pitch = linear_slice_pitch;
+  if (cl_mem_cpu_tiling_mode() == 2)
+    cl_tiling_copy_scalar(&r, to_image);
+  else
+    cl_tiling_copy(&r, to_image);
+}
+
 static void
 cl_mem_copy_image(struct _cl_mem_image *image,
 		  size_t row_pitch,
 		  size_t slice_pitch,
 		  void* host_ptr)
 {
-  char* dst_ptr = cl_mem_map_auto((cl_mem)image, 1);
   size_t origin[3] = {0, 0, 0};
   size_t region[3] = {image->w, image->h, image->depth};
-
+  char* dst_ptr;
+
+  if (cl_mem_image_cpu_tiling(image)) {
+    dst_ptr = cl_mem_map((cl_mem)image, 1);
+    cl_mem_copy_image_region_tiled(origin, region, host_ptr, row_pitch, slice_pitch,
+                                   dst_ptr, image->row_pitch, image->slice_pitch,
+                                   image, CL_FALSE, CL_TRUE);
+    cl_mem_unmap((cl_mem)image);
+    return;
+  }
+  dst_ptr = cl_mem_map_auto((cl_mem)image, 1);
   cl_mem_copy_image_region(origin, region, dst_ptr, image->row_pitch, image->slice_pitch,
                            host_ptr, row_pitch, slice_pitch, image, CL_FALSE, CL_FALSE); //offset is 0
   cl_mem_unmap_auto((cl_mem)image);
@@ -967,6 +1120,10 @@ _cl_mem_new_image_from_buffer(cl_context ctx,
     offset = ((struct _cl_mem_buffer *)buffer)->sub_offset;
     mem_buffer = mem_buffer->parent;
   }
+  /* The buffer object is replaced by the one of the image below: the buffer
+   * and its sub-buffers first leave their slab, whose chunk is then released */
+  if ((err = cl_mem_leave_slab(&mem_buffer->base)) != CL_SUCCESS)
+    goto error;
   /* Get the size of each pixel */
   if (UNLIKELY((err = cl_image_byte_per_pixel(image_format, &bpp)) != CL_SUCCESS))
     goto error;
@@ -1073,6 +1230,7 @@ cl_mem_delete(cl_mem mem)
 
   /* Remove it from the list */
   if (mem->ctx) {
+    cl_handle_registry_remove(&mem->ctx->handles, mem);
     pthread_mutex_lock(&mem->ctx->buffer_lock);
       if (mem->prev)
         mem->prev->next = mem->next;
@@ -1127,6 +1285,7 @@ cl_mem_delete(cl_mem mem)
     cl_mem_delete((cl_mem )(buffer->parent));
   } else if (LIKELY(mem->bo != NULL)) {
     cl_buffer_unreference(mem->bo);
+    cl_mem_release_slab(mem);
   }
 
   if (mem->is_userptr &&
@@ -1874,12 +2033,22 @@ cl_mem_copy_buffer_to_image(cl_command_queue queue, cl_mem buffer, struct _cl_me
 }
 
 
+/* Where the data of mem starts in the mapping of its buffer object */
+static INLINE void *
+cl_mem_virtual(cl_mem mem)
+{
+  assert(cl_buffer_get_virtual(mem->bo));
+  /* The userptr objects are reached through host_ptr */
+  if (mem->is_userptr)
+    return cl_buffer_get_virtual(mem->bo);
+  return (char *)cl_buffer_get_virtual(mem->bo) + mem->offset;
+}
+
 LOCAL void*
 cl_mem_map(cl_mem mem, int write)
 {
   cl_buffer_map(mem->bo, write);
-  assert(cl_buffer_get_virtual(mem->bo));
-  return cl_buffer_get_virtual(mem->bo);
+  return cl_mem_virtual(mem);
 }
 
 LOCAL cl_int
@@ -1893,17 +2062,15 @@ LOCAL void*
 cl_mem_map_gtt(cl_mem mem)
 {
   cl_buffer_map_gtt(mem->bo);
-  assert(cl_buffer_get_virtual(mem->bo));
   mem->mapped_gtt = 1;
-  return cl_buffer_get_virtual(mem->bo);
+  return cl_mem_virtual(mem);
 }
 
 LOCAL void *
 cl_mem_map_gtt_unsync(cl_mem mem)
 {
   cl_buffer_map_gtt_unsync(mem->bo);
-  assert(cl_buffer_get_virtual(mem->bo));
-  return cl_buffer_get_virtual(mem->bo);
+  return cl_mem_virtual(mem);
 }
 
 LOCAL cl_int
@@ -1916,10 +2083,6 @@ cl_mem_unmap_gtt(cl_mem mem)
 LOCAL void*
 cl_mem_map_auto(cl_mem mem, int write)
 {
-  //if mem is not created from userptr, the offset should be always zero.
-  if (!mem->is_userptr)
-    assert(mem->offset == 0);
-
   if (IS_IMAGE(mem) && cl_mem_image(mem)->tiling != CL_NO_TILE)
     return cl_mem_map_gtt(mem);
   else {
@@ -2055,6 +2218,9 @@ cl_mem_get_fd(cl_mem mem,
               int* fd)
 {
   cl_int err = CL_SUCCESS;
+  /* The file descriptor gives the whole buffer object */
+  if ((err = cl_mem_leave_slab(mem)) != CL_SUCCESS)
+    return err;
   if(cl_buffer_get_fd(mem->bo, fd))
 	err = CL_INVALID_OPERATION;
   return err;
@@ -94,7 +94,8 @@ typedef  struct _cl_mem {
   uint8_t mapped_gtt;       /* This object has mapped gtt, for unmap. */
   cl_mem_dstr_cb *dstr_cb;  /* The destroy callback. */
   uint8_t is_userptr;       /* CL_MEM_USE_HOST_PTR is enabled*/
-  size_t offset;            /* offset of host_ptr to the page beginning, only for CL_MEM_USE_HOST_PTR*/
+  size_t offset;            /* offset of host_ptr to the page beginning for CL_MEM_USE_HOST_PTR,
+                               offset in the slab for the suballocated buffers */
 } _cl_mem;
 
 struct _cl_mem_image {
@@ -156,6 +157,7 @@ struct _cl_mem_buffer {
   struct _cl_mem_buffer* sub_prev, *sub_next;/* We chain the sub memory buffers together */
   pthread_mutex_t sub_lock;            /* Sub buffers list lock*/
   struct _cl_mem_buffer* parent;       /* Point to the parent buffer if is sub-buffer */
+  struct _cl_suballoc_slab* slab;      /* Slab the buffer was carved from, if any */
 };
 
 inline static struct _cl_mem_image *
@@ -185,8 +187,8 @@ extern cl_int cl_get_mem_object_info(cl_mem, cl_mem_info, size_t, void *, size_t
 /* Query information about an image */
 extern cl_int cl_get_image_info(cl_mem, cl_image_info, size_t, void *, size_t *);
 
-/* Query whether mem is in buffers */
-extern cl_int is_valid_mem(cl_mem mem, cl_mem buffers);
+/* Query whether mem is a live memory object of ctx */
+extern cl_int is_valid_mem(cl_mem mem, cl_context ctx);
 
 /* Create a new memory object and initialize it with possible user data */
 extern cl_mem cl_mem_new_buffer(cl_context, cl_mem_flags, size_t, void*, cl_int*);
@@ -283,6 +285,20 @@ void
 cl_mem_copy_image_to_image(const size_t *dst_origin,const size_t *src_origin, const size_t *region,
                            const struct _cl_mem_image *dst_image, const struct _cl_mem_image *src_image);
 
+/* Whether the CPU copies the regions of the tiled image itself through a
+ * cached mapping of its buffer, instead of through the GTT mapping */
+extern cl_bool cl_mem_image_cpu_tiling(const struct _cl_mem_image *image);
+
+/* Copy a region between linear memory and the cached mapping of a tiled
+ * image, to the image if to_image is set. The pitches are the ones of
+ * cl_mem_copy_image_region, tiled is the start of the mapping */
+extern void
+cl_mem_copy_image_region_tiled(const size_t *origin, const size_t *region,
+                               void *linear, size_t linear_row_pitch, size_t linear_slice_pitch,
+                               void *tiled, size_t tiled_row_pitch, size_t tiled_slice_pitch,
+                               const struct _cl_mem_image *image, cl_bool offset_linear,
+                               cl_bool to_image);
+
 extern cl_mem cl_mem_new_libva_buffer(cl_context ctx,
                                       unsigned int bo_name,
                                       cl_int *errcode);
@@ -25,6 +25,7 @@
 #include "cl_utils.h"
 #include "cl_khr_icd.h"
 #include "cl_gbe_loader.h"
+#include "cl_program_registry.h"
 #include "CL/cl.h"
 #include "CL/cl_intel.h"
 
@@ -55,6 +56,31 @@ cl_program_release_binary(cl_program p)
   }
 }
 
+static void
+cl_specialized_kernel_delete(cl_specialized_kernel *spec)
+{
+  if (spec == NULL)
+    return;
+  if (spec->opaque)
+    interp_program_delete(spec->opaque);
+  cl_free(spec->name);
+  cl_free(spec->arg_index);
+  cl_free(spec->arg_value);
+  cl_free(spec);
+}
+
+static void
+cl_program_release_specialized_kernels(cl_program p)
+{
+  uint32_t i;
+  for (i = 0; i < p->spec_n; ++i) {
+    assert(p->spec[i]->ref_n == 0);
+    cl_specialized_kernel_delete(p->spec[i]);
+    p->spec[i] = NULL;
+  }
+  p->spec_n = 0;
+}
+
 LOCAL void
 cl_program_delete(cl_program p)
 {
@@ -97,11 +123,17 @@ cl_program_delete(cl_program p)
     cl_kernel_delete(p->ker[i]);
   cl_free(p->ker);
 
+  /* Kernels hold a reference on their program: no variant is used anymore */
+  cl_program_release_specialized_kernels(p);
+  pthread_mutex_destroy(&p->spec_lock);
+
   /* Program belongs to their parent context */
   cl_context_delete(p->ctx);
 
   /* Free the program as allocated by the compiler */
-  if (p->opaque) {
+  if (p->is_shared)
+    cl_program_registry_put(p->opaque);
+  else if (p->opaque) {
     if (CompilerSupported())
       compiler_program_clean_llvm_resource(p->opaque);
     interp_program_delete(p->opaque);
@@ -123,6 +155,7 @@ cl_program_new(cl_context ctx)
   p->ref_n = 1;
   p->magic = CL_MAGIC_PROGRAM_HEADER;
   p->ctx = ctx;
+  pthread_mutex_init(&p->spec_lock, NULL);
   p->build_log = calloc(1000, sizeof(char));
   if (p->build_log)
     p->build_log_max_sz = 1000;
@@ -143,6 +176,140 @@ cl_program_add_ref(cl_program p)
   atomic_inc(&p->ref_n);
 }
 
+static cl_specialized_kernel *
+cl_specialized_kernel_new(cl_program p,
+                          const char *name,
+                          uint32_t arg_num,
+                          const uint32_t *arg_index,
+                          const uint64_t *arg_value)
+{
+  cl_specialized_kernel *spec = NULL;
+  int opt_level = 1;
+
+  TRY_ALLOC_NO_ERR (spec, CALLOC(cl_specialized_kernel));
+  TRY_ALLOC_NO_ERR (spec->name, cl_calloc(strlen(name) + 1, sizeof(char)));
+  TRY_ALLOC_NO_ERR (spec->arg_index, cl_calloc(arg_num, sizeof(uint32_t)));
+  TRY_ALLOC_NO_ERR (spec->arg_value, cl_calloc(arg_num, sizeof(uint64_t)));
+  strcpy(spec->name, name);
+  memcpy(spec->arg_index, arg_index, arg_num * sizeof(uint32_t));
+  memcpy(spec->arg_value, arg_value, arg_num * sizeof(uint64_t));
+  spec->arg_num = arg_num;
+
+  /* A failed compilation is remembered as well to not try it again */
+  if (p->build_opts && strstr(p->build_opts, "-cl-opt-disable"))
+    opt_level = 0;
+  if (CompilerSupported() && compiler_program_new_specialized)
+    spec->opaque = compiler_program_new_specialized(p->opaque, name, arg_num,
+                                                    arg_index, arg_value, opt_level);
+  if (spec->opaque)
+    spec->kernel = interp_program_get_kernel_by_name(spec->opaque, name);
+
+exit:
+  return spec;
+error:
+  cl_specialized_kernel_delete(spec);
+  spec = NULL;
+  goto exit;
+}
+
+/* Index of the variant in the program, spec_n if there is none. victim is
+ * set to the least recently used variant nobody runs, CL_PROGRAM_MAX_SPECIALIZED
+ * if there is none. The caller holds spec_lock */
+static uint32_t
+cl_program_find_specialized_kernel(cl_program p,
+                                   const char *name,
+                                   uint32_t arg_num,
+                                   const uint32_t *arg_index,
+                                   const uint64_t *arg_value,
+                                   uint32_t *victim)
+{
+  uint32_t i;
+
+  *victim = CL_PROGRAM_MAX_SPECIALIZED;
+  for (i = 0; i < p->spec_n; ++i) {
+    cl_specialized_kernel *curr = p->spec[i];
+    if (curr->arg_num == arg_num &&
+        strcmp(curr->name, name) == 0 &&
+        memcmp(curr->arg_index, arg_index, arg_num * sizeof(uint32_t)) == 0 &&
+        memcmp(curr->arg_value, arg_value, arg_num * sizeof(uint64_t)) == 0)
+      return i;
+    if (curr->ref_n == 0 &&
+        (*victim == CL_PROGRAM_MAX_SPECIALIZED || curr->last_use < p->spec[*victim]->last_use))
+      *victim = i;
+  }
+  return p->spec_n;
+}
+
+LOCAL cl_specialized_kernel *
+cl_program_get_specialized_kernel(cl_program p,
+                                  const char *name,
+                                  uint32_t arg_num,
+                                  const uint32_t *arg_index,
+                                  const uint64_t *arg_value)
+{
+  cl_specialized_kernel *spec = NULL, *fresh = NULL, *evicted = NULL;
+  uint32_t i, victim;
+
+  assert(p && name && arg_num > 0);
+  pthread_mutex_lock(&p->spec_lock);
+  p->spec_clock++;
+  i = cl_program_find_specialized_kernel(p, name, arg_num, arg_index, arg_value, &victim);
+  if (i != p->spec_n) {
+    spec = p->spec[i];
+    goto found;
+  }
+  if (p->spec_n == CL_PROGRAM_MAX_SPECIALIZED && victim == CL_PROGRAM_MAX_SPECIALIZED)
+    goto exit;
+  pthread_mutex_unlock(&p->spec_lock);
+
+  /* Compile without the lock, the other launches of the program go on */
+  fresh = cl_specialized_kernel_new(p, name, arg_num, arg_index, arg_value);
+  if (fresh == NULL)
+    return NULL;
+
+  /* Another thread may have added the same variant, or taken the room */
+  pthread_mutex_lock(&p->spec_lock);
+  i = cl_program_find_specialized_kernel(p, name, arg_num, arg_index, arg_value, &victim);
+  if (i != p->spec_n) {
+    spec = p->spec[i];
+    goto found;
+  }
+
+  /* Make room by evicting the least recently used variant nobody runs */
+  if (p->spec_n == CL_PROGRAM_MAX_SPECIALIZED) {
+    if (victim == CL_PROGRAM_MAX_SPECIALIZED)
+      goto exit;
+    evicted = p->spec[victim];
+    p->spec[victim] = p->spec[--p->spec_n];
+  }
+  spec = fresh;
+  fresh = NULL;
+  p->spec[p->spec_n++] = spec;
+
+found:
+  spec->ref_n++;
+  spec->last_use = p->spec_clock;
+exit:
+  pthread_mutex_unlock(&p->spec_lock);
+  /* The compiled variant we did not keep and the evicted one */
+  if (fresh)
+    cl_specialized_kernel_delete(fresh);
+  if (evicted)
+    cl_specialized_kernel_delete(evicted);
+  return spec;
+}
+
+LOCAL void
+cl_program_put_specialized_kernel(cl_program p, cl_specialized_kernel *spec)
+{
+  if (spec == NULL)
+    return;
+  pthread_mutex_lock(&p->spec_lock);
+  assert(spec->ref_n > 0);
+  spec->ref_n--;
+  pthread_mutex_unlock(&p->spec_lock);
+}
+
 static cl_int
 cl_program_load_gen_program(cl_program p)
 {
@@ -166,6 +333,35 @@ error:
   return err;
 }
 
+LOCAL cl_program
+cl_program_create_from_registry(cl_context ctx, gbe_program opaque)
+{
+  cl_program p = NULL;
+  cl_int err = CL_SUCCESS;
+
+  assert(opaque != NULL);
+  TRY_ALLOC (p, cl_program_new(ctx));
+  p->opaque = opaque;
+  p->is_shared = 1;
+  p->source_type = FROM_BINARY;
+  p->binary_type = CL_PROGRAM_BINARY_TYPE_EXECUTABLE;
+
+  /* Only the code upload into the context buffer manager is left to do */
+  TRY (cl_program_load_gen_program, p);
+  p->is_built = 1;
+  p->build_status = CL_BUILD_SUCCESS;
+
+exit:
+  return p;
+error:
+  if (p)
+    cl_program_delete(p);
+  else
+    cl_program_registry_put(opaque);
+  p = NULL;
+  goto exit;
+}
+
 inline cl_bool isBitcodeWrapper(const unsigned char *BufPtr, const unsigned char *BufEnd)
 {
   // See if you can find the hidden message in the magic bytes :-).
@@ -876,3 +1072,16 @@ cl_program_get_kernel_names(cl_program p, size_t size, char *names, size_t *size
     if(size_ret) *size_ret += len + 1; //add ';'
   }
 }
+
+LOCAL cl_bool
+cl_program_get_cache_stats(cl_ulong stats[2])
+{
+  uint64_t hits = 0, misses = 0;
+
+  if (compiler_program_cache_get_stats == NULL)
+    return CL_FALSE;
+  compiler_program_cache_get_stats(&hits, &misses);
+  stats[0] = hits;
+  stats[1] = misses;
+  return CL_TRUE;
+}
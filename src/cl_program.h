@@ -26,6 +26,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 // This is the structure ouput by the compiler
 struct _gbe_program;
@@ -37,6 +38,21 @@ enum {
   FROM_LLVM_SPIR = 3
 };
 
+/* Maximum number of specialized kernels a program keeps around */
+#define CL_PROGRAM_MAX_SPECIALIZED 16
+
+/* One kernel compiled again with some of its scalar arguments folded in */
+typedef struct cl_specialized_kernel {
+  char *name;             /* Kernel it was specialized from */
+  uint32_t arg_num;       /* Number of folded arguments */
+  uint32_t *arg_index;    /* Their indices in increasing order */
+  uint64_t *arg_value;    /* And their values */
+  gbe_program opaque;     /* Program holding the specialized kernel */
+  gbe_kernel kernel;      /* NULL if the kernel cannot be specialized */
+  uint32_t ref_n;         /* Kernels currently running this code */
+  uint64_t last_use;      /* Least recently used unreferenced ones go first */
+} cl_specialized_kernel;
+
 /* This maps an OCL file containing some kernels */
 struct _cl_program {
   DEFINE_ICD(dispatch)
@@ -55,11 +71,16 @@ struct _cl_program {
   uint32_t ker_n;         /* Number of declared kernels */
   uint32_t source_type:2; /* Built from binary, source or LLVM */
   uint32_t is_built:1;    /* Did we call clBuildProgram on it? */
+  uint32_t is_shared:1;   /* opaque belongs to the internal program registry */
   int32_t build_status;   /* build status. */
   char *build_opts;       /* The build options for this program */
   size_t build_log_max_sz; /*build log maximum size in byte.*/
   char *build_log;         /* The build log for this program. */
   size_t build_log_sz;    /* The actual build log size.*/
+  cl_specialized_kernel *spec[CL_PROGRAM_MAX_SPECIALIZED]; /* Specialized kernels */
+  uint32_t spec_n;        /* Number of them */
+  uint64_t spec_clock;    /* Incremented at each lookup */
+  pthread_mutex_t spec_lock; /* Protects the specialized kernels */
 };
 
 /* Create a empty program */
@@ -71,6 +92,27 @@ extern void cl_program_delete(cl_program);
 /* Add one more reference to the object (to defer its deletion) */
 extern void cl_program_add_ref(cl_program);
 
+/* Create a built program of ctx on top of a compiled program of the internal
+ * program registry. The reference on opaque is transferred to the program
+ */
+extern cl_program cl_program_create_from_registry(cl_context ctx, gbe_program opaque);
+
+/* Get the code of kernel name with the given arguments folded in, compiling
+ * it on the first request. Returns NULL when the cache is full of variants in
+ * use. The returned entry has a NULL kernel if the kernel cannot be
+ * specialized. Each entry must be released with
+ * cl_program_put_specialized_kernel
+ */
+extern cl_specialized_kernel *
+cl_program_get_specialized_kernel(cl_program p,
+                                  const char *name,
+                                  uint32_t arg_num,
+                                  const uint32_t *arg_index,
+                                  const uint64_t *arg_value);
+
+/* Release an entry returned by cl_program_get_specialized_kernel */
+extern void cl_program_put_specialized_kernel(cl_program p, cl_specialized_kernel *spec);
+
 /* Create a kernel for the OCL user */
 extern cl_kernel cl_program_create_kernel(cl_program, const char*, cl_int*);
 
@@ -133,5 +175,9 @@ cl_program_get_kernel_names(cl_program p,
                             size_t size,
                             char *names,
                             size_t *size_ret);
+/* Hits and misses of the binary cache of the process. Returns CL_FALSE if the
+ * compiler has no binary cache */
+extern cl_bool
+cl_program_get_cache_stats(cl_ulong stats[2]);
 #endif /* __CL_PROGRAM_H__ */
 
@@ -0,0 +1,155 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "cl_program_registry.h"
+#include "cl_khr_icd.h"
+#include "cl_device_id.h"
+#include "cl_gbe_loader.h"
+#include "cl_alloc.h"
+#include "cl_utils.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <assert.h>
+
+/* One compiled program shared by all the contexts of a device */
+typedef struct _cl_registered_program {
+  struct _cl_registered_program *next;
+  cl_device_id device;     /* Device it was compiled for */
+  const char *data;        /* Binary or source it was built from */
+  char *options;           /* Build options (may be NULL) */
+  gbe_program opaque;      /* What the compiler produced */
+  volatile int ref_n;      /* Contexts using it + the registry itself */
+} cl_registered_program;
+
+static cl_registered_program *registered_programs = NULL;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int
+cl_program_registry_same_options(const char *a, const char *b)
+{
+  if (a == NULL || b == NULL)
+    return a == b;
+  return strcmp(a, b) == 0;
+}
+
+/* Must be called with the registry lock held */
+static cl_registered_program *
+cl_program_registry_find(cl_device_id device, const char *data, const char *options)
+{
+  cl_registered_program *entry;
+  for (entry = registered_programs; entry != NULL; entry = entry->next)
+    if (entry->device == device && entry->data == data &&
+        cl_program_registry_same_options(entry->options, options))
+      return entry;
+  return NULL;
+}
+
+static gbe_program
+cl_program_registry_build(cl_device_id device, const char *data, size_t size,
+                          cl_bool from_source, const char *options)
+{
+  gbe_program opaque;
+
+  if (!from_source)
+    return interp_program_new_from_binary(device->vendor_id, data, size);
+  if (!CompilerSupported())
+    return NULL;
+  opaque = compiler_program_new_from_source(device->vendor_id, data, 0, options, NULL, NULL);
+  /* Nothing links against the shared programs: drop their LLVM module now,
+   * whether the program gets registered or loses the race below */
+  if (opaque)
+    compiler_program_clean_llvm_resource(opaque);
+  return opaque;
+}
+
+LOCAL gbe_program
+cl_program_registry_get(cl_device_id device,
+                        const char *data,
+                        size_t size,
+                        cl_bool from_source,
+                        const char *options)
+{
+  cl_registered_program *entry = NULL;
+  gbe_program opaque = NULL;
+
+  pthread_mutex_lock(&registry_lock);
+  entry = cl_program_registry_find(device, data, options);
+  if (entry) {
+    atomic_inc(&entry->ref_n);
+    pthread_mutex_unlock(&registry_lock);
+    return entry->opaque;
+  }
+  pthread_mutex_unlock(&registry_lock);
+
+  /* Build it without holding the lock. Programs are only compiled once
+   * anyway, and different programs can then be built concurrently */
+  opaque = cl_program_registry_build(device, data, size, from_source, options);
+  if (opaque == NULL)
+    return NULL;
+
+  pthread_mutex_lock(&registry_lock);
+  entry = cl_program_registry_find(device, data, options);
+  if (entry) {
+    /* Somebody else was faster */
+    atomic_inc(&entry->ref_n);
+    pthread_mutex_unlock(&registry_lock);
+    interp_program_delete(opaque);
+    return entry->opaque;
+  }
+  TRY_ALLOC_NO_ERR (entry, CALLOC(cl_registered_program));
+  if (options) {
+    TRY_ALLOC_NO_ERR (entry->options, cl_calloc(strlen(options) + 1, sizeof(char)));
+    memcpy(entry->options, options, strlen(options));
+  }
+  entry->device = device;
+  entry->data = data;
+  entry->opaque = opaque;
+  entry->ref_n = 2;
+  entry->next = registered_programs;
+  registered_programs = entry;
+  pthread_mutex_unlock(&registry_lock);
+  return opaque;
+
+error:
+  pthread_mutex_unlock(&registry_lock);
+  if (entry)
+    cl_free(entry);
+  interp_program_delete(opaque);
+  return NULL;
+}
+
+LOCAL void
+cl_program_registry_put(gbe_program opaque)
+{
+  cl_registered_program *entry;
+
+  if (opaque == NULL)
+    return;
+  pthread_mutex_lock(&registry_lock);
+  for (entry = registered_programs; entry != NULL; entry = entry->next)
+    if (entry->opaque == opaque)
+      break;
+  assert(entry != NULL);
+  /* The registry reference is never released, so the program stays around
+   * for the next context */
+  if (entry)
+    atomic_dec(&entry->ref_n);
+  assert(entry == NULL || entry->ref_n >= 1);
+  pthread_mutex_unlock(&registry_lock);
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __CL_PROGRAM_REGISTRY_H__
+#define __CL_PROGRAM_REGISTRY_H__
+
+#include "program.h"
+#include "CL/cl.h"
+
+/* Process wide registry of the compiled internal programs (copy, fill...).
+ * The compiler output only depends on the device, so it is built once and
+ * shared by all the contexts: each context only uploads the kernel code in
+ * its own buffer manager. The registry keeps its own reference on every
+ * program, so short-lived contexts never rebuild them.
+ */
+
+/* Get a reference on the program built from data for the given device.
+ * data is either a Gen binary or an OpenCL source (from_source) and also
+ * identifies the program, so it must be a static string. The program is
+ * built on first use. Returns NULL if it cannot be built
+ */
+extern gbe_program cl_program_registry_get(cl_device_id device,
+                                           const char *data,
+                                           size_t size,
+                                           cl_bool from_source,
+                                           const char *options);
+
+/* Release a reference taken with cl_program_registry_get */
+extern void cl_program_registry_put(gbe_program opaque);
+
+#endif /* __CL_PROGRAM_REGISTRY_H__ */
@@ -98,6 +98,10 @@ cl_sampler_new(cl_context ctx,
   pthread_mutex_unlock(&ctx->sampler_lock);
   sampler->ctx = ctx;
   cl_context_add_ref(ctx);
+  if (cl_handle_registry_add(&ctx->handles, sampler) != 0) {
+    err = CL_OUT_OF_HOST_MEMORY;
+    goto error;
+  }
 
   sampler->clkSamplerValue = cl_to_clk(normalized_coords, address, filter);
 
@@ -111,6 +115,16 @@ error:
   goto exit;
 }
 
+LOCAL cl_int
+is_valid_sampler(cl_sampler sampler, cl_context ctx)
+{
+  if (!cl_handle_registry_contains(&ctx->handles, sampler))
+    return CL_INVALID_SAMPLER;
+  if (UNLIKELY(sampler->magic != CL_MAGIC_SAMPLER_HEADER))
+    return CL_INVALID_SAMPLER;
+  return CL_SUCCESS;
+}
+
 LOCAL void
 cl_sampler_delete(cl_sampler sampler)
 {
@@ -120,6 +134,7 @@ cl_sampler_delete(cl_sampler sampler)
     return;
 
   assert(sampler->ctx);
+  cl_handle_registry_remove(&sampler->ctx->handles, sampler);
   pthread_mutex_lock(&sampler->ctx->sampler_lock);
     if (sampler->prev)
       sampler->prev->next = sampler->next;
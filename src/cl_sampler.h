@@ -50,6 +50,9 @@ extern void cl_sampler_delete(cl_sampler);
 /* Add one more reference to this object */
 extern void cl_sampler_add_ref(cl_sampler);
 
+/* Query whether sampler is a live sampler object of ctx */
+extern cl_int is_valid_sampler(cl_sampler sampler, cl_context ctx);
+
 /* set a sampler kernel argument */
 int cl_set_sampler_arg_slot(cl_kernel k, int index, cl_sampler sampler);
 
@@ -0,0 +1,308 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "cl_suballoc.h"
+#include "cl_context.h"
+#include "cl_alloc.h"
+#include "cl_utils.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define SLAB_SIZE (64 * KB)
+#define CHUNK_MIN_SIZE 128   /* CL_DEVICE_MEM_BASE_ADDR_ALIGN */
+#define CHUNK_MAX_SIZE 4096
+
+enum {
+  SUBALLOC_CLASS_N = 6,      /* 128 bytes to 4KB */
+  SLAB_WORD_N = SLAB_SIZE / CHUNK_MIN_SIZE / 64
+};
+
+typedef struct _cl_suballoc_slab {
+  struct _cl_suballoc_slab *next;
+  cl_buffer bo;                   /* Backing buffer object */
+  uint32_t class_id;              /* Chunks are CHUNK_MIN_SIZE << class_id bytes */
+  uint32_t chunk_n;               /* Chunks in the slab */
+  uint32_t free_n;                /* Chunks which can be handed out */
+  uint32_t deferred_n;            /* Released chunks the GPU may still access */
+  uint64_t free[SLAB_WORD_N];     /* One bit per free chunk */
+  uint64_t deferred[SLAB_WORD_N]; /* One bit per deferred chunk */
+} cl_suballoc_slab;
+
+typedef struct _cl_suballoc_stats {
+  uint32_t slab_n;          /* Slabs currently allocated */
+  uint32_t peak_slab_n;     /* Highest slab_n so far */
+  uint32_t buffer_n;        /* Memory objects living in the slabs */
+  size_t slab_bytes;        /* Total size of the slabs */
+  size_t requested_bytes;   /* Size asked for by these memory objects */
+  size_t chunk_bytes;       /* Size handed out to them, rounded to the size classes */
+  size_t deferred_bytes;    /* Released, the GPU may still access them */
+  size_t peak_slab_bytes;   /* Highest slab_bytes so far */
+  size_t peak_chunk_bytes;  /* Highest chunk_bytes while slab_bytes was at its peak */
+  size_t peak_deferred_bytes; /* Highest deferred_bytes so far */
+  uint64_t alloc_n;         /* Memory objects suballocated so far */
+  uint64_t slab_alloc_n;    /* Slabs allocated so far */
+  uint64_t total_requested_bytes; /* Size asked for by all of them */
+  uint64_t total_chunk_bytes;     /* Size handed out to all of them */
+} cl_suballoc_stats;
+
+struct _cl_suballoc {
+  pthread_mutex_t lock;
+  cl_context ctx;
+  size_t max_size;                             /* Largest size suballocated */
+  cl_suballoc_slab *slabs[SUBALLOC_CLASS_N];   /* Slabs of each size class */
+  cl_suballoc_stats stats;
+};
+
+static INLINE size_t
+cl_suballoc_chunk_size(uint32_t class_id)
+{
+  return (size_t)CHUNK_MIN_SIZE << class_id;
+}
+
+/* Called with the lock held after the sizes change */
+static void
+cl_suballoc_update_peaks(cl_suballoc_stats *stats)
+{
+  if (stats->slab_bytes > stats->peak_slab_bytes) {
+    stats->peak_slab_bytes = stats->slab_bytes;
+    stats->peak_chunk_bytes = stats->chunk_bytes;
+  } else if (stats->slab_bytes == stats->peak_slab_bytes)
+    stats->peak_chunk_bytes = MAX(stats->peak_chunk_bytes, stats->chunk_bytes);
+  stats->peak_deferred_bytes = MAX(stats->peak_deferred_bytes, stats->deferred_bytes);
+}
+
+LOCAL struct _cl_suballoc *
+cl_suballoc_new(cl_context ctx)
+{
+  struct _cl_suballoc *suballoc = NULL;
+  const char *env = getenv("OCL_BUFFER_SUBALLOC_SIZE");
+
+  TRY_ALLOC_NO_ERR (suballoc, CALLOC(struct _cl_suballoc));
+  pthread_mutex_init(&suballoc->lock, NULL);
+  suballoc->ctx = ctx;
+  suballoc->max_size = CHUNK_MAX_SIZE;
+  if (env != NULL)
+    suballoc->max_size = atol(env) > 0 ? MIN((size_t)atol(env), CHUNK_MAX_SIZE) : 0;
+
+error:
+  return suballoc;
+}
+
+static void
+cl_suballoc_slab_delete(struct _cl_suballoc *suballoc, cl_suballoc_slab *slab)
+{
+  suballoc->stats.slab_n--;
+  suballoc->stats.slab_bytes -= SLAB_SIZE;
+  suballoc->stats.deferred_bytes -= slab->deferred_n * cl_suballoc_chunk_size(slab->class_id);
+  cl_buffer_unreference(slab->bo);
+  cl_free(slab);
+}
+
+LOCAL void
+cl_suballoc_delete(struct _cl_suballoc *suballoc)
+{
+  cl_suballoc_slab *slab;
+  uint32_t class_id;
+
+  if (suballoc == NULL)
+    return;
+
+  if (getenv("OCL_BUFFER_SUBALLOC_STATS")) {
+    const cl_suballoc_stats *stats = &suballoc->stats;
+    /* Internal fragmentation: what the rounding to the size classes wasted.
+     * External fragmentation: the share of the slabs free or deferred when
+     * they took the most memory. Each slab is a buffer object */
+    printf("[Suballoc] {\"allocs\": %llu, \"slab_bos\": %llu, \"peak_slab_bos\": %u, "
+           "\"requested_bytes\": %llu, \"chunk_bytes\": %llu, \"internal_fragmentation\": %.3f, "
+           "\"peak_slab_bytes\": %llu, \"peak_deferred_bytes\": %llu, "
+           "\"external_fragmentation\": %.3f}\n",
+           (unsigned long long)stats->alloc_n, (unsigned long long)stats->slab_alloc_n,
+           stats->peak_slab_n, (unsigned long long)stats->total_requested_bytes,
+           (unsigned long long)stats->total_chunk_bytes,
+           stats->total_chunk_bytes ?
+             1.0 - (double)stats->total_requested_bytes / stats->total_chunk_bytes : 0.0,
+           (unsigned long long)stats->peak_slab_bytes,
+           (unsigned long long)stats->peak_deferred_bytes,
+           stats->peak_slab_bytes ?
+             1.0 - (double)stats->peak_chunk_bytes / stats->peak_slab_bytes : 0.0);
+  }
+
+  for (class_id = 0; class_id < SUBALLOC_CLASS_N; class_id++) {
+    while ((slab = suballoc->slabs[class_id]) != NULL) {
+      assert(slab->free_n + slab->deferred_n == slab->chunk_n);
+      suballoc->slabs[class_id] = slab->next;
+      cl_suballoc_slab_delete(suballoc, slab);
+    }
+  }
+  pthread_mutex_destroy(&suballoc->lock);
+  cl_free(suballoc);
+}
+
+static cl_suballoc_slab *
+cl_suballoc_slab_new(struct _cl_suballoc *suballoc, uint32_t class_id)
+{
+  cl_suballoc_slab *slab = NULL;
+  uint32_t i;
+
+  TRY_ALLOC_NO_ERR (slab, CALLOC(cl_suballoc_slab));
+  slab->bo = cl_buffer_alloc(cl_context_get_bufmgr(suballoc->ctx),
+                             "CL suballocated memory objects", SLAB_SIZE, 4096);
+  if (slab->bo == NULL) {
+    cl_free(slab);
+    return NULL;
+  }
+  slab->class_id = class_id;
+  slab->chunk_n = SLAB_SIZE / cl_suballoc_chunk_size(class_id);
+  slab->free_n = slab->chunk_n;
+  for (i = 0; i < slab->chunk_n; i++)
+    slab->free[i / 64] |= 1ull << (i % 64);
+
+  slab->next = suballoc->slabs[class_id];
+  suballoc->slabs[class_id] = slab;
+  suballoc->stats.slab_n++;
+  suballoc->stats.slab_bytes += SLAB_SIZE;
+  suballoc->stats.slab_alloc_n++;
+  suballoc->stats.peak_slab_n = MAX(suballoc->stats.peak_slab_n, suballoc->stats.slab_n);
+  cl_suballoc_update_peaks(&suballoc->stats);
+
+error:
+  return slab;
+}
+
+static cl_suballoc_slab *
+cl_suballoc_find_slab(struct _cl_suballoc *suballoc, uint32_t class_id, int *deferred)
+{
+  cl_suballoc_slab *slab;
+
+  *deferred = 0;
+  for (slab = suballoc->slabs[class_id]; slab != NULL; slab = slab->next) {
+    if (slab->free_n > 0)
+      return slab;
+    *deferred |= slab->deferred_n > 0;
+  }
+  return NULL;
+}
+
+/* Hand the deferred chunks out again once nothing can access them: no
+ * kernel is batched but not submitted and the GPU is done with the slab */
+static void
+cl_suballoc_recycle(struct _cl_suballoc *suballoc, uint32_t class_id)
+{
+  cl_suballoc_slab *slab;
+  uint32_t i;
+
+  if (suballoc->ctx->batched_n != 0)
+    return;
+
+  for (slab = suballoc->slabs[class_id]; slab != NULL; slab = slab->next) {
+    if (slab->deferred_n == 0 || cl_buffer_is_busy(slab->bo))
+      continue;
+    for (i = 0; i < SLAB_WORD_N; i++) {
+      slab->free[i] |= slab->deferred[i];
+      slab->deferred[i] = 0;
+    }
+    suballoc->stats.deferred_bytes -= slab->deferred_n * cl_suballoc_chunk_size(class_id);
+    slab->free_n += slab->deferred_n;
+    slab->deferred_n = 0;
+  }
+}
+
+LOCAL cl_buffer
+cl_suballoc_alloc(struct _cl_suballoc *suballoc, size_t size,
+                  size_t *offset, struct _cl_suballoc_slab **slab_out)
+{
+  cl_suballoc_slab *slab;
+  uint32_t class_id = 0, i, bit;
+  int deferred;
+
+  if (suballoc == NULL || size == 0 || size > suballoc->max_size)
+    return NULL;
+  while (cl_suballoc_chunk_size(class_id) < size)
+    class_id++;
+
+  pthread_mutex_lock(&suballoc->lock);
+  slab = cl_suballoc_find_slab(suballoc, class_id, &deferred);
+  if (slab == NULL && deferred) {
+    /* The kernels this thread batched may use the released chunks */
+    pthread_mutex_unlock(&suballoc->lock);
+    cl_context_flush_batches(suballoc->ctx);
+    pthread_mutex_lock(&suballoc->lock);
+    cl_suballoc_recycle(suballoc, class_id);
+    slab = cl_suballoc_find_slab(suballoc, class_id, &deferred);
+  }
+  if (slab == NULL)
+    slab = cl_suballoc_slab_new(suballoc, class_id);
+  if (slab == NULL) {
+    pthread_mutex_unlock(&suballoc->lock);
+    return NULL;
+  }
+
+  for (i = 0; slab->free[i] == 0; i++)
+    ;
+  bit = __builtin_ctzll(slab->free[i]);
+  slab->free[i] &= ~(1ull << bit);
+  slab->free_n--;
+  *offset = (i * 64 + bit) * cl_suballoc_chunk_size(class_id);
+  *slab_out = slab;
+
+  suballoc->stats.buffer_n++;
+  suballoc->stats.requested_bytes += size;
+  suballoc->stats.chunk_bytes += cl_suballoc_chunk_size(class_id);
+  suballoc->stats.alloc_n++;
+  suballoc->stats.total_requested_bytes += size;
+  suballoc->stats.total_chunk_bytes += cl_suballoc_chunk_size(class_id);
+  cl_suballoc_update_peaks(&suballoc->stats);
+  cl_buffer_reference(slab->bo);
+  pthread_mutex_unlock(&suballoc->lock);
+  return slab->bo;
+}
+
+LOCAL void
+cl_suballoc_free(struct _cl_suballoc *suballoc, struct _cl_suballoc_slab *slab,
+                 size_t offset, size_t size)
+{
+  const size_t chunk_sz = cl_suballoc_chunk_size(slab->class_id);
+  const uint32_t chunk = offset / chunk_sz;
+  cl_suballoc_slab **it;
+
+  pthread_mutex_lock(&suballoc->lock);
+  assert(chunk < slab->chunk_n);
+  assert(!(slab->free[chunk / 64] & (1ull << (chunk % 64))));
+  slab->deferred[chunk / 64] |= 1ull << (chunk % 64);
+  slab->deferred_n++;
+  suballoc->stats.buffer_n--;
+  suballoc->stats.requested_bytes -= size;
+  suballoc->stats.chunk_bytes -= chunk_sz;
+  suballoc->stats.deferred_bytes += chunk_sz;
+  cl_suballoc_update_peaks(&suballoc->stats);
+
+  /* Nothing lives in the slab anymore: release it unless it is the last one
+   * of its class. The GPU keeps the buffer object alive as long as needed */
+  if (slab->free_n + slab->deferred_n == slab->chunk_n &&
+      (suballoc->slabs[slab->class_id] != slab || slab->next != NULL)) {
+    for (it = &suballoc->slabs[slab->class_id]; *it != slab; it = &(*it)->next)
+      ;
+    *it = slab->next;
+    cl_suballoc_slab_delete(suballoc, slab);
+  }
+  pthread_mutex_unlock(&suballoc->lock);
+}
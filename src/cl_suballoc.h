@@ -0,0 +1,64 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __CL_SUBALLOC_H__
+#define __CL_SUBALLOC_H__
+
+#include "cl_driver.h"
+#include "CL/cl.h"
+
+#include <stdint.h>
+
+/* Small buffers are carved out of large buffer objects (slabs) instead of
+ * getting a buffer object each. A slab holds chunks of one size class, a
+ * power of two between the base address alignment of the device (128 bytes)
+ * and 4KB. A released chunk is only handed out again once the GPU is done
+ * with its slab, since the kernels launched on the released buffer may
+ * still run. The memory object keeps its offset in the slab in mem->offset.
+ */
+
+struct _cl_suballoc;
+struct _cl_suballoc_slab;
+
+/* The suballocator of a context. OCL_BUFFER_SUBALLOC_SIZE sets the largest
+ * buffer size it serves, 0 disables it
+ */
+extern struct _cl_suballoc *cl_suballoc_new(cl_context ctx);
+
+/* Release the slabs. All the chunks must have been released. The statistics
+ * are printed when OCL_BUFFER_SUBALLOC_STATS is set: the buffer objects
+ * allocated for the slabs and the memory lost in them, to the size classes
+ * (internal fragmentation) and to the chunks not handed out when the slabs
+ * took the most memory (external fragmentation)
+ */
+extern void cl_suballoc_delete(struct _cl_suballoc *suballoc);
+
+/* Carve size bytes out of a slab. Returns a new reference on the slab buffer
+ * object and sets the offset of the chunk and its slab, NULL if size is too
+ * large to be suballocated or no slab can be allocated
+ */
+extern cl_buffer cl_suballoc_alloc(struct _cl_suballoc *suballoc, size_t size,
+                                   size_t *offset, struct _cl_suballoc_slab **slab);
+
+/* Release a chunk given by cl_suballoc_alloc. The caller still drops its
+ * reference on the slab buffer object
+ */
+extern void cl_suballoc_free(struct _cl_suballoc *suballoc, struct _cl_suballoc_slab *slab,
+                             size_t offset, size_t size);
+
+#endif /* __CL_SUBALLOC_H__ */
@@ -17,26 +17,38 @@
  */
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
 
 #include "cl_thread.h"
 #include "cl_alloc.h"
 #include "cl_utils.h"
+#include "cl_context.h"
+#include "cl_access_set.h"
 
 /* Because the cl_command_queue can be used in several threads simultaneously but
    without add ref to it, we now handle it like this:
-   Keep one threads_slot_array, every time the thread get gpgpu or batch buffer, if it
-   does not have a slot, assign it.
-   The resources are keeped in queue private, and resize it if needed.
-   When the thread exit, the slot will be set invalid.
+   Every thread gets a slot, the lowest free one, the first time it uses a queue
+   and gives it back when it exits, so the slots stay as few as the threads alive.
+   The resources are keeped in queue private, in a table indexed by the slots.
+   The threads look their data up without any lock: the table is only replaced
+   by a larger copy, published atomically, and the copies it replaced are kept
+   until the queue is released.
+   A thread given the slot of a thread which exited takes over its data.
    When queue released, all the resources will be released. If user still enqueue, flush
    or finish the queue after it has been released, the behavior is undefined.
-   TODO: Need to shrink the slot map.
    */
 
-static int thread_array_num = 1;
-static int *thread_slot_map = NULL;
-static int thread_magic_num = 1;
-static pthread_mutex_t thread_queue_map_lock = PTHREAD_MUTEX_INITIALIZER;
+/* The slots are allocated by chunks which are never freed or moved, so that
+   taking a slot does not race with a reallocation */
+enum { thread_slot_chunk_size = 64, thread_slot_chunk_num = 1024 };
+
+static atomic_t * volatile thread_slot_chunks[thread_slot_chunk_num]; /* 1 when taken */
+static atomic_t thread_slot_num = 0;   /* Slots handed out at least once */
+static atomic_t thread_magic_num = 1;
+static pthread_key_t thread_slot_key;
+static pthread_once_t thread_slot_once = PTHREAD_ONCE_INIT;
 
 static __thread int thread_id = -1;
 static __thread int thread_magic = -1;
@@ -45,89 +57,244 @@ typedef struct _thread_spec_data {
   cl_gpgpu gpgpu ;
   int valid;
   void* thread_batch_buf;
+  int batched_n;      /* Launches recorded in the batch buffer but not submitted yet */
   int thread_magic;
+  cl_access_set access;       /* Objects of the launches of the command being enqueued */
+  cl_access_set batch_access; /* Objects of the launches since the last cache flush of the batch */
+  pthread_mutex_t batch_lock; /* Held by the thread while it records a launch, and by the
+                                 threads flushing its batch with the ones of the queue */
+  int recording;              /* The thread holds batch_lock, only the thread reads it */
 } thread_spec_data;
 
+typedef struct _thread_data_table {
+  int num;
+  struct _thread_data_table *replaced;  /* The smaller table it was copied from */
+  thread_spec_data *data[];
+} thread_data_table;
+
+/* Flushed gpgpus kept to record the next batches of the queue, so that their
+   state buffers are not allocated again for every flush */
+enum { gpgpu_pool_size = 8 };
+
 typedef struct _queue_thread_private {
-  thread_spec_data**  threads_data;
-  int threads_data_num;
-  pthread_mutex_t thread_data_lock;
+  thread_data_table * volatile threads_data;
+  cl_gpgpu gpgpu_pool[gpgpu_pool_size]; /* oldest first */
+  int gpgpu_pool_n;
+  pthread_mutex_t thread_data_lock;     /* Held to grow the table, to walk it and for the pool */
 } queue_thread_private;
 
-static thread_spec_data * __create_thread_spec_data(cl_command_queue queue, int create)
+static atomic_t *__thread_slot(int id, int create)
 {
-  queue_thread_private *thread_private = ((queue_thread_private *)(queue->thread_data));
-  thread_spec_data* spec = NULL;
-  int i = 0;
+  atomic_t * volatile *chunk = &thread_slot_chunks[id / thread_slot_chunk_size];
+  atomic_t *slots = *chunk;
+
+  if (slots == NULL && create) {
+    slots = calloc(thread_slot_chunk_size, sizeof(atomic_t));
+    if (slots == NULL)
+      return NULL;
+    if (!__sync_bool_compare_and_swap(chunk, NULL, slots)) {
+      free((void *)slots);
+      slots = *chunk;
+    }
+  }
+  return slots ? slots + id % thread_slot_chunk_size : NULL;
+}
+
+/* Called when a thread which took a slot exits */
+static void __release_thread_slot(void *arg)
+{
+  atomic_t *slot = __thread_slot((int)(intptr_t)arg - 1, 0);
+
+  /* The data the thread left in the queues goes to the next owner of the slot */
+  __sync_lock_release(slot);
+}
 
-  if (thread_id == -1) {
+static void __create_thread_slot_key(void)
+{
+  pthread_key_create(&thread_slot_key, __release_thread_slot);
+}
 
-    pthread_mutex_lock(&thread_queue_map_lock);
-    for (i = 0; i < thread_array_num; i++) {
-      if (thread_slot_map[i] == 0) {
-        thread_id = i;
+static void __take_thread_slot(void)
+{
+  atomic_t *slot = NULL;
+  int i, num;
+
+  pthread_once(&thread_slot_once, __create_thread_slot_key);
+  for (;;) {
+    num = thread_slot_num;
+    for (i = 0; i < num; i++) {
+      slot = __thread_slot(i, 0);
+      if (slot && *slot == 0 && __sync_bool_compare_and_swap(slot, 0, 1))
         break;
-      }
     }
+    if (i < num)
+      break;
+    /* None free: a new one, unless a thread scanning the slots took it first */
+    i = atomic_inc(&thread_slot_num);
+    assert(i < thread_slot_chunk_size * thread_slot_chunk_num);
+    slot = __thread_slot(i, 1);
+    assert(slot);
+    if (__sync_bool_compare_and_swap(slot, 0, 1))
+      break;
+  }
 
-    if (i == thread_array_num) {
-      thread_array_num *= 2;
-      thread_slot_map = realloc(thread_slot_map, sizeof(int) * thread_array_num);
-      memset(thread_slot_map + thread_array_num/2, 0, sizeof(int) * (thread_array_num/2));
-      thread_id = thread_array_num/2;
-    }
+  thread_id = i;
+  thread_magic = atomic_inc(&thread_magic_num);
+  pthread_setspecific(thread_slot_key, (void *)(intptr_t)(i + 1));
+}
 
-    thread_slot_map[thread_id] = 1;
+/* Take the oldest retired gpgpu of the pool, if its batch completed */
+static cl_gpgpu __pool_take_gpgpu(queue_thread_private *thread_private)
+{
+  cl_gpgpu gpgpu = NULL;
 
-    thread_magic = thread_magic_num++;
-    pthread_mutex_unlock(&thread_queue_map_lock);
+  pthread_mutex_lock(&thread_private->thread_data_lock);
+  if (thread_private->gpgpu_pool_n > 0 && cl_gpgpu_reuse(thread_private->gpgpu_pool[0]) == 0) {
+    gpgpu = thread_private->gpgpu_pool[0];
+    thread_private->gpgpu_pool_n--;
+    memmove(thread_private->gpgpu_pool, thread_private->gpgpu_pool + 1,
+            thread_private->gpgpu_pool_n * sizeof(cl_gpgpu));
   }
+  pthread_mutex_unlock(&thread_private->thread_data_lock);
+  return gpgpu;
+}
+
+/* Keep a flushed gpgpu for later, the pool drops its oldest one when full */
+static void __pool_put_gpgpu(queue_thread_private *thread_private, cl_gpgpu gpgpu)
+{
+  cl_gpgpu oldest = NULL;
 
   pthread_mutex_lock(&thread_private->thread_data_lock);
-  if (thread_array_num > thread_private->threads_data_num) {// just enlarge
-    int old_num = thread_private->threads_data_num;
-    thread_private->threads_data_num = thread_array_num;
-    thread_private->threads_data = realloc(thread_private->threads_data,
-                thread_private->threads_data_num * sizeof(void *));
-    memset(thread_private->threads_data + old_num, 0,
-           sizeof(void*) * (thread_private->threads_data_num - old_num));
+  if (thread_private->gpgpu_pool_n == gpgpu_pool_size) {
+    oldest = thread_private->gpgpu_pool[0];
+    thread_private->gpgpu_pool_n--;
+    memmove(thread_private->gpgpu_pool, thread_private->gpgpu_pool + 1,
+            thread_private->gpgpu_pool_n * sizeof(cl_gpgpu));
+  }
+  thread_private->gpgpu_pool[thread_private->gpgpu_pool_n++] = gpgpu;
+  pthread_mutex_unlock(&thread_private->thread_data_lock);
+
+  if (oldest)
+    cl_gpgpu_delete(oldest);
+}
+
+/* The context counts the kernels batched by all its threads */
+static void __set_batched_num(cl_command_queue queue, thread_spec_data *spec, int num)
+{
+  if (num != spec->batched_n)
+    atomic_add(&queue->ctx->batched_n, num - spec->batched_n);
+  spec->batched_n = num;
+}
+
+/* The data of the thread, without lock */
+static thread_spec_data * __lookup_thread_spec_data(queue_thread_private *thread_private)
+{
+  thread_data_table *table = thread_private->threads_data;
+
+  assert(thread_id != -1);
+  return thread_id < table->num ? table->data[thread_id] : NULL;
+}
+
+/* Take over the data left by the thread which had the slot before */
+static void __adopt_thread_spec_data(cl_command_queue queue, thread_spec_data *spec)
+{
+  pthread_mutex_lock(&spec->batch_lock);
+  if (spec->thread_batch_buf) {
+    cl_gpgpu_unref_batch_buf(spec->thread_batch_buf);
+    spec->thread_batch_buf = NULL;
+  }
+  if (spec->valid) {
+    /* Submit what the thread batched before exiting */
+    if (spec->batched_n > 0)
+      cl_gpgpu_flush(spec->gpgpu);
+    __pool_put_gpgpu((queue_thread_private *)queue->thread_data, spec->gpgpu);
+    spec->gpgpu = NULL;
+    __set_batched_num(queue, spec, 0);
+    spec->valid = 0;
+  }
+  cl_access_set_clear(&spec->access);
+  cl_access_set_clear(&spec->batch_access);
+  spec->recording = 0;
+  spec->thread_magic = thread_magic;
+  pthread_mutex_unlock(&spec->batch_lock);
+}
+
+/* The thread changes the batch of its data under its lock, unless it holds
+   it already to record a launch */
+static void __lock_own_batch(thread_spec_data *spec)
+{
+  if (!spec->recording)
+    pthread_mutex_lock(&spec->batch_lock);
+}
+
+static void __unlock_own_batch(thread_spec_data *spec)
+{
+  if (!spec->recording)
+    pthread_mutex_unlock(&spec->batch_lock);
+}
+
+static thread_spec_data * __create_thread_spec_data(cl_command_queue queue, int create)
+{
+  queue_thread_private *thread_private = ((queue_thread_private *)(queue->thread_data));
+  thread_data_table *table, *larger;
+  thread_spec_data* spec = NULL;
+  int num;
+
+  if (thread_id == -1)
+    __take_thread_slot();
+
+  spec = __lookup_thread_spec_data(thread_private);
+  if (spec) {
+    if (spec->thread_magic != thread_magic)
+      __adopt_thread_spec_data(queue, spec);
+    return spec;
   }
+  if (!create)
+    return NULL;
 
-  assert(thread_id != -1 && thread_id < thread_array_num);
-  spec = thread_private->threads_data[thread_id];
-  if (!spec && create) {
-       spec = CALLOC(thread_spec_data);
-       spec->thread_magic = thread_magic;
-       thread_private->threads_data[thread_id] = spec;
+  pthread_mutex_lock(&thread_private->thread_data_lock);
+  table = thread_private->threads_data;
+  if (thread_id >= table->num) {
+    num = MAX(table->num * 2, thread_id + 1);
+    TRY_ALLOC_NO_ERR(larger, cl_malloc(sizeof(thread_data_table) + num * sizeof(thread_spec_data *)));
+    memcpy(larger->data, table->data, table->num * sizeof(thread_spec_data *));
+    memset(larger->data + table->num, 0, (num - table->num) * sizeof(thread_spec_data *));
+    larger->num = num;
+    larger->replaced = table;
+    /* The readers of the old table may still use it */
+    __sync_synchronize();
+    thread_private->threads_data = table = larger;
   }
 
-  pthread_mutex_unlock(&thread_private->thread_data_lock);
+  TRY_ALLOC_NO_ERR(spec, CALLOC(thread_spec_data));
+  pthread_mutex_init(&spec->batch_lock, NULL);
+  spec->thread_magic = thread_magic;
+  __sync_synchronize();
+  table->data[thread_id] = spec;
 
+error:
+  pthread_mutex_unlock(&thread_private->thread_data_lock);
   return spec;
 }
 
 void* cl_thread_data_create(void)
 {
   queue_thread_private* thread_private = CALLOC(queue_thread_private);
+  thread_data_table *table;
+  int num = MAX(thread_slot_num, 1);
 
   if (thread_private == NULL)
     return NULL;
 
-  if (thread_slot_map == NULL) {
-    pthread_mutex_lock(&thread_queue_map_lock);
-    thread_slot_map = calloc(thread_array_num, sizeof(int));
-    pthread_mutex_unlock(&thread_queue_map_lock);
-
+  table = cl_calloc(1, sizeof(thread_data_table) + num * sizeof(thread_spec_data *));
+  if (table == NULL) {
+    cl_free(thread_private);
+    return NULL;
   }
-
+  table->num = num;
+  thread_private->threads_data = table;
   pthread_mutex_init(&thread_private->thread_data_lock, NULL);
 
-  pthread_mutex_lock(&thread_private->thread_data_lock);
-  thread_private->threads_data = malloc(thread_array_num * sizeof(void *));
-  memset(thread_private->threads_data, 0, sizeof(void*) * thread_array_num);
-  thread_private->threads_data_num = thread_array_num;
-  pthread_mutex_unlock(&thread_private->thread_data_lock);
-
   return thread_private;
 }
 
@@ -135,11 +302,10 @@ cl_gpgpu cl_get_thread_gpgpu(cl_command_queue queue)
 {
   thread_spec_data* spec = __create_thread_spec_data(queue, 1);
 
-  if (!spec->thread_magic && spec->thread_magic != thread_magic) {
-    //We may get the slot from last thread. So free the resource.
-    spec->valid = 0;
-  }
+  if (spec == NULL)
+    return NULL;
 
+  __lock_own_batch(spec);
   if (!spec->valid) {
     if (spec->thread_batch_buf) {
       cl_gpgpu_unref_batch_buf(spec->thread_batch_buf);
@@ -149,11 +315,15 @@ cl_gpgpu cl_get_thread_gpgpu(cl_command_queue queue)
       cl_gpgpu_delete(spec->gpgpu);
       spec->gpgpu = NULL;
     }
-    TRY_ALLOC_NO_ERR(spec->gpgpu, cl_gpgpu_new(queue->ctx->drv));
+    spec->gpgpu = __pool_take_gpgpu((queue_thread_private *)queue->thread_data);
+    if (spec->gpgpu == NULL)
+      TRY_ALLOC_NO_ERR(spec->gpgpu, cl_gpgpu_new(queue->ctx->drv));
+    __set_batched_num(queue, spec, 0);
     spec->valid = 1;
   }
 
  error:
+  __unlock_own_batch(spec);
   return spec->gpgpu;
 }
 
@@ -163,10 +333,12 @@ void cl_set_thread_batch_buf(cl_command_queue queue, void* buf)
 
   assert(spec && spec->thread_magic == thread_magic);
 
+  __lock_own_batch(spec);
   if (spec->thread_batch_buf) {
     cl_gpgpu_unref_batch_buf(spec->thread_batch_buf);
   }
   spec->thread_batch_buf = buf;
+  __unlock_own_batch(spec);
 }
 
 void* cl_get_thread_batch_buf(cl_command_queue queue) {
@@ -177,76 +349,187 @@ void* cl_get_thread_batch_buf(cl_command_queue queue) {
   return spec->thread_batch_buf;
 }
 
+int cl_get_thread_batched_num(cl_command_queue queue)
+{
+  thread_spec_data* spec = __create_thread_spec_data(queue, 1);
+
+  assert(spec && spec->thread_magic == thread_magic);
+
+  return spec->valid ? spec->batched_n : 0;
+}
+
+void cl_set_thread_batched_num(cl_command_queue queue, int num)
+{
+  thread_spec_data* spec = __create_thread_spec_data(queue, 1);
+
+  assert(spec && spec->thread_magic == thread_magic && spec->valid);
+
+  __lock_own_batch(spec);
+  __set_batched_num(queue, spec, num);
+  __unlock_own_batch(spec);
+}
+
+cl_access_set* cl_get_thread_access_set(cl_command_queue queue)
+{
+  thread_spec_data* spec = __create_thread_spec_data(queue, 1);
+
+  assert(spec && spec->thread_magic == thread_magic);
+
+  return &spec->access;
+}
+
+cl_access_set* cl_get_thread_batch_access_set(cl_command_queue queue)
+{
+  thread_spec_data* spec = __create_thread_spec_data(queue, 1);
+
+  assert(spec && spec->thread_magic == thread_magic);
+
+  return &spec->batch_access;
+}
+
 void cl_invalid_thread_gpgpu(cl_command_queue queue)
 {
   queue_thread_private *thread_private = ((queue_thread_private *)(queue->thread_data));
   thread_spec_data* spec = NULL;
 
-  pthread_mutex_lock(&thread_private->thread_data_lock);
-  spec = thread_private->threads_data[thread_id];
+  spec = __lookup_thread_spec_data(thread_private);
   assert(spec);
-  pthread_mutex_unlock(&thread_private->thread_data_lock);
 
-  if (!spec->valid) {
-    return;
+  __lock_own_batch(spec);
+  if (spec->valid) {
+    assert(spec->gpgpu);
+    __pool_put_gpgpu(thread_private, spec->gpgpu);
+    spec->gpgpu = NULL;
+    __set_batched_num(queue, spec, 0);
+    spec->valid = 0;
   }
-
-  assert(spec->gpgpu);
-  cl_gpgpu_delete(spec->gpgpu);
-  spec->gpgpu = NULL;
-  spec->valid = 0;
+  __unlock_own_batch(spec);
 }
 
-cl_gpgpu cl_thread_gpgpu_take(cl_command_queue queue)
+cl_gpgpu cl_thread_gpgpu_take(cl_command_queue queue, int *batched_n)
 {
   queue_thread_private *thread_private = ((queue_thread_private *)(queue->thread_data));
   thread_spec_data* spec = NULL;
 
-  pthread_mutex_lock(&thread_private->thread_data_lock);
-  spec = thread_private->threads_data[thread_id];
-  assert(spec);
-  pthread_mutex_unlock(&thread_private->thread_data_lock);
+  cl_gpgpu gpgpu = NULL;
 
-  if (!spec->valid)
-    return NULL;
+  spec = __lookup_thread_spec_data(thread_private);
+  assert(spec);
 
-  assert(spec->gpgpu);
-  cl_gpgpu gpgpu = spec->gpgpu;
-  spec->gpgpu = NULL;
-  spec->valid = 0;
+  *batched_n = 0;
+  __lock_own_batch(spec);
+  if (spec->valid) {
+    assert(spec->gpgpu);
+    gpgpu = spec->gpgpu;
+    spec->gpgpu = NULL;
+    /* The caller holds the launches now: they are not uncounted */
+    *batched_n = spec->batched_n;
+    spec->batched_n = 0;
+    spec->valid = 0;
+  }
+  __unlock_own_batch(spec);
   return gpgpu;
 }
 
+int cl_thread_batch_lock(cl_command_queue queue)
+{
+  thread_spec_data* spec = __create_thread_spec_data(queue, 1);
+
+  assert(spec && spec->thread_magic == thread_magic);
+
+  if (spec->recording)
+    return 0;
+  pthread_mutex_lock(&spec->batch_lock);
+  spec->recording = 1;
+  return 1;
+}
+
+void cl_thread_batch_unlock(cl_command_queue queue)
+{
+  thread_spec_data* spec = __lookup_thread_spec_data((queue_thread_private *)queue->thread_data);
+
+  if (spec == NULL || !spec->recording)
+    return;
+  spec->recording = 0;
+  pthread_mutex_unlock(&spec->batch_lock);
+}
+
+cl_int cl_thread_flush_batches(cl_command_queue queue, int wait)
+{
+  queue_thread_private *thread_private = ((queue_thread_private *)(queue->thread_data));
+  thread_data_table *table;
+  thread_spec_data* spec;
+  cl_int err = CL_SUCCESS;
+  int i, own;
+
+  /* The slots taken after this point enqueue after the caller */
+  pthread_mutex_lock(&thread_private->thread_data_lock);
+  table = thread_private->threads_data;
+  pthread_mutex_unlock(&thread_private->thread_data_lock);
+
+  for (i = 0; i < table->num; i++) {
+    if ((spec = table->data[i]) == NULL)
+      continue;
+    /* A thread waits for the others to finish recording their launch, but
+       not for itself */
+    own = i == thread_id && spec->recording;
+    if (!own)
+      pthread_mutex_lock(&spec->batch_lock);
+    if (spec->valid && spec->batched_n > 0) {
+      if (cl_gpgpu_flush(spec->gpgpu) < 0)
+        err = CL_OUT_OF_RESOURCES;
+      __pool_put_gpgpu(thread_private, spec->gpgpu);
+      spec->gpgpu = NULL;
+      __set_batched_num(queue, spec, 0);
+      spec->valid = 0;
+    }
+    if (wait && spec->thread_batch_buf)
+      cl_gpgpu_sync(spec->thread_batch_buf);
+    if (!own)
+      pthread_mutex_unlock(&spec->batch_lock);
+  }
+  return err;
+}
+
 /* The destructor for clean the thread specific data. */
 void cl_thread_data_destroy(cl_command_queue queue)
 {
   int i = 0;
   queue_thread_private *thread_private = ((queue_thread_private *)(queue->thread_data));
-  int threads_data_num;
-  thread_spec_data** threads_data;
+  thread_data_table *table, *replaced;
 
   pthread_mutex_lock(&thread_private->thread_data_lock);
-  threads_data_num = thread_private->threads_data_num;
-  threads_data = thread_private->threads_data;
-  thread_private->threads_data_num = 0;
+  table = thread_private->threads_data;
   thread_private->threads_data = NULL;
   pthread_mutex_unlock(&thread_private->thread_data_lock);
+  for (i = 0; i < thread_private->gpgpu_pool_n; i++)
+    cl_gpgpu_delete(thread_private->gpgpu_pool[i]);
+  pthread_mutex_destroy(&thread_private->thread_data_lock);
   cl_free(thread_private);
   queue->thread_data = NULL;
 
-  for (i = 0; i < threads_data_num; i++) {
-    if (threads_data[i] != NULL && threads_data[i]->thread_batch_buf) {
-      cl_gpgpu_unref_batch_buf(threads_data[i]->thread_batch_buf);
-      threads_data[i]->thread_batch_buf = NULL;
+  for (i = 0; i < table->num; i++) {
+    if (table->data[i] != NULL && table->data[i]->thread_batch_buf) {
+      cl_gpgpu_unref_batch_buf(table->data[i]->thread_batch_buf);
+      table->data[i]->thread_batch_buf = NULL;
     }
 
-    if (threads_data[i] != NULL && threads_data[i]->valid) {
-      cl_gpgpu_delete(threads_data[i]->gpgpu);
-      threads_data[i]->gpgpu = NULL;
-      threads_data[i]->valid = 0;
+    if (table->data[i] != NULL && table->data[i]->valid) {
+      /* Releasing the queue flushes it, submit what the thread batched */
+      if (table->data[i]->batched_n > 0)
+        cl_gpgpu_flush(table->data[i]->gpgpu);
+      cl_gpgpu_delete(table->data[i]->gpgpu);
+      table->data[i]->gpgpu = NULL;
+      __set_batched_num(queue, table->data[i], 0);
+      table->data[i]->valid = 0;
     }
-    cl_free(threads_data[i]);
+    if (table->data[i] != NULL)
+      pthread_mutex_destroy(&table->data[i]->batch_lock);
+    cl_free(table->data[i]);
   }
 
-  cl_free(threads_data);
+  for (; table != NULL; table = replaced) {
+    replaced = table->replaced;
+    cl_free(table);
+  }
 }
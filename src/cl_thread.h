@@ -41,7 +41,32 @@ void cl_set_thread_batch_buf(cl_command_queue queue, void* buf);
 /* Used to get the batch buffer of each thread. */
 void* cl_get_thread_batch_buf(cl_command_queue queue);
 
-/* take current gpgpu from the thread gpgpu pool. */
-cl_gpgpu cl_thread_gpgpu_take(cl_command_queue queue);
+/* take current gpgpu from the thread gpgpu pool. Its launches, returned in
+ * batched_n, stay counted in ctx->batched_n until the caller submits them. */
+cl_gpgpu cl_thread_gpgpu_take(cl_command_queue queue, int *batched_n);
+
+/* Used to get the number of launches waiting in the batch buffer of each thread. */
+int cl_get_thread_batched_num(cl_command_queue queue);
+
+/* Used to set the number of launches waiting in the batch buffer of each thread. */
+void cl_set_thread_batched_num(cl_command_queue queue, int num);
+
+/* Used to get the memory objects of the launches of the command the thread enqueues. */
+struct _cl_access_set* cl_get_thread_access_set(cl_command_queue queue);
+
+/* Used to get the memory objects of the launches the thread recorded in its batch
+   buffer since the last cache flush. */
+struct _cl_access_set* cl_get_thread_batch_access_set(cl_command_queue queue);
+
+/* Used to keep the other threads from flushing the batch buffer of the thread while it
+   records a launch in it. Returns whether the lock was taken by this call. */
+int cl_thread_batch_lock(cl_command_queue queue);
+
+/* Used to let the other threads flush the batch buffer of the thread again. */
+void cl_thread_batch_unlock(cl_command_queue queue);
+
+/* Submit the launches all the threads batched on the queue, and wait for the last batch
+   of each thread if asked. */
+cl_int cl_thread_flush_batches(cl_command_queue queue, int wait);
 
 #endif /* __CL_THREAD_H__ */
@@ -0,0 +1,251 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "cl_tiling.h"
+#include "cl_utils.h"
+
+#include <emmintrin.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TILE_SIZE      4096
+#define TILE_X_WIDTH   512
+#define TILE_X_HEIGHT  8
+#define TILE_Y_WIDTH   128
+#define TILE_Y_HEIGHT  32
+#define TILE_Y_COLUMN  16
+
+/* A thread more for each part of this size of the region */
+#define TILING_THREAD_BYTES (2 << 20)
+#define TILING_MAX_THREADS 8
+/* The regions from this size on do not stay in the caches: their stores
+ * bypass them */
+#define TILING_STREAM_BYTES (8 << 20)
+
+LOCAL cl_bool
+cl_tiling_supported(cl_image_tiling_t tiling, cl_buffer_swizzle swizzle, size_t pitch)
+{
+  if (swizzle == CL_SWIZZLE_UNSUPPORTED)
+    return CL_FALSE;
+  if (tiling == CL_TILE_X)
+    return pitch % TILE_X_WIDTH == 0;
+  if (tiling == CL_TILE_Y)
+    return pitch % TILE_Y_WIDTH == 0;
+  return CL_FALSE;
+}
+
+static INLINE size_t
+cl_tiling_swizzle(size_t offset, cl_buffer_swizzle swizzle)
+{
+  size_t bit;
+
+  switch (swizzle) {
+    case CL_SWIZZLE_9:
+      bit = offset >> 9;
+      break;
+    case CL_SWIZZLE_9_10:
+      bit = (offset >> 9) ^ (offset >> 10);
+      break;
+    case CL_SWIZZLE_9_11:
+      bit = (offset >> 9) ^ (offset >> 11);
+      break;
+    case CL_SWIZZLE_9_10_11:
+      bit = (offset >> 9) ^ (offset >> 10) ^ (offset >> 11);
+      break;
+    default:
+      return offset;
+  }
+  return offset ^ ((bit & 1) << 6);
+}
+
+static INLINE size_t
+cl_tiling_offset_unswizzled(cl_image_tiling_t tiling, size_t pitch, size_t x, size_t y)
+{
+  switch (tiling) {
+    case CL_TILE_X:
+      return y / TILE_X_HEIGHT * pitch * TILE_X_HEIGHT + x / TILE_X_WIDTH * TILE_SIZE +
+             y % TILE_X_HEIGHT * TILE_X_WIDTH + x % TILE_X_WIDTH;
+    case CL_TILE_Y:
+      return y / TILE_Y_HEIGHT * pitch * TILE_Y_HEIGHT + x / TILE_Y_WIDTH * TILE_SIZE +
+             x % TILE_Y_WIDTH / TILE_Y_COLUMN * TILE_Y_COLUMN * TILE_Y_HEIGHT +
+             y % TILE_Y_HEIGHT * TILE_Y_COLUMN + x % TILE_Y_COLUMN;
+    default:
+      return y * pitch + x;
+  }
+}
+
+LOCAL size_t
+cl_tiling_offset(cl_image_tiling_t tiling, cl_buffer_swizzle swizzle,
+                 size_t pitch, size_t x, size_t y)
+{
+  return cl_tiling_swizzle(cl_tiling_offset_unswizzled(tiling, pitch, x, y), swizzle);
+}
+
+/* Copy n bytes. With stream set, the stores bypass the caches */
+static INLINE void
+cl_tiling_copy_span(char *dst, const char *src, size_t n, cl_bool stream)
+{
+  __m128i a, b, c, d;
+  size_t head;
+
+  if (stream && n >= 16) {
+    head = -(uintptr_t)dst & 15;
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    n -= head;
+    for (; n >= 64; n -= 64, dst += 64, src += 64) {
+      a = _mm_loadu_si128((const __m128i *)src);
+      b = _mm_loadu_si128((const __m128i *)src + 1);
+      c = _mm_loadu_si128((const __m128i *)src + 2);
+      d = _mm_loadu_si128((const __m128i *)src + 3);
+      _mm_stream_si128((__m128i *)dst, a);
+      _mm_stream_si128((__m128i *)dst + 1, b);
+      _mm_stream_si128((__m128i *)dst + 2, c);
+      _mm_stream_si128((__m128i *)dst + 3, d);
+    }
+    for (; n >= 16; n -= 16, dst += 16, src += 16)
+      _mm_stream_si128((__m128i *)dst, _mm_loadu_si128((const __m128i *)src));
+  } else {
+    for (; n >= 64; n -= 64, dst += 64, src += 64) {
+      a = _mm_loadu_si128((const __m128i *)src);
+      b = _mm_loadu_si128((const __m128i *)src + 1);
+      c = _mm_loadu_si128((const __m128i *)src + 2);
+      d = _mm_loadu_si128((const __m128i *)src + 3);
+      _mm_storeu_si128((__m128i *)dst, a);
+      _mm_storeu_si128((__m128i *)dst + 1, b);
+      _mm_storeu_si128((__m128i *)dst + 2, c);
+      _mm_storeu_si128((__m128i *)dst + 3, d);
+    }
+    for (; n >= 16; n -= 16, dst += 16, src += 16)
+      _mm_storeu_si128((__m128i *)dst, _mm_loadu_si128((const __m128i *)src));
+  }
+  if (n)
+    memcpy(dst, src, n);
+}
+
+/* Copy a row of the surface. Its bytes are contiguous in the tiled surface
+ * up to the end of a row of an X tile or of a column of a Y tile, and of 64
+ * bytes when the bit 6 is swizzled */
+static void
+cl_tiling_copy_row(const cl_tiled_region *r, size_t y, char *linear,
+                   cl_bool to_tiled, cl_bool stream)
+{
+  size_t span = r->tiling == CL_TILE_X ? TILE_X_WIDTH : TILE_Y_COLUMN;
+  size_t x = r->x, end = r->x + r->w;
+  size_t offset, swizzled, n;
+
+  while (x < end) {
+    offset = cl_tiling_offset_unswizzled(r->tiling, r->pitch, x, y);
+    swizzled = cl_tiling_swizzle(offset, r->swizzle);
+    n = MIN(end - x, span - x % span);
+    if (swizzled != offset)
+      n = MIN(n, 64 - x % 64);
+    if (to_tiled)
+      cl_tiling_copy_span(r->tiled + swizzled, linear, n, stream);
+    else
+      cl_tiling_copy_span(linear, r->tiled + swizzled, n, stream);
+    linear += n;
+    x += n;
+  }
+}
+
+typedef struct _cl_tiling_job {
+  const cl_tiled_region *region;
+  size_t begin, end;          /* Rows of the region, the slices one after the other */
+  cl_bool to_tiled;
+  cl_bool stream;
+} cl_tiling_job;
+
+static void *
+cl_tiling_run(void *arg)
+{
+  const cl_tiling_job *job = arg;
+  const cl_tiled_region *r = job->region;
+  size_t i, y, z;
+
+  for (i = job->begin; i < job->end; i++) {
+    z = i / r->h;
+    y = i % r->h;
+    cl_tiling_copy_row(r, r->y + z * r->slice_rows + y * r->row_rows,
+                       r->linear + z * r->linear_slice_pitch + y * r->linear_row_pitch,
+                       job->to_tiled, job->stream);
+  }
+  if (job->stream)
+    _mm_sfence();
+  return NULL;
+}
+
+static int
+cl_tiling_thread_n(size_t bytes)
+{
+  static int cpu_n = 0;
+
+  if (cpu_n == 0)
+    cpu_n = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+  return MIN(MIN(cpu_n, TILING_MAX_THREADS), MAX(bytes / TILING_THREAD_BYTES, 1));
+}
+
+LOCAL void
+cl_tiling_copy(const cl_tiled_region *region, cl_bool to_tiled)
+{
+  cl_tiling_job jobs[TILING_MAX_THREADS];
+  pthread_t threads[TILING_MAX_THREADS];
+  size_t rows = region->h * region->d, skew = region->y % TILE_Y_HEIGHT;
+  int i, started, n = cl_tiling_thread_n(region->w * rows);
+
+  for (i = 0; i < n; i++) {
+    jobs[i].region = region;
+    /* Bands of whole tile rows, the threads do not share cache lines */
+    jobs[i].begin = i == 0 ? 0 : MIN(ALIGN(rows * i / n + skew, TILE_Y_HEIGHT) - skew, rows);
+    jobs[i].end = i + 1 == n ? rows : MIN(ALIGN(rows * (i + 1) / n + skew, TILE_Y_HEIGHT) - skew, rows);
+    jobs[i].to_tiled = to_tiled;
+    jobs[i].stream = region->w * rows >= TILING_STREAM_BYTES;
+  }
+
+  /* The calling thread copies the first band */
+  for (started = 1; started < n; started++)
+    if (pthread_create(&threads[started], NULL, cl_tiling_run, &jobs[started]) != 0)
+      break;
+  cl_tiling_run(&jobs[0]);
+  for (i = started; i < n; i++)
+    cl_tiling_run(&jobs[i]);
+  for (i = 1; i < started; i++)
+    pthread_join(threads[i], NULL);
+}
+
+LOCAL void
+cl_tiling_copy_scalar(const cl_tiled_region *r, cl_bool to_tiled)
+{
+  size_t x, y, z;
+  char *tiled, *linear;
+
+  for (z = 0; z < r->d; z++)
+    for (y = 0; y < r->h; y++)
+      for (x = 0; x < r->w; x++) {
+        tiled = r->tiled + cl_tiling_offset(r->tiling, r->swizzle, r->pitch, r->x + x,
+                                            r->y + z * r->slice_rows + y * r->row_rows);
+        linear = r->linear + z * r->linear_slice_pitch + y * r->linear_row_pitch + x;
+        if (to_tiled)
+          *tiled = *linear;
+        else
+          *linear = *tiled;
+      }
+}
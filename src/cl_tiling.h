@@ -0,0 +1,66 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __CL_TILING_H__
+#define __CL_TILING_H__
+
+#include "cl_driver.h"
+#include "cl_mem.h"
+#include "CL/cl.h"
+
+#include <stddef.h>
+
+/* Copies between the X or Y tiled surfaces and linear memory done by the
+ * CPU, through a regular cached mapping of the buffer objects. It replaces
+ * the fenced GTT mapping, much slower to read and write.
+ *
+ * An X tile is 8 rows of 512 bytes. A Y tile is 32 rows of 128 bytes, stored
+ * as 8 columns of 16 bytes one after the other. Both tiles are 4KB and the
+ * tiles of a surface are stored row after row.
+ */
+
+typedef struct _cl_tiled_region {
+  char *tiled;                /* Mapping of the tiled buffer object */
+  size_t pitch;               /* Row pitch of the tiled surface */
+  cl_image_tiling_t tiling;
+  cl_buffer_swizzle swizzle;
+  size_t x, y;                /* Origin: in bytes and rows of the surface */
+  size_t w, h, d;             /* Size: in bytes, rows and slices */
+  size_t row_rows;            /* Surface rows between two rows of the region */
+  size_t slice_rows;          /* Surface rows between two slices of the region */
+  char *linear;               /* Linear copy of the region */
+  size_t linear_row_pitch;
+  size_t linear_slice_pitch;
+} cl_tiled_region;
+
+/* Whether the CPU can copy the regions of the tiled surface */
+extern cl_bool cl_tiling_supported(cl_image_tiling_t tiling, cl_buffer_swizzle swizzle, size_t pitch);
+
+/* Offset of the byte (x, y) in the tiled surface. The reference for the
+ * vectorized copies */
+extern size_t cl_tiling_offset(cl_image_tiling_t tiling, cl_buffer_swizzle swizzle,
+                               size_t pitch, size_t x, size_t y);
+
+/* Copy the region to the tiled surface if to_tiled is set, from it else.
+ * Large regions are split between several threads */
+extern void cl_tiling_copy(const cl_tiled_region *region, cl_bool to_tiled);
+
+/* Same as cl_tiling_copy, one byte at a time with cl_tiling_offset */
+extern void cl_tiling_copy_scalar(const cl_tiled_region *region, cl_bool to_tiled);
+
+#endif /* __CL_TILING_H__ */
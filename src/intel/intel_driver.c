@@ -764,6 +764,32 @@ static int intel_buffer_set_tiling(cl_buffer bo,
   return ret;
 }
 
+static cl_buffer_swizzle
+intel_buffer_get_swizzle(cl_buffer bo)
+{
+  uint32_t intel_tiling, intel_swizzle_mode;
+
+  /* The kernel may have refused the tiling asked for */
+  if (drm_intel_bo_get_tiling((drm_intel_bo*)bo, &intel_tiling, &intel_swizzle_mode) != 0 ||
+      intel_tiling == I915_TILING_NONE)
+    return CL_SWIZZLE_UNSUPPORTED;
+  switch (intel_swizzle_mode) {
+    case I915_BIT_6_SWIZZLE_NONE:
+      return CL_SWIZZLE_NONE;
+    case I915_BIT_6_SWIZZLE_9:
+      return CL_SWIZZLE_9;
+    case I915_BIT_6_SWIZZLE_9_10:
+      return CL_SWIZZLE_9_10;
+    case I915_BIT_6_SWIZZLE_9_11:
+      return CL_SWIZZLE_9_11;
+    case I915_BIT_6_SWIZZLE_9_10_11:
+      return CL_SWIZZLE_9_10_11;
+    default:
+      /* The bit 17 swizzling modes depend on the physical pages */
+      return CL_SWIZZLE_UNSUPPORTED;
+  }
+}
+
 static void
 intel_update_device_info(cl_device_id device)
 {
@@ -849,7 +875,9 @@ intel_setup_callbacks(void)
   cl_buffer_subdata = (cl_buffer_subdata_cb *) drm_intel_bo_subdata;
   cl_buffer_get_subdata = (cl_buffer_get_subdata_cb *) drm_intel_bo_get_subdata;
   cl_buffer_wait_rendering = (cl_buffer_wait_rendering_cb *) drm_intel_bo_wait_rendering;
+  cl_buffer_is_busy = (cl_buffer_is_busy_cb *) drm_intel_bo_busy;
   cl_buffer_get_fd = (cl_buffer_get_fd_cb *) drm_intel_bo_gem_export_to_prime;
   cl_buffer_get_tiling_align = (cl_buffer_get_tiling_align_cb *)intel_buffer_get_tiling_align;
+  cl_buffer_get_swizzle = (cl_buffer_get_swizzle_cb *) intel_buffer_get_swizzle;
   intel_set_gpgpu_callbacks(intel_get_device_id());
 }
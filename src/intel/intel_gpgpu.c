@@ -107,6 +107,9 @@ intel_gpgpu_load_idrt_t *intel_gpgpu_load_idrt = NULL;
 typedef void (intel_gpgpu_pipe_control_t)(intel_gpgpu_t *gpgpu);
 intel_gpgpu_pipe_control_t *intel_gpgpu_pipe_control = NULL;
 
+typedef void (intel_gpgpu_pipe_stall_t)(intel_gpgpu_t *gpgpu);
+intel_gpgpu_pipe_stall_t *intel_gpgpu_pipe_stall = NULL;
+
 typedef void (intel_gpgpu_select_pipeline_t)(intel_gpgpu_t *gpgpu);
 intel_gpgpu_select_pipeline_t *intel_gpgpu_select_pipeline = NULL;
 
@@ -134,6 +137,7 @@ static void intel_gpgpu_unref_batch_buf(void *buf)
 static void
 intel_gpgpu_delete_finished(intel_gpgpu_t *gpgpu)
 {
+  uint32_t i;
   if (gpgpu == NULL)
     return;
   if(gpgpu->time_stamp_b.bo)
@@ -142,17 +146,21 @@ intel_gpgpu_delete_finished(intel_gpgpu_t *gpgpu)
     drm_intel_bo_unreference(gpgpu->printf_b.bo);
   if(gpgpu->printf_b.ibo)
     drm_intel_bo_unreference(gpgpu->printf_b.ibo);
-  if (gpgpu->aux_buf.bo)
-    drm_intel_bo_unreference(gpgpu->aux_buf.bo);
   if (gpgpu->perf_b.bo)
     drm_intel_bo_unreference(gpgpu->perf_b.bo);
-  if (gpgpu->stack_b.bo)
-    drm_intel_bo_unreference(gpgpu->stack_b.bo);
   if (gpgpu->scratch_b.bo)
     drm_intel_bo_unreference(gpgpu->scratch_b.bo);
 
-  if(gpgpu->constant_b.bo)
-    drm_intel_bo_unreference(gpgpu->constant_b.bo);
+  /* The aux, constant and stack buffers belong to the state slots */
+  for (i = 0; i < gpgpu->slot_n; i++) {
+    if (gpgpu->slots[i].aux_bo)
+      drm_intel_bo_unreference(gpgpu->slots[i].aux_bo);
+    if (gpgpu->slots[i].constant_bo)
+      drm_intel_bo_unreference(gpgpu->slots[i].constant_bo);
+    if (gpgpu->slots[i].stack_bo)
+      drm_intel_bo_unreference(gpgpu->slots[i].stack_bo);
+  }
+  cl_free(gpgpu->slots);
 
   intel_batchbuffer_delete(gpgpu->batch);
   cl_free(gpgpu);
@@ -236,6 +244,7 @@ intel_gpgpu_new(intel_driver_t *drv)
 
   TRY_ALLOC_NO_ERR (state, CALLOC(intel_gpgpu_t));
   state->drv = drv;
+  state->l3_slm = -1;
   state->batch = intel_batchbuffer_new(state->drv);
   assert(state->batch);
 
@@ -663,6 +672,39 @@ intel_gpgpu_pipe_control_gen8(intel_gpgpu_t *gpgpu)
   ADVANCE_BATCH(gpgpu->batch);
 }
 
+/* Wait for the walkers before changing the states, without flushing the caches */
+static void
+intel_gpgpu_pipe_stall_gen7(intel_gpgpu_t *gpgpu)
+{
+  gen6_pipe_control_t* pc = (gen6_pipe_control_t*)
+    intel_batchbuffer_alloc_space(gpgpu->batch, sizeof(gen6_pipe_control_t));
+  memset(pc, 0, sizeof(*pc));
+  pc->dw0.length = SIZEOF32(gen6_pipe_control_t) - 2;
+  pc->dw0.instruction_subopcode = GEN7_PIPE_CONTROL_SUBOPCODE_3D_CONTROL;
+  pc->dw0.instruction_opcode = GEN7_PIPE_CONTROL_OPCODE_3D_CONTROL;
+  pc->dw0.instruction_pipeline = GEN7_PIPE_CONTROL_3D;
+  pc->dw0.instruction_type = GEN7_PIPE_CONTROL_INSTRUCTION_GFX;
+  pc->dw1.stall_at_pixel_scoreboard = 1;
+  pc->dw1.cs_stall = 1;
+  ADVANCE_BATCH(gpgpu->batch);
+}
+
+static void
+intel_gpgpu_pipe_stall_gen8(intel_gpgpu_t *gpgpu)
+{
+  gen8_pipe_control_t* pc = (gen8_pipe_control_t*)
+    intel_batchbuffer_alloc_space(gpgpu->batch, sizeof(gen8_pipe_control_t));
+  memset(pc, 0, sizeof(*pc));
+  pc->dw0.length = SIZEOF32(gen8_pipe_control_t) - 2;
+  pc->dw0.instruction_subopcode = GEN7_PIPE_CONTROL_SUBOPCODE_3D_CONTROL;
+  pc->dw0.instruction_opcode = GEN7_PIPE_CONTROL_OPCODE_3D_CONTROL;
+  pc->dw0.instruction_pipeline = GEN7_PIPE_CONTROL_3D;
+  pc->dw0.instruction_type = GEN7_PIPE_CONTROL_INSTRUCTION_GFX;
+  pc->dw1.stall_at_pixel_scoreboard = 1;
+  pc->dw1.cs_stall = 1;
+  ADVANCE_BATCH(gpgpu->batch);
+}
+
 static void
 intel_gpgpu_set_L3_gen7(intel_gpgpu_t *gpgpu, uint32_t use_slm)
 {
@@ -775,9 +817,17 @@ static void
 intel_gpgpu_batch_start(intel_gpgpu_t *gpgpu)
 {
   intel_batchbuffer_start_atomic(gpgpu->batch, 256);
-  intel_gpgpu_pipe_control(gpgpu);
-  assert(intel_gpgpu_set_L3);
-  intel_gpgpu_set_L3(gpgpu, gpgpu->ker->use_slm);
+  /* Without hazard with the previous launches and with the same L3 setting,
+   * their results need not be flushed: only wait for them */
+  if (gpgpu->skip_flush && gpgpu->l3_slm == (int32_t)gpgpu->ker->use_slm)
+    intel_gpgpu_pipe_stall(gpgpu);
+  else {
+    intel_gpgpu_pipe_control(gpgpu);
+    assert(intel_gpgpu_set_L3);
+    intel_gpgpu_set_L3(gpgpu, gpgpu->ker->use_slm);
+    gpgpu->l3_slm = gpgpu->ker->use_slm;
+  }
+  gpgpu->skip_flush = 0;
   intel_gpgpu_select_pipeline(gpgpu);
   intel_gpgpu_set_base_address(gpgpu);
   intel_gpgpu_load_vfe_state(gpgpu);
@@ -803,6 +853,12 @@ intel_gpgpu_batch_start(intel_gpgpu_t *gpgpu)
     intel_gpgpu_write_timestamp(gpgpu, 0);
 }
 
+static void
+intel_gpgpu_skip_flush(intel_gpgpu_t *gpgpu)
+{
+  gpgpu->skip_flush = 1;
+}
+
 static void
 intel_gpgpu_post_action_gen7(intel_gpgpu_t *gpgpu, int32_t flush_mode)
 {
@@ -819,6 +875,7 @@ intel_gpgpu_post_action_gen75(intel_gpgpu_t *gpgpu, int32_t flush_mode)
   /* Restore L3 control to disable SLM mode,
      otherwise, may affect 3D pipeline */
   intel_gpgpu_set_L3(gpgpu, 0);
+  gpgpu->l3_slm = 0;
 }
 
 static void
@@ -850,15 +907,26 @@ intel_gpgpu_batch_end(intel_gpgpu_t *gpgpu, int32_t flush_mode)
 static int
 intel_gpgpu_batch_reset(intel_gpgpu_t *gpgpu, size_t sz)
 {
+  gpgpu->l3_slm = -1;
+  gpgpu->skip_flush = 0;
   return intel_batchbuffer_reset(gpgpu->batch, sz);
 }
 
 static int
 intel_gpgpu_flush(intel_gpgpu_t *gpgpu)
 {
+  uint32_t i;
+  int ret;
+
   if (!gpgpu->batch || !gpgpu->batch->buffer)
     return 0;
-  return intel_batchbuffer_flush(gpgpu->batch);
+  ret = intel_batchbuffer_flush(gpgpu->batch);
+  /* The kernel has the relocations now. Drop them so that the aux buffers
+   * kept for the next launches do not pin the buffers of this one */
+  for (i = 0; i < gpgpu->slot_used; i++)
+    if (drm_intel_gem_bo_get_reloc_count(gpgpu->slots[i].aux_bo) > 0)
+      drm_intel_gem_bo_clear_relocs(gpgpu->slots[i].aux_bo, 0);
+  return ret;
   /* FIXME:
      Remove old assert here for binded buffer offset 0 which
      tried to guard possible NULL buffer pointer check in kernel, as
@@ -871,6 +939,88 @@ intel_gpgpu_flush(intel_gpgpu_t *gpgpu)
   */
 }
 
+/* Copy a state into the aux buffer unless it is already there. The aux
+ * buffers are recycled, so a kernel launched again with the same arguments
+ * finds its surface and sampler states in place
+ */
+static INLINE void
+intel_gpgpu_write_state(void *dst, const void *state, size_t size)
+{
+  if (memcmp(dst, state, size) != 0)
+    memcpy(dst, state, size);
+}
+
+static INLINE void
+intel_gpgpu_set_binding_table(surface_heap_t *heap, uint32_t index, uint32_t state_sz)
+{
+  const uint32_t entry = offsetof(surface_heap_t, surface) + index * state_sz;
+  if (heap->binding_table[index] != entry)
+    heap->binding_table[index] = entry;
+}
+
+/* Each launch recorded in the batch takes the next state slot: its aux buffer
+ * (surface heap, curbe, IDRT and samplers), constant buffer and stack. The
+ * slots are taken again from the first one once the batch retired (see
+ * intel_gpgpu_reuse), so the buffers are allocated by the first launches only
+ */
+static int
+intel_gpgpu_take_state_slot(intel_gpgpu_t *gpgpu, uint32_t size_aux)
+{
+  intel_gpgpu_state_slot_t *slot;
+  drm_intel_bo *bo;
+
+  if (gpgpu->slot_used == gpgpu->slot_n) {
+    intel_gpgpu_state_slot_t *slots;
+    slots = cl_realloc(gpgpu->slots, (gpgpu->slot_n + 1) * sizeof(intel_gpgpu_state_slot_t));
+    if (slots == NULL)
+      return -1;
+    memset(&slots[gpgpu->slot_n], 0, sizeof(intel_gpgpu_state_slot_t));
+    gpgpu->slots = slots;
+    gpgpu->slot_n++;
+  }
+  slot = &gpgpu->slots[gpgpu->slot_used];
+
+  if (slot->aux_bo && slot->aux_bo->size < size_aux) {
+    dri_bo_unreference(slot->aux_bo);
+    slot->aux_bo = NULL;
+  }
+  if (slot->aux_bo == NULL) {
+    bo = dri_bo_alloc(gpgpu->drv->bufmgr, "AUX_BUFFER", size_aux, 4096);
+    if (!bo || dri_bo_map(bo, 1) != 0) {
+      if (bo)
+        dri_bo_unreference(bo);
+      return -1;
+    }
+    memset(bo->virtual, 0, size_aux);
+    slot->aux_bo = bo;
+  } else {
+    /* Keep the states of the previous launch, only the relocations go */
+    if (drm_intel_gem_bo_get_reloc_count(slot->aux_bo) > 0)
+      drm_intel_gem_bo_clear_relocs(slot->aux_bo, 0);
+    if (dri_bo_map(slot->aux_bo, 1) != 0)
+      return -1;
+  }
+
+  gpgpu->slot_used++;
+  gpgpu->aux_buf.bo = slot->aux_bo;
+  gpgpu->constant_b.bo = NULL;
+  gpgpu->stack_b.bo = NULL;
+  return 0;
+}
+
+/* Get a flushed gpgpu ready for new launches once its batch retired */
+static int
+intel_gpgpu_reuse(intel_gpgpu_t *gpgpu)
+{
+  if (gpgpu->batch->buffer && drm_intel_bo_busy(gpgpu->batch->buffer))
+    return -1;
+  gpgpu->slot_used = 0;
+  gpgpu->aux_buf.bo = NULL;
+  gpgpu->constant_b.bo = NULL;
+  gpgpu->stack_b.bo = NULL;
+  return 0;
+}
+
 static int
 intel_gpgpu_state_init(intel_gpgpu_t *gpgpu,
                        uint32_t max_threads,
@@ -908,16 +1058,8 @@ intel_gpgpu_state_init(intel_gpgpu_t *gpgpu,
       fprintf(stderr, "Could not allocate buffer for profiling.\n");
   }
 
-  /* stack */
-  if (gpgpu->stack_b.bo)
-    dri_bo_unreference(gpgpu->stack_b.bo);
-  gpgpu->stack_b.bo = NULL;
-
   /* Set the auxiliary buffer*/
   uint32_t size_aux = 0;
-  if(gpgpu->aux_buf.bo)
-    dri_bo_unreference(gpgpu->aux_buf.bo);
-  gpgpu->aux_buf.bo = NULL;
 
   /* begin with surface heap to make sure it's page aligned,
      because state base address use 20bit for the address */
@@ -947,18 +1089,17 @@ intel_gpgpu_state_init(intel_gpgpu_t *gpgpu,
   /* make sure aux buffer is page aligned */
   size_aux = ALIGN(size_aux, 4096);
 
-  bo = dri_bo_alloc(gpgpu->drv->bufmgr, "AUX_BUFFER", size_aux, 4096);
-  if (!bo || dri_bo_map(bo, 1) != 0) {
+  if (intel_gpgpu_take_state_slot(gpgpu, size_aux) != 0) {
     fprintf(stderr, "%s:%d: %s.\n", __FILE__, __LINE__, strerror(errno));
-    if (bo)
-      dri_bo_unreference(bo);
     if (profiling && gpgpu->time_stamp_b.bo)
       dri_bo_unreference(gpgpu->time_stamp_b.bo);
     gpgpu->time_stamp_b.bo = NULL;
     return -1;
   }
-  memset(bo->virtual, 0, size_aux);
-  gpgpu->aux_buf.bo = bo;
+  /* The samplers expect a zero border color, which a recycled buffer
+   * laid out for another kernel may not hold there */
+  memset(gpgpu->aux_buf.bo->virtual + gpgpu->aux_offset.sampler_border_color_state_offset, 0,
+         GEN_MAX_SAMPLERS * sizeof(gen7_sampler_border_color_t));
   return 0;
 }
 
@@ -966,8 +1107,7 @@ static void
 intel_gpgpu_set_buf_reloc_gen7(intel_gpgpu_t *gpgpu, int32_t index, dri_bo* obj_bo, uint32_t obj_bo_offset)
 {
   surface_heap_t *heap = gpgpu->aux_buf.bo->virtual + gpgpu->aux_offset.surface_heap_offset;
-  heap->binding_table[index] = offsetof(surface_heap_t, surface) +
-                               index * sizeof(gen7_surface_state_t);
+  intel_gpgpu_set_binding_table(heap, index, sizeof(gen7_surface_state_t));
   dri_bo_emit_reloc(gpgpu->aux_buf.bo,
                     I915_GEM_DOMAIN_RENDER,
                     I915_GEM_DOMAIN_RENDER,
@@ -981,9 +1121,15 @@ intel_gpgpu_set_buf_reloc_gen7(intel_gpgpu_t *gpgpu, int32_t index, dri_bo* obj_
 static dri_bo*
 intel_gpgpu_alloc_constant_buffer(intel_gpgpu_t *gpgpu, uint32_t size, uint8_t bti)
 {
-  if(gpgpu->constant_b.bo)
-    dri_bo_unreference(gpgpu->constant_b.bo);
-  gpgpu->constant_b.bo = drm_intel_bo_alloc(gpgpu->drv->bufmgr, "CONSTANT_BUFFER", size, 64);
+  intel_gpgpu_state_slot_t *slot = &gpgpu->slots[gpgpu->slot_used - 1];
+
+  if (slot->constant_bo && slot->constant_bo->size < size) {
+    dri_bo_unreference(slot->constant_bo);
+    slot->constant_bo = NULL;
+  }
+  if (slot->constant_bo == NULL)
+    slot->constant_bo = drm_intel_bo_alloc(gpgpu->drv->bufmgr, "CONSTANT_BUFFER", size, 64);
+  gpgpu->constant_b.bo = slot->constant_bo;
   if (gpgpu->constant_b.bo == NULL)
     return NULL;
 
@@ -997,7 +1143,7 @@ intel_gpgpu_setup_bti_gen7(intel_gpgpu_t *gpgpu, drm_intel_bo *buf, uint32_t int
 {
   uint32_t s = size - 1;
   surface_heap_t *heap = gpgpu->aux_buf.bo->virtual + gpgpu->aux_offset.surface_heap_offset;
-  gen7_surface_state_t *ss0 = (gen7_surface_state_t *) &heap->surface[index * sizeof(gen7_surface_state_t)];
+  gen7_surface_state_t state, *ss0 = &state;
   memset(ss0, 0, sizeof(gen7_surface_state_t));
   ss0->ss0.surface_type = I965_SURFACE_BUFFER;
   ss0->ss0.surface_format = format;
@@ -1008,9 +1154,10 @@ intel_gpgpu_setup_bti_gen7(intel_gpgpu_t *gpgpu, drm_intel_bo *buf, uint32_t int
   ss0->ss2.height = (s >> 7) & 0x3fff; /* bits 20:7 of sz */
   ss0->ss3.depth  = (s >> 21) & 0x3ff; /* bits 30:21 of sz */
   ss0->ss5.cache_control = cl_gpgpu_get_cache_ctrl();
-  heap->binding_table[index] = offsetof(surface_heap_t, surface) + index * sizeof(gen7_surface_state_t);
+  intel_gpgpu_set_binding_table(heap, index, sizeof(gen7_surface_state_t));
 
   ss0->ss1.base_addr = buf->offset + internal_offset;
+  intel_gpgpu_write_state(&heap->surface[index * sizeof(gen7_surface_state_t)], ss0, sizeof(*ss0));
   dri_bo_emit_reloc(gpgpu->aux_buf.bo,
                       I915_GEM_DOMAIN_RENDER,
                       I915_GEM_DOMAIN_RENDER,
@@ -1027,7 +1174,7 @@ intel_gpgpu_setup_bti_gen75(intel_gpgpu_t *gpgpu, drm_intel_bo *buf, uint32_t in
 {
   uint32_t s = size - 1;
   surface_heap_t *heap = gpgpu->aux_buf.bo->virtual + gpgpu->aux_offset.surface_heap_offset;
-  gen7_surface_state_t *ss0 = (gen7_surface_state_t *) &heap->surface[index * sizeof(gen7_surface_state_t)];
+  gen7_surface_state_t state, *ss0 = &state;
   memset(ss0, 0, sizeof(gen7_surface_state_t));
   ss0->ss0.surface_type = I965_SURFACE_BUFFER;
   ss0->ss0.surface_format = format;
@@ -1044,9 +1191,10 @@ intel_gpgpu_setup_bti_gen75(intel_gpgpu_t *gpgpu, drm_intel_bo *buf, uint32_t in
   ss0->ss2.height = (s >> 7) & 0x3fff; /* bits 20:7 of sz */
   ss0->ss3.depth  = (s >> 21) & 0x3ff; /* bits 30:21 of sz */
   ss0->ss5.cache_control = cl_gpgpu_get_cache_ctrl();
-  heap->binding_table[index] = offsetof(surface_heap_t, surface) + index * sizeof(gen7_surface_state_t);
+  intel_gpgpu_set_binding_table(heap, index, sizeof(gen7_surface_state_t));
 
   ss0->ss1.base_addr = buf->offset + internal_offset;
+  intel_gpgpu_write_state(&heap->surface[index * sizeof(gen7_surface_state_t)], ss0, sizeof(*ss0));
   dri_bo_emit_reloc(gpgpu->aux_buf.bo,
                       I915_GEM_DOMAIN_RENDER,
                       I915_GEM_DOMAIN_RENDER,
@@ -1063,7 +1211,7 @@ intel_gpgpu_setup_bti_gen8(intel_gpgpu_t *gpgpu, drm_intel_bo *buf, uint32_t int
 {
   uint32_t s = size - 1;
   surface_heap_t *heap = gpgpu->aux_buf.bo->virtual + gpgpu->aux_offset.surface_heap_offset;
-  gen8_surface_state_t *ss0 = (gen8_surface_state_t *) &heap->surface[index * sizeof(gen8_surface_state_t)];
+  gen8_surface_state_t state, *ss0 = &state;
   memset(ss0, 0, sizeof(gen8_surface_state_t));
   ss0->ss0.surface_type = I965_SURFACE_BUFFER;
   ss0->ss0.surface_format = format;
@@ -1080,9 +1228,10 @@ intel_gpgpu_setup_bti_gen8(intel_gpgpu_t *gpgpu, drm_intel_bo *buf, uint32_t int
   ss0->ss2.height = (s >> 7) & 0x3fff; /* bits 20:7 of sz */
   ss0->ss3.depth  = (s >> 21) & 0x3ff; /* bits 30:21 of sz */
   ss0->ss1.mem_obj_ctrl_state = cl_gpgpu_get_cache_ctrl();
-  heap->binding_table[index] = offsetof(surface_heap_t, surface) + index * sizeof(gen8_surface_state_t);
+  intel_gpgpu_set_binding_table(heap, index, sizeof(gen8_surface_state_t));
   ss0->ss8.surface_base_addr_lo = (buf->offset64 + internal_offset) & 0xffffffff;
   ss0->ss9.surface_base_addr_hi = ((buf->offset64 + internal_offset) >> 32) & 0xffffffff;
+  intel_gpgpu_write_state(&heap->surface[index * sizeof(gen8_surface_state_t)], ss0, sizeof(*ss0));
   dri_bo_emit_reloc(gpgpu->aux_buf.bo,
                     I915_GEM_DOMAIN_RENDER,
                     I915_GEM_DOMAIN_RENDER,
@@ -1160,7 +1309,7 @@ intel_gpgpu_bind_image_gen7(intel_gpgpu_t *gpgpu,
                               int32_t tiling)
 {
   surface_heap_t *heap = gpgpu->aux_buf.bo->virtual + gpgpu->aux_offset.surface_heap_offset;
-  gen7_surface_state_t *ss = (gen7_surface_state_t *) &heap->surface[index * sizeof(gen7_surface_state_t)];
+  gen7_surface_state_t state, *ss = &state;
 
   memset(ss, 0, sizeof(*ss));
   ss->ss0.vertical_line_stride = 0; // always choose VALIGN_2
@@ -1187,6 +1336,7 @@ intel_gpgpu_bind_image_gen7(intel_gpgpu_t *gpgpu,
     ss->ss0.tile_walk = I965_TILEWALK_YMAJOR;
   }
   ss->ss0.render_cache_rw_mode = 1; /* XXX do we need to set it? */
+  intel_gpgpu_write_state(&heap->surface[index * sizeof(gen7_surface_state_t)], ss, sizeof(*ss));
   intel_gpgpu_set_buf_reloc_gen7(gpgpu, index, obj_bo, obj_bo_offset);
 
   assert(index < GEN_MAX_SURFACES);
@@ -1208,7 +1358,7 @@ intel_gpgpu_bind_image_gen75(intel_gpgpu_t *gpgpu,
                               int32_t tiling)
 {
   surface_heap_t *heap = gpgpu->aux_buf.bo->virtual + gpgpu->aux_offset.surface_heap_offset;
-  gen7_surface_state_t *ss = (gen7_surface_state_t *) &heap->surface[index * sizeof(gen7_surface_state_t)];
+  gen7_surface_state_t state, *ss = &state;
   memset(ss, 0, sizeof(*ss));
   ss->ss0.vertical_line_stride = 0; // always choose VALIGN_2
   ss->ss0.surface_type = get_surface_type(gpgpu, index, type);
@@ -1237,6 +1387,7 @@ intel_gpgpu_bind_image_gen75(intel_gpgpu_t *gpgpu,
     ss->ss0.tile_walk = I965_TILEWALK_YMAJOR;
   }
   ss->ss0.render_cache_rw_mode = 1; /* XXX do we need to set it? */
+  intel_gpgpu_write_state(&heap->surface[index * sizeof(gen7_surface_state_t)], ss, sizeof(*ss));
   intel_gpgpu_set_buf_reloc_gen7(gpgpu, index, obj_bo, obj_bo_offset);
 
   assert(index < GEN_MAX_SURFACES);
@@ -1258,7 +1409,7 @@ intel_gpgpu_bind_image_gen8(intel_gpgpu_t *gpgpu,
                             int32_t tiling)
 {
   surface_heap_t *heap = gpgpu->aux_buf.bo->virtual + gpgpu->aux_offset.surface_heap_offset;
-  gen8_surface_state_t *ss = (gen8_surface_state_t *) &heap->surface[index * sizeof(gen8_surface_state_t)];
+  gen8_surface_state_t state, *ss = &state;
   memset(ss, 0, sizeof(*ss));
   ss->ss0.vertical_line_stride = 0; // always choose VALIGN_2
   ss->ss0.surface_type = get_surface_type(gpgpu, index, type);
@@ -1295,8 +1446,8 @@ intel_gpgpu_bind_image_gen8(intel_gpgpu_t *gpgpu,
   ss->ss7.shader_channel_select_alpha = I965_SURCHAN_SELECT_ALPHA;
   ss->ss0.render_cache_rw_mode = 1; /* XXX do we need to set it? */
 
-  heap->binding_table[index] = offsetof(surface_heap_t, surface) +
-                               index * surface_state_sz;
+  intel_gpgpu_write_state(&heap->surface[index * sizeof(gen8_surface_state_t)], ss, sizeof(*ss));
+  intel_gpgpu_set_binding_table(heap, index, surface_state_sz);
   dri_bo_emit_reloc(gpgpu->aux_buf.bo,
                     I915_GEM_DOMAIN_RENDER,
                     I915_GEM_DOMAIN_RENDER,
@@ -1325,7 +1476,7 @@ intel_gpgpu_bind_image_gen9(intel_gpgpu_t *gpgpu,
                             int32_t tiling)
 {
   surface_heap_t *heap = gpgpu->aux_buf.bo->virtual + gpgpu->aux_offset.surface_heap_offset;
-  gen8_surface_state_t *ss = (gen8_surface_state_t *) &heap->surface[index * sizeof(gen8_surface_state_t)];
+  gen8_surface_state_t state, *ss = &state;
   memset(ss, 0, sizeof(*ss));
   ss->ss0.vertical_line_stride = 0; // always choose VALIGN_2
   ss->ss0.surface_type = get_surface_type(gpgpu, index, type);
@@ -1371,8 +1522,8 @@ intel_gpgpu_bind_image_gen9(intel_gpgpu_t *gpgpu,
   ss->ss7.shader_channel_select_alpha = I965_SURCHAN_SELECT_ALPHA;
   ss->ss0.render_cache_rw_mode = 1; /* XXX do we need to set it? */
 
-  heap->binding_table[index] = offsetof(surface_heap_t, surface) +
-                               index * surface_state_sz;
+  intel_gpgpu_write_state(&heap->surface[index * sizeof(gen8_surface_state_t)], ss, sizeof(*ss));
+  intel_gpgpu_set_binding_table(heap, index, surface_state_sz);
   dri_bo_emit_reloc(gpgpu->aux_buf.bo,
                     I915_GEM_DOMAIN_RENDER,
                     I915_GEM_DOMAIN_RENDER,
@@ -1425,7 +1576,15 @@ static void
 intel_gpgpu_set_stack(intel_gpgpu_t *gpgpu, uint32_t offset, uint32_t size, uint8_t bti)
 {
   drm_intel_bufmgr *bufmgr = gpgpu->drv->bufmgr;
-  gpgpu->stack_b.bo = drm_intel_bo_alloc(bufmgr, "STACK", size, 64);
+  intel_gpgpu_state_slot_t *slot = &gpgpu->slots[gpgpu->slot_used - 1];
+
+  if (slot->stack_bo && slot->stack_bo->size < size) {
+    drm_intel_bo_unreference(slot->stack_bo);
+    slot->stack_bo = NULL;
+  }
+  if (slot->stack_bo == NULL)
+    slot->stack_bo = drm_intel_bo_alloc(bufmgr, "STACK", size, 64);
+  gpgpu->stack_b.bo = slot->stack_bo;
 
   cl_gpgpu_bind_buf((cl_gpgpu)gpgpu, (cl_buffer)gpgpu->stack_b.bo, offset, 0, size, bti);
 }
@@ -1607,7 +1766,7 @@ intel_gpgpu_upload_samplers(intel_gpgpu_t *gpgpu, const void *data, uint32_t n)
 {
   if (n) {
     const size_t sz = n * sizeof(gen6_sampler_state_t);
-    memcpy(gpgpu->aux_buf.bo->virtual + gpgpu->aux_offset.sampler_state_offset, data, sz);
+    intel_gpgpu_write_state(gpgpu->aux_buf.bo->virtual + gpgpu->aux_offset.sampler_state_offset, data, sz);
   }
 }
 
@@ -1633,9 +1792,10 @@ intel_gpgpu_insert_sampler_gen7(intel_gpgpu_t *gpgpu, uint32_t index, uint32_t c
 {
   int using_nearest = 0;
   uint32_t wrap_mode;
-  gen7_sampler_state_t *sampler;
+  gen7_sampler_state_t state, *sampler = &state;
+  gen7_sampler_state_t *dst;
 
-  sampler = (gen7_sampler_state_t *)(gpgpu->aux_buf.bo->virtual + gpgpu->aux_offset.sampler_state_offset)  + index;
+  dst = (gen7_sampler_state_t *)(gpgpu->aux_buf.bo->virtual + gpgpu->aux_offset.sampler_state_offset)  + index;
   memset(sampler, 0, sizeof(*sampler));
   assert((gpgpu->aux_buf.bo->offset + gpgpu->aux_offset.sampler_border_color_state_offset) % 32 == 0);
   sampler->ss2.default_color_pointer = (gpgpu->aux_buf.bo->offset + gpgpu->aux_offset.sampler_border_color_state_offset) >> 5;
@@ -1681,6 +1841,7 @@ intel_gpgpu_insert_sampler_gen7(intel_gpgpu_t *gpgpu, uint32_t index, uint32_t c
      sampler->ss3.address_round |= GEN_ADDRESS_ROUNDING_ENABLE_U_MAG |
                                    GEN_ADDRESS_ROUNDING_ENABLE_V_MAG |
                                    GEN_ADDRESS_ROUNDING_ENABLE_R_MAG;
+  intel_gpgpu_write_state(dst, sampler, sizeof(*sampler));
 
   dri_bo_emit_reloc(gpgpu->aux_buf.bo,
                     I915_GEM_DOMAIN_SAMPLER, 0,
@@ -1698,9 +1859,10 @@ intel_gpgpu_insert_sampler_gen8(intel_gpgpu_t *gpgpu, uint32_t index, uint32_t c
 {
   int using_nearest = 0;
   uint32_t wrap_mode;
-  gen8_sampler_state_t *sampler;
+  gen8_sampler_state_t state, *sampler = &state;
+  gen8_sampler_state_t *dst;
 
-  sampler = (gen8_sampler_state_t *)(gpgpu->aux_buf.bo->virtual + gpgpu->aux_offset.sampler_state_offset)  + index;
+  dst = (gen8_sampler_state_t *)(gpgpu->aux_buf.bo->virtual + gpgpu->aux_offset.sampler_state_offset)  + index;
   memset(sampler, 0, sizeof(*sampler));
   assert((gpgpu->aux_buf.bo->offset + gpgpu->aux_offset.sampler_border_color_state_offset) % 32 == 0);
   if ((clk_sampler & __CLK_NORMALIZED_MASK) == CLK_NORMALIZED_COORDS_FALSE)
@@ -1745,6 +1907,7 @@ intel_gpgpu_insert_sampler_gen8(intel_gpgpu_t *gpgpu, uint32_t index, uint32_t c
      sampler->ss3.address_round |= GEN_ADDRESS_ROUNDING_ENABLE_U_MAG |
                                    GEN_ADDRESS_ROUNDING_ENABLE_V_MAG |
                                    GEN_ADDRESS_ROUNDING_ENABLE_R_MAG;
+  intel_gpgpu_write_state(dst, sampler, sizeof(*sampler));
 }
 
 static void
@@ -2119,6 +2282,7 @@ intel_set_gpgpu_callbacks(int device_id)
 {
   cl_gpgpu_new = (cl_gpgpu_new_cb *) intel_gpgpu_new;
   cl_gpgpu_delete = (cl_gpgpu_delete_cb *) intel_gpgpu_delete;
+  cl_gpgpu_reuse = (cl_gpgpu_reuse_cb *) intel_gpgpu_reuse;
   cl_gpgpu_sync = (cl_gpgpu_sync_cb *) intel_gpgpu_sync;
   cl_gpgpu_bind_buf = (cl_gpgpu_bind_buf_cb *) intel_gpgpu_bind_buf;
   cl_gpgpu_set_stack = (cl_gpgpu_set_stack_cb *) intel_gpgpu_set_stack;
@@ -2130,6 +2294,7 @@ intel_set_gpgpu_callbacks(int device_id)
   cl_gpgpu_upload_samplers = (cl_gpgpu_upload_samplers_cb *) intel_gpgpu_upload_samplers;
   cl_gpgpu_batch_reset = (cl_gpgpu_batch_reset_cb *) intel_gpgpu_batch_reset;
   cl_gpgpu_batch_start = (cl_gpgpu_batch_start_cb *) intel_gpgpu_batch_start;
+  cl_gpgpu_skip_flush = (cl_gpgpu_skip_flush_cb *) intel_gpgpu_skip_flush;
   cl_gpgpu_batch_end = (cl_gpgpu_batch_end_cb *) intel_gpgpu_batch_end;
   cl_gpgpu_flush = (cl_gpgpu_flush_cb *) intel_gpgpu_flush;
   cl_gpgpu_bind_sampler = (cl_gpgpu_bind_sampler_cb *) intel_gpgpu_bind_sampler_gen7;
@@ -2165,6 +2330,7 @@ intel_set_gpgpu_callbacks(int device_id)
     intel_gpgpu_load_idrt = intel_gpgpu_load_idrt_gen8;
     cl_gpgpu_bind_sampler = (cl_gpgpu_bind_sampler_cb *) intel_gpgpu_bind_sampler_gen8;
     intel_gpgpu_pipe_control = intel_gpgpu_pipe_control_gen8;
+    intel_gpgpu_pipe_stall = intel_gpgpu_pipe_stall_gen8;
 	intel_gpgpu_select_pipeline = intel_gpgpu_select_pipeline_gen7;
     return;
   }
@@ -2184,6 +2350,7 @@ intel_set_gpgpu_callbacks(int device_id)
     intel_gpgpu_load_idrt = intel_gpgpu_load_idrt_gen8;
     cl_gpgpu_bind_sampler = (cl_gpgpu_bind_sampler_cb *) intel_gpgpu_bind_sampler_gen8;
     intel_gpgpu_pipe_control = intel_gpgpu_pipe_control_gen8;
+    intel_gpgpu_pipe_stall = intel_gpgpu_pipe_stall_gen8;
     intel_gpgpu_select_pipeline = intel_gpgpu_select_pipeline_gen9;
     return;
   }
@@ -2205,6 +2372,7 @@ intel_set_gpgpu_callbacks(int device_id)
     intel_gpgpu_read_ts_reg = intel_gpgpu_read_ts_reg_gen7; //HSW same as ivb
     intel_gpgpu_setup_bti = intel_gpgpu_setup_bti_gen75;
     intel_gpgpu_pipe_control = intel_gpgpu_pipe_control_gen75;
+    intel_gpgpu_pipe_stall = intel_gpgpu_pipe_stall_gen7;
   }
   else if (IS_IVYBRIDGE(device_id)) {
     cl_gpgpu_bind_image = (cl_gpgpu_bind_image_cb *) intel_gpgpu_bind_image_gen7;
@@ -2220,5 +2388,6 @@ intel_set_gpgpu_callbacks(int device_id)
     intel_gpgpu_post_action = intel_gpgpu_post_action_gen7;
     intel_gpgpu_setup_bti = intel_gpgpu_setup_bti_gen7;
     intel_gpgpu_pipe_control = intel_gpgpu_pipe_control_gen7;
+    intel_gpgpu_pipe_stall = intel_gpgpu_pipe_stall_gen7;
   }
 }
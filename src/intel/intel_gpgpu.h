@@ -40,6 +40,13 @@ enum {max_sampler_n = 16 };
 struct intel_driver;
 struct intel_batchbuffer;
 
+/* Buffers of one launch recorded in the batch, kept for the next launches */
+typedef struct intel_gpgpu_state_slot {
+  drm_intel_bo *aux_bo;      /* surface heap, curbe, IDRT and samplers */
+  drm_intel_bo *constant_bo;
+  drm_intel_bo *stack_bo;
+} intel_gpgpu_state_slot_t;
+
 /* Handle GPGPU state */
 struct intel_gpgpu
 {
@@ -67,7 +74,7 @@ struct intel_gpgpu
   struct { drm_intel_bo *bo;
            drm_intel_bo *ibo;} printf_b;      /* the printf buf and index buf*/
 
-  struct { drm_intel_bo *bo; } aux_buf;
+  struct { drm_intel_bo *bo; } aux_buf;       /* borrowed from the current slot */
   struct {
     uint32_t surface_heap_offset;
     uint32_t curbe_offset;
@@ -83,6 +90,13 @@ struct intel_gpgpu
   } curb;
 
   uint32_t max_threads;      /* max threads requested by the user */
+
+  intel_gpgpu_state_slot_t *slots; /* one per launch of the batch */
+  uint32_t slot_n;                 /* number of slots allocated */
+  uint32_t slot_used;              /* number of slots taken by the batch */
+
+  int32_t l3_slm;                  /* SLM setting of the L3 in the batch, -1 before the first launch */
+  uint32_t skip_flush;             /* no hazard with the previous launches of the batch */
 };
 
 struct intel_gpgpu_node {
@@ -0,0 +1,801 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "null/null_driver.h"
+#include "cl_driver.h"
+#include "cl_device_data.h"
+#include "cl_context.h"
+#include "cl_mem.h"
+#include "cl_alloc.h"
+#include "cl_utils.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Device reported when OCL_NULL_DRIVER does not give one */
+#define NULL_DRIVER_DEFAULT_DEVICE PCI_CHIP_HASWELL_D2
+
+typedef struct null_driver {
+  int device_id;
+  uint32_t gen_ver;
+  int dump;                 /* Print the batches when they are flushed */
+  uint64_t latency;         /* Time the batches take to complete, in ns */
+  atomic_t batch_n;         /* Batches flushed so far */
+  atomic_t walker_n;        /* Walkers flushed so far */
+} null_driver_t;
+
+/* Buffer objects are plain host allocations */
+typedef struct null_buffer {
+  atomic_t ref_n;
+  size_t size;
+  void *virtual;
+  uint32_t own:1;           /* Not a user pointer */
+  uint32_t tiling:2;
+  size_t stride;
+} null_buffer_t;
+
+/* What one GPGPU_WALKER of the batch runs */
+typedef struct null_walker {
+  uint32_t simd_sz;
+  uint32_t thread_n;
+  size_t global_wk_off[3];
+  size_t global_wk_sz[3];
+  size_t local_wk_sz[3];
+  uint32_t curbe_sz;
+  uint32_t slm_sz;
+  uint32_t surface_n;
+  uint32_t image_n;
+  uint32_t sampler_n;
+  uint32_t flush:1;         /* Caches flushed before it, not only a stall */
+} null_walker_t;
+
+/* The recorded batch buffer */
+typedef struct null_batch {
+  atomic_t ref_n;
+  null_walker_t *walkers;
+  uint32_t walker_n;
+  uint32_t walker_max;
+  uint32_t flushed:1;
+  uint64_t flush_time;
+  uint64_t done_time;       /* When the batch completes */
+} null_batch_t;
+
+typedef struct null_gpgpu {
+  null_driver_t *drv;
+  null_batch_t *batch;
+  cl_gpgpu_kernel ker;      /* Copy of the kernel of the last states setup */
+  void *curbe;              /* Host copy of the thread payloads */
+  uint32_t curbe_max;
+  null_buffer_t *constant_b;
+  null_buffer_t *stack_b;
+  null_buffer_t *scratch_b;
+  null_buffer_t *printf_b[2];
+  uint32_t max_threads;
+  uint32_t surface_n;
+  uint32_t image_n;
+  uint32_t sampler_n;
+  uint32_t in_batch:1;      /* Between batch start and batch end */
+  uint32_t skip_flush:1;    /* No hazard between the next walker and the previous ones */
+  void *printf_info;
+  size_t global_wk_sz[3];
+} null_gpgpu_t;
+
+typedef struct null_event {
+  null_batch_t *batch;
+  int status;
+  uint64_t ts[2];
+} null_event_t;
+
+static uint64_t
+null_get_time(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+LOCAL int
+null_driver_enabled(void)
+{
+  const char *env = getenv("OCL_NULL_DRIVER");
+  return env != NULL && strtol(env, NULL, 0) != 0;
+}
+
+/**************************************************************************
+ * Driver
+ **************************************************************************/
+static int
+null_get_device_id(void)
+{
+  const char *env = getenv("OCL_NULL_DRIVER");
+  long id = env ? strtol(env, NULL, 0) : 0;
+
+  /* Any value but a PCI id picks the default device */
+  return id > 1 ? (int)id : NULL_DRIVER_DEFAULT_DEVICE;
+}
+
+/* Wait until the given time of null_get_time */
+static void
+null_sleep_until(uint64_t time)
+{
+  struct timespec ts;
+  ts.tv_sec = time / 1000000000ull;
+  ts.tv_nsec = time % 1000000000ull;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+    ;
+}
+
+static null_driver_t*
+null_driver_new(cl_context_prop props)
+{
+  null_driver_t *drv = NULL;
+  const char *env = getenv("OCL_NULL_DRIVER_DUMP");
+  const char *latency = getenv("OCL_NULL_DRIVER_EVENT_LATENCY");
+
+  if (props != NULL && props->gl_type != CL_GL_NOSHARE) {
+    fprintf(stderr, "The null driver does not share objects with OpenGL.\n");
+    return NULL;
+  }
+
+  TRY_ALLOC_NO_ERR (drv, CALLOC(null_driver_t));
+  drv->device_id = null_get_device_id();
+  if (IS_GEN9(drv->device_id))
+    drv->gen_ver = 9;
+  else if (IS_GEN8(drv->device_id))
+    drv->gen_ver = 8;
+  else if (IS_GEN75(drv->device_id))
+    drv->gen_ver = 75;
+  else
+    drv->gen_ver = 7;
+  drv->dump = env != NULL && atoi(env) != 0;
+  if (latency != NULL && atol(latency) > 0)
+    drv->latency = (uint64_t)atol(latency) * 1000;
+
+error:
+  return drv;
+}
+
+static void
+null_driver_delete(null_driver_t *drv)
+{
+  if (drv == NULL)
+    return;
+  if (drv->dump)
+    fprintf(stderr, "[null driver] %d batch(es), %d walker(s) flushed\n",
+            drv->batch_n, drv->walker_n);
+  cl_free(drv);
+}
+
+static cl_buffer_mgr
+null_driver_get_bufmgr(null_driver_t *drv)
+{
+  return (cl_buffer_mgr) drv;
+}
+
+static uint32_t
+null_driver_get_ver(null_driver_t *drv)
+{
+  return drv->gen_ver;
+}
+
+static void
+null_update_device_info(cl_device_id device)
+{
+  /* The host memory is the device memory */
+}
+
+/**************************************************************************
+ * Buffer
+ **************************************************************************/
+static null_buffer_t*
+null_buffer_alloc(cl_buffer_mgr bufmgr, const char *name, size_t size, size_t align)
+{
+  null_buffer_t *bo = NULL;
+
+  TRY_ALLOC_NO_ERR (bo, CALLOC(null_buffer_t));
+  bo->ref_n = 1;
+  bo->size = size;
+  bo->own = 1;
+  bo->virtual = cl_aligned_malloc(size ? size : 1, align > 64 ? align : 64);
+  if (bo->virtual == NULL)
+    goto error;
+  memset(bo->virtual, 0, size);
+  return bo;
+
+error:
+  cl_free(bo);
+  return NULL;
+}
+
+static null_buffer_t*
+null_buffer_alloc_userptr(cl_buffer_mgr bufmgr, const char *name, void *data,
+                          size_t size, unsigned long flags)
+{
+  null_buffer_t *bo = NULL;
+
+  TRY_ALLOC_NO_ERR (bo, CALLOC(null_buffer_t));
+  bo->ref_n = 1;
+  bo->size = size;
+  bo->virtual = data;
+
+error:
+  return bo;
+}
+
+static void
+null_buffer_reference(null_buffer_t *bo)
+{
+  atomic_inc(&bo->ref_n);
+}
+
+static int
+null_buffer_unreference(null_buffer_t *bo)
+{
+  if (bo == NULL || atomic_dec(&bo->ref_n) != 1)
+    return 0;
+  if (bo->own)
+    cl_free(bo->virtual);
+  cl_free(bo);
+  return 1;
+}
+
+static int
+null_buffer_set_tiling(null_buffer_t *bo, cl_image_tiling_t tiling, size_t stride)
+{
+  bo->tiling = tiling;
+  bo->stride = stride;
+  return 0;
+}
+
+/* Same layout as the hardware so the image sizes do not depend on the driver */
+static uint32_t
+null_buffer_get_tiling_align(cl_context ctx, uint32_t tiling_mode, uint32_t dim)
+{
+  uint32_t gen_ver = ((null_driver_t *)ctx->drv)->gen_ver;
+  uint32_t slice_align = gen_ver == 8 ? 4 : 2;
+
+  switch (tiling_mode) {
+  case CL_TILE_X:
+    if (dim == 0) return 512;
+    if (dim == 1) return 8;
+    return gen_ver == 9 ? 8 : slice_align;
+  case CL_TILE_Y:
+    if (dim == 0) return 128;
+    if (dim == 1) return 32;
+    return gen_ver == 9 ? 32 : slice_align;
+  case CL_NO_TILE:
+    assert(dim == 1 || dim == 2);
+    return (gen_ver == 8 || gen_ver == 9) ? 4 : 2;
+  }
+  return 0;
+}
+
+/* The images are stored the way the GTT shows them: the CPU cannot detile them */
+static cl_buffer_swizzle
+null_buffer_get_swizzle(null_buffer_t *bo)
+{
+  return CL_SWIZZLE_UNSUPPORTED;
+}
+
+static int null_buffer_map(null_buffer_t *bo, uint32_t write_enable) { return 0; }
+static int null_buffer_unmap(null_buffer_t *bo) { return 0; }
+static int null_buffer_map_gtt(null_buffer_t *bo) { return 0; }
+static void* null_buffer_get_virtual(null_buffer_t *bo) { return bo->virtual; }
+static size_t null_buffer_get_size(null_buffer_t *bo) { return bo->size; }
+static int null_buffer_pin(null_buffer_t *bo, uint32_t alignment) { return 0; }
+static int null_buffer_wait_rendering(null_buffer_t *bo) { return 0; }
+static int null_buffer_is_busy(null_buffer_t *bo) { return 0; }
+static int null_buffer_get_fd(null_buffer_t *bo, int *fd) { return -1; }
+
+static int
+null_buffer_subdata(null_buffer_t *bo, unsigned long offset, unsigned long size, const void *data)
+{
+  assert(offset + size <= bo->size);
+  memcpy((char *)bo->virtual + offset, data, size);
+  return 0;
+}
+
+static int
+null_buffer_get_subdata(null_buffer_t *bo, unsigned long offset, unsigned long size, void *data)
+{
+  assert(offset + size <= bo->size);
+  memcpy(data, (char *)bo->virtual + offset, size);
+  return 0;
+}
+
+static cl_buffer
+null_buffer_from_libva(cl_context ctx, unsigned int bo_name, void *info)
+{
+  return NULL;
+}
+
+/**************************************************************************
+ * Batch buffer
+ **************************************************************************/
+static void
+null_batch_unref(null_batch_t *batch)
+{
+  if (batch == NULL || atomic_dec(&batch->ref_n) != 1)
+    return;
+  cl_free(batch->walkers);
+  cl_free(batch);
+}
+
+static void*
+null_gpgpu_ref_batch_buf(null_gpgpu_t *gpgpu)
+{
+  if (gpgpu->batch)
+    atomic_inc(&gpgpu->batch->ref_n);
+  return gpgpu->batch;
+}
+
+static void
+null_gpgpu_unref_batch_buf(void *buf)
+{
+  null_batch_unref((null_batch_t *)buf);
+}
+
+static void
+null_gpgpu_sync(void *buf)
+{
+  null_batch_t *batch = (null_batch_t *)buf;
+
+  /* The batches complete OCL_NULL_DRIVER_EVENT_LATENCY after their flush */
+  if (batch != NULL && batch->flushed)
+    null_sleep_until(batch->done_time);
+}
+
+static int
+null_gpgpu_batch_reset(null_gpgpu_t *gpgpu, size_t sz)
+{
+  null_batch_t *batch = NULL;
+
+  TRY_ALLOC_NO_ERR (batch, CALLOC(null_batch_t));
+  batch->ref_n = 1;
+  null_batch_unref(gpgpu->batch);
+  gpgpu->batch = batch;
+  gpgpu->skip_flush = 0;
+  return 0;
+
+error:
+  return -1;
+}
+
+static void
+null_gpgpu_batch_start(null_gpgpu_t *gpgpu)
+{
+  assert(gpgpu->batch && !gpgpu->batch->flushed && !gpgpu->in_batch);
+  gpgpu->in_batch = 1;
+}
+
+static void
+null_gpgpu_skip_flush(null_gpgpu_t *gpgpu)
+{
+  gpgpu->skip_flush = 1;
+}
+
+static void
+null_gpgpu_batch_end(null_gpgpu_t *gpgpu, int32_t flush_mode)
+{
+  assert(gpgpu->in_batch);
+  gpgpu->in_batch = 0;
+}
+
+static void
+null_gpgpu_walker(null_gpgpu_t *gpgpu,
+                  uint32_t simd_sz,
+                  uint32_t thread_n,
+                  const size_t global_wk_off[3],
+                  const size_t global_wk_sz[3],
+                  const size_t local_wk_sz[3])
+{
+  null_batch_t *batch = gpgpu->batch;
+  null_walker_t *walker;
+
+  assert(gpgpu->in_batch);
+  if (batch->walker_n == batch->walker_max) {
+    uint32_t max = batch->walker_max ? 2 * batch->walker_max : 4;
+    null_walker_t *walkers = cl_realloc(batch->walkers, max * sizeof(null_walker_t));
+    if (walkers == NULL)
+      return;
+    batch->walkers = walkers;
+    batch->walker_max = max;
+  }
+
+  walker = &batch->walkers[batch->walker_n++];
+  walker->simd_sz = simd_sz;
+  walker->thread_n = thread_n;
+  memcpy(walker->global_wk_off, global_wk_off, sizeof(walker->global_wk_off));
+  memcpy(walker->global_wk_sz, global_wk_sz, sizeof(walker->global_wk_sz));
+  memcpy(walker->local_wk_sz, local_wk_sz, sizeof(walker->local_wk_sz));
+  walker->curbe_sz = gpgpu->ker.curbe_sz;
+  walker->slm_sz = gpgpu->ker.slm_sz;
+  walker->surface_n = gpgpu->surface_n;
+  walker->image_n = gpgpu->image_n;
+  walker->sampler_n = gpgpu->sampler_n;
+  walker->flush = batch->walker_n == 1 || !gpgpu->skip_flush;
+  gpgpu->skip_flush = 0;
+}
+
+static void
+null_batch_dump(const null_batch_t *batch, int index)
+{
+  uint32_t i;
+
+  fprintf(stderr, "[null driver] batch %d: %u walker(s)\n", index, batch->walker_n);
+  for (i = 0; i < batch->walker_n; ++i) {
+    const null_walker_t *w = &batch->walkers[i];
+    fprintf(stderr, "[null driver]   walker %u: SIMD%u, %u thread(s) per group, "
+            "global %zux%zux%zu, offset %zux%zux%zu, local %zux%zux%zu, "
+            "curbe %u, slm %u, %u surface(s), %u image(s), %u sampler(s), %s\n",
+            i, w->simd_sz, w->thread_n,
+            w->global_wk_sz[0], w->global_wk_sz[1], w->global_wk_sz[2],
+            w->global_wk_off[0], w->global_wk_off[1], w->global_wk_off[2],
+            w->local_wk_sz[0], w->local_wk_sz[1], w->local_wk_sz[2],
+            w->curbe_sz, w->slm_sz, w->surface_n, w->image_n, w->sampler_n,
+            w->flush ? "flush" : "stall");
+  }
+}
+
+static int
+null_gpgpu_flush(null_gpgpu_t *gpgpu)
+{
+  null_batch_t *batch = gpgpu->batch;
+  null_driver_t *drv = gpgpu->drv;
+  int index;
+
+  if (batch == NULL || batch->flushed || batch->walker_n == 0)
+    return 0;
+  batch->flushed = 1;
+  batch->flush_time = null_get_time();
+  batch->done_time = batch->flush_time + drv->latency;
+  index = atomic_inc(&drv->batch_n);
+  atomic_add(&drv->walker_n, batch->walker_n);
+  if (drv->dump)
+    null_batch_dump(batch, index);
+  return 0;
+}
+
+/**************************************************************************
+ * GPGPU state
+ **************************************************************************/
+static null_gpgpu_t*
+null_gpgpu_new(null_driver_t *drv)
+{
+  null_gpgpu_t *gpgpu = NULL;
+
+  TRY_ALLOC_NO_ERR (gpgpu, CALLOC(null_gpgpu_t));
+  gpgpu->drv = drv;
+
+error:
+  return gpgpu;
+}
+
+static void
+null_gpgpu_delete(null_gpgpu_t *gpgpu)
+{
+  if (gpgpu == NULL)
+    return;
+  null_batch_unref(gpgpu->batch);
+  null_buffer_unreference(gpgpu->constant_b);
+  null_buffer_unreference(gpgpu->stack_b);
+  null_buffer_unreference(gpgpu->scratch_b);
+  null_buffer_unreference(gpgpu->printf_b[0]);
+  null_buffer_unreference(gpgpu->printf_b[1]);
+  cl_free(gpgpu->curbe);
+  cl_free(gpgpu);
+}
+
+/* The batches complete as soon as they are flushed */
+static int
+null_gpgpu_reuse(null_gpgpu_t *gpgpu)
+{
+  return 0;
+}
+
+static int
+null_gpgpu_state_init(null_gpgpu_t *gpgpu, uint32_t max_threads, uint32_t size_cs_entry, int profiling)
+{
+  gpgpu->max_threads = max_threads;
+  gpgpu->surface_n = 0;
+  gpgpu->image_n = 0;
+  gpgpu->sampler_n = 0;
+  null_buffer_unreference(gpgpu->stack_b);
+  gpgpu->stack_b = NULL;
+  null_buffer_unreference(gpgpu->printf_b[0]);
+  null_buffer_unreference(gpgpu->printf_b[1]);
+  gpgpu->printf_b[0] = gpgpu->printf_b[1] = NULL;
+  return 0;
+}
+
+static void
+null_gpgpu_bind_buf(null_gpgpu_t *gpgpu, null_buffer_t *buf, uint32_t offset,
+                    uint32_t internal_offset, uint32_t size, uint8_t bti)
+{
+  gpgpu->surface_n++;
+}
+
+static void
+null_gpgpu_bind_image(null_gpgpu_t *gpgpu, uint32_t index, null_buffer_t *obj_bo,
+                      uint32_t obj_bo_offset, uint32_t format, uint32_t bpp, uint32_t type,
+                      int32_t w, int32_t h, int32_t depth, int32_t pitch,
+                      int32_t slice_pitch, int32_t tiling)
+{
+  gpgpu->image_n++;
+}
+
+static void
+null_gpgpu_bind_sampler(null_gpgpu_t *gpgpu, uint32_t *samplers, size_t sampler_sz)
+{
+  gpgpu->sampler_n = sampler_sz;
+}
+
+static uint32_t
+null_gpgpu_get_cache_ctrl(void)
+{
+  return 0;
+}
+
+static void
+null_gpgpu_set_stack(null_gpgpu_t *gpgpu, uint32_t offset, uint32_t size, uint8_t bti)
+{
+  null_buffer_unreference(gpgpu->stack_b);
+  gpgpu->stack_b = null_buffer_alloc((cl_buffer_mgr)gpgpu->drv, "STACK", size, 64);
+  null_gpgpu_bind_buf(gpgpu, gpgpu->stack_b, offset, 0, size, bti);
+}
+
+static int
+null_gpgpu_set_scratch(null_gpgpu_t *gpgpu, uint32_t per_thread_size)
+{
+  size_t total = (size_t)per_thread_size * gpgpu->max_threads;
+
+  if (gpgpu->scratch_b && gpgpu->scratch_b->size < total) {
+    null_buffer_unreference(gpgpu->scratch_b);
+    gpgpu->scratch_b = NULL;
+  }
+  if (gpgpu->scratch_b == NULL && total) {
+    gpgpu->scratch_b = null_buffer_alloc((cl_buffer_mgr)gpgpu->drv, "SCRATCH_BO", total, 4096);
+    if (gpgpu->scratch_b == NULL)
+      return -1;
+  }
+  return 0;
+}
+
+static void
+null_gpgpu_set_perf_counters(null_gpgpu_t *gpgpu, null_buffer_t *perf)
+{
+}
+
+static int
+null_gpgpu_upload_curbes(null_gpgpu_t *gpgpu, const void *data, uint32_t size)
+{
+  if (size > gpgpu->curbe_max) {
+    void *curbe = cl_realloc(gpgpu->curbe, size);
+    if (curbe == NULL)
+      return -1;
+    gpgpu->curbe = curbe;
+    gpgpu->curbe_max = size;
+  }
+  memcpy(gpgpu->curbe, data, size);
+  return 0;
+}
+
+static null_buffer_t*
+null_gpgpu_alloc_constant_buffer(null_gpgpu_t *gpgpu, uint32_t size, uint8_t bti)
+{
+  null_buffer_unreference(gpgpu->constant_b);
+  gpgpu->constant_b = null_buffer_alloc((cl_buffer_mgr)gpgpu->drv, "CONSTANT_BUFFER", size, 64);
+  if (gpgpu->constant_b)
+    null_gpgpu_bind_buf(gpgpu, gpgpu->constant_b, 0, 0, size, bti);
+  return gpgpu->constant_b;
+}
+
+static void
+null_gpgpu_states_setup(null_gpgpu_t *gpgpu, cl_gpgpu_kernel *kernel)
+{
+  gpgpu->ker = *kernel;
+}
+
+/**************************************************************************
+ * Printf
+ **************************************************************************/
+static int
+null_gpgpu_set_printf_buf(null_gpgpu_t *gpgpu, uint32_t i, uint32_t size, uint32_t offset, uint8_t bti)
+{
+  assert(i < 2);
+  null_buffer_unreference(gpgpu->printf_b[i]);
+  gpgpu->printf_b[i] = null_buffer_alloc((cl_buffer_mgr)gpgpu->drv, "Printf buffer", size, 4096);
+  if (gpgpu->printf_b[i] == NULL)
+    return -1;
+  null_gpgpu_bind_buf(gpgpu, gpgpu->printf_b[i], offset, 0, size, bti);
+  return 0;
+}
+
+static void*
+null_gpgpu_map_printf_buf(null_gpgpu_t *gpgpu, uint32_t i)
+{
+  assert(i < 2 && gpgpu->printf_b[i]);
+  return gpgpu->printf_b[i]->virtual;
+}
+
+static void
+null_gpgpu_unmap_printf_buf_addr(null_gpgpu_t *gpgpu, uint32_t i)
+{
+}
+
+static void
+null_gpgpu_release_printf_buf(null_gpgpu_t *gpgpu, uint32_t i)
+{
+  assert(i < 2);
+  null_buffer_unreference(gpgpu->printf_b[i]);
+  gpgpu->printf_b[i] = NULL;
+}
+
+static void
+null_gpgpu_set_printf_info(null_gpgpu_t *gpgpu, void *printf_info, size_t *global_sz)
+{
+  gpgpu->printf_info = printf_info;
+  memcpy(gpgpu->global_wk_sz, global_sz, sizeof(gpgpu->global_wk_sz));
+}
+
+static void*
+null_gpgpu_get_printf_info(null_gpgpu_t *gpgpu, size_t *global_sz, size_t *outbuf_sz)
+{
+  memcpy(global_sz, gpgpu->global_wk_sz, sizeof(gpgpu->global_wk_sz));
+  if (gpgpu->printf_b[1])
+    *outbuf_sz = gpgpu->printf_b[1]->size;
+  return gpgpu->printf_info;
+}
+
+/**************************************************************************
+ * Events
+ **************************************************************************/
+static null_event_t*
+null_gpgpu_event_new(null_gpgpu_t *gpgpu)
+{
+  null_event_t *event = NULL;
+
+  TRY_ALLOC_NO_ERR (event, CALLOC(null_event_t));
+  event->batch = null_gpgpu_ref_batch_buf(gpgpu);
+  event->status = command_queued;
+
+error:
+  return event;
+}
+
+static void
+null_gpgpu_event_flush(null_event_t *event)
+{
+  assert(event->status == command_queued);
+  event->status = command_running;
+}
+
+/* Nothing runs, so the command is done as soon as it is submitted, or
+ * OCL_NULL_DRIVER_EVENT_LATENCY later to mimic the GPU */
+static int
+null_gpgpu_event_update_status(null_event_t *event, int wait)
+{
+  const null_batch_t *batch = event->batch;
+
+  if (event->status == command_running) {
+    if (batch && batch->flushed && null_get_time() < batch->done_time) {
+      if (!wait)
+        return event->status;
+      null_sleep_until(batch->done_time);
+    }
+    event->ts[0] = batch && batch->flushed ? batch->flush_time : null_get_time();
+    event->ts[1] = batch && batch->flushed ? batch->done_time : event->ts[0];
+    event->status = command_complete;
+  }
+  return event->status;
+}
+
+static void
+null_gpgpu_event_delete(null_event_t *event)
+{
+  null_batch_unref(event->batch);
+  cl_free(event);
+}
+
+static void
+null_gpgpu_event_get_gpu_cur_timestamp(null_gpgpu_t *gpgpu, uint64_t *ret_ts)
+{
+  *ret_ts = null_get_time();
+}
+
+static void
+null_gpgpu_event_get_exec_timestamp(null_gpgpu_t *gpgpu, null_event_t *event,
+                                    int index, uint64_t *ret_ts)
+{
+  assert(index == 0 || index == 1);
+  null_gpgpu_event_update_status(event, 1);
+  *ret_ts = event->ts[index];
+}
+
+LOCAL void
+null_setup_callbacks(void)
+{
+  cl_driver_new = (cl_driver_new_cb *) null_driver_new;
+  cl_driver_delete = (cl_driver_delete_cb *) null_driver_delete;
+  cl_driver_get_ver = (cl_driver_get_ver_cb *) null_driver_get_ver;
+  cl_driver_get_bufmgr = (cl_driver_get_bufmgr_cb *) null_driver_get_bufmgr;
+  cl_driver_get_device_id = (cl_driver_get_device_id_cb *) null_get_device_id;
+  cl_driver_update_device_info = (cl_driver_update_device_info_cb *) null_update_device_info;
+  cl_buffer_alloc = (cl_buffer_alloc_cb *) null_buffer_alloc;
+  cl_buffer_alloc_userptr = (cl_buffer_alloc_userptr_cb *) null_buffer_alloc_userptr;
+  cl_buffer_set_tiling = (cl_buffer_set_tiling_cb *) null_buffer_set_tiling;
+  cl_buffer_get_buffer_from_libva = (cl_buffer_get_buffer_from_libva_cb *) null_buffer_from_libva;
+  cl_buffer_get_image_from_libva = (cl_buffer_get_image_from_libva_cb *) null_buffer_from_libva;
+  cl_buffer_reference = (cl_buffer_reference_cb *) null_buffer_reference;
+  cl_buffer_unreference = (cl_buffer_unreference_cb *) null_buffer_unreference;
+  cl_buffer_map = (cl_buffer_map_cb *) null_buffer_map;
+  cl_buffer_unmap = (cl_buffer_unmap_cb *) null_buffer_unmap;
+  cl_buffer_map_gtt = (cl_buffer_map_gtt_cb *) null_buffer_map_gtt;
+  cl_buffer_unmap_gtt = (cl_buffer_unmap_gtt_cb *) null_buffer_unmap;
+  cl_buffer_map_gtt_unsync = (cl_buffer_map_gtt_unsync_cb *) null_buffer_map_gtt;
+  cl_buffer_get_virtual = (cl_buffer_get_virtual_cb *) null_buffer_get_virtual;
+  cl_buffer_get_size = (cl_buffer_get_size_cb *) null_buffer_get_size;
+  cl_buffer_pin = (cl_buffer_pin_cb *) null_buffer_pin;
+  cl_buffer_unpin = (cl_buffer_unpin_cb *) null_buffer_unmap;
+  cl_buffer_subdata = (cl_buffer_subdata_cb *) null_buffer_subdata;
+  cl_buffer_get_subdata = (cl_buffer_get_subdata_cb *) null_buffer_get_subdata;
+  cl_buffer_wait_rendering = (cl_buffer_wait_rendering_cb *) null_buffer_wait_rendering;
+  cl_buffer_is_busy = (cl_buffer_is_busy_cb *) null_buffer_is_busy;
+  cl_buffer_get_fd = (cl_buffer_get_fd_cb *) null_buffer_get_fd;
+  cl_buffer_get_tiling_align = (cl_buffer_get_tiling_align_cb *) null_buffer_get_tiling_align;
+  cl_buffer_get_swizzle = (cl_buffer_get_swizzle_cb *) null_buffer_get_swizzle;
+
+  cl_gpgpu_new = (cl_gpgpu_new_cb *) null_gpgpu_new;
+  cl_gpgpu_delete = (cl_gpgpu_delete_cb *) null_gpgpu_delete;
+  cl_gpgpu_reuse = (cl_gpgpu_reuse_cb *) null_gpgpu_reuse;
+  cl_gpgpu_sync = (cl_gpgpu_sync_cb *) null_gpgpu_sync;
+  cl_gpgpu_bind_buf = (cl_gpgpu_bind_buf_cb *) null_gpgpu_bind_buf;
+  cl_gpgpu_set_stack = (cl_gpgpu_set_stack_cb *) null_gpgpu_set_stack;
+  cl_gpgpu_state_init = (cl_gpgpu_state_init_cb *) null_gpgpu_state_init;
+  cl_gpgpu_set_perf_counters = (cl_gpgpu_set_perf_counters_cb *) null_gpgpu_set_perf_counters;
+  cl_gpgpu_upload_curbes = (cl_gpgpu_upload_curbes_cb *) null_gpgpu_upload_curbes;
+  cl_gpgpu_alloc_constant_buffer = (cl_gpgpu_alloc_constant_buffer_cb *) null_gpgpu_alloc_constant_buffer;
+  cl_gpgpu_states_setup = (cl_gpgpu_states_setup_cb *) null_gpgpu_states_setup;
+  cl_gpgpu_batch_reset = (cl_gpgpu_batch_reset_cb *) null_gpgpu_batch_reset;
+  cl_gpgpu_batch_start = (cl_gpgpu_batch_start_cb *) null_gpgpu_batch_start;
+  cl_gpgpu_skip_flush = (cl_gpgpu_skip_flush_cb *) null_gpgpu_skip_flush;
+  cl_gpgpu_batch_end = (cl_gpgpu_batch_end_cb *) null_gpgpu_batch_end;
+  cl_gpgpu_flush = (cl_gpgpu_flush_cb *) null_gpgpu_flush;
+  cl_gpgpu_walker = (cl_gpgpu_walker_cb *) null_gpgpu_walker;
+  cl_gpgpu_bind_image = (cl_gpgpu_bind_image_cb *) null_gpgpu_bind_image;
+  cl_gpgpu_bind_sampler = (cl_gpgpu_bind_sampler_cb *) null_gpgpu_bind_sampler;
+  cl_gpgpu_get_cache_ctrl = (cl_gpgpu_get_cache_ctrl_cb *) null_gpgpu_get_cache_ctrl;
+  cl_gpgpu_set_scratch = (cl_gpgpu_set_scratch_cb *) null_gpgpu_set_scratch;
+  cl_gpgpu_event_new = (cl_gpgpu_event_new_cb *) null_gpgpu_event_new;
+  cl_gpgpu_event_flush = (cl_gpgpu_event_flush_cb *) null_gpgpu_event_flush;
+  cl_gpgpu_event_update_status = (cl_gpgpu_event_update_status_cb *) null_gpgpu_event_update_status;
+  cl_gpgpu_event_delete = (cl_gpgpu_event_delete_cb *) null_gpgpu_event_delete;
+  cl_gpgpu_event_get_exec_timestamp = (cl_gpgpu_event_get_exec_timestamp_cb *) null_gpgpu_event_get_exec_timestamp;
+  cl_gpgpu_event_get_gpu_cur_timestamp = (cl_gpgpu_event_get_gpu_cur_timestamp_cb *) null_gpgpu_event_get_gpu_cur_timestamp;
+  cl_gpgpu_ref_batch_buf = (cl_gpgpu_ref_batch_buf_cb *) null_gpgpu_ref_batch_buf;
+  cl_gpgpu_unref_batch_buf = (cl_gpgpu_unref_batch_buf_cb *) null_gpgpu_unref_batch_buf;
+  cl_gpgpu_set_printf_buffer = (cl_gpgpu_set_printf_buffer_cb *) null_gpgpu_set_printf_buf;
+  cl_gpgpu_map_printf_buffer = (cl_gpgpu_map_printf_buffer_cb *) null_gpgpu_map_printf_buf;
+  cl_gpgpu_unmap_printf_buffer = (cl_gpgpu_unmap_printf_buffer_cb *) null_gpgpu_unmap_printf_buf_addr;
+  cl_gpgpu_release_printf_buffer = (cl_gpgpu_release_printf_buffer_cb *) null_gpgpu_release_printf_buf;
+  cl_gpgpu_set_printf_info = (cl_gpgpu_set_printf_info_cb *) null_gpgpu_set_printf_info;
+  cl_gpgpu_get_printf_info = (cl_gpgpu_get_printf_info_cb *) null_gpgpu_get_printf_info;
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright © 2015 Intel Corporation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __NULL_DRIVER_H__
+#define __NULL_DRIVER_H__
+
+/* The null driver does not touch the GPU: the buffers live in host memory,
+ * the batch buffers are recorded and decoded instead of executed and the
+ * commands complete as soon as they are flushed. It lets the host side of
+ * the runtime be profiled on any machine.
+ */
+
+/* Whether OCL_NULL_DRIVER asks for the null driver */
+extern int null_driver_enabled(void);
+
+/* init the call backs used by the ocl driver */
+extern void null_setup_callbacks(void);
+
+#endif /* __NULL_DRIVER_H__ */
@@ -1,303 +1,386 @@
 #include <performance.h>
+#include "cl_kernel.h"
+#include "cl_gbe_loader.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <math.h>
-#include <sys/time.h>
+#include <time.h>
 #include <pthread.h>
 
-#define MAX_KERNEL_NAME_LENGTH 100
-#define MAX_KERNEL_EXECUTION_COUNT 100000
-#define MAX_KERNEL_BUILD_OPT 1000
-typedef struct kernel_storage_node
+/* Kernel profiling (OCL_OUTPUT_KERNEL_PERF).
+ * Every launch is first written into a ring buffer owned by the enqueuing
+ * thread, so recording takes no lock. The rings are drained into a hash
+ * table of kernels (context, name, build options) which keeps the counts and
+ * a log-scale histogram of the execution times, from which the percentiles
+ * are computed. Draining happens when a ring is full, when the statistics
+ * are exported and at exit.
+ * Timing a launch means draining the queue before it and waiting for it, so
+ * only one launch out of OCL_KERNEL_PERF_SAMPLE is timed. The other ones are
+ * only counted.
+ */
+
+#define PERF_RING_SIZE 1024          /* Launches buffered per thread */
+#define PERF_TABLE_SIZE 256          /* Buckets of the kernel hash table */
+#define PERF_HIST_SUB_BUCKETS 8      /* Histogram precision is 1/8 of a power of 2 */
+#define PERF_HIST_BUCKETS (42 * PERF_HIST_SUB_BUCKETS) /* Up to 2^42 ns */
+
+/* What we know about one launch */
+typedef struct perf_launch_info
 {
-  char kernel_name[MAX_KERNEL_NAME_LENGTH];
-  float kernel_times[MAX_KERNEL_EXECUTION_COUNT];
-  char build_option[MAX_KERNEL_BUILD_OPT];
-  int current_count;
-  float kernel_sum_time;
-  struct kernel_storage_node *next;
-} kernel_storage_node;
-
-typedef struct context_storage_node
+  size_t global_wk_sz[3];
+  size_t local_wk_sz[3];
+  uint32_t work_dim;
+  uint32_t simd_width;
+  uint32_t curbe_size;
+  uint32_t scratch_size;
+} perf_launch_info;
+
+/* All the launches of one kernel with given build options in one context */
+typedef struct perf_kernel
 {
-  uintptr_t context_id;
-  kernel_storage_node *kernels_storage;
-  char max_time_kernel_name[MAX_KERNEL_NAME_LENGTH];
-  float kernel_max_time;
-  int kernel_count;
-  struct context_storage_node *next;
-} context_storage_node;
-
-typedef struct storage
+  struct perf_kernel *next;      /* Hash chain */
+  struct perf_kernel *all_next;  /* All kernels in creation order */
+  uintptr_t context;
+  uint32_t context_id;           /* Contexts are numbered as they show up */
+  uint64_t hash;
+  char *kernel_name;
+  char *build_option;
+  /* Only modified by the drainer, with perf_lock held */
+  uint64_t launch_n;
+  uint64_t sample_n;
+  double sum_ms;
+  double min_ms;
+  double max_ms;
+  uint32_t hist[PERF_HIST_BUCKETS];
+  perf_launch_info last;         /* The most recent launch */
+} perf_kernel;
+
+typedef struct perf_record
 {
-  context_storage_node * context_storage;
-} storage;
+  perf_kernel *kernel;
+  uint64_t time_ns;              /* 0 when the launch was not timed */
+  perf_launch_info info;
+} perf_record;
 
+/* Single producer (the owner thread) / single consumer (the drainer) ring */
+typedef struct perf_ring
+{
+  perf_record records[PERF_RING_SIZE];
+  volatile uint32_t head;        /* Only written by the owner thread */
+  volatile uint32_t tail;        /* Only written by the drainer */
+  struct perf_ring *next;
+} perf_ring;
+
+/* Launch started by time_start and not recorded yet */
+typedef struct perf_pending
+{
+  int active;
+  int sampled;
+  uint64_t start_ns;
+  perf_launch_info info;
+} perf_pending;
 
+int b_output_kernel_perf = 0;
+static uint32_t sample_period = 1;
+static char *output_file = NULL;
+static int output_csv = 0;
+static uint64_t export_interval_ns = 0;
+static volatile uint64_t next_export_ns = 0;
+
+static pthread_once_t perf_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t perf_lock = PTHREAD_MUTEX_INITIALIZER;  /* Drainer */
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER; /* Insertions */
+static perf_kernel * volatile kernel_table[PERF_TABLE_SIZE];
+static perf_kernel *all_kernels = NULL, **all_kernels_tail = &all_kernels;
+static uint32_t context_n = 0;
+static perf_ring *rings = NULL;
+
+static __thread perf_ring *thread_ring = NULL;
+static __thread perf_pending pending;
+static __thread uint32_t sample_counter = 0;
+
+static uint64_t perf_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
 
-static storage record;
-static int atexit_registered = 0;
+static uint64_t perf_hash(uintptr_t context, const char *kernel_name, const char *build_opt)
+{
+  uint64_t h = 0xcbf29ce484222325ull ^ (uint64_t)context;
+  const char *p;
+  for (p = kernel_name; *p; ++p)
+    h = (h ^ (unsigned char)*p) * 0x100000001b3ull;
+  h = (h ^ 0xff) * 0x100000001b3ull;
+  for (p = build_opt; *p; ++p)
+    h = (h ^ (unsigned char)*p) * 0x100000001b3ull;
+  return h;
+}
 
+static perf_kernel * find_kernel(cl_context context, const char *kernel_name, const char *build_opt)
+{
+  const uint64_t h = perf_hash((uintptr_t)context, kernel_name, build_opt);
+  const uint32_t bucket = h % PERF_TABLE_SIZE;
+  perf_kernel *k;
+
+  /* Entries are never removed and are published after being filled, so the
+   * look-up does not need the lock */
+  for (k = kernel_table[bucket]; k != NULL; k = k->next)
+    if (k->hash == h && k->context == (uintptr_t)context &&
+        !strcmp(k->kernel_name, kernel_name) && !strcmp(k->build_option, build_opt))
+      return k;
+
+  pthread_mutex_lock(&table_lock);
+  for (k = kernel_table[bucket]; k != NULL; k = k->next)
+    if (k->hash == h && k->context == (uintptr_t)context &&
+        !strcmp(k->kernel_name, kernel_name) && !strcmp(k->build_option, build_opt))
+      break;
+  if (k == NULL && (k = (perf_kernel *)calloc(1, sizeof(perf_kernel))) != NULL) {
+    perf_kernel *other;
+    k->context = (uintptr_t)context;
+    k->context_id = context_n;
+    for (other = all_kernels; other != NULL; other = other->all_next)
+      if (other->context == k->context) {
+        k->context_id = other->context_id;
+        break;
+      }
+    if (k->context_id == context_n)
+      context_n++;
+    k->hash = h;
+    k->kernel_name = strdup(kernel_name);
+    k->build_option = strdup(build_opt);
+    k->min_ms = -1.0;
+    *all_kernels_tail = k;
+    all_kernels_tail = &k->all_next;
+    k->next = kernel_table[bucket];
+    __sync_synchronize();
+    kernel_table[bucket] = k;
+  }
+  pthread_mutex_unlock(&table_lock);
+  return k;
+}
 
-static context_storage_node * prev_context_pointer = NULL;
-static kernel_storage_node * prev_kernel_pointer = NULL;
+static uint32_t hist_bucket(uint64_t ns)
+{
+  uint32_t msb, shift, bucket;
+  if (ns < PERF_HIST_SUB_BUCKETS)
+    return (uint32_t)ns;
+  msb = 63 - __builtin_clzll(ns);
+  shift = msb - 3;
+  bucket = (shift + 1) * PERF_HIST_SUB_BUCKETS + ((ns >> shift) & (PERF_HIST_SUB_BUCKETS - 1));
+  return bucket < PERF_HIST_BUCKETS ? bucket : PERF_HIST_BUCKETS - 1;
+}
 
-static context_storage_node * find_context(cl_context context)
+/* Middle of the time range covered by a bucket, in ms */
+static double hist_bucket_ms(uint32_t bucket)
 {
-  if(NULL != prev_context_pointer )
-  {
-    if(prev_context_pointer->context_id == (uintptr_t)context)
-      return prev_context_pointer;
-  }
+  uint32_t shift;
+  if (bucket < PERF_HIST_SUB_BUCKETS)
+    return bucket / 1e6;
+  shift = bucket / PERF_HIST_SUB_BUCKETS - 1;
+  return ((double)((PERF_HIST_SUB_BUCKETS + bucket % PERF_HIST_SUB_BUCKETS) << shift) +
+          (double)(1ull << shift) / 2) / 1e6;
+}
 
-  if(NULL == record.context_storage)
-  {
-    record.context_storage = (context_storage_node *) malloc(sizeof(context_storage_node));
-    record.context_storage->context_id = (uintptr_t)context;
-    record.context_storage->kernels_storage = NULL;
-    record.context_storage->kernel_max_time = 0.0f;
-    record.context_storage->next = NULL;
-    record.context_storage->kernel_count = 0;
-    return record.context_storage;
+static double percentile_ms(const perf_kernel *k, double percent)
+{
+  uint64_t rank, count = 0;
+  uint32_t i;
+  if (k->sample_n == 0)
+    return 0.0;
+  rank = (uint64_t)(percent / 100.0 * (k->sample_n - 1)) + 1;
+  for (i = 0; i < PERF_HIST_BUCKETS; ++i) {
+    count += k->hist[i];
+    if (count >= rank)
+      break;
   }
+  /* The exact bounds are known, do not report something out of them */
+  if (hist_bucket_ms(i) < k->min_ms) return k->min_ms;
+  if (hist_bucket_ms(i) > k->max_ms) return k->max_ms;
+  return hist_bucket_ms(i);
+}
 
-  context_storage_node *pre = record.context_storage;
-  context_storage_node *cur = record.context_storage;
-  while(NULL !=cur && (uintptr_t)context != cur->context_id )
-  {
-    pre = cur;
-    cur = cur->next;
+/* Must be called with perf_lock held */
+static void drain_ring(perf_ring *ring)
+{
+  const uint32_t head = ring->head;
+  uint32_t i;
+  __sync_synchronize();
+  for (i = ring->tail; i != head; ++i) {
+    const perf_record *r = &ring->records[i % PERF_RING_SIZE];
+    perf_kernel *k = r->kernel;
+    k->launch_n++;
+    k->last = r->info;
+    if (r->time_ns) {
+      const double ms = r->time_ns / 1e6;
+      k->sample_n++;
+      k->sum_ms += ms;
+      if (k->min_ms < 0 || ms < k->min_ms) k->min_ms = ms;
+      if (ms > k->max_ms) k->max_ms = ms;
+      k->hist[hist_bucket(r->time_ns)]++;
+    }
   }
-  if(NULL != cur)
-    return cur;
-
-  pre->next = (context_storage_node *)malloc(sizeof(context_storage_node));
-  pre = pre->next;
-  pre->context_id = (uintptr_t)context;
-  pre->kernels_storage = NULL;
-  pre->kernel_max_time = 0.0f;
-  pre->next = NULL;
-  pre->kernel_count = 0;
-  return pre;
+  __sync_synchronize();
+  ring->tail = head;
 }
 
-static kernel_storage_node * find_kernel(context_storage_node *p_context, const char *kernel_name, const char *build_opt)
+/* Must be called with perf_lock held */
+static void drain_all_rings(void)
 {
-  if(NULL != prev_kernel_pointer && NULL != prev_context_pointer &&
-     p_context == prev_context_pointer &&
-     !strncmp(kernel_name, prev_kernel_pointer->kernel_name, MAX_KERNEL_NAME_LENGTH) &&
-     !strncmp(build_opt, prev_kernel_pointer->build_option, MAX_KERNEL_BUILD_OPT))
-    return prev_kernel_pointer;
-
-  if(NULL == p_context)
-    return NULL;
+  perf_ring *ring;
+  for (ring = rings; ring != NULL; ring = ring->next)
+    drain_ring(ring);
+}
 
-  if(NULL == p_context->kernels_storage)
-  {
-    p_context->kernels_storage = (kernel_storage_node *)malloc(sizeof(kernel_storage_node));
-    p_context->kernel_count++;
-    strncpy(p_context->kernels_storage->kernel_name,kernel_name, MAX_KERNEL_NAME_LENGTH);
-    p_context->kernels_storage->kernel_name[MAX_KERNEL_NAME_LENGTH - 1] = '\0';
-    strncpy(p_context->kernels_storage->build_option, build_opt, MAX_KERNEL_BUILD_OPT);
-    p_context->kernels_storage->build_option[MAX_KERNEL_BUILD_OPT - 1] = '\0';
-    p_context->kernels_storage->current_count = 0;
-    p_context->kernels_storage->kernel_sum_time = 0.0f;
-    p_context->kernels_storage->next = NULL;
-    return p_context->kernels_storage;
+static void fput_escaped(FILE *f, const char *str, int csv)
+{
+  for (; *str; ++str) {
+    const unsigned char c = *str;
+    if (csv) {
+      if (c == '"') fputc('"', f);
+      fputc(c, f);
+    } else if (c == '"' || c == '\\')
+      fprintf(f, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(f, "\\u%04x", c);
+    else
+      fputc(c, f);
   }
+}
 
-  kernel_storage_node *pre = p_context->kernels_storage;
-  kernel_storage_node *cur = p_context->kernels_storage;
-  while(NULL != cur &&
-        (strncmp(cur->kernel_name, kernel_name, MAX_KERNEL_NAME_LENGTH) ||
-         strncmp(cur->build_option, build_opt, MAX_KERNEL_BUILD_OPT)))
-  {
-    pre = cur;
-    cur = cur->next;
+static void export_json(FILE *f)
+{
+  const perf_kernel *k;
+  int first = 1;
+  fprintf(f, "{\n  \"kernels\": [");
+  for (k = all_kernels; k != NULL; k = k->all_next) {
+    const perf_launch_info *l = &k->last;
+    fprintf(f, "%s\n    {\"context\": %u, \"name\": \"", first ? "" : ",", k->context_id);
+    fput_escaped(f, k->kernel_name, 0);
+    fprintf(f, "\", \"build_options\": \"");
+    fput_escaped(f, k->build_option, 0);
+    fprintf(f, "\", \"launches\": %llu, \"samples\": %llu, \"total_ms\": %.4f, "
+               "\"mean_ms\": %.4f, \"min_ms\": %.4f, \"p50_ms\": %.4f, \"p99_ms\": %.4f, "
+               "\"max_ms\": %.4f, \"work_dim\": %u, \"global_size\": [%zu, %zu, %zu], "
+               "\"local_size\": [%zu, %zu, %zu], \"simd_width\": %u, \"curbe_size\": %u, "
+               "\"scratch_size\": %u}",
+            (unsigned long long)k->launch_n, (unsigned long long)k->sample_n, k->sum_ms,
+            k->sample_n ? k->sum_ms / k->sample_n : 0.0, k->min_ms < 0 ? 0.0 : k->min_ms,
+            percentile_ms(k, 50), percentile_ms(k, 99), k->max_ms, l->work_dim,
+            l->global_wk_sz[0], l->global_wk_sz[1], l->global_wk_sz[2],
+            l->local_wk_sz[0], l->local_wk_sz[1], l->local_wk_sz[2],
+            l->simd_width, l->curbe_size, l->scratch_size);
+    first = 0;
   }
-  if(NULL != cur)
-    return cur;
-
-  p_context->kernel_count++;
-  pre->next = (kernel_storage_node *)malloc(sizeof(kernel_storage_node));
-  pre = pre->next;
-  pre->current_count = 0;
-  pre->kernel_sum_time = 0.0f;
-  pre->next = NULL;
-  strncpy(pre->kernel_name, kernel_name, MAX_KERNEL_NAME_LENGTH);
-  pre->kernel_name[MAX_KERNEL_NAME_LENGTH - 1] = '\0';
-  strncpy(pre->build_option, build_opt, MAX_KERNEL_BUILD_OPT);
-  pre->build_option[MAX_KERNEL_NAME_LENGTH - 1] = '\0';
-  return pre;
+  fprintf(f, "\n  ]\n}\n");
 }
 
-static void free_storage()
+static void export_csv(FILE *f)
 {
-  context_storage_node *p_context = record.context_storage;
-  while(NULL != p_context)
-  {
-    context_storage_node *p_tmp_context = p_context->next;
-    kernel_storage_node *p_kernel = p_context->kernels_storage;
-    while(NULL != p_kernel)
-    {
-      kernel_storage_node *p_tmp_kernel = p_kernel->next;
-      free(p_kernel);
-      p_kernel = p_tmp_kernel;
-    }
-    free(p_context);
-    p_context = p_tmp_context;
+  const perf_kernel *k;
+  fprintf(f, "context,name,build_options,launches,samples,total_ms,mean_ms,min_ms,p50_ms,"
+             "p99_ms,max_ms,work_dim,global_size_0,global_size_1,global_size_2,"
+             "local_size_0,local_size_1,local_size_2,simd_width,curbe_size,scratch_size\n");
+  for (k = all_kernels; k != NULL; k = k->all_next) {
+    const perf_launch_info *l = &k->last;
+    fprintf(f, "%u,\"", k->context_id);
+    fput_escaped(f, k->kernel_name, 1);
+    fprintf(f, "\",\"");
+    fput_escaped(f, k->build_option, 1);
+    fprintf(f, "\",%llu,%llu,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%u,%zu,%zu,%zu,%zu,%zu,%zu,%u,%u,%u\n",
+            (unsigned long long)k->launch_n, (unsigned long long)k->sample_n, k->sum_ms,
+            k->sample_n ? k->sum_ms / k->sample_n : 0.0, k->min_ms < 0 ? 0.0 : k->min_ms,
+            percentile_ms(k, 50), percentile_ms(k, 99), k->max_ms, l->work_dim,
+            l->global_wk_sz[0], l->global_wk_sz[1], l->global_wk_sz[2],
+            l->local_wk_sz[0], l->local_wk_sz[1], l->local_wk_sz[2],
+            l->simd_width, l->curbe_size, l->scratch_size);
   }
 }
 
-typedef struct time_element
-{
-  char kernel_name[MAX_KERNEL_NAME_LENGTH];
-  float kernel_sum_time;
-  int kernel_execute_count;
-  double dev;
-  float kernel_times[MAX_KERNEL_EXECUTION_COUNT];
-  uint32_t time_index;
-} time_element;
-
-static int cmp(const void *a, const void *b)
+/* Must be called with perf_lock held. The file is replaced atomically so a
+ * reader never sees a partial export */
+static void export_file(void)
 {
-  if(((time_element *)a)->kernel_sum_time < ((time_element *)b)->kernel_sum_time)
-    return 1;
-  else if(((time_element *)a)->kernel_sum_time > ((time_element *)b)->kernel_sum_time)
-    return -1;
-  else
-    return 0;
+  char *tmp_name;
+  FILE *f;
+  if (output_file == NULL)
+    return;
+  if ((tmp_name = (char *)malloc(strlen(output_file) + 5)) == NULL)
+    return;
+  sprintf(tmp_name, "%s.tmp", output_file);
+  if ((f = fopen(tmp_name, "w")) != NULL) {
+    if (output_csv)
+      export_csv(f);
+    else
+      export_json(f);
+    if (fclose(f) == 0)
+      rename(tmp_name, output_file);
+    else
+      remove(tmp_name);
+  }
+  free(tmp_name);
 }
 
 static void print_time_info()
 {
-  context_storage_node *p_context = record.context_storage;
-  if(NULL == p_context)
+  uint32_t context_id;
+  if (NULL == all_kernels)
   {
     printf("Nothing to output !\n");
     return;
   }
 
-  int tmp_context_id = 0;
-  while(NULL != p_context)
+  for (context_id = 0; context_id < context_n; ++context_id)
   {
-    printf("[------------ CONTEXT %4d ------------]\n", tmp_context_id++);
+    const perf_kernel *k;
+    double sum_time = 0.0;
+    printf("[------------ CONTEXT %4d ------------]\n", context_id);
     printf("  ->>>> KERNELS TIME SUMMARY <<<<-\n");
-
-    kernel_storage_node *p_kernel = p_context->kernels_storage;
-    kernel_storage_node *p_tmp_kernel = p_kernel;
-    time_element *te = (time_element *)malloc(sizeof(time_element)*p_context->kernel_count);
-    memset(te, 0, sizeof(time_element)*p_context->kernel_count);
-    int i = -1, j = 0, k = 0;
-    while(NULL != p_tmp_kernel)
-    {
-      for(k=0; k<=i; k++)
-      {
-        if(!strncmp(te[k].kernel_name, p_tmp_kernel->kernel_name, MAX_KERNEL_NAME_LENGTH))
-          break;
-      }
-      if(k == i+1)
-      {
-        i++;
-        k = i;
-      }
-      te[k].kernel_execute_count += p_tmp_kernel->current_count;
-      strncpy(te[k].kernel_name, p_tmp_kernel->kernel_name, MAX_KERNEL_NAME_LENGTH);
-      te[k].kernel_name[MAX_KERNEL_NAME_LENGTH - 1] = '\0';
-      te[k].kernel_sum_time += p_tmp_kernel->kernel_sum_time;
-      for(j=0; j != p_tmp_kernel->current_count; ++j)
-        te[k].kernel_times[te[k].time_index++] = p_tmp_kernel->kernel_times[j];
-      p_tmp_kernel = p_tmp_kernel->next;
-    }
-
-    for(k=0; k<=i; k++)
-    {
-      float average = te[k].kernel_sum_time / te[k].kernel_execute_count;
-      double sumsquare = 0.0;
-      for(j=0; j<te[k].time_index; ++j)
-        sumsquare += pow((te[k].kernel_times[j] - average), 2.0);
-      te[k].dev = sqrt(sumsquare / te[k].kernel_execute_count);
-    }
-
-    float sum_time = 0.0f;
-    qsort((void *)te, p_context->kernel_count, sizeof(time_element), cmp);
-    for(j=0; j<=i; ++j)
-      sum_time += te[j].kernel_sum_time;
-
-    for(j=0; j<=i; ++j)
+    for (k = all_kernels; k != NULL; k = k->all_next)
+      if (k->context_id == context_id)
+        sum_time += k->sum_ms;
+    for (k = all_kernels; k != NULL; k = k->all_next)
     {
-      printf("    [Kernel Name: %-30s Time(ms): (%4.1f%%) %9.2f  Count: %-7d  Ave(ms): %7.2f  Dev: %.1lf%%]\n",
-             te[j].kernel_name,
-             te[j].kernel_sum_time / sum_time * 100,
-             te[j].kernel_sum_time,
-             te[j].kernel_execute_count,
-             te[j].kernel_sum_time / te[j].kernel_execute_count,
-             te[j].dev / te[j].kernel_sum_time * te[j].kernel_execute_count * 100);
+      if (k->context_id != context_id)
+        continue;
+      printf("    [Kernel Name: %-30s Time(ms): (%4.1f%%) %9.2f  Count: %-7llu  Ave(ms): %7.2f  P50(ms): %7.2f  P99(ms): %7.2f]\n",
+             k->kernel_name,
+             sum_time > 0 ? k->sum_ms / sum_time * 100 : 0.0,
+             k->sum_ms,
+             (unsigned long long)k->launch_n,
+             k->sample_n ? k->sum_ms / k->sample_n : 0.0,
+             percentile_ms(k, 50),
+             percentile_ms(k, 99));
+      if (2 != b_output_kernel_perf)
+        continue;
+      if (*k->build_option != '\0')
+        printf("      ->Build Options : %s\n", k->build_option);
+      printf("      ->Last Launch   : dim %u global (%zu, %zu, %zu) local (%zu, %zu, %zu) SIMD%u curbe %u scratch %u\n",
+             k->last.work_dim,
+             k->last.global_wk_sz[0], k->last.global_wk_sz[1], k->last.global_wk_sz[2],
+             k->last.local_wk_sz[0], k->last.local_wk_sz[1], k->last.local_wk_sz[2],
+             k->last.simd_width, k->last.curbe_size, k->last.scratch_size);
+      printf("      ->Timed Runs    : %llu  Min(ms): %.2f  Max(ms): %.2f\n",
+             (unsigned long long)k->sample_n, k->min_ms < 0 ? 0.0 : k->min_ms, k->max_ms);
     }
-    free(te);
     printf("    Total : %.2f\n", sum_time);
-    if(2 != b_output_kernel_perf)
-    {
-      printf("[------------  CONTEXT ENDS------------]\n\n");
-      p_context = p_context->next;
-      continue;
-    }
-    p_tmp_kernel = p_kernel;
-    printf("\n  ->>>> KERNELS TIME DETAIL <<<<-\n");
-    while(NULL != p_kernel)
-    {
-      printf("    [Kernel Name : %30s   Time(ms): %.2f]\n", p_kernel->kernel_name, p_kernel->kernel_sum_time);
-      if(*p_kernel->build_option != '\0')
-      {
-        int count = 0;
-        printf("      ->Build Options : ");
-        while(p_kernel->build_option[count] != '\0' )
-        {
-          printf("%c", p_kernel->build_option[count++]);
-          if(count % 100 == 0)
-            printf("\n                         ");
-        }
-        printf("\n");
-      }
-      for(i=0; i!=p_kernel->current_count; ++i)
-        printf("      Execution Round%5d : %.2f (ms)\n", i+1, p_kernel->kernel_times[i]);
-      p_kernel = p_kernel->next;
-    }
     printf("[------------  CONTEXT ENDS------------]\n\n");
-    p_context = p_context->next;
   }
-  free_storage();
 }
 
-
-static void insert(cl_context context, const char *kernel_name, const char *build_opt, float time)
+static void perf_exit(void)
 {
-  if(!atexit_registered)
-  {
-    atexit_registered = 1;
-    atexit(print_time_info);
-  }
-  context_storage_node *p_context = find_context(context);
-  kernel_storage_node *p_kernel = find_kernel(p_context, kernel_name, build_opt);
-  prev_context_pointer = p_context;
-  prev_kernel_pointer = p_kernel;
-  p_kernel->kernel_times[p_kernel->current_count++] = time;
-  p_kernel->kernel_sum_time += time;
-  if(p_kernel->kernel_sum_time > p_context->kernel_max_time)
-  {
-    p_context->kernel_max_time = p_kernel->kernel_sum_time;
-    strncpy(p_context->max_time_kernel_name, kernel_name, MAX_KERNEL_NAME_LENGTH);
-    p_context->max_time_kernel_name[MAX_KERNEL_NAME_LENGTH - 1] = '\0';
-  }
+  pthread_mutex_lock(&perf_lock);
+  drain_all_rings();
+  if (output_file)
+    export_file();
+  else
+    print_time_info();
+  pthread_mutex_unlock(&perf_lock);
 }
 
-
-static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-int b_output_kernel_perf = 0;
-static struct timeval start, end;
-
-void initialize_env_var()
+static void perf_init(void)
 {
   char *env = getenv("OCL_OUTPUT_KERNEL_PERF");
   if(NULL == env || !strncmp(env,"0", 1))
@@ -306,19 +389,99 @@ void initialize_env_var()
     b_output_kernel_perf = 1;
   else
     b_output_kernel_perf = 2;
+  if (!b_output_kernel_perf)
+    return;
+
+  if ((env = getenv("OCL_KERNEL_PERF_SAMPLE")) != NULL && atoi(env) > 0)
+    sample_period = atoi(env);
+  if ((env = getenv("OCL_KERNEL_PERF_FILE")) != NULL && *env != '\0')
+    output_file = strdup(env);
+  if ((env = getenv("OCL_KERNEL_PERF_FORMAT")) != NULL)
+    output_csv = !strcmp(env, "csv");
+  export_interval_ns = 10 * 1000000000ull;
+  if ((env = getenv("OCL_KERNEL_PERF_INTERVAL")) != NULL)
+    export_interval_ns = (uint64_t)atoi(env) * 1000000000ull;
+  next_export_ns = perf_now_ns() + export_interval_ns;
+  atexit(perf_exit);
+}
+
+void initialize_env_var()
+{
+  pthread_once(&perf_once, perf_init);
 }
 
-void time_start(cl_context context, const char * kernel_name, cl_command_queue cq)
+void time_start(cl_context context, cl_kernel k, uint32_t work_dim,
+                const size_t *global_wk_sz, const size_t *local_wk_sz,
+                cl_command_queue cq)
 {
-  pthread_mutex_lock(&mutex);
-  gettimeofday(&start, NULL);
+  uint32_t i;
+  /* A launch which failed before time_end is simply forgotten */
+  pending.active = 1;
+  pending.sampled = (sample_counter++ % sample_period) == 0;
+  pending.info.work_dim = work_dim;
+  for (i = 0; i < 3; ++i) {
+    pending.info.global_wk_sz[i] = i < work_dim && global_wk_sz ? global_wk_sz[i] : 1;
+    pending.info.local_wk_sz[i] = i < work_dim && local_wk_sz ? local_wk_sz[i] : 1;
+  }
+  pending.info.simd_width = cl_kernel_get_simd_width(k);
+  pending.info.curbe_size = k->curbe_sz;
+  pending.info.scratch_size = interp_kernel_get_scratch_size(k->opaque);
+  /* Drain the queue first: the time of a sampled launch must not include
+   * the launches enqueued before it */
+  if (pending.sampled) {
+    clFinish(cq);
+    pending.start_ns = perf_now_ns();
+  }
 }
 
 void time_end(cl_context context, const char * kernel_name, const char * build_opt, cl_command_queue cq)
 {
-  clFinish(cq);
-  gettimeofday(&end, NULL);
-  float t = (end.tv_sec - start.tv_sec)*1000 + (end.tv_usec - start.tv_usec)/1000.0f;
-  insert(context, kernel_name, build_opt, t);
-  pthread_mutex_unlock(&mutex);
+  perf_record *r;
+  perf_kernel *k;
+  uint64_t time_ns = 0;
+
+  if (!pending.active)
+    return;
+  pending.active = 0;
+  if (pending.sampled) {
+    clFinish(cq);
+    time_ns = perf_now_ns() - pending.start_ns;
+    if (time_ns == 0)
+      time_ns = 1;
+  }
+  if ((k = find_kernel(context, kernel_name, build_opt)) == NULL)
+    return;
+
+  if (thread_ring == NULL) {
+    if ((thread_ring = (perf_ring *)calloc(1, sizeof(perf_ring))) == NULL)
+      return;
+    pthread_mutex_lock(&perf_lock);
+    thread_ring->next = rings;
+    rings = thread_ring;
+    pthread_mutex_unlock(&perf_lock);
+  }
+
+  if (thread_ring->head - thread_ring->tail == PERF_RING_SIZE) {
+    pthread_mutex_lock(&perf_lock);
+    drain_ring(thread_ring);
+    pthread_mutex_unlock(&perf_lock);
+  }
+  r = &thread_ring->records[thread_ring->head % PERF_RING_SIZE];
+  r->kernel = k;
+  r->time_ns = time_ns;
+  r->info = pending.info;
+  __sync_synchronize();
+  thread_ring->head++;
+
+  /* Periodic export, done by whoever gets there first */
+  if (output_file && export_interval_ns && perf_now_ns() >= next_export_ns &&
+      pthread_mutex_trylock(&perf_lock) == 0) {
+    const uint64_t now = perf_now_ns();
+    if (now >= next_export_ns) {
+      next_export_ns = now + export_interval_ns;
+      drain_all_rings();
+      export_file();
+    }
+    pthread_mutex_unlock(&perf_lock);
+  }
 }
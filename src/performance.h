@@ -1,10 +1,15 @@
 #ifndef __PERFORMANCE_H__
 #define __PERFORMANCE_H__
 #include "CL/cl.h"
+#include <stdint.h>
 
 
 extern int b_output_kernel_perf;
-void time_start(cl_context context, const char * kernel_name, cl_command_queue cq);
+/* Remember the launch of kernel k on cq. Only sampled launches are timed */
+void time_start(cl_context context, cl_kernel k, uint32_t work_dim,
+                const size_t *global_wk_sz, const size_t *local_wk_sz,
+                cl_command_queue cq);
+/* Record the launch started by time_start under kernel_name */
 void time_end(cl_context context, const char * kernel_name, const char * build_opt, cl_command_queue cq);
 void initialize_env_var();
 
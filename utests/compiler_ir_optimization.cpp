@@ -0,0 +1,118 @@
+#include "utest_helper.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+
+static const size_t n = 64;
+static const char *passes[] = {
+  "OCL_OPTIMIZE_CONST_FOLD", "OCL_OPTIMIZE_CSE", "OCL_OPTIMIZE_GLOBAL_CSE"
+};
+
+/* Build the kernel, check its results and return its Gen instruction count */
+static uint32_t run(const char *name, int *distance) {
+  cl_kernel_compile_stats_intel stats;
+
+  OCL_CALL(cl_kernel_init, "compiler_ir_optimization.cl", name, SOURCE, NULL);
+  OCL_CREATE_BUFFER(buf[0], 0, n * sizeof(int), NULL);
+  OCL_CREATE_BUFFER(buf[1], 0, n * sizeof(int), NULL);
+  OCL_CREATE_BUFFER(buf[2], 0, n * sizeof(int), NULL);
+  OCL_MAP_BUFFER(0);
+  OCL_MAP_BUFFER(1);
+  OCL_MAP_BUFFER(2);
+  for (uint32_t i = 0; i < n; ++i) {
+    ((int *)buf_data[0])[i] = rand() & 0xfff;
+    ((int *)buf_data[1])[i] = rand() & 0xfff;
+    ((int *)buf_data[2])[i] = -1;
+  }
+  OCL_UNMAP_BUFFER(0);
+  OCL_UNMAP_BUFFER(1);
+  OCL_UNMAP_BUFFER(2);
+  globals[0] = n;
+  locals[0] = 16;
+
+  if (distance) {
+    OCL_SET_ARG(0, sizeof(cl_mem), &buf[0]);
+    OCL_SET_ARG(1, sizeof(cl_mem), &buf[2]);
+    OCL_NDRANGE(1);
+    OCL_MAP_BUFFER(0);
+    OCL_MAP_BUFFER(2);
+    const int *src = (int *)buf_data[0], *dst = (int *)buf_data[2];
+    /* Only the Gen IR knows where the local arrays are, but their distance
+     * is the same for all the work items */
+    for (uint32_t gid = 0; gid < n; ++gid) {
+      const uint32_t base = gid / 16 * 16, lid = gid % 16;
+      const int d = dst[gid] - src[base + 15 - lid] * (src[base + lid] + 1);
+      if (gid == 0)
+        *distance = d;
+      OCL_ASSERT(d == *distance);
+    }
+    OCL_UNMAP_BUFFER(0);
+    OCL_UNMAP_BUFFER(2);
+  } else {
+    OCL_SET_ARG(0, sizeof(cl_mem), &buf[0]);
+    OCL_SET_ARG(1, sizeof(cl_mem), &buf[1]);
+    OCL_SET_ARG(2, sizeof(cl_mem), &buf[2]);
+    OCL_NDRANGE(1);
+    OCL_MAP_BUFFER(0);
+    OCL_MAP_BUFFER(1);
+    OCL_MAP_BUFFER(2);
+    for (uint32_t i = 0; i < n; ++i) {
+      const int x = ((int *)buf_data[0])[i] + ((int *)buf_data[1])[i];
+      OCL_ASSERT(((int *)buf_data[2])[i] == ((x & 1) ? x : -1));
+    }
+    OCL_UNMAP_BUFFER(0);
+    OCL_UNMAP_BUFFER(1);
+    OCL_UNMAP_BUFFER(2);
+  }
+
+  OCL_CALL(clGetKernelWorkGroupInfo, kernel, device, CL_KERNEL_COMPILE_STATS_INTEL,
+           sizeof(stats), &stats, NULL);
+  cl_buffer_destroy();
+  OCL_DESTROY_KERNEL_KEEP_PROGRAM(false);
+  return stats.insn_num;
+}
+
+/* Run this case again in a process started with the pass disabled, and read
+ * back its counts */
+static void run_disabled(const char *disabled, uint32_t *fold, uint32_t *cse, int *distance)
+{
+  char output[64];
+
+  OCL_ASSERT(cl_run_child_case("compiler_ir_optimization", disabled, "0", output, sizeof(output)));
+  OCL_ASSERT(sscanf(output, "%u %u %d", fold, cse, distance) == 3);
+}
+
+/* Each Gen IR pass, toggled with its OCL_OPTIMIZE_* variable, must keep the
+ * results and save instructions on the kernel written for it */
+void compiler_ir_optimization(void)
+{
+  int distance, noFoldDistance, localDistance, noCSEDistance;
+  uint32_t noFold, localCSE, noCSE, unused;
+
+  const uint32_t fold = run("compiler_ir_optimization_fold", &distance);
+  const uint32_t cse = run("compiler_ir_optimization_cse", NULL);
+  if (cl_is_child_case()) {
+    char output[64];
+    snprintf(output, sizeof(output), "%u %u %d", fold, cse, distance);
+    cl_child_case_output(output);
+    return;
+  }
+
+  for (size_t i = 0; i < sizeof(passes) / sizeof(passes[0]); ++i)
+    if (getenv(passes[i]) != NULL) {
+      fprintf(stderr, "%s is set. Ignore this case.\n", passes[i]);
+      return;
+    }
+  run_disabled("OCL_OPTIMIZE_CONST_FOLD", &noFold, &unused, &noFoldDistance);
+  run_disabled("OCL_OPTIMIZE_GLOBAL_CSE", &unused, &localCSE, &localDistance);
+  run_disabled("OCL_OPTIMIZE_CSE", &unused, &noCSE, &noCSEDistance);
+
+  printf(" constant folding %u -> %u, local cse %u -> %u, global cse %u -> %u",
+         noFold, fold, noCSE, localCSE, localCSE, cse);
+  /* The distance of the local arrays is the same for all the builds */
+  OCL_ASSERT(noFoldDistance == distance && localDistance == distance && noCSEDistance == distance);
+  OCL_ASSERT(fold < noFold);
+  OCL_ASSERT(localCSE < noCSE);
+  OCL_ASSERT(cse < localCSE);
+}
+
+MAKE_UTEST_FROM_FUNCTION(compiler_ir_optimization);
@@ -0,0 +1,86 @@
+#include "utest_helper.hpp"
+#include <stdio.h>
+#include <string.h>
+
+static const size_t n = 64;
+static const int iteration_n = 10;
+
+static void pressure(void)
+{
+  OCL_CALL(cl_kernel_init, "compiler_reg_allocator.cl", "compiler_reg_allocator_pressure", SOURCE, NULL);
+  OCL_CREATE_BUFFER(buf[0], 0, n * 32 * sizeof(uint32_t), NULL);
+  OCL_CREATE_BUFFER(buf[1], 0, n * 16 * sizeof(uint32_t), NULL);
+  OCL_MAP_BUFFER(0);
+  for (uint32_t i = 0; i < n * 32; ++i)
+    ((uint32_t *)buf_data[0])[i] = rand();
+  OCL_UNMAP_BUFFER(0);
+  OCL_SET_ARG(0, sizeof(cl_mem), &buf[0]);
+  OCL_SET_ARG(1, sizeof(cl_mem), &buf[1]);
+  OCL_SET_ARG(2, sizeof(int), &iteration_n);
+  globals[0] = n;
+  locals[0] = 16;
+  OCL_NDRANGE(1);
+
+  OCL_MAP_BUFFER(0);
+  OCL_MAP_BUFFER(1);
+  for (uint32_t gid = 0; gid < n; ++gid) {
+    uint32_t a[16], b[16], c[16];
+    memcpy(a, (uint32_t *)buf_data[0] + gid * 32, sizeof(a));
+    memcpy(b, (uint32_t *)buf_data[0] + gid * 32 + 16, sizeof(b));
+    for (int i = 0; i < iteration_n; ++i) {
+      for (int k = 0; k < 16; ++k)
+        c[k] = a[k] * 3u + b[(k + 1) % 16];
+      memcpy(a, c, sizeof(a));
+      for (int k = 0; k < 16; ++k)
+        b[k] = (b[k] ^ 0x5a5au) + a[(k + 15) % 16];
+    }
+    for (int k = 0; k < 16; ++k)
+      OCL_ASSERT(((uint32_t *)buf_data[1])[gid * 16 + k] == (a[k] ^ b[k]));
+  }
+  OCL_UNMAP_BUFFER(0);
+  OCL_UNMAP_BUFFER(1);
+  cl_buffer_destroy();
+  OCL_DESTROY_KERNEL_KEEP_PROGRAM(false);
+}
+
+static void remat(void)
+{
+  OCL_CALL(cl_kernel_init, "compiler_reg_allocator.cl", "compiler_reg_allocator_remat", SOURCE, NULL);
+  OCL_CREATE_BUFFER(buf[0], 0, n * sizeof(uint32_t), NULL);
+  OCL_SET_ARG(0, sizeof(cl_mem), &buf[0]);
+  OCL_SET_ARG(1, sizeof(int), &iteration_n);
+  globals[0] = n;
+  locals[0] = 16;
+  OCL_NDRANGE(1);
+
+  OCL_MAP_BUFFER(0);
+  for (uint32_t gid = 0; gid < n; ++gid) {
+    uint32_t x = gid;
+    for (int i = 0; i < iteration_n; ++i)
+      x = ((x + i) & 1) ? x * 0x1234u + 0x5678u : (x ^ 0x9abcu) - 0xdefu;
+    OCL_ASSERT(((uint32_t *)buf_data[0])[gid] == x);
+  }
+  OCL_UNMAP_BUFFER(0);
+  cl_buffer_destroy();
+  OCL_DESTROY_KERNEL_KEEP_PROGRAM(false);
+}
+
+/* The kernels must give the same results with both register allocators.
+ * OCL_REG_ALLOCATOR is read when the backend is loaded: unless it is set,
+ * the case runs again in a process for each allocator */
+void compiler_reg_allocator(void)
+{
+  char output[64];
+
+  if (getenv("OCL_REG_ALLOCATOR") != NULL) {
+    pressure();
+    remat();
+    if (cl_is_child_case())
+      cl_child_case_output("done");
+    return;
+  }
+  OCL_ASSERT(cl_run_child_case("compiler_reg_allocator", "OCL_REG_ALLOCATOR", "0", output, sizeof(output)));
+  OCL_ASSERT(cl_run_child_case("compiler_reg_allocator", "OCL_REG_ALLOCATOR", "1", output, sizeof(output)));
+}
+
+MAKE_UTEST_FROM_FUNCTION(compiler_reg_allocator);
@@ -0,0 +1,46 @@
+#include "utest_helper.hpp"
+
+void compiler_uniform_phi(void)
+{
+  const size_t n = 64;
+  const int count = 13;
+
+  // Setup kernel and buffers
+  OCL_CREATE_KERNEL("compiler_uniform_phi");
+  OCL_CREATE_BUFFER(buf[0], 0, n * sizeof(uint32_t), NULL);
+  OCL_CREATE_BUFFER(buf[1], 0, n * sizeof(uint32_t), NULL);
+  OCL_SET_ARG(0, sizeof(cl_mem), &buf[0]);
+  OCL_SET_ARG(1, sizeof(cl_mem), &buf[1]);
+  OCL_SET_ARG(2, sizeof(int), &count);
+  OCL_MAP_BUFFER(0);
+  for (uint32_t i = 0; i < n; ++i)
+    ((uint32_t*)buf_data[0])[i] = rand();
+  OCL_UNMAP_BUFFER(0);
+
+  // Run the kernel
+  globals[0] = n;
+  locals[0] = 16;
+  OCL_NDRANGE(1);
+  OCL_MAP_BUFFER(0);
+  OCL_MAP_BUFFER(1);
+
+  // Check results
+  const uint32_t *src = (uint32_t*)buf_data[0];
+  uint32_t acc = 0, step = 1;
+  for (int i = 0; i < count; ++i) {
+    acc += src[i] * step;
+    step = step * 3 + i;
+  }
+  for (uint32_t gid = 0; gid < n; ++gid) {
+    const uint32_t lid = gid % 16;
+    uint32_t x = acc;
+    for (uint32_t i = 0; i < (lid & 3); ++i)
+      x = x * 2 + step;
+    const uint32_t y = (lid & 4) ? step : acc;
+    OCL_ASSERT(((uint32_t*)buf_data[1])[gid] == x + y);
+  }
+  OCL_UNMAP_BUFFER(0);
+  OCL_UNMAP_BUFFER(1);
+}
+
+MAKE_UTEST_FROM_FUNCTION(compiler_uniform_phi);
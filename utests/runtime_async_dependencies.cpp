@@ -0,0 +1,81 @@
+#include "utest_helper.hpp"
+#include <unistd.h>
+
+static const size_t n = 1024;
+static volatile int completed_n;
+
+static void CL_CALLBACK count_completed(cl_event ev, cl_int status, void *user_data)
+{
+  if (status == CL_COMPLETE)
+    __sync_fetch_and_add(&completed_n, 1);
+}
+
+static void copy(cl_mem src, cl_mem dst, cl_uint wait_n, const cl_event *wait_list, cl_event *ev)
+{
+  OCL_SET_ARG(0, sizeof(cl_mem), &src);
+  OCL_SET_ARG(1, sizeof(cl_mem), &dst);
+  OCL_CALL(clEnqueueNDRangeKernel, queue, kernel, 1, NULL, globals, locals, wait_n, wait_list, ev);
+}
+
+/* A launch waiting for a launch still running returns at once and the event
+ * dispatcher submits it later: the in-order queue must still run the
+ * launches in order and the callbacks must all be called */
+void runtime_async_dependencies(void)
+{
+  float a[n], d[n];
+  cl_event ev[3];
+  cl_int status;
+
+  for (size_t i = 0; i < n; ++i) {
+    a[i] = i;
+    d[i] = -1.f - i;
+  }
+  OCL_CREATE_KERNEL("test_copy_buffer");
+  OCL_CREATE_BUFFER(buf[0], CL_MEM_COPY_HOST_PTR, sizeof(a), a);
+  OCL_CREATE_BUFFER(buf[1], 0, sizeof(a), NULL);
+  OCL_CREATE_BUFFER(buf[2], 0, sizeof(a), NULL);
+  OCL_CREATE_BUFFER(buf[3], CL_MEM_COPY_HOST_PTR, sizeof(d), d);
+  globals[0] = n;
+  locals[0] = 16;
+  completed_n = 0;
+
+  copy(buf[0], buf[1], 0, NULL, &ev[0]);
+  OCL_CALL(clSetEventCallback, ev[0], CL_COMPLETE, count_completed, NULL);
+  copy(buf[1], buf[2], 1, &ev[0], &ev[1]);
+  OCL_CALL(clSetEventCallback, ev[1], CL_COMPLETE, count_completed, NULL);
+  // Without wait list, but behind the previous launches of the queue
+  copy(buf[3], buf[1], 0, NULL, NULL);
+  copy(buf[2], buf[0], 1, &ev[1], &ev[2]);
+
+  OCL_CALL(clWaitForEvents, 3, ev);
+  for (int i = 0; i < 3; ++i) {
+    OCL_CALL(clGetEventInfo, ev[i], CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+    OCL_ASSERT(status == CL_COMPLETE);
+  }
+  // The event dispatcher may still be calling the callbacks
+  for (int i = 0; i < 1000 && completed_n < 2; ++i)
+    usleep(1000);
+  OCL_ASSERT(completed_n == 2);
+  OCL_FINISH();
+
+  float result[n];
+  OCL_CALL(clEnqueueReadBuffer, queue, buf[2], CL_TRUE, 0, sizeof(result), result, 0, NULL, NULL);
+  for (size_t i = 0; i < n; ++i)
+    OCL_ASSERT(result[i] == a[i]);
+  OCL_CALL(clEnqueueReadBuffer, queue, buf[1], CL_TRUE, 0, sizeof(result), result, 0, NULL, NULL);
+  for (size_t i = 0; i < n; ++i)
+    OCL_ASSERT(result[i] == d[i]);
+
+  // A blocking read waiting for a launch sees its result
+  cl_event last;
+  copy(buf[3], buf[2], 1, &ev[2], &last);
+  OCL_CALL(clEnqueueReadBuffer, queue, buf[2], CL_TRUE, 0, sizeof(result), result, 1, &last, NULL);
+  for (size_t i = 0; i < n; ++i)
+    OCL_ASSERT(result[i] == d[i]);
+
+  OCL_CALL(clReleaseEvent, last);
+  for (int i = 0; i < 3; ++i)
+    OCL_CALL(clReleaseEvent, ev[i]);
+}
+
+MAKE_UTEST_FROM_FUNCTION(runtime_async_dependencies);
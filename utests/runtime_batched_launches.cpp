@@ -0,0 +1,209 @@
+#include "utest_helper.hpp"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+static const size_t threads = 256;
+
+static uint32_t expected(uint32_t value, uint32_t first, uint32_t last)
+{
+  for (uint32_t step = first; step < last; ++step)
+    value = value * 3 + step;
+  return value;
+}
+
+/* Each launch depends on the previous one, so the launches recorded in one
+ * batch buffer must run in order and all of them before the buffer is read */
+void runtime_batched_launches(void)
+{
+  const uint32_t launch_n = 40;
+  cl_event ev;
+  uint32_t step;
+
+  OCL_CREATE_KERNEL("runtime_batched_launches");
+  OCL_CREATE_BUFFER(buf[0], 0, threads * sizeof(uint32_t), NULL);
+  OCL_SET_ARG(0, sizeof(cl_mem), &buf[0]);
+  globals[0] = threads;
+  locals[0] = 16;
+
+  OCL_MAP_BUFFER(0);
+  for (uint32_t i = 0; i < threads; ++i)
+    ((uint32_t *)buf_data[0])[i] = i;
+  OCL_UNMAP_BUFFER(0);
+
+  // More launches than one batch holds, read back by the map extension
+  for (step = 0; step < launch_n; ++step) {
+    OCL_SET_ARG(1, sizeof(uint32_t), &step);
+    OCL_NDRANGE(1);
+  }
+  OCL_MAP_BUFFER(0);
+  for (uint32_t i = 0; i < threads; ++i)
+    OCL_ASSERT(((uint32_t *)buf_data[0])[i] == expected(i, 0, launch_n));
+  OCL_UNMAP_BUFFER(0);
+
+  // A launch with an event in the middle of a batch
+  for (step = 0; step < launch_n; ++step) {
+    OCL_SET_ARG(1, sizeof(uint32_t), &step);
+    if (step == launch_n / 2) {
+      OCL_CALL(clEnqueueNDRangeKernel, queue, kernel, 1, NULL, globals, locals, 0, NULL, &ev);
+      OCL_CALL(clWaitForEvents, 1, &ev);
+      OCL_CALL(clReleaseEvent, ev);
+    } else
+      OCL_NDRANGE(1);
+  }
+  OCL_FLUSH();
+  OCL_FINISH();
+
+  // Read back through the queue
+  uint32_t result[threads];
+  OCL_CALL(clEnqueueReadBuffer, queue, buf[0], CL_TRUE, 0, sizeof(result), result, 0, NULL, NULL);
+  for (uint32_t i = 0; i < threads; ++i)
+    OCL_ASSERT(result[i] == expected(expected(i, 0, launch_n), 0, launch_n));
+}
+
+MAKE_UTEST_FROM_FUNCTION(runtime_batched_launches);
+
+/* The launches another thread batched on the queue, and which the null
+ * driver prints when their batch is flushed */
+static const int round_n = 5;
+static pthread_barrier_t round_barrier;
+static cl_command_queue thread_queue;
+static cl_kernel thread_kernel;
+
+/* Returns non NULL on failure: the assertions only work in the main thread */
+static void *batch_thread(void *arg)
+{
+  size_t global = 64, local = 16;
+  cl_int err = CL_SUCCESS;
+
+  for (int round = 0; round < round_n; ++round) {
+    for (int i = 0; i < round + 2 && err == CL_SUCCESS; ++i)
+      err = clEnqueueNDRangeKernel(thread_queue, thread_kernel, 1, NULL, &global, &local,
+                                   0, NULL, NULL);
+    pthread_barrier_wait(&round_barrier);  // Batched
+    pthread_barrier_wait(&round_barrier);  // Submitted by the main thread
+  }
+  return err == CL_SUCCESS ? NULL : (void *)1;
+}
+
+/* Walkers of each batch the null driver printed so far */
+static std::vector<unsigned> read_batches(const char *path)
+{
+  std::vector<unsigned> walkers;
+  char line[512];
+  unsigned n;
+  int index;
+  FILE *file = fopen(path, "r");
+
+  while (file && fgets(line, sizeof(line), file))
+    if (sscanf(line, "[null driver] batch %d: %u walker(s)", &index, &n) == 2)
+      walkers.push_back(n);
+  if (file)
+    fclose(file);
+  return walkers;
+}
+
+/* A flush, a finish, a marker, a barrier and a command the CPU runs must all
+ * submit the launches another thread batched on the queue, whole */
+void runtime_batched_launches_threads(void)
+{
+  const char *src =
+    "kernel void runtime_batched_launches_threads(global int *dst) {\n"
+    "  dst[get_global_id(0)] += 1;\n"
+    "}\n";
+  const char *limit = getenv("OCL_BATCH_KERNEL_NUM");
+  const char *dump = getenv("OCL_NULL_DRIVER_DUMP");
+  char *saved_dump = dump ? strdup(dump) : NULL;
+  char path[] = "/tmp/beignet_batchesXXXXXX";
+  std::vector<unsigned> walkers[round_n];
+  cl_int status, read_status = CL_SUCCESS;
+  cl_event marker;
+  int result[64];
+  void *ret;
+
+  if (getenv("OCL_NULL_DRIVER") == NULL || (limit != NULL && atoi(limit) <= round_n + 1)) {
+    fprintf(stderr, "OCL_NULL_DRIVER is not set or OCL_BATCH_KERNEL_NUM is too small. Ignore this case.\n");
+    free(saved_dump);
+    return;
+  }
+
+  /* A context of its own: the driver reads OCL_NULL_DRIVER_DUMP when it is
+   * created */
+  setenv("OCL_NULL_DRIVER_DUMP", "1", 1);
+  cl_context thread_ctx = clCreateContext(NULL, 1, &device, NULL, NULL, &status);
+  if (saved_dump)
+    setenv("OCL_NULL_DRIVER_DUMP", saved_dump, 1);
+  else
+    unsetenv("OCL_NULL_DRIVER_DUMP");
+  free(saved_dump);
+  OCL_ASSERT(status == CL_SUCCESS);
+  thread_queue = clCreateCommandQueue(thread_ctx, device, 0, &status);
+  OCL_ASSERT(status == CL_SUCCESS);
+  cl_program prog = clCreateProgramWithSource(thread_ctx, 1, &src, NULL, &status);
+  OCL_ASSERT(status == CL_SUCCESS);
+  OCL_CALL(clBuildProgram, prog, 1, &device, NULL, NULL, NULL);
+  thread_kernel = clCreateKernel(prog, "runtime_batched_launches_threads", &status);
+  OCL_ASSERT(status == CL_SUCCESS);
+  cl_mem dst = clCreateBuffer(thread_ctx, 0, sizeof(result), NULL, &status);
+  OCL_ASSERT(status == CL_SUCCESS);
+  OCL_CALL(clSetKernelArg, thread_kernel, 0, sizeof(cl_mem), &dst);
+
+  /* The dump goes to a file until the context is released */
+  int fd = mkstemp(path);
+  OCL_ASSERT(fd >= 0);
+  fflush(stderr);
+  const int saved_stderr = dup(2);
+  dup2(fd, 2);
+  close(fd);
+
+  pthread_t id;
+  pthread_barrier_init(&round_barrier, NULL, 2);
+  if (pthread_create(&id, NULL, batch_thread, NULL) != 0) {
+    dup2(saved_stderr, 2);
+    OCL_ASSERT(0);
+  }
+  for (int round = 0; round < round_n; ++round) {
+    pthread_barrier_wait(&round_barrier);
+    switch (round) {
+      case 0: clFlush(thread_queue); break;
+      case 1: clFinish(thread_queue); break;
+      case 2:
+        clEnqueueMarkerWithWaitList(thread_queue, 0, NULL, &marker);
+        clReleaseEvent(marker);
+        break;
+      case 3: clEnqueueBarrierWithWaitList(thread_queue, 0, NULL, NULL); break;
+      default:
+        read_status = clEnqueueReadBuffer(thread_queue, dst, CL_TRUE, 0, sizeof(result),
+                                          result, 0, NULL, NULL);
+        break;
+    }
+    walkers[round] = read_batches(path);
+    pthread_barrier_wait(&round_barrier);
+  }
+  pthread_join(id, &ret);
+  pthread_barrier_destroy(&round_barrier);
+
+  clReleaseMemObject(dst);
+  clReleaseKernel(thread_kernel);
+  clReleaseProgram(prog);
+  clReleaseCommandQueue(thread_queue);
+  clReleaseContext(thread_ctx);
+  fflush(stderr);
+  dup2(saved_stderr, 2);
+  close(saved_stderr);
+  unlink(path);
+
+  OCL_ASSERT(ret == NULL);
+  OCL_ASSERT(read_status == CL_SUCCESS);
+  /* One batch per round, flushed by the main thread, with all the launches
+   * of the round */
+  for (int round = 0; round < round_n; ++round) {
+    OCL_ASSERT(walkers[round].size() == (size_t)round + 1);
+    OCL_ASSERT(walkers[round][round] == (unsigned)round + 2);
+  }
+}
+
+MAKE_UTEST_FROM_FUNCTION(runtime_batched_launches_threads);
@@ -0,0 +1,101 @@
+#include "utest_helper.hpp"
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+
+/* The binary cache (OCL_BINARY_CACHE_DIR) must hit on a rebuild of the same
+ * program, and miss as soon as the options or an included header change:
+ * reusing the binary of a stale header would silently run old code */
+
+static std::string cache_header_dir;
+
+static void write_header(int value)
+{
+  const std::string path = cache_header_dir + "/runtime_binary_cache.h";
+  FILE *file = fopen(path.c_str(), "w");
+  OCL_ASSERT(file != NULL);
+  fprintf(file, "#define CACHE_VALUE %d\n", value);
+  fclose(file);
+}
+
+static void get_cache_stats(cl_ulong stats[2])
+{
+  OCL_CALL(clGetProgramBuildInfo, program, device, CL_PROGRAM_BINARY_CACHE_STATS_INTEL,
+           2 * sizeof(cl_ulong), stats, NULL);
+}
+
+/* Build the source, check the cache counters moved as expected and run the
+ * kernel */
+static void build_and_check(const std::string &src, const std::string &options,
+                            cl_ulong hits, cl_ulong misses, int expected)
+{
+  const char *str = src.c_str();
+  cl_ulong before[2], after[2];
+  cl_int status;
+
+  get_cache_stats(before);
+  cl_program prog = clCreateProgramWithSource(ctx, 1, &str, NULL, &status);
+  OCL_ASSERT(status == CL_SUCCESS);
+  OCL_CALL(clBuildProgram, prog, 1, &device, options.c_str(), NULL, NULL);
+  get_cache_stats(after);
+  OCL_ASSERT(after[0] - before[0] == hits);
+  OCL_ASSERT(after[1] - before[1] == misses);
+
+  cl_kernel k = clCreateKernel(prog, "runtime_binary_cache", &status);
+  OCL_ASSERT(status == CL_SUCCESS);
+  OCL_CALL(clSetKernelArg, k, 0, sizeof(cl_mem), &buf[0]);
+  size_t global = 16, local = 16;
+  OCL_CALL(clEnqueueNDRangeKernel, queue, k, 1, NULL, &global, &local, 0, NULL, NULL);
+  OCL_MAP_BUFFER(0);
+  for (int i = 0; i < 16; ++i)
+    OCL_ASSERT(((int *)buf_data[0])[i] == expected + i);
+  OCL_UNMAP_BUFFER(0);
+  clReleaseKernel(k);
+  clReleaseProgram(prog);
+}
+
+void runtime_binary_cache(void)
+{
+  cl_ulong stats[2];
+  char dir[] = "/tmp/beignet_cache_hdrXXXXXX";
+
+  /* Any program answers the query */
+  OCL_CREATE_KERNEL("compiler_ceil");
+  if (clGetProgramBuildInfo(program, device, CL_PROGRAM_BINARY_CACHE_STATS_INTEL,
+                            sizeof(stats), stats, NULL) != CL_SUCCESS ||
+      getenv("OCL_BINARY_CACHE_DIR") == NULL) {
+    fprintf(stderr, "OCL_BINARY_CACHE_DIR is not set. Ignore this case.\n");
+    return;
+  }
+  OCL_ASSERT(mkdtemp(dir) != NULL);
+  cache_header_dir = dir;
+  OCL_CREATE_BUFFER(buf[0], 0, 16 * sizeof(int), NULL);
+
+  /* A source no earlier run can have cached */
+  char salt[64];
+  snprintf(salt, sizeof(salt), "/* %d %ld */\n", (int)getpid(), (long)time(NULL));
+  const std::string src = std::string(salt) +
+    "#include \"runtime_binary_cache.h\"\n"
+    "kernel void runtime_binary_cache(global int *dst) {\n"
+    "  dst[get_global_id(0)] = CACHE_VALUE + get_global_id(0);\n"
+    "}\n";
+  const std::string options = "-I " + cache_header_dir;
+
+  write_header(1);
+  build_and_check(src, options, 0, 1, 1);
+  /* Same source, options and header */
+  build_and_check(src, options, 1, 0, 1);
+  /* Other options */
+  build_and_check(src, options + " -DCACHE_UNUSED", 0, 1, 1);
+  /* Other header: the stale entry must not be used */
+  write_header(2);
+  build_and_check(src, options, 0, 1, 2);
+  build_and_check(src, options, 1, 0, 2);
+
+  unlink((cache_header_dir + "/runtime_binary_cache.h").c_str());
+  rmdir(dir);
+}
+
+MAKE_UTEST_FROM_FUNCTION(runtime_binary_cache);
@@ -0,0 +1,93 @@
+#include "utest_helper.hpp"
+#include "utest_file_map.hpp"
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <cstring>
+
+/* Build several programs from many threads at once. Each thread builds every
+ * source a few times and checks that it gets exactly the binary a plain
+ * single threaded build produced. */
+
+static const char *concurrent_sources[] = {
+  "compiler_mandelbrot.cl",
+  "compiler_box_blur_float.cl",
+  "compiler_long_div.cl",
+  "compiler_math.cl",
+  "compiler_switch.cl",
+  "compiler_ceil.cl",
+};
+static const int concurrent_source_n = sizeof(concurrent_sources) / sizeof(concurrent_sources[0]);
+static const int concurrent_thread_n = 8;
+static const int concurrent_iter_n = 4;
+
+static std::vector<std::string> concurrent_src;
+static std::vector<std::string> concurrent_ref;
+
+static bool build_and_get_binary(const std::string &src, std::string &bin)
+{
+  const char *str = src.c_str();
+  const size_t sz = src.size();
+  cl_int status;
+  cl_program prog = clCreateProgramWithSource(ctx, 1, &str, &sz, &status);
+  if (status != CL_SUCCESS)
+    return false;
+  status = clBuildProgram(prog, 1, &device, NULL, NULL, NULL);
+  size_t bin_sz = 0;
+  if (status == CL_SUCCESS)
+    status = clGetProgramInfo(prog, CL_PROGRAM_BINARY_SIZES, sizeof(bin_sz), &bin_sz, NULL);
+  if (status == CL_SUCCESS && bin_sz != 0) {
+    bin.resize(bin_sz);
+    unsigned char *ptr = (unsigned char *) &bin[0];
+    status = clGetProgramInfo(prog, CL_PROGRAM_BINARIES, sizeof(ptr), &ptr, NULL);
+  }
+  clReleaseProgram(prog);
+  return status == CL_SUCCESS && bin_sz != 0;
+}
+
+static void *concurrent_build_thread(void *arg)
+{
+  const long id = (long) arg;
+  for (int iter = 0; iter < concurrent_iter_n; ++iter)
+    for (int i = 0; i < concurrent_source_n; ++i) {
+      /* Different threads start on different sources */
+      const int src = (i + id) % concurrent_source_n;
+      std::string bin;
+      if (!build_and_get_binary(concurrent_src[src], bin))
+        return (void *) 1;
+      if (bin != concurrent_ref[src])
+        return (void *) 2;
+    }
+  return NULL;
+}
+
+static void runtime_concurrent_build(void)
+{
+  concurrent_src.resize(concurrent_source_n);
+  concurrent_ref.resize(concurrent_source_n);
+
+  for (int i = 0; i < concurrent_source_n; ++i) {
+    char *ker_path = cl_do_kiss_path(concurrent_sources[i], device);
+    cl_file_map_t *fm = cl_file_map_new();
+    OCL_ASSERT(cl_file_map_open(fm, ker_path) == CL_FILE_MAP_SUCCESS);
+    concurrent_src[i].assign(cl_file_map_begin(fm), cl_file_map_size(fm));
+    cl_file_map_delete(fm);
+    free(ker_path);
+    OCL_ASSERT(build_and_get_binary(concurrent_src[i], concurrent_ref[i]));
+  }
+
+  pthread_t threads[concurrent_thread_n];
+  for (long t = 0; t < concurrent_thread_n; ++t)
+    OCL_ASSERT(pthread_create(&threads[t], NULL, concurrent_build_thread, (void *) t) == 0);
+
+  int failed = 0;
+  for (int t = 0; t < concurrent_thread_n; ++t) {
+    void *ret = NULL;
+    pthread_join(threads[t], &ret);
+    if (ret != NULL)
+      failed++;
+  }
+  OCL_ASSERT(failed == 0);
+}
+
+MAKE_UTEST_FROM_FUNCTION(runtime_concurrent_build);
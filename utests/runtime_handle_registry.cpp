@@ -0,0 +1,102 @@
+#include "utest_helper.hpp"
+#include <pthread.h>
+
+/* The buffers, samplers and events given as kernel arguments or in a wait
+ * list are checked against the objects of the context: threads creating and
+ * releasing them at the same time must never see a live object rejected, and
+ * a released one must be rejected without being read */
+
+static const int thread_n = 8, iteration_n = 200;
+static const char *source =
+  "kernel void runtime_handle_registry(global int *dst, read_only image2d_t img, sampler_t s) {\n"
+  "  dst[get_global_id(0)] = read_imagei(img, s, (int2)(0, 0)).x;\n"
+  "}\n";
+static cl_program registry_program;
+static pthread_barrier_t start_barrier;
+
+/* Returns non NULL on failure: the assertions only work in the main thread */
+static void *create_release_thread(void *arg)
+{
+  cl_int err = CL_SUCCESS;
+  cl_kernel k = clCreateKernel(registry_program, "runtime_handle_registry", &err);
+
+  pthread_barrier_wait(&start_barrier);
+  for (int i = 0; i < iteration_n && err == CL_SUCCESS; ++i) {
+    cl_mem mem = clCreateBuffer(ctx, 0, 64 * sizeof(int), NULL, &err);
+    if (err != CL_SUCCESS)
+      break;
+    err = clSetKernelArg(k, 0, sizeof(cl_mem), &mem);
+    clReleaseMemObject(mem);
+    if (err != CL_SUCCESS)
+      break;
+
+    cl_sampler s = clCreateSampler(ctx, CL_FALSE, CL_ADDRESS_CLAMP, CL_FILTER_NEAREST, &err);
+    if (err != CL_SUCCESS)
+      break;
+    err = clSetKernelArg(k, 2, sizeof(cl_sampler), &s);
+    clReleaseSampler(s);
+    if (err != CL_SUCCESS)
+      break;
+
+    cl_event user = clCreateUserEvent(ctx, &err), marker = NULL;
+    if (err != CL_SUCCESS)
+      break;
+    err = clSetUserEventStatus(user, CL_COMPLETE);
+    if (err == CL_SUCCESS)
+      err = clEnqueueMarkerWithWaitList(queue, 1, &user, &marker);
+    if (err == CL_SUCCESS)
+      err = clWaitForEvents(1, &marker);
+    if (marker != NULL)
+      clReleaseEvent(marker);
+    clReleaseEvent(user);
+  }
+  if (k != NULL)
+    clReleaseKernel(k);
+  return err == CL_SUCCESS ? NULL : (void *)1;
+}
+
+void runtime_handle_registry(void)
+{
+  pthread_t threads[thread_n];
+  cl_int status;
+
+  registry_program = clCreateProgramWithSource(ctx, 1, &source, NULL, &status);
+  OCL_ASSERT(status == CL_SUCCESS);
+  OCL_CALL(clBuildProgram, registry_program, 1, &device, NULL, NULL, NULL);
+
+  pthread_barrier_init(&start_barrier, NULL, thread_n);
+  for (int t = 0; t < thread_n; ++t)
+    OCL_ASSERT(pthread_create(&threads[t], NULL, create_release_thread, NULL) == 0);
+  int failed = 0;
+  for (int t = 0; t < thread_n; ++t) {
+    void *ret;
+    pthread_join(threads[t], &ret);
+    failed += ret != NULL;
+  }
+  pthread_barrier_destroy(&start_barrier);
+  OCL_ASSERT(failed == 0);
+
+  /* Released handles, with no object created since */
+  cl_kernel k = clCreateKernel(registry_program, "runtime_handle_registry", &status);
+  OCL_ASSERT(status == CL_SUCCESS);
+  cl_mem mem = clCreateBuffer(ctx, 0, 64 * sizeof(int), NULL, &status);
+  OCL_ASSERT(status == CL_SUCCESS);
+  OCL_CALL(clReleaseMemObject, mem);
+  OCL_ASSERT(clSetKernelArg(k, 0, sizeof(cl_mem), &mem) == CL_INVALID_MEM_OBJECT);
+
+  cl_sampler s = clCreateSampler(ctx, CL_FALSE, CL_ADDRESS_CLAMP, CL_FILTER_NEAREST, &status);
+  OCL_ASSERT(status == CL_SUCCESS);
+  OCL_CALL(clReleaseSampler, s);
+  OCL_ASSERT(clSetKernelArg(k, 2, sizeof(cl_sampler), &s) == CL_INVALID_SAMPLER);
+
+  cl_event user = clCreateUserEvent(ctx, &status);
+  OCL_ASSERT(status == CL_SUCCESS);
+  OCL_CALL(clSetUserEventStatus, user, CL_COMPLETE);
+  OCL_CALL(clReleaseEvent, user);
+  OCL_ASSERT(clEnqueueMarkerWithWaitList(queue, 1, &user, NULL) == CL_INVALID_EVENT_WAIT_LIST);
+
+  OCL_CALL(clReleaseKernel, k);
+  OCL_CALL(clReleaseProgram, registry_program);
+}
+
+MAKE_UTEST_FROM_FUNCTION(runtime_handle_registry);
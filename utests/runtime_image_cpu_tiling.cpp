@@ -0,0 +1,104 @@
+#include "utest_helper.hpp"
+#include <string.h>
+
+static const size_t w = 2000, h = 1100;
+
+static uint32_t pattern(size_t x, size_t y, uint32_t seed)
+{
+  return (uint32_t)(x * 2654435761u) ^ (uint32_t)(y * 40503u) ^ seed;
+}
+
+/* What the GPU sees of the image */
+static void check_gpu(cl_mem image, const uint32_t *expected)
+{
+  size_t origin[3] = {0, 0, 0}, region[3] = {w, h, 1};
+  cl_mem copy;
+
+  OCL_CREATE_BUFFER(copy, 0, w * h * sizeof(uint32_t), NULL);
+  OCL_CALL(clEnqueueCopyImageToBuffer, queue, image, copy, origin, region, 0, 0, NULL, NULL);
+  uint32_t *result = (uint32_t *)clEnqueueMapBuffer(queue, copy, CL_TRUE, CL_MAP_READ, 0,
+                                                    w * h * sizeof(uint32_t), 0, NULL, NULL, NULL);
+  OCL_ASSERT(result != NULL);
+  OCL_ASSERT(memcmp(result, expected, w * h * sizeof(uint32_t)) == 0);
+  OCL_CALL(clEnqueueUnmapMemObject, queue, copy, result, 0, NULL, NULL);
+  OCL_CALL(clReleaseMemObject, copy);
+}
+
+/* The CPU reads and writes the tiled images through a cached mapping: the
+ * GPU, the GTT mapping and the CPU must all see the same pixels, whatever
+ * the alignment of the regions */
+void runtime_image_cpu_tiling(void)
+{
+  cl_image_format format;
+  cl_image_desc desc;
+  size_t origin[3], region[3], row_pitch, slice_pitch;
+  uint32_t *data = (uint32_t *)malloc(w * h * sizeof(uint32_t));
+  uint32_t *sub = (uint32_t *)malloc(w * h * sizeof(uint32_t));
+
+  memset(&format, 0, sizeof(format));
+  memset(&desc, 0, sizeof(desc));
+  format.image_channel_order = CL_RGBA;
+  format.image_channel_data_type = CL_UNSIGNED_INT8;
+  desc.image_type = CL_MEM_OBJECT_IMAGE2D;
+  desc.image_width = w;
+  desc.image_height = h;
+  OCL_CREATE_IMAGE(buf[0], 0, &format, &desc, NULL);
+
+  // Large enough to be split between threads
+  for (size_t y = 0; y < h; ++y)
+    for (size_t x = 0; x < w; ++x)
+      data[y * w + x] = pattern(x, y, 0);
+  origin[0] = origin[1] = origin[2] = 0;
+  region[0] = w; region[1] = h; region[2] = 1;
+  OCL_WRITE_IMAGE(buf[0], origin, region, data);
+  check_gpu(buf[0], data);
+
+  // Unaligned region with a row pitch larger than its rows
+  origin[0] = 3; origin[1] = 5;
+  region[0] = 997; region[1] = 301;
+  row_pitch = (region[0] + 13) * sizeof(uint32_t);
+  for (size_t y = 0; y < region[1]; ++y)
+    for (size_t x = 0; x < region[0]; ++x) {
+      sub[y * (region[0] + 13) + x] = pattern(x, y, 0xdeadbeef);
+      data[(origin[1] + y) * w + origin[0] + x] = pattern(x, y, 0xdeadbeef);
+    }
+  OCL_CALL(clEnqueueWriteImage, queue, buf[0], CL_TRUE, origin, region, row_pitch, 0, sub, 0, NULL, NULL);
+  check_gpu(buf[0], data);
+
+  origin[0] = 7; origin[1] = 9;
+  region[0] = 1501; region[1] = 777;
+  OCL_READ_IMAGE(buf[0], origin, region, sub);
+  for (size_t y = 0; y < region[1]; ++y)
+    for (size_t x = 0; x < region[0]; ++x)
+      OCL_ASSERT(sub[y * region[0] + x] == data[(origin[1] + y) * w + origin[0] + x]);
+
+  // Mapped through the GTT
+  uint32_t *mapped = (uint32_t *)clEnqueueMapImage(queue, buf[0], CL_TRUE, CL_MAP_READ, origin, region,
+                                                   &row_pitch, &slice_pitch, 0, NULL, NULL, NULL);
+  OCL_ASSERT(mapped != NULL);
+  for (size_t y = 0; y < region[1]; ++y)
+    for (size_t x = 0; x < region[0]; ++x)
+      OCL_ASSERT(mapped[y * row_pitch / sizeof(uint32_t) + x] == data[(origin[1] + y) * w + origin[0] + x]);
+  OCL_CALL(clEnqueueUnmapMemObject, queue, buf[0], mapped, 0, NULL, NULL);
+
+  // The copy of an image using the host memory goes back on unmap
+  OCL_CREATE_IMAGE(buf[1], CL_MEM_USE_HOST_PTR, &format, &desc, data);
+  check_gpu(buf[1], data);
+  origin[0] = 11; origin[1] = 13;
+  region[0] = 555; region[1] = 333;
+  mapped = (uint32_t *)clEnqueueMapImage(queue, buf[1], CL_TRUE, CL_MAP_WRITE, origin, region,
+                                         &row_pitch, &slice_pitch, 0, NULL, NULL, NULL);
+  OCL_ASSERT(mapped == data + origin[1] * w + origin[0]);
+  for (size_t y = 0; y < region[1]; ++y)
+    for (size_t x = 0; x < region[0]; ++x)
+      mapped[y * row_pitch / sizeof(uint32_t) + x] = pattern(x, y, 0x1234567);
+  OCL_CALL(clEnqueueUnmapMemObject, queue, buf[1], mapped, 0, NULL, NULL);
+  check_gpu(buf[1], data);
+
+  OCL_CALL(clReleaseMemObject, buf[1]);
+  buf[1] = NULL;
+  free(sub);
+  free(data);
+}
+
+MAKE_UTEST_FROM_FUNCTION(runtime_image_cpu_tiling);
@@ -0,0 +1,36 @@
+#include "utest_helper.hpp"
+#include <string.h>
+
+void runtime_kernel_compile_stats(void)
+{
+  cl_kernel_compile_stats_intel stats;
+  size_t size = 0;
+
+  OCL_CREATE_KERNEL("compiler_fabs");
+
+  OCL_CALL(clGetKernelWorkGroupInfo, kernel, device, CL_KERNEL_COMPILE_STATS_INTEL,
+           0, NULL, &size);
+  OCL_ASSERT(size == sizeof(stats));
+  OCL_CALL(clGetKernelWorkGroupInfo, kernel, device, CL_KERNEL_COMPILE_STATS_INTEL,
+           sizeof(stats), &stats, NULL);
+  OCL_ASSERT(stats.simd_width == 8 || stats.simd_width == 16);
+  OCL_ASSERT(stats.attempts >= 1);
+  OCL_ASSERT(stats.insn_num > 0);
+  OCL_ASSERT(stats.compacted_insn_num <= stats.insn_num);
+  OCL_ASSERT(stats.grf_num > 0 && stats.grf_num <= 128);
+  OCL_ASSERT(stats.spill_num == 0 && stats.fill_num == 0);
+  OCL_ASSERT(stats.total_time >= stats.selection_time + stats.reg_alloc_time);
+
+  OCL_CALL(clGetKernelWorkGroupInfo, kernel, device, CL_KERNEL_COMPILE_STATS_JSON_INTEL,
+           0, NULL, &size);
+  OCL_ASSERT(size > 1);
+  char *json = (char *) malloc(size);
+  OCL_CALL(clGetKernelWorkGroupInfo, kernel, device, CL_KERNEL_COMPILE_STATS_JSON_INTEL,
+           size, json, NULL);
+  OCL_ASSERT(strlen(json) == size - 1);
+  OCL_ASSERT(json[0] == '{' && json[size - 2] == '}');
+  OCL_ASSERT(strstr(json, "\"kernel\":\"compiler_fabs\"") != NULL);
+  free(json);
+}
+
+MAKE_UTEST_FROM_FUNCTION(runtime_kernel_compile_stats);
@@ -0,0 +1,122 @@
+#include "utest_helper.hpp"
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+
+static const size_t threads = 64;
+
+/* Check the results of the last launch and return the Gen instructions of
+ * the code it ran. The results are also copied to out if given */
+static uint32_t check(int n, float scale, float *out = NULL)
+{
+  cl_kernel_compile_stats_intel stats;
+
+  OCL_MAP_BUFFER(0);
+  OCL_MAP_BUFFER(1);
+  for (uint32_t gid = 0; gid < threads; ++gid) {
+    float sum = 0.f;
+    for (int i = 0; i < n; ++i)
+      sum += ((float *)buf_data[0])[gid * 8 + i] * scale;
+    OCL_ASSERT(fabsf(((float *)buf_data[1])[gid] - sum) <= 1e-3f * fabsf(sum) + 1e-5f);
+  }
+  if (out)
+    memcpy(out, buf_data[1], threads * sizeof(float));
+  OCL_UNMAP_BUFFER(0);
+  OCL_UNMAP_BUFFER(1);
+
+  OCL_CALL(clGetKernelWorkGroupInfo, kernel, device, CL_KERNEL_COMPILE_STATS_INTEL,
+           sizeof(stats), &stats, NULL);
+  return stats.insn_num;
+}
+
+static uint32_t run_and_check(int n, float scale, float *out = NULL)
+{
+  OCL_NDRANGE(1);
+  return check(n, scale, out);
+}
+
+/* Returns non NULL on failure: the assertions only work in the main thread */
+static void *launch_thread(void *arg)
+{
+  cl_int err = CL_SUCCESS;
+  for (int i = 0; i < 32 && err == CL_SUCCESS; ++i)
+    err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, globals, locals, 0, NULL, NULL);
+  return err == CL_SUCCESS ? NULL : (void *)1;
+}
+
+/* The kernel must compute the same results whether its arguments are folded
+ * in the code or read from the curbe, when switching from one to the other */
+void runtime_kernel_specialization(void)
+{
+  float generic[threads], specialized[threads];
+  int n = 8;
+  float scale = 0.5f;
+
+  OCL_CREATE_KERNEL("runtime_kernel_specialization");
+  OCL_CREATE_BUFFER(buf[0], 0, threads * 8 * sizeof(float), NULL);
+  OCL_CREATE_BUFFER(buf[1], 0, threads * sizeof(float), NULL);
+  OCL_SET_ARG(0, sizeof(cl_mem), &buf[0]);
+  OCL_SET_ARG(1, sizeof(cl_mem), &buf[1]);
+  OCL_SET_ARG(2, sizeof(int), &n);
+  OCL_SET_ARG(3, sizeof(float), &scale);
+  globals[0] = threads;
+  locals[0] = 16;
+
+  OCL_MAP_BUFFER(0);
+  for (uint32_t i = 0; i < threads * 8; ++i)
+    ((float *)buf_data[0])[i] = (float)(rand() & 0xff) / 16.f;
+  OCL_UNMAP_BUFFER(0);
+
+  // Generic code
+  run_and_check(n, scale);
+  scale = 2.f;
+  OCL_SET_ARG(3, sizeof(float), &scale);
+  const uint32_t generic_insn = run_and_check(n, scale, generic);
+
+  // Both scalars folded: the loop is unrolled in another code computing the
+  // same values
+  OCL_CALL(clSetKernelArgConstantIntel, kernel, 2, sizeof(int), &n);
+  OCL_CALL(clSetKernelArgConstantIntel, kernel, 3, sizeof(float), &scale);
+  const uint32_t specialized_insn = run_and_check(n, scale, specialized);
+  OCL_ASSERT(generic_insn > 0 && specialized_insn > 0);
+  OCL_ASSERT(specialized_insn != generic_insn);
+  for (uint32_t gid = 0; gid < threads; ++gid)
+    OCL_ASSERT(fabsf(specialized[gid] - generic[gid]) <= 1e-5f * fabsf(generic[gid]));
+
+  // Another trip count gives another variant
+  n = 3;
+  OCL_CALL(clSetKernelArgConstantIntel, kernel, 2, sizeof(int), &n);
+  run_and_check(n, scale);
+
+  // Launches from several threads: one of them switches to the code of the
+  // new trip count while the others launch the kernel
+  n = 6;
+  OCL_CALL(clSetKernelArgConstantIntel, kernel, 2, sizeof(int), &n);
+  pthread_t ids[4];
+  for (int t = 0; t < 4; ++t)
+    OCL_ASSERT(pthread_create(&ids[t], NULL, launch_thread, NULL) == 0);
+  int failed = 0;
+  for (int t = 0; t < 4; ++t) {
+    void *ret;
+    pthread_join(ids[t], &ret);
+    failed += ret != NULL;
+  }
+  OCL_ASSERT(failed == 0);
+  OCL_FINISH();
+  check(n, scale);
+
+  // The trip count is a regular argument again
+  n = 5;
+  OCL_SET_ARG(2, sizeof(int), &n);
+  run_and_check(n, scale);
+
+  // Back to the generic code
+  scale = 0.25f;
+  OCL_SET_ARG(3, sizeof(float), &scale);
+  OCL_ASSERT(run_and_check(n, scale) == generic_insn);
+
+  // Only scalar arguments can be folded
+  OCL_ASSERT(clSetKernelArgConstantIntel(kernel, 0, sizeof(cl_mem), &buf[0]) == CL_INVALID_ARG_VALUE);
+}
+
+MAKE_UTEST_FROM_FUNCTION(runtime_kernel_specialization);
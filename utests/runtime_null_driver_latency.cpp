@@ -0,0 +1,117 @@
+#include "utest_helper.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* With OCL_NULL_DRIVER_EVENT_LATENCY, the commands of the null driver
+ * complete this long after their flush: the events must be running until
+ * then, and waiting for them, finishing the queue, the callbacks, the
+ * profiling and the dependent commands must all see the latency */
+
+static const long latency_us = 100000;
+static volatile uint64_t callback_time;
+
+static uint64_t now_us(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void CL_CALLBACK record_completion(cl_event ev, cl_int status, void *user_data)
+{
+  if (status == CL_COMPLETE)
+    callback_time = now_us();
+}
+
+void runtime_null_driver_latency(void)
+{
+  const char *src =
+    "kernel void runtime_null_driver_latency(global int *dst) {\n"
+    "  dst[get_global_id(0)] = get_global_id(0);\n"
+    "}\n";
+  const char *env = getenv("OCL_NULL_DRIVER_EVENT_LATENCY");
+  char *saved_latency = env ? strdup(env) : NULL;
+  char latency[32];
+  size_t global = 64, local = 16;
+  cl_event ev[2];
+  cl_ulong start, end;
+  cl_int status;
+
+  if (getenv("OCL_NULL_DRIVER") == NULL) {
+    fprintf(stderr, "OCL_NULL_DRIVER is not set. Ignore this case.\n");
+    free(saved_latency);
+    return;
+  }
+
+  /* A context of its own: the driver reads OCL_NULL_DRIVER_EVENT_LATENCY
+   * when it is created */
+  snprintf(latency, sizeof(latency), "%ld", latency_us);
+  setenv("OCL_NULL_DRIVER_EVENT_LATENCY", latency, 1);
+  cl_context latency_ctx = clCreateContext(NULL, 1, &device, NULL, NULL, &status);
+  if (saved_latency)
+    setenv("OCL_NULL_DRIVER_EVENT_LATENCY", saved_latency, 1);
+  else
+    unsetenv("OCL_NULL_DRIVER_EVENT_LATENCY");
+  free(saved_latency);
+  OCL_ASSERT(status == CL_SUCCESS);
+  cl_command_queue latency_queue = clCreateCommandQueue(latency_ctx, device, CL_QUEUE_PROFILING_ENABLE, &status);
+  OCL_ASSERT(status == CL_SUCCESS);
+  cl_program prog = clCreateProgramWithSource(latency_ctx, 1, &src, NULL, &status);
+  OCL_ASSERT(status == CL_SUCCESS);
+  OCL_CALL(clBuildProgram, prog, 1, &device, NULL, NULL, NULL);
+  cl_kernel k = clCreateKernel(prog, "runtime_null_driver_latency", &status);
+  OCL_ASSERT(status == CL_SUCCESS);
+  cl_mem dst = clCreateBuffer(latency_ctx, 0, global * sizeof(int), NULL, &status);
+  OCL_ASSERT(status == CL_SUCCESS);
+  OCL_CALL(clSetKernelArg, k, 0, sizeof(cl_mem), &dst);
+
+  // Running until the latency elapsed, then complete after a wait
+  callback_time = 0;
+  uint64_t before = now_us();
+  OCL_CALL(clEnqueueNDRangeKernel, latency_queue, k, 1, NULL, &global, &local, 0, NULL, &ev[0]);
+  OCL_CALL(clSetEventCallback, ev[0], CL_COMPLETE, record_completion, NULL);
+  OCL_CALL(clFlush, latency_queue);
+  OCL_CALL(clGetEventInfo, ev[0], CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+  OCL_ASSERT(status != CL_COMPLETE);
+  OCL_CALL(clWaitForEvents, 1, &ev[0]);
+  OCL_ASSERT(now_us() - before >= (uint64_t)latency_us);
+  OCL_CALL(clGetEventInfo, ev[0], CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+  OCL_ASSERT(status == CL_COMPLETE);
+
+  // The callback may run in the event dispatcher, after the wait returned
+  for (int i = 0; i < 1000 && callback_time == 0; ++i)
+    usleep(1000);
+  OCL_ASSERT(callback_time != 0 && callback_time - before >= (uint64_t)latency_us);
+
+  // The profiling reports the latency as the execution time
+  OCL_CALL(clGetEventProfilingInfo, ev[0], CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL);
+  OCL_CALL(clGetEventProfilingInfo, ev[0], CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL);
+  OCL_ASSERT(end - start >= (cl_ulong)latency_us * 1000);
+  OCL_CALL(clReleaseEvent, ev[0]);
+
+  // A finish waits for the latency too
+  before = now_us();
+  OCL_CALL(clEnqueueNDRangeKernel, latency_queue, k, 1, NULL, &global, &local, 0, NULL, NULL);
+  OCL_CALL(clFinish, latency_queue);
+  OCL_ASSERT(now_us() - before >= (uint64_t)latency_us);
+
+  // A command waiting for another one is only flushed once it completed
+  before = now_us();
+  OCL_CALL(clEnqueueNDRangeKernel, latency_queue, k, 1, NULL, &global, &local, 0, NULL, &ev[0]);
+  OCL_CALL(clFlush, latency_queue);
+  OCL_CALL(clEnqueueNDRangeKernel, latency_queue, k, 1, NULL, &global, &local, 1, &ev[0], &ev[1]);
+  OCL_CALL(clWaitForEvents, 2, ev);
+  OCL_ASSERT(now_us() - before >= 2 * (uint64_t)latency_us);
+  OCL_CALL(clReleaseEvent, ev[0]);
+  OCL_CALL(clReleaseEvent, ev[1]);
+
+  OCL_CALL(clReleaseMemObject, dst);
+  OCL_CALL(clReleaseKernel, k);
+  OCL_CALL(clReleaseProgram, prog);
+  OCL_CALL(clReleaseCommandQueue, latency_queue);
+  OCL_CALL(clReleaseContext, latency_ctx);
+}
+
+MAKE_UTEST_FROM_FUNCTION(runtime_null_driver_latency);
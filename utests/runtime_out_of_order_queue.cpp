@@ -0,0 +1,88 @@
+#include "utest_helper.hpp"
+
+static const size_t n = 1024;
+
+static void copy(cl_command_queue q, cl_mem src, cl_mem dst, cl_uint wait_n, const cl_event *wait_list, cl_event *ev)
+{
+  OCL_SET_ARG(0, sizeof(cl_mem), &src);
+  OCL_SET_ARG(1, sizeof(cl_mem), &dst);
+  OCL_CALL(clEnqueueNDRangeKernel, q, kernel, 1, NULL, globals, locals, wait_n, wait_list, ev);
+}
+
+static void check(cl_mem mem, const float *expected)
+{
+  float result[n];
+  OCL_CALL(clEnqueueReadBuffer, queue, mem, CL_TRUE, 0, sizeof(result), result, 0, NULL, NULL);
+  for (size_t i = 0; i < n; ++i)
+    OCL_ASSERT(result[i] == expected[i]);
+}
+
+/* The commands of an out-of-order queue run as soon as their wait list
+ * completes, but still after the commands not run yet which write what they
+ * access or access what they write */
+void runtime_out_of_order_queue(void)
+{
+  cl_command_queue_properties props;
+  cl_command_queue ooo;
+  cl_event gate, ev[2];
+  cl_int status, err;
+  float a[n], b[n], c[n];
+
+  OCL_CALL(clGetDeviceInfo, device, CL_DEVICE_QUEUE_PROPERTIES, sizeof(props), &props, NULL);
+  OCL_ASSERT(props & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+  ooo = clCreateCommandQueue(ctx, device, CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE, &err);
+  OCL_ASSERT(err == CL_SUCCESS);
+
+  for (size_t i = 0; i < n; ++i) {
+    a[i] = i;
+    b[i] = -1.f - i;
+    c[i] = 2.f * i;
+  }
+  OCL_CREATE_KERNEL("test_copy_buffer");
+  OCL_CREATE_BUFFER(buf[0], CL_MEM_COPY_HOST_PTR, sizeof(a), a);
+  OCL_CREATE_BUFFER(buf[1], 0, sizeof(a), NULL);
+  OCL_CREATE_BUFFER(buf[2], 0, sizeof(a), NULL);
+  OCL_CREATE_BUFFER(buf[3], CL_MEM_COPY_HOST_PTR, sizeof(b), b);
+  OCL_CREATE_BUFFER(buf[4], 0, sizeof(b), NULL);
+  OCL_CREATE_BUFFER(buf[5], CL_MEM_COPY_HOST_PTR, sizeof(c), c);
+  globals[0] = n;
+  locals[0] = 16;
+
+  // Held back until the gate opens
+  gate = clCreateUserEvent(ctx, &err);
+  OCL_ASSERT(err == CL_SUCCESS);
+  copy(ooo, buf[0], buf[1], 1, &gate, NULL);
+  // Reads what the held command writes
+  copy(ooo, buf[1], buf[2], 0, NULL, NULL);
+  // Writes what the held command reads
+  copy(ooo, buf[5], buf[0], 0, NULL, NULL);
+  // Independent: runs right away
+  copy(ooo, buf[3], buf[4], 0, NULL, &ev[0]);
+  OCL_CALL(clWaitForEvents, 1, &ev[0]);
+  OCL_CALL(clGetEventInfo, ev[0], CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+  OCL_ASSERT(status == CL_COMPLETE);
+
+  OCL_CALL(clSetUserEventStatus, gate, CL_COMPLETE);
+  OCL_CALL(clFinish, ooo);
+  check(buf[1], a);
+  check(buf[2], a);
+  check(buf[0], c);
+  check(buf[4], b);
+
+  // Launches batched together, only the dependent one flushes the caches
+  copy(ooo, buf[3], buf[1], 0, NULL, NULL);
+  copy(ooo, buf[5], buf[2], 0, NULL, NULL);
+  copy(ooo, buf[1], buf[4], 0, NULL, NULL);
+  copy(ooo, buf[2], buf[0], 0, NULL, &ev[1]);
+  OCL_CALL(clWaitForEvents, 1, &ev[1]);
+  OCL_CALL(clFinish, ooo);
+  check(buf[4], b);
+  check(buf[0], c);
+
+  OCL_CALL(clReleaseEvent, ev[1]);
+  OCL_CALL(clReleaseEvent, ev[0]);
+  OCL_CALL(clReleaseEvent, gate);
+  OCL_CALL(clReleaseCommandQueue, ooo);
+}
+
+MAKE_UTEST_FROM_FUNCTION(runtime_out_of_order_queue);
@@ -0,0 +1,126 @@
+#include "utest_helper.hpp"
+#include <vector>
+
+static const int buffer_n = 64;
+static const size_t float_n = 16; // 64 byte buffers, carved out of shared slabs
+
+static float value(int buffer, size_t i, int round)
+{
+  return buffer * 1000.f + i + round * 0.5f;
+}
+
+static void copy_buffers(cl_mem *src, cl_mem *dst, int n)
+{
+  for (int i = 0; i < n; ++i) {
+    OCL_SET_ARG(0, sizeof(cl_mem), &src[i]);
+    OCL_SET_ARG(1, sizeof(cl_mem), &dst[i]);
+    OCL_NDRANGE(1);
+  }
+}
+
+static void check_buffer(cl_mem mem, int buffer, int round)
+{
+  float data[float_n];
+  OCL_CALL(clEnqueueReadBuffer, queue, mem, CL_TRUE, 0, sizeof(data), data, 0, NULL, NULL);
+  for (size_t i = 0; i < float_n; ++i)
+    OCL_ASSERT(data[i] == value(buffer, i, round));
+}
+
+/* Small buffers share buffer objects: the kernels, the reads and the maps
+ * must all reach the right bytes, and a released buffer must not hand its
+ * memory to a new one while a kernel still writes it */
+void runtime_small_buffers(void)
+{
+  cl_mem src[buffer_n], dst[buffer_n];
+  float data[float_n];
+  cl_int status;
+
+  OCL_CREATE_KERNEL("test_copy_buffer");
+  globals[0] = float_n;
+  locals[0] = 16;
+
+  for (int round = 0; round < 2; ++round) {
+    for (int i = 0; i < buffer_n; ++i) {
+      for (size_t j = 0; j < float_n; ++j)
+        data[j] = value(i, j, round);
+      src[i] = clCreateBuffer(ctx, CL_MEM_COPY_HOST_PTR, sizeof(data), data, &status);
+      OCL_ASSERT(status == CL_SUCCESS);
+      dst[i] = clCreateBuffer(ctx, 0, sizeof(data), NULL, &status);
+      OCL_ASSERT(status == CL_SUCCESS);
+    }
+    copy_buffers(src, dst, buffer_n);
+
+    // Released while the copies may still be pending
+    for (int i = 0; i < buffer_n; ++i)
+      OCL_CALL(clReleaseMemObject, src[i]);
+    for (int i = 0; i < buffer_n; ++i)
+      check_buffer(dst[i], i, round);
+
+    float *ptr = (float *)clEnqueueMapBuffer(queue, dst[buffer_n - 1], CL_TRUE, CL_MAP_READ,
+                                             0, sizeof(data), 0, NULL, NULL, &status);
+    OCL_ASSERT(status == CL_SUCCESS);
+    for (size_t j = 0; j < float_n; ++j)
+      OCL_ASSERT(ptr[j] == value(buffer_n - 1, j, round));
+    OCL_CALL(clEnqueueUnmapMemObject, queue, dst[buffer_n - 1], ptr, 0, NULL, NULL);
+
+    for (int i = 0; i < buffer_n; ++i)
+      OCL_CALL(clReleaseMemObject, dst[i]);
+  }
+
+  // Sub-buffer of a small buffer
+  float whole[4 * float_n];
+  cl_buffer_region region = { 2 * sizeof(data), sizeof(data) };
+  for (size_t j = 0; j < 4 * float_n; ++j)
+    whole[j] = -1.f;
+  dst[0] = clCreateBuffer(ctx, CL_MEM_COPY_HOST_PTR, sizeof(whole), whole, &status);
+  OCL_ASSERT(status == CL_SUCCESS);
+  dst[1] = clCreateSubBuffer(dst[0], 0, CL_BUFFER_CREATE_TYPE_REGION, &region, &status);
+  OCL_ASSERT(status == CL_SUCCESS);
+  for (size_t j = 0; j < float_n; ++j)
+    data[j] = value(7, j, 0);
+  src[0] = clCreateBuffer(ctx, CL_MEM_COPY_HOST_PTR, sizeof(data), data, &status);
+  OCL_ASSERT(status == CL_SUCCESS);
+  copy_buffers(src, dst + 1, 1);
+  check_buffer(dst[1], 7, 0);
+  OCL_CALL(clEnqueueReadBuffer, queue, dst[0], CL_TRUE, 0, sizeof(whole), whole, 0, NULL, NULL);
+  for (size_t j = 0; j < 4 * float_n; ++j)
+    OCL_ASSERT(whole[j] == (j / float_n == 2 ? value(7, j % float_n, 0) : -1.f));
+  OCL_CALL(clReleaseMemObject, src[0]);
+  OCL_CALL(clReleaseMemObject, dst[1]);
+  OCL_CALL(clReleaseMemObject, dst[0]);
+
+  // Released while its copy waits for a user event: its chunk must not be
+  // handed out before the copy ran, even once the slabs are full
+  const int filler_n = 1100;
+  std::vector<cl_mem> fillers(filler_n);
+  cl_event user = clCreateUserEvent(ctx, &status);
+  OCL_ASSERT(status == CL_SUCCESS);
+  for (size_t j = 0; j < float_n; ++j)
+    data[j] = value(3, j, 0);
+  src[0] = clCreateBuffer(ctx, CL_MEM_COPY_HOST_PTR, sizeof(data), data, &status);
+  OCL_ASSERT(status == CL_SUCCESS);
+  dst[0] = clCreateBuffer(ctx, 0, sizeof(data), NULL, &status);
+  OCL_ASSERT(status == CL_SUCCESS);
+  OCL_SET_ARG(0, sizeof(cl_mem), &src[0]);
+  OCL_SET_ARG(1, sizeof(cl_mem), &dst[0]);
+  OCL_CALL(clEnqueueNDRangeKernel, queue, kernel, 1, NULL, globals, locals, 1, &user, NULL);
+  // The kernel holds a reference on its arguments
+  OCL_SET_ARG(1, sizeof(cl_mem), &src[0]);
+  OCL_CALL(clReleaseMemObject, dst[0]);
+  for (size_t j = 0; j < float_n; ++j)
+    data[j] = value(5, j, 1);
+  for (int i = 0; i < filler_n; ++i) {
+    fillers[i] = clCreateBuffer(ctx, CL_MEM_COPY_HOST_PTR, sizeof(data), data, &status);
+    OCL_ASSERT(status == CL_SUCCESS);
+  }
+  OCL_CALL(clSetUserEventStatus, user, CL_COMPLETE);
+  OCL_FINISH();
+  for (int i = 0; i < filler_n; ++i) {
+    check_buffer(fillers[i], 5, 1);
+    OCL_CALL(clReleaseMemObject, fillers[i]);
+  }
+  OCL_CALL(clReleaseMemObject, src[0]);
+  OCL_CALL(clReleaseEvent, user);
+}
+
+MAKE_UTEST_FROM_FUNCTION(runtime_small_buffers);
@@ -0,0 +1,76 @@
+#include "utest_helper.hpp"
+#include <pthread.h>
+#include <string.h>
+
+static const size_t w = 64, h = 16;
+static const size_t thread_local_sz[4] = {8, 16, 32, 64};
+
+/* Every work item writes its own global ID, computed from the local IDs of
+ * the thread curbes */
+static void check(int base)
+{
+  OCL_MAP_BUFFER(0);
+  for (uint32_t i = 0; i < w * h; ++i)
+    OCL_ASSERT(((int *)buf_data[0])[i] == base + (int)i);
+  OCL_UNMAP_BUFFER(0);
+}
+
+static void run_and_check(size_t dim, size_t local_x, size_t local_y, int base)
+{
+  OCL_MAP_BUFFER(0);
+  memset(buf_data[0], 0xff, w * h * sizeof(int));
+  OCL_UNMAP_BUFFER(0);
+  OCL_SET_ARG(1, sizeof(int), &base);
+  globals[0] = dim == 1 ? w * h : w;
+  globals[1] = h;
+  locals[0] = local_x;
+  locals[1] = local_y;
+  OCL_NDRANGE(dim);
+  check(base);
+}
+
+/* Returns non NULL on failure: the assertions only work in the main thread */
+static void *launch_thread(void *arg)
+{
+  const size_t global = w * h, local = *(const size_t *)arg;
+  cl_int err = CL_SUCCESS;
+  for (int i = 0; i < 32 && err == CL_SUCCESS; ++i)
+    err = clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global, &local, 0, NULL, NULL);
+  return err == CL_SUCCESS ? NULL : (void *)1;
+}
+
+/* The thread curbes of the last launch are reused when the work group shape
+ * is the same, patched when an argument changes and rebuilt otherwise. Other
+ * threads launching the same kernel with other shapes must not see them
+ * half built */
+void runtime_thread_curbes(void)
+{
+  OCL_CREATE_KERNEL("runtime_thread_curbes");
+  OCL_CREATE_BUFFER(buf[0], 0, w * h * sizeof(int), NULL);
+  OCL_SET_ARG(0, sizeof(cl_mem), &buf[0]);
+
+  run_and_check(1, 16, 1, 0);
+  // Same shape, another argument
+  run_and_check(1, 16, 1, 7);
+  // Other shapes
+  run_and_check(1, 32, 1, 7);
+  run_and_check(2, 8, 4, 3);
+  run_and_check(2, 16, 2, 3);
+  run_and_check(1, 16, 1, 5);
+
+  // Several threads, one shape each
+  pthread_t ids[4];
+  for (int t = 0; t < 4; ++t)
+    OCL_ASSERT(pthread_create(&ids[t], NULL, launch_thread, (void *)&thread_local_sz[t]) == 0);
+  int failed = 0;
+  for (int t = 0; t < 4; ++t) {
+    void *ret;
+    pthread_join(ids[t], &ret);
+    failed += ret != NULL;
+  }
+  OCL_ASSERT(failed == 0);
+  OCL_FINISH();
+  check(5);
+}
+
+MAKE_UTEST_FROM_FUNCTION(runtime_thread_curbes);
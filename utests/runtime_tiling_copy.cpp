@@ -0,0 +1,142 @@
+#include "utest_helper.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+extern "C" {
+#include "cl_tiling.h"
+}
+
+/* The copies of the runtime between the tiled surfaces and linear memory,
+ * checked on the host alone against the copy done one byte at a time: the
+ * vectorized copy splits the rows at the tile and swizzle boundaries, the
+ * large regions between threads and bypass the caches */
+
+static const cl_buffer_swizzle swizzles[] = {
+  CL_SWIZZLE_NONE, CL_SWIZZLE_9, CL_SWIZZLE_9_10, CL_SWIZZLE_9_11, CL_SWIZZLE_9_10_11
+};
+
+static void fill(std::vector<char> &data)
+{
+  for (size_t i = 0; i < data.size(); ++i)
+    data[i] = (char)rand();
+}
+
+/* Copy the region in both directions with cl_tiling_copy and
+ * cl_tiling_copy_scalar: the tiled surfaces, and the linear copies with the
+ * bytes between their rows, must end the same */
+static void check_region(cl_image_tiling_t tiling, cl_buffer_swizzle swizzle, size_t pitch,
+                         size_t x, size_t y, size_t w, size_t h, size_t d,
+                         size_t row_rows, size_t slice_rows,
+                         size_t linear_row_pitch, size_t linear_slice_pitch)
+{
+  const size_t tile_h = tiling == CL_TILE_X ? 8 : 32;
+  const size_t rows = y + (d - 1) * slice_rows + (h - 1) * row_rows + 1;
+  std::vector<char> tiled(pitch * ((rows + tile_h - 1) / tile_h * tile_h));
+  std::vector<char> linear((d - 1) * linear_slice_pitch + (h - 1) * linear_row_pitch + w);
+  cl_tiled_region region;
+
+  OCL_ASSERT(cl_tiling_supported(tiling, swizzle, pitch) && x + w <= pitch);
+  region.pitch = pitch;
+  region.tiling = tiling;
+  region.swizzle = swizzle;
+  region.x = x;
+  region.y = y;
+  region.w = w;
+  region.h = h;
+  region.d = d;
+  region.row_rows = row_rows;
+  region.slice_rows = slice_rows;
+  region.linear_row_pitch = linear_row_pitch;
+  region.linear_slice_pitch = linear_slice_pitch;
+
+  // To the tiled surface
+  fill(tiled);
+  fill(linear);
+  std::vector<char> reference(tiled);
+  region.linear = &linear[0];
+  region.tiled = &tiled[0];
+  cl_tiling_copy(&region, CL_TRUE);
+  region.tiled = &reference[0];
+  cl_tiling_copy_scalar(&region, CL_TRUE);
+  OCL_ASSERT(memcmp(&tiled[0], &reference[0], tiled.size()) == 0);
+
+  // From the tiled surface
+  fill(tiled);
+  fill(linear);
+  std::vector<char> linear_reference(linear);
+  region.tiled = &tiled[0];
+  region.linear = &linear[0];
+  cl_tiling_copy(&region, CL_FALSE);
+  region.linear = &linear_reference[0];
+  cl_tiling_copy_scalar(&region, CL_FALSE);
+  OCL_ASSERT(memcmp(&linear[0], &linear_reference[0], linear.size()) == 0);
+}
+
+/* A pitch a tile wider than the bytes, rarely a power of two */
+static size_t pitch_for(size_t bytes, size_t tile_w)
+{
+  return (bytes + tile_w - 1) / tile_w * tile_w + tile_w;
+}
+
+/* cl_tiling_offset must map the surface onto itself, and match the layout of
+ * the tiles */
+static void check_offsets(cl_image_tiling_t tiling, cl_buffer_swizzle swizzle, size_t pitch)
+{
+  const size_t rows = 64;
+  std::vector<char> seen(pitch * rows, 0);
+
+  for (size_t y = 0; y < rows; ++y)
+    for (size_t x = 0; x < pitch; ++x) {
+      const size_t offset = cl_tiling_offset(tiling, swizzle, pitch, x, y);
+      OCL_ASSERT(offset < seen.size() && !seen[offset]);
+      seen[offset] = 1;
+    }
+}
+
+void runtime_tiling_copy(void)
+{
+  const cl_image_tiling_t tilings[] = {CL_TILE_X, CL_TILE_Y};
+
+  // What the CPU can copy
+  OCL_ASSERT(!cl_tiling_supported(CL_NO_TILE, CL_SWIZZLE_NONE, 4096));
+  OCL_ASSERT(!cl_tiling_supported(CL_TILE_X, CL_SWIZZLE_NONE, 512 + 128));
+  OCL_ASSERT(cl_tiling_supported(CL_TILE_Y, CL_SWIZZLE_NONE, 512 + 128));
+  OCL_ASSERT(!cl_tiling_supported(CL_TILE_Y, CL_SWIZZLE_NONE, 128 + 16));
+  OCL_ASSERT(!cl_tiling_supported(CL_TILE_X, CL_SWIZZLE_UNSUPPORTED, 4096));
+
+  // Second row of the second X tile, and its bit 6 swizzled with the bit 9
+  OCL_ASSERT(cl_tiling_offset(CL_TILE_X, CL_SWIZZLE_NONE, 1024, 512, 1) == 4096 + 512);
+  OCL_ASSERT(cl_tiling_offset(CL_TILE_X, CL_SWIZZLE_9, 1024, 512, 1) == 4096 + 512 + 64);
+  // Second row of the second column of a Y tile
+  OCL_ASSERT(cl_tiling_offset(CL_TILE_Y, CL_SWIZZLE_NONE, 256, 16, 1) == 16 * 32 + 16);
+
+  srand(1);
+  for (size_t t = 0; t < sizeof(tilings) / sizeof(tilings[0]); ++t)
+    for (size_t s = 0; s < sizeof(swizzles) / sizeof(swizzles[0]); ++s) {
+      const cl_image_tiling_t tiling = tilings[t];
+      const cl_buffer_swizzle swizzle = swizzles[s];
+      const size_t tile_w = tiling == CL_TILE_X ? 512 : 128;
+
+      check_offsets(tiling, swizzle, 3 * tile_w);
+      // Whole surface, with a pitch not a power of two
+      check_region(tiling, swizzle, 3 * tile_w, 0, 0, 3 * tile_w, 64, 1, 1, 0, 3 * tile_w, 0);
+      // Unaligned regions and linear pitches
+      check_region(tiling, swizzle, 3 * tile_w, 1, 1, 1, 1, 1, 1, 0, 1, 0);
+      check_region(tiling, swizzle, pitch_for(3 + 997, tile_w), 3, 5, 997, 301, 1, 1, 0, 997 + 13, 0);
+      check_region(tiling, swizzle, pitch_for(61 + 67, tile_w), 61, 7, 67, 33, 1, 1, 0, 67 + 5, 0);
+      check_region(tiling, swizzle, 3 * tile_w, tile_w - 1, 31, tile_w + 2, 9, 1, 1, 0, tile_w + 3, 0);
+      // Slices of a 3D image, and the rows of a 1D array going to slices
+      check_region(tiling, swizzle, pitch_for(17 + 333, tile_w), 17, 3, 333, 21, 3, 1, 37,
+                   333 + 7, (333 + 7) * 21 + 11);
+      check_region(tiling, swizzle, pitch_for(9 + 555, tile_w), 9, 2, 555, 1, 19, 0, 1, 555 + 1, 555 + 1);
+    }
+
+  // Large enough for the threads and the stores bypassing the caches
+  for (size_t t = 0; t < sizeof(tilings) / sizeof(tilings[0]); ++t) {
+    check_region(tilings[t], CL_SWIZZLE_NONE, 4096, 3, 5, 4093, 2101, 1, 1, 0, 4093 + 3, 0);
+    check_region(tilings[t], CL_SWIZZLE_9_10_11, 4096 + 512, 3, 5, 4093, 2101, 1, 1, 0, 4093 + 3, 0);
+  }
+}
+
+MAKE_UTEST_FROM_FUNCTION(runtime_tiling_copy);
@@ -105,6 +105,11 @@ struct UTest
   static void __ANON__##FN##__(void) { BENCHMARK(FN()); } \
   static const UTest __##FN##__(__ANON__##FN##__, #FN, true);
 
+/*! Same as above for benchmarks which do not measure a bandwidth */
+#define MAKE_BENCHMARK_FROM_FUNCTION_WITH_UNIT(FN, UNIT) \
+  static void __ANON__##FN##__(void) { BENCHMARK_WITH_UNIT(FN(), UNIT); } \
+  static const UTest __##FN##__(__ANON__##FN##__, #FN, true);
+
 
 /*! No assert is expected */
 #define UTEST_EXPECT_SUCCESS(EXPR) \
@@ -134,12 +139,14 @@ struct UTest
     } \
   } while (0)
 
-#define BENCHMARK(EXPR) \
+#define BENCHMARK(EXPR) BENCHMARK_WITH_UNIT(EXPR, "GB/S")
+
+#define BENCHMARK_WITH_UNIT(EXPR, UNIT) \
  do { \
     double ret = 0;\
     try { \
       ret = EXPR; \
-      std::cout << "    [Result: " << std::fixed<< std::setprecision(3) << ret << " GB/S]    [SUCCESS]" << std::endl; \
+      std::cout << "    [Result: " << std::fixed<< std::setprecision(3) << ret << " " << UNIT << "]    [SUCCESS]" << std::endl; \
       UTest::retStatistics.passCount += 1; \
     } \
     catch (Exception e) { \
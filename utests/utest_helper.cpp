@@ -28,6 +28,8 @@
 #include <cstring>
 #include <cassert>
 #include <cmath>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #define FATAL(...) \
 do { \
@@ -702,3 +704,53 @@ double time_subtract(struct timeval *y, struct timeval *x, struct timeval *resul
   double msec = 1000.0*(y->tv_sec - x->tv_sec) + (y->tv_usec - x->tv_usec)/1000.0;
   return msec;
 }
+
+/* Where the child case writes its line, removed by the parent */
+static const char *child_output_var = "UTEST_CHILD_CASE_OUTPUT";
+
+bool cl_run_child_case(const char *case_name, const char *var, const char *value,
+                       char *output, size_t size)
+{
+  char path[] = "/tmp/utest_child_case_XXXXXX";
+  const int fd = mkstemp(path);
+  int status = -1;
+
+  if (fd < 0)
+    return false;
+  close(fd);
+  const pid_t pid = fork();
+  if (pid == 0) {
+    setenv(var, value, 1);
+    setenv(child_output_var, path, 1);
+    execl("/proc/self/exe", "utest_run", "-c", case_name, (char *)NULL);
+    _exit(127);
+  }
+  if (pid < 0 || waitpid(pid, &status, 0) != pid) {
+    unlink(path);
+    return false;
+  }
+
+  // The assertions of the case are caught in the child: only a written line
+  // tells it reached its end
+  FILE *file = fopen(path, "r");
+  bool done = false;
+  if (file != NULL) {
+    done = fgets(output, size, file) != NULL;
+    fclose(file);
+  }
+  unlink(path);
+  return done && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+bool cl_is_child_case(void)
+{
+  return getenv(child_output_var) != NULL;
+}
+
+void cl_child_case_output(const char *line)
+{
+  FILE *file = fopen(getenv(child_output_var), "w");
+  OCL_ASSERT(file != NULL);
+  fprintf(file, "%s\n", line);
+  fclose(file);
+}
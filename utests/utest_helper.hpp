@@ -233,5 +233,18 @@ extern int cl_INT_ULP(int int_number);
 /* subtract the time */
 double time_subtract(struct timeval *y, struct timeval *x, struct timeval *result);
 
+/* The backend reads the OCL_* variables once, when it is loaded: run the case
+ * again in a new process with the variable set in its environment. Returns
+ * true when the case ran to its end there, with the line it reported with
+ * cl_child_case_output in output */
+extern bool cl_run_child_case(const char *case_name, const char *var, const char *value,
+                              char *output, size_t size);
+
+/* Is the case running in the process started by cl_run_child_case */
+extern bool cl_is_child_case(void);
+
+/* Report the success of the child case, with a line for its parent */
+extern void cl_child_case_output(const char *line);
+
 #endif /* __UTEST_HELPER_HPP__ */
 